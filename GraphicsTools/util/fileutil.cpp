@@ -5,6 +5,13 @@
 #include "fileutil.h"
 #include "stringutil.h"
 
+#if !PLATFORM_PC && !XXX_GAME
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // !PLATFORM_PC && !XXX_GAME
+
 void StartupMain(int argc, const char* argv[])
 {
 #if PLATFORM_PC
@@ -394,6 +401,30 @@ bool FileExistsAndIsNotZeroBytes(const char* path)
 	return false;
 }
 
+bool GetFileSizeAndTime(const char* path, uint64& size, uint64& time)
+{
+#if PLATFORM_PC
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data) || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		return false;
+	size = ((uint64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	time = ((uint64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	return true;
+#elif XXX_GAME
+	(void)path;
+	size = 0;
+	time = 0;
+	return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	size = (uint64)st.st_size;
+	time = (uint64)st.st_mtime;
+	return true;
+#endif
+}
+
 size_t rage_fgetline(char* line, size_t size, FILE* file)
 {
 	size_t stored;
@@ -411,6 +442,90 @@ size_t rage_fgetline(char* line, size_t size, FILE* file)
 	return stored;
 }
 
+bool MappedFile::Open(const char* path)
+{
+	Close();
+#if PLATFORM_PC
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		CloseHandle(file);
+		return false;
+	}
+	m_data = reinterpret_cast<const uint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == NULL) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+	m_handle = file;
+	m_mapping = mapping;
+#elif XXX_GAME
+	FILE* f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+	fseek(f, 0, SEEK_END);
+	const size_t size = (size_t)ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8* data = new uint8[size];
+	if (size == 0 || fread(data, size, 1, f) != 1) {
+		delete[] data;
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	m_data = data;
+	m_size = size;
+	m_owned = true;
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // mapping stays valid after the descriptor is closed
+	if (data == MAP_FAILED)
+		return false;
+	m_data = reinterpret_cast<const uint8*>(data);
+	m_size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data == NULL)
+		return;
+	if (m_owned)
+		delete[] m_data;
+	else {
+	#if PLATFORM_PC
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_handle);
+	#elif !XXX_GAME
+		munmap(const_cast<uint8*>(m_data), m_size);
+	#endif
+	}
+	m_data = NULL;
+	m_size = 0;
+	m_handle = NULL;
+	m_mapping = NULL;
+	m_owned = false;
+}
+
 // pass ext = NULL to always convert '.' to 'p' (e.g. floating point strings)
 // pass ext = path + strlen(path) to never convert '.' to 'p'
 // otherwise pass ext = strrchr(path, '.')
@@ -74,9 +74,35 @@ void BuildSearchList(std::vector<std::string>& files, const char* path, const ch
 
 bool FileExists(const char* path);
 bool FileExistsAndIsNotZeroBytes(const char* path);
+bool GetFileSizeAndTime(const char* path, uint64& size, uint64& time); // time is the last write time, only comparable on the same platform
 
 size_t rage_fgetline(char* line, size_t size, FILE* file);
 
+// read-only view of a whole file, memory mapped where the platform supports it (otherwise the file is read into memory)
+class MappedFile
+{
+public:
+	MappedFile() : m_data(NULL), m_size(0), m_handle(NULL), m_mapping(NULL), m_owned(false) {}
+	~MappedFile() { Close(); }
+
+	bool Open(const char* path);
+	void Close();
+
+	inline bool IsOpen() const { return m_data != NULL; }
+	inline const uint8* GetData() const { return m_data; }
+	inline size_t GetSize() const { return m_size; }
+
+private:
+	MappedFile(const MappedFile&); // non-copyable
+	MappedFile& operator =(const MappedFile&);
+
+	const uint8* m_data;
+	size_t m_size;
+	void* m_handle; // platform file handle (HANDLE on PC)
+	void* m_mapping; // platform mapping handle
+	bool m_owned; // m_data was allocated by us rather than mapped
+};
+
 std::string MakePathCompatible(const char* path, const char* ext = NULL);
 std::string MakePathCompatibleStringf(const char* format, ...);
 
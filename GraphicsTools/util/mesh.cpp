@@ -8,11 +8,14 @@
 #include "fileutil.h"
 #include "progressdisplay.h"
 #include "stringutil.h"
+#include "taskscheduler.h"
 
 //#include "imageutil.h"
 
 #include "vmath/vmath_intersects.h"
 
+#include <unordered_map>
+
 #if PLATFORM_PS4
 namespace std
 {
@@ -157,6 +160,52 @@ const Triangle3V_SOA8 MakePoly_SOA8(const IndexedTriangle tris[8], const std::ve
 }
 #endif // HAS_VEC8V
 
+void VertexWelder::Reserve(uint32 count)
+{
+	uint32 size = Max<uint32>(16, (uint32)m_slots.size());
+	while (size < count*2)
+		size *= 2;
+	if (size == m_slots.size())
+		return;
+	std::vector<Slot> slots(size);
+	for (uint32 i = 0; i < size; i++)
+		slots[i].m_index = INVALID_INDEX;
+	const uint32 mask = size - 1;
+	for (size_t i = 0; i < m_slots.size(); i++) {
+		if (m_slots[i].m_index != INVALID_INDEX) {
+			uint32 j = m_slots[i].m_hash & mask;
+			while (slots[j].m_index != INVALID_INDEX)
+				j = (j + 1) & mask;
+			slots[j] = m_slots[i];
+		}
+	}
+	m_slots.swap(slots);
+}
+
+void VertexWelder::Insert(uint32 hash, uint32 index)
+{
+	MeshAssert(index != INVALID_INDEX);
+	if ((m_count + 1)*2 > m_slots.size())
+		Reserve(Max(m_count + 1, m_count*2));
+	const uint32 mask = (uint32)m_slots.size() - 1;
+	uint32 i = hash & mask;
+	while (m_slots[i].m_index != INVALID_INDEX)
+		i = (i + 1) & mask;
+	m_slots[i].m_index = index;
+	m_slots[i].m_hash = hash;
+	m_count++;
+}
+
+uint32 VertexWelder::HashPosition(Vec3V_arg pos)
+{
+	uint32 bits[3];
+	memcpy(bits, &pos, sizeof(bits));
+	uint64 h = bits[0]*0x9E3779B97F4A7C15ULL ^ bits[1]*0xC2B2AE3D27D4EB4FULL ^ bits[2]*0x165667B19E3779F9ULL;
+	h = (h ^ (h >> 33))*0xFF51AFD7ED558CCDULL; // murmur3 finalizer, the low bits select the slot
+	h = (h ^ (h >> 33))*0xC4CEB9FE1A85EC53ULL;
+	return (uint32)(h ^ (h >> 33));
+}
+
 void MeshBase::CheckVertexStreams() const
 {
 	if (m_normals  ) MeshAssert(m_normals  ->size() == m_verts.size());
@@ -279,6 +328,26 @@ const MeshBase::Vertex MeshBase::GetVertex(uint32 index) const
 	return v;
 }
 
+bool MeshBase::IsVertexEqual(uint32 index, const Vertex& v) const
+{
+	MeshAssert(index < m_verts.size());
+	if (memcmp(&m_verts[index], &v.m_pos, 3*sizeof(float)) != 0) return false;
+	if (m_normals   && memcmp(&m_normals  ->operator[](index), &v.m_normal  , 3*sizeof(float)) != 0) return false;
+	if (m_texcoords && memcmp(&m_texcoords->operator[](index), &v.m_texcoord, 2*sizeof(float)) != 0) return false;
+	if (m_colors    && memcmp(&m_colors   ->operator[](index), &v.m_color   , 4*sizeof(float)) != 0) return false;
+	return true;
+}
+
+bool MeshBase::IsVertexEqual(uint32 index0, uint32 index1) const
+{
+	MeshAssert(index0 < m_verts.size() && index1 < m_verts.size());
+	if (memcmp(&m_verts[index0], &m_verts[index1], 3*sizeof(float)) != 0) return false;
+	if (m_normals   && memcmp(&m_normals  ->operator[](index0), &m_normals  ->operator[](index1), 3*sizeof(float)) != 0) return false;
+	if (m_texcoords && memcmp(&m_texcoords->operator[](index0), &m_texcoords->operator[](index1), 2*sizeof(float)) != 0) return false;
+	if (m_colors    && memcmp(&m_colors   ->operator[](index0), &m_colors   ->operator[](index1), 4*sizeof(float)) != 0) return false;
+	return true;
+}
+
 const MeshBase::Vertex MeshBase::Interpolate(const Vertex& v0, const Vertex& v1, ScalarV_arg t, bool normalize)
 {
 	Vertex v;
@@ -293,8 +362,15 @@ const MeshBase::Vertex MeshBase::Interpolate(const Vertex& v0, const Vertex& v1,
 
 uint32 MeshBase::AddVertex(const Vertex& v, bool useMap)
 {
-	if (useMap && m_vertexMap.find(v.GetCrcHash()) == m_vertexMap.end())
-		return AddVertex(v, false);
+	if (useMap) {
+		const uint32 hash = VertexWelder::HashPosition(v.m_pos);
+		uint32 index = m_vertexWelder.Find(hash, [this, &v](uint32 i) { return IsVertexEqual(i, v); });
+		if (index == VertexWelder::INVALID_INDEX) {
+			index = AddVertex(v, false);
+			m_vertexWelder.Insert(hash, index);
+		}
+		return index;
+	}
 	const uint32 index = (uint32)m_verts.size();
 	m_verts.push_back(v.m_pos);
 	if (m_normals  ) m_normals  ->push_back(v.m_normal  );
@@ -357,50 +433,136 @@ float CalculateMeshSurfaceArea(const QuadMesh& mesh, bool textureSpace)
 	return CalculateMeshSurfaceArea_T(mesh, textureSpace);
 }
 
-static Vec2V_out LoadOBJ_ReadVec2V(char* s)
+#define OBJ_LOAD_CHUNK_SIZE (4<<20) // bytes of OBJ text parsed per task
+
+static inline bool LoadOBJ_IsDigit(char c)
 {
-	s = strtok(s, " \t");
-	const float x = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float y = s ? (float)atof(s) : 0.0f; MeshAssert(s);
-	return Vec2V(x,y);
+	return (unsigned)(c - '0') < 10;
 }
 
-static Vec3V_out LoadOBJ_ReadVec3V(char* s)
+// strtok-style tokens within [p,end), returns false when there are no more
+static inline bool LoadOBJ_NextToken(const char*& p, const char* end, const char*& token, const char*& tokenEnd)
 {
-	s = strtok(s, " \t");
-	const float x = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float y = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float z = s ? (float)atof(s) : 0.0f; MeshAssert(s);
-	return Vec3V(x,y,z);
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	if (p == end)
+		return false;
+	token = p;
+	while (p < end && *p != ' ' && *p != '\t')
+		p++;
+	tokenEnd = p;
+	return true;
 }
 
-static Vec3V_out LoadOBJ_ReadVec3V_RGBA(char* s, Vec4V& color, bool& hasColor)
-{
-	s = strtok(s, " \t");
-	const float x = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float y = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float z = s ? (float)atof(s) : 0.0f; MeshAssert(s);
-	if (s) { // .obj format optionally stores RGBA color after position
-		s = strtok(NULL, " \t");
-		if (s) {
-			hasColor = true;
-			color.xf_ref() = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-			color.yf_ref() = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-			color.zf_ref() = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-			color.wf_ref() = s ? (float)atof(s) : 1.0f;
+// returns exactly what (float)atof would for the token - plain decimals whose mantissa has at most 15 significant digits
+// and whose power of 10 is exactly representable can be converted with a single correctly rounded multiply or divide
+// (Clinger's fast path), everything else (long mantissas, large exponents, inf/nan, hex, trailing junk) goes to strtod
+static float LoadOBJ_ParseFloat(const char* s, const char* end)
+{
+	static const double powersOf10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+	const char* p = s;
+	bool negative = false;
+	if (p < end && (*p == '+' || *p == '-'))
+		negative = *p++ == '-';
+	uint64 mantissa = 0;
+	int numDigits = 0; // significant digits, leading zeros don't count
+	int exponent = 0;
+	bool anyDigits = false;
+	for (; p < end && LoadOBJ_IsDigit(*p); p++, anyDigits = true) {
+		if (mantissa || *p != '0') {
+			mantissa = mantissa*10 + (*p - '0');
+			numDigits++;
 		}
 	}
-	return Vec3V(x,y,z);
+	if (p < end && *p == '.') {
+		for (p++; p < end && LoadOBJ_IsDigit(*p); p++, anyDigits = true) {
+			if (mantissa || *p != '0') {
+				mantissa = mantissa*10 + (*p - '0');
+				numDigits++;
+			}
+			exponent--;
+		}
+	}
+	if (anyDigits && p < end && (*p == 'e' || *p == 'E')) {
+		const char* q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '+' || *q == '-'))
+			negativeExponent = *q++ == '-';
+		if (q < end && LoadOBJ_IsDigit(*q)) { // otherwise the 'e' isn't part of the number
+			int e = 0;
+			for (; q < end && LoadOBJ_IsDigit(*q); q++)
+				e = Min(e*10 + (*q - '0'), 100000);
+			exponent += negativeExponent ? -e : e;
+			p = q;
+		}
+	}
+	if (anyDigits && p == end && numDigits <= 15 && exponent >= -22 && exponent <= 22) {
+		double d = (double)mantissa; // exact, since mantissa < 10^15 < 2^53
+		if (exponent < 0)
+			d /= powersOf10[-exponent];
+		else
+			d *= powersOf10[exponent];
+		return (float)(negative ? -d : d);
+	}
+	char buffer[64];
+	const size_t len = (size_t)(end - s);
+	if (len < sizeof(buffer)) {
+		memcpy(buffer, s, len);
+		buffer[len] = '\0';
+		return (float)strtod(buffer, NULL);
+	} else
+		return (float)strtod(std::string(s, len).c_str(), NULL);
 }
 
-static Vec4V_out LoadOBJ_ReadVec4V(char* s)
+// same as atoi on the token
+static int LoadOBJ_ParseInt(const char* s, const char* end)
 {
-	s = strtok(s, " \t");
-	const float x = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float y = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float z = s ? (float)atof(s) : 0.0f; s = strtok(NULL, " \t");
-	const float w = s ? (float)atof(s) : 0.0f; MeshAssert(s);
-	return Vec4V(x,y,z,w);
+	bool negative = false;
+	if (s < end && (*s == '+' || *s == '-'))
+		negative = *s++ == '-';
+	uint32 value = 0;
+	for (; s < end && LoadOBJ_IsDigit(*s); s++)
+		value = value*10 + (*s - '0');
+	return negative ? -(int)value : (int)value;
+}
+
+static Vec2V_out LoadOBJ_ReadVec2V(const char* s, const char* end)
+{
+	const char* token;
+	const char* tokenEnd;
+	const float x = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+	const bool hasY = LoadOBJ_NextToken(s, end, token, tokenEnd);
+	const float y = hasY ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f; MeshAssert(hasY);
+	return Vec2V(x,y);
+}
+
+static Vec3V_out LoadOBJ_ReadVec3V(const char* s, const char* end)
+{
+	const char* token;
+	const char* tokenEnd;
+	const float x = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+	const float y = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+	const bool hasZ = LoadOBJ_NextToken(s, end, token, tokenEnd);
+	const float z = hasZ ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f; MeshAssert(hasZ);
+	return Vec3V(x,y,z);
+}
+
+static Vec3V_out LoadOBJ_ReadVec3V_RGBA(const char* s, const char* end, Vec4V& color, bool& hasColor)
+{
+	const char* token;
+	const char* tokenEnd;
+	const float x = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+	const float y = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+	const bool hasZ = LoadOBJ_NextToken(s, end, token, tokenEnd);
+	const float z = hasZ ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f; MeshAssert(hasZ);
+	if (hasZ && LoadOBJ_NextToken(s, end, token, tokenEnd)) { // .obj format optionally stores RGBA color after position
+		hasColor = true;
+		color.xf_ref() = LoadOBJ_ParseFloat(token, tokenEnd);
+		color.yf_ref() = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+		color.zf_ref() = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 0.0f;
+		color.wf_ref() = LoadOBJ_NextToken(s, end, token, tokenEnd) ? LoadOBJ_ParseFloat(token, tokenEnd) : 1.0f;
+	}
+	return Vec3V(x,y,z);
 }
 
 class LoadOBJ_FaceIndex
@@ -417,44 +579,60 @@ public:
 		return memcmp(this, &rhs, sizeof(*this)) < 0;
 	}
 
+	bool operator ==(const LoadOBJ_FaceIndex& rhs) const
+	{
+		return m_posIndex == rhs.m_posIndex && m_texIndex == rhs.m_texIndex && m_nrmIndex == rhs.m_nrmIndex;
+	}
+
 	int m_posIndex; // positions (and per-vertex RGBA colors)
 	int m_texIndex; // texcoords
 	int m_nrmIndex; // normals
 };
 
-static bool LoadOBJ_ReadFace(const char* str, std::vector<LoadOBJ_FaceIndex>& face, int vertStartLocal)
+class LoadOBJ_FaceIndexHash
 {
-	char buffer[512] = "";
-	char* toks = buffer;
-	strcpy(buffer, str);
-	while (true) {
-		const char* temp = strtok(toks, " \t\n\r");
-		if (temp == NULL)
-			break;
-		toks = NULL;
-		const char* ss = strstr(temp, "//");
-		const char* s1 = ss ? NULL : strstr(temp, "/");
-		const char* s2 = s1 ? strstr(s1 + 2, "/") : NULL;
-		int posIndex = atoi(temp);
-		int texIndex = 0; // if not set, 0 will get decremented to -1 which means "none"
-		int nrmIndex = 0;
-		if (ss) // "vertex//normal"
-			nrmIndex = atoi(ss + 2);
-		else if (s1) { // "vertex/texcoord"
-			texIndex = atoi(s1 + 1);
-			if (s2)
-				nrmIndex = atoi(s2 + 1); // "vertex/texcoord/normal"
-		}
-		posIndex = (posIndex >= 0) ? (posIndex - 1) : (vertStartLocal - posIndex - 1);
-		texIndex = (texIndex >= 0) ? (texIndex - 1) : (vertStartLocal - texIndex - 1);
-		nrmIndex = (nrmIndex >= 0) ? (nrmIndex - 1) : (vertStartLocal - nrmIndex - 1);
-		face.push_back(LoadOBJ_FaceIndex(posIndex, texIndex, nrmIndex));
+public:
+	size_t operator ()(const LoadOBJ_FaceIndex& f) const
+	{
+		const uint64 h = (uint64)(uint32)f.m_posIndex*0x9E3779B97F4A7C15ULL ^ (uint64)(uint32)f.m_texIndex*0xC2B2AE3D27D4EB4FULL ^ (uint64)(uint32)f.m_nrmIndex*0x165667B19E3779F9ULL;
+		return (size_t)(h ^ (h >> 29));
 	}
-	if (face.size() == 3) {
+};
+
+// 1-based indices, negative indices count from vertStartLocal (see LoadOBJ_T) - 0 (missing) becomes -1, which means "none"
+static inline int LoadOBJ_ResolveIndex(int index, int vertStartLocal)
+{
+	return (index >= 0) ? (index - 1) : (vertStartLocal - index - 1);
+}
+
+// "vertex", "vertex/texcoord", "vertex//normal" or "vertex/texcoord/normal", indices are returned as written
+static const LoadOBJ_FaceIndex LoadOBJ_ParseFaceIndex(const char* s, const char* end)
+{
+	const char* ss = NULL;
+	for (const char* p = s; p + 1 < end && ss == NULL; p++)
+		ss = (p[0] == '/' && p[1] == '/') ? p : NULL;
+	const char* s1 = ss ? NULL : (const char*)memchr(s, '/', end - s);
+	const char* s2 = (s1 && s1 + 2 < end) ? (const char*)memchr(s1 + 2, '/', end - s1 - 2) : NULL;
+	const int posIndex = LoadOBJ_ParseInt(s, end);
+	int texIndex = 0; // if not set, 0 will get decremented to -1 which means "none"
+	int nrmIndex = 0;
+	if (ss) // "vertex//normal"
+		nrmIndex = LoadOBJ_ParseInt(ss + 2, end);
+	else if (s1) { // "vertex/texcoord"
+		texIndex = LoadOBJ_ParseInt(s1 + 1, end);
+		if (s2)
+			nrmIndex = LoadOBJ_ParseInt(s2 + 1, end); // "vertex/texcoord/normal"
+	}
+	return LoadOBJ_FaceIndex(posIndex, texIndex, nrmIndex);
+}
+
+static bool LoadOBJ_IsFaceValid(const LoadOBJ_FaceIndex* face, size_t numIndices)
+{
+	if (numIndices == 3) {
 		if (face[0].m_posIndex == face[1].m_posIndex ||
 			face[1].m_posIndex == face[2].m_posIndex ||
 			face[2].m_posIndex == face[0].m_posIndex) return false;
-	} else if (face.size() == 4) {
+	} else if (numIndices == 4) {
 		if (face[0].m_posIndex == face[2].m_posIndex ||
 			face[1].m_posIndex == face[3].m_posIndex) return false;
 		if ((face[0].m_posIndex == face[1].m_posIndex && face[2].m_posIndex == face[3].m_posIndex) ||
@@ -465,222 +643,571 @@ static bool LoadOBJ_ReadFace(const char* str, std::vector<LoadOBJ_FaceIndex>& fa
 	return true;
 }
 
+static bool LoadOBJ_ReadFace(const char* str, std::vector<LoadOBJ_FaceIndex>& face, int vertStartLocal)
+{
+	const char* end = str + strlen(str);
+	const char* token;
+	const char* tokenEnd;
+	while (LoadOBJ_NextToken(str, end, token, tokenEnd)) {
+		LoadOBJ_FaceIndex index = LoadOBJ_ParseFaceIndex(token, tokenEnd);
+		index.m_posIndex = LoadOBJ_ResolveIndex(index.m_posIndex, vertStartLocal);
+		index.m_texIndex = LoadOBJ_ResolveIndex(index.m_texIndex, vertStartLocal);
+		index.m_nrmIndex = LoadOBJ_ResolveIndex(index.m_nrmIndex, vertStartLocal);
+		face.push_back(index);
+	}
+	return LoadOBJ_IsFaceValid(face.data(), face.size());
+}
+
+// everything parsed from one line-aligned chunk of the file - indices are kept as written, since negative indices depend on
+// how many vertices the earlier chunks had and are only resolved when the chunks are merged (in order, on one thread)
+class LoadOBJ_Chunk
+{
+public:
+	class Face
+	{
+	public:
+		uint32 m_indexStart; // into m_indices
+		uint32 m_numIndices;
+		uint32 m_posCount; // positions in this chunk before the face
+	};
+
+	class Line // info and group lines
+	{
+	public:
+		bool m_group;
+		uint32 m_faceCount; // faces in this chunk before the line
+		std::string m_str;
+	};
+
+	std::vector<Vec3V> m_positions;
+	std::vector<std::pair<uint32,Vec4V>> m_colors; // index into m_positions, only for vertices which have a color
+	std::vector<Vec3V> m_normals;
+	std::vector<Vec2V> m_texcoords;
+	std::vector<LoadOBJ_FaceIndex> m_indices;
+	std::vector<Face> m_faces;
+	std::vector<Line> m_lines;
+};
+
+static void LoadOBJ_ParseChunk(LoadOBJ_Chunk& chunk, const char* p, const char* end, const Mat34V* transform, bool loadTexcoordsAndNormals)
+{
+	const char* infoStartStr = "#INFO -> ";
+	const size_t infoStartStrLen = strlen(infoStartStr);
+	char groupStartStr[3];
+	sprintf(groupStartStr, "%c ", OBJ_GROUP_CHAR);
+	const size_t groupStartStrLen = strlen(groupStartStr);
+	while (p < end) {
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		if (lineEnd == NULL)
+			lineEnd = end;
+		const char* line = p;
+		const char* cr = (const char*)memchr(line, '\r', lineEnd - line);
+		const char* lineStrEnd = cr ? cr : lineEnd; // the line stops at the first '\r' or '\n', as it did with fgets/strpbrk
+		const size_t lineLen = (size_t)(lineStrEnd - line);
+		p = (lineEnd < end) ? lineEnd + 1 : end;
+		if (lineLen >= 2 && line[0] == 'v' && line[1] == ' ') {
+			Vec4V color = Vec4V(V_WAXIS);
+			bool hasColor = false;
+			Vec3V v = LoadOBJ_ReadVec3V_RGBA(line + 2, lineStrEnd, color, hasColor);
+			if (transform)
+				v = transform->Transform(v);
+			if (hasColor)
+				chunk.m_colors.push_back(std::make_pair((uint32)chunk.m_positions.size(), color));
+			chunk.m_positions.push_back(v);
+		} else if (lineLen >= 2 && line[0] == 'f' && line[1] == ' ') {
+			LoadOBJ_Chunk::Face face;
+			face.m_indexStart = (uint32)chunk.m_indices.size();
+			face.m_posCount = (uint32)chunk.m_positions.size();
+			const char* s = line + 2;
+			const char* token;
+			const char* tokenEnd;
+			while (LoadOBJ_NextToken(s, lineStrEnd, token, tokenEnd))
+				chunk.m_indices.push_back(LoadOBJ_ParseFaceIndex(token, tokenEnd));
+			face.m_numIndices = (uint32)chunk.m_indices.size() - face.m_indexStart;
+			chunk.m_faces.push_back(face);
+		} else if (loadTexcoordsAndNormals && lineLen >= 3 && line[0] == 'v' && line[1] == 'n' && line[2] == ' ') {
+			Vec3V norm = LoadOBJ_ReadVec3V(line + 3, lineStrEnd);
+			if (transform)
+				norm = transform->TransformDir(norm);
+			chunk.m_normals.push_back(norm);
+		} else if (loadTexcoordsAndNormals && lineLen >= 3 && line[0] == 'v' && line[1] == 't' && line[2] == ' ')
+			chunk.m_texcoords.push_back(LoadOBJ_ReadVec2V(line + 3, lineStrEnd));
+		else {
+			const bool info = lineLen >= infoStartStrLen && memcmp(line, infoStartStr, infoStartStrLen) == 0;
+			const bool group = !info && lineLen >= groupStartStrLen && memcmp(line, groupStartStr, groupStartStrLen) == 0;
+			if (info || group) {
+				LoadOBJ_Chunk::Line l;
+				l.m_group = group;
+				l.m_faceCount = (uint32)chunk.m_faces.size();
+				l.m_str.assign(line + (group ? groupStartStrLen : infoStartStrLen), lineStrEnd);
+				chunk.m_lines.push_back(l);
+			}
+		}
+	}
+}
+
+// maps the file and parses it in line-aligned chunks, in parallel if a scheduler is given
+static bool LoadOBJ_ParseFile(const char* path, std::vector<LoadOBJ_Chunk>& chunks, const Mat34V* transform, bool loadTexcoordsAndNormals, TaskScheduler* scheduler)
+{
+	char path2[512];
+	strcpy(path2, PathExt(path, ".obj"));
+	MappedFile file;
+	if (!file.Open(path2)) {
+		if (FileExists(path2))
+			return true; // empty files can't be mapped
+		fprintf(stderr, "failed to load OBJ %s!\n", path2);
+		return false;
+	}
+	const char* data = reinterpret_cast<const char*>(file.GetData());
+	const char* dataEnd = data + file.GetSize();
+	const size_t numChunks = scheduler ? Max<size_t>(1, (file.GetSize() + OBJ_LOAD_CHUNK_SIZE - 1)/OBJ_LOAD_CHUNK_SIZE) : 1;
+	std::vector<const char*> chunkStart(numChunks + 1);
+	chunkStart[0] = data;
+	chunkStart[numChunks] = dataEnd;
+	for (size_t i = 1; i < numChunks; i++) {
+		const char* p = data + i*(file.GetSize()/numChunks);
+		if (p < chunkStart[i - 1])
+			p = chunkStart[i - 1];
+		const char* lineEnd = (const char*)memchr(p, '\n', dataEnd - p);
+		chunkStart[i] = lineEnd ? lineEnd + 1 : dataEnd;
+	}
+	chunks.resize(numChunks);
+	const auto ParseChunks = [&](unsigned begin, unsigned end, unsigned) {
+		for (unsigned i = begin; i < end; i++)
+			LoadOBJ_ParseChunk(chunks[i], chunkStart[i], chunkStart[i + 1], transform, loadTexcoordsAndNormals);
+	};
+	if (scheduler)
+		scheduler->ParallelFor((unsigned)numChunks, 1, ParseChunks);
+	else
+		ParseChunks(0, (unsigned)numChunks, 0);
+	return true;
+}
+
+template <typename MeshType> static void LoadOBJ_ApplyLines(MeshType& mesh, const LoadOBJ_Chunk& chunk, size_t& lineIndex, size_t faceCount, int& currentGroup)
+{
+	for (; lineIndex < chunk.m_lines.size() && chunk.m_lines[lineIndex].m_faceCount <= faceCount; lineIndex++) {
+		const LoadOBJ_Chunk::Line& line = chunk.m_lines[lineIndex];
+		if (line.m_group)
+			currentGroup = mesh.FindOrAddGroup(line.m_str.c_str());
+		else
+			mesh.m_info.push_back(line.m_str);
+	}
+}
+
 // supports position and optional per-vertex color (but not normals or texcoords)
 // also supports "local vertices" with negative indices (which don't seem to be supported well in MeshLab for normals or texcoords)
-template <typename MeshType> static bool LoadOBJ_T(const char* path, MeshType& mesh, const Mat34V* transform)
+template <typename MeshType> static bool LoadOBJ_T(const char* path, MeshType& mesh, const Mat34V* transform, TaskScheduler* scheduler)
 {
 	typedef typename MeshType::IndexedPolyType IndexedPolyType;
-	char path2[512];
-	strcpy(path2, PathExt(path, ".obj"));
-	FILE* file = fopen(path2, "r");
-	if (file) {
-		const uint32 vertStart = (uint32)mesh.m_verts.size();
-		uint32 vertStartLocal = 0; // this codepath supports "local" vertices, i.e. indexed with negative values
-		bool firstVertInLocal = true;
-		int currentGroup = -1;
-		char line[1024] = "";
-		unsigned lineIndex = 0;
-		const char* infoStartStr = "#INFO -> ";
-		const size_t infoStartStrLen = strlen(infoStartStr);
-		char groupStartStr[3];
-		sprintf(groupStartStr, "%c ", OBJ_GROUP_CHAR);
-		const size_t groupStartStrLen = strlen(groupStartStr);
-		const char* vertStartStr = "v ";
-		const size_t vertStartStrLen = strlen(vertStartStr);
-		const char* faceStartStr = "f ";
-		const size_t faceStartStrLen = strlen(faceStartStr);
-		while (fgets(line, sizeof(line), file)) {
-			++lineIndex;
-			char* end = strpbrk(line, "\r\n");
-			if (end)
-				*end = '\0';
-			if (strncmp(line, infoStartStr, infoStartStrLen) == 0)
-				mesh.m_info.push_back(line + infoStartStrLen);
-			else if (strncmp(line, groupStartStr, groupStartStrLen) == 0)
-				currentGroup = mesh.FindOrAddGroup(line + groupStartStrLen);
-			else if (strncmp(line, vertStartStr, vertStartStrLen) == 0) {
-				if (firstVertInLocal) {
-					firstVertInLocal = false;
-					vertStartLocal = (uint32)mesh.m_verts.size() - vertStart;
-				}
-				Vec4V color = Vec4V(V_WAXIS);
-				bool hasColor = false;
-				Vec3V v = LoadOBJ_ReadVec3V_RGBA(line + vertStartStrLen, color, hasColor);
-				if (transform)
-					v = transform->Transform(v);
-				const uint32 numVerts = (uint32)mesh.m_verts.size();
-				mesh.m_verts.push_back(v);
-				if (hasColor && mesh.m_colors == NULL)
-					mesh.m_colors = new std::vector<Vec4V>;
-				if (mesh.m_colors) {
-					const uint32 numVertColors = (uint32)mesh.m_colors->size();
-					if (numVertColors < numVerts) {
-						mesh.m_colors->resize(numVerts);
-						for (uint32 i = numVertColors; i < numVerts; i++)
-							mesh.m_colors->operator[](i) = Vec4V(V_WAXIS);
-					}
-					mesh.m_colors->push_back(color);
-				}
-			} else if (strncmp(line, faceStartStr, faceStartStrLen) == 0) {
-				std::vector<LoadOBJ_FaceIndex> face;
-				if (LoadOBJ_ReadFace(line + faceStartStrLen, face, vertStartLocal)) { // only supports position, not texcoord or normals
-					const uint32 numIndices = (uint32)face.size();
-					std::vector<uint32> indices;
-					indices.resize(numIndices);
-					for (uint32 i = 0; i < numIndices; i++) {
-						indices[i] = (uint32)face[i].m_posIndex;
-						MeshAssert(indices[i] < mesh.m_verts.size());
-					}
-					IndexedPolyType::AddPolys(mesh.m_polys, vertStart, &indices.front(), numIndices, currentGroup);
-					firstVertInLocal = true;
+	std::vector<LoadOBJ_Chunk> chunks;
+	if (!LoadOBJ_ParseFile(path, chunks, transform, false, scheduler))
+		return false;
+	const uint32 vertStart = (uint32)mesh.m_verts.size();
+	uint32 numVerts = 0;
+	bool hasColors = mesh.m_colors != NULL;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		numVerts += (uint32)chunks[i].m_positions.size();
+		hasColors |= !chunks[i].m_colors.empty();
+	}
+	mesh.m_verts.reserve(vertStart + numVerts);
+	for (size_t i = 0; i < chunks.size(); i++)
+		mesh.m_verts.insert(mesh.m_verts.end(), chunks[i].m_positions.begin(), chunks[i].m_positions.end());
+	if (hasColors && numVerts > 0) { // once any vertex has a color, every vertex gets one
+		if (mesh.m_colors == NULL)
+			mesh.m_colors = new std::vector<Vec4V>;
+		mesh.m_colors->resize(vertStart + numVerts, Vec4V(V_WAXIS));
+		uint32 chunkVertStart = vertStart;
+		for (size_t i = 0; i < chunks.size(); i++) {
+			for (size_t j = 0; j < chunks[i].m_colors.size(); j++)
+				mesh.m_colors->operator[](chunkVertStart + chunks[i].m_colors[j].first) = chunks[i].m_colors[j].second;
+			chunkVertStart += (uint32)chunks[i].m_positions.size();
+		}
+	}
+
+	// negative indices are relative to the first vertex after the last face which was added (a "local" block of vertices)
+	uint32 vertStartLocal = 0;
+	uint32 lastFaceVertCount = 0;
+	uint32 chunkVertStart = 0;
+	int currentGroup = -1;
+	std::vector<uint32> indices;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		LoadOBJ_Chunk& chunk = chunks[i];
+		size_t lineIndex = 0;
+		for (size_t faceIndex = 0; faceIndex < chunk.m_faces.size(); faceIndex++) {
+			LoadOBJ_ApplyLines(mesh, chunk, lineIndex, faceIndex, currentGroup);
+			const LoadOBJ_Chunk::Face& face = chunk.m_faces[faceIndex];
+			const uint32 vertCount = chunkVertStart + face.m_posCount;
+			if (vertCount > lastFaceVertCount)
+				vertStartLocal = lastFaceVertCount;
+			LoadOBJ_FaceIndex* faceIndices = chunk.m_indices.data() + face.m_indexStart;
+			for (uint32 j = 0; j < face.m_numIndices; j++)
+				faceIndices[j].m_posIndex = LoadOBJ_ResolveIndex(faceIndices[j].m_posIndex, (int)vertStartLocal);
+			if (LoadOBJ_IsFaceValid(faceIndices, face.m_numIndices)) { // only supports position, not texcoord or normals
+				indices.resize(face.m_numIndices);
+				for (uint32 j = 0; j < face.m_numIndices; j++) {
+					indices[j] = (uint32)faceIndices[j].m_posIndex;
+					MeshAssert(indices[j] < mesh.m_verts.size());
 				}
+				IndexedPolyType::AddPolys(mesh.m_polys, vertStart, indices.data(), face.m_numIndices, currentGroup);
+				lastFaceVertCount = vertCount;
 			}
 		}
-		fclose(file);
-		return true;
-	} else {
-		fprintf(stderr, "failed to load OBJ %s!\n", path2);
-		return false;
+		LoadOBJ_ApplyLines(mesh, chunk, lineIndex, chunk.m_faces.size(), currentGroup);
+		chunkVertStart += (uint32)chunk.m_positions.size();
 	}
+	return true;
 }
 
-template <typename MeshType> static bool LoadOBJ_PosTexNrm_T(const char* path, MeshType& mesh, const Mat34V* transform)
+template <typename MeshType> static bool LoadOBJ_PosTexNrm_T(const char* path, MeshType& mesh, const Mat34V* transform, TaskScheduler* scheduler)
 {
 	typedef typename MeshType::IndexedPolyType IndexedPolyType;
-	// TODO -- consider consolidating this code with LoadOBJ_T
-	FILE* file = fopen(PathExt(path, ".obj"), "r");
-	if (file) {
-		const uint32 vertStart = (uint32)mesh.m_verts.size();
-		int currentGroup = -1;
-		char line[1024] = "";
-		unsigned lineIndex = 0;
-		const char* infoStartStr = "#INFO -> ";
-		const size_t infoStartStrLen = strlen(infoStartStr);
-		char groupStartStr[3];
-		sprintf(groupStartStr, "%c ", OBJ_GROUP_CHAR);
-		const size_t groupStartStrLen = strlen(groupStartStr);
-		const char* vertStartStr_pos = "v ";
-		const char* vertStartStr_nrm = "vn ";
-		const char* vertStartStr_tex = "vt ";
-		const size_t vertStartStrLen_pos = strlen(vertStartStr_pos);
-		const size_t vertStartStrLen_nrm = strlen(vertStartStr_nrm);
-		const size_t vertStartStrLen_tex = strlen(vertStartStr_tex);
-		const char* faceStartStr = "f ";
-		const size_t faceStartStrLen = strlen(faceStartStr);
-		std::vector<Vec3V> verts;
-		std::vector<Vec4V> vertColors;
-		std::vector<Vec3V> normals;
-		std::vector<Vec2V> texcoords;
-		std::map<LoadOBJ_FaceIndex,uint32> vertexMap;
-		while (fgets(line, sizeof(line), file)) {
-			++lineIndex;
-			char* end = strpbrk(line, "\r\n");
-			if (end)
-				*end = '\0';
-			if (strncmp(line, infoStartStr, infoStartStrLen) == 0)
-				mesh.m_info.push_back(line + infoStartStrLen);
-			else if (strncmp(line, groupStartStr, groupStartStrLen) == 0)
-				currentGroup = mesh.FindOrAddGroup(line + groupStartStrLen);
-			else if (strncmp(line, vertStartStr_pos, vertStartStrLen_pos) == 0) {
-				Vec4V color = Vec4V(V_WAXIS);
-				bool hasColor = false;
-				Vec3V v = LoadOBJ_ReadVec3V_RGBA(line + vertStartStrLen_pos, color, hasColor);
-				if (transform)
-					v = transform->Transform(v);
-				const uint32 numVerts = (uint32)verts.size();
-				verts.push_back(v);
-				if (hasColor) {
-					if (vertColors.size() < numVerts) {
-						const uint32 numColors = (uint32)vertColors.size();
-						vertColors.resize(numVerts);
-						for (uint32 i = numColors; i < numVerts; i++)
-							vertColors[i] = Vec4V(V_WAXIS);
-					}
-					vertColors.push_back(color);
-				}
-			} else if (strncmp(line, vertStartStr_nrm, vertStartStrLen_nrm) == 0) {
-				Vec3V norm = LoadOBJ_ReadVec3V(line + vertStartStrLen_nrm);
-				if (transform)
-					norm = transform->TransformDir(norm);
-				normals.push_back(norm);
-			} else if (strncmp(line, vertStartStr_tex, vertStartStrLen_tex) == 0) {
-				Vec2V texcoord = LoadOBJ_ReadVec2V(line + vertStartStrLen_tex);
-				texcoords.push_back(texcoord);
-			} else if (strncmp(line, faceStartStr, faceStartStrLen) == 0) {
-				std::vector<LoadOBJ_FaceIndex> face;
-				if (LoadOBJ_ReadFace(line + faceStartStrLen, face, 0)) {
-					const uint32 numIndices = (uint32)face.size();
-					std::vector<uint32> indices;
-					indices.resize(numIndices);
-					for (uint32 i = 0; i < numIndices; i++) {
-						const auto f = vertexMap.find(face[i]);
-						if (f == vertexMap.end()) {
-							const uint32 numVerts = (uint32)mesh.m_verts.size();
-							indices[i] = vertexMap[face[i]] = numVerts;
-							MeshAssert(face[i].m_posIndex < verts.size());
-							mesh.m_verts.push_back(verts[face[i].m_posIndex]);
-							if (!vertColors.empty()) {
-								if (mesh.m_colors == NULL)
-									mesh.m_colors = new std::vector<Vec4V>;
-								if (mesh.m_colors->size() < numVerts) {
-									const uint32 numColors = (uint32)mesh.m_colors->size();
-									mesh.m_colors->resize(numVerts);
-									for (uint32 i = numColors; i < numVerts; i++)
-										mesh.m_colors->operator[](i) = Vec4V(V_WAXIS);
-								}
-								mesh.m_colors->push_back(vertColors[face[i].m_posIndex]);
+	std::vector<LoadOBJ_Chunk> chunks;
+	if (!LoadOBJ_ParseFile(path, chunks, transform, true, scheduler))
+		return false;
+	const uint32 vertStart = (uint32)mesh.m_verts.size();
+	std::vector<Vec3V> verts;
+	std::vector<Vec4V> vertColors;
+	std::vector<Vec3V> normals;
+	std::vector<Vec2V> texcoords;
+	size_t numIndices = 0;
+	uint32 firstColoredVert = 0xFFFFFFFF;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		const LoadOBJ_Chunk& chunk = chunks[i];
+		for (size_t j = 0; j < chunk.m_colors.size(); j++) {
+			const uint32 vertIndex = (uint32)verts.size() + chunk.m_colors[j].first;
+			firstColoredVert = Min(vertIndex, firstColoredVert);
+			vertColors.resize(vertIndex + 1, Vec4V(V_WAXIS));
+			vertColors[vertIndex] = chunk.m_colors[j].second;
+		}
+		verts.insert(verts.end(), chunk.m_positions.begin(), chunk.m_positions.end());
+		normals.insert(normals.end(), chunk.m_normals.begin(), chunk.m_normals.end());
+		texcoords.insert(texcoords.end(), chunk.m_texcoords.begin(), chunk.m_texcoords.end());
+		numIndices += chunk.m_indices.size();
+	}
+
+	// each distinct position/texcoord/normal combination becomes a vertex, in the order the faces use them
+	std::unordered_map<LoadOBJ_FaceIndex,uint32,LoadOBJ_FaceIndexHash> vertexMap;
+	vertexMap.reserve(Min<size_t>(numIndices, verts.size()*2));
+	uint32 chunkVertStart = 0;
+	int currentGroup = -1;
+	std::vector<uint32> indices;
+	for (size_t chunkIndex = 0; chunkIndex < chunks.size(); chunkIndex++) {
+		LoadOBJ_Chunk& chunk = chunks[chunkIndex];
+		size_t lineIndex = 0;
+		for (size_t faceIndex = 0; faceIndex < chunk.m_faces.size(); faceIndex++) {
+			LoadOBJ_ApplyLines(mesh, chunk, lineIndex, faceIndex, currentGroup);
+			const LoadOBJ_Chunk::Face& f = chunk.m_faces[faceIndex];
+			const bool hasVertColors = firstColoredVert < chunkVertStart + f.m_posCount; // only colors defined before the face count
+			LoadOBJ_FaceIndex* face = chunk.m_indices.data() + f.m_indexStart;
+			for (uint32 i = 0; i < f.m_numIndices; i++) {
+				face[i].m_posIndex = LoadOBJ_ResolveIndex(face[i].m_posIndex, 0);
+				face[i].m_texIndex = LoadOBJ_ResolveIndex(face[i].m_texIndex, 0);
+				face[i].m_nrmIndex = LoadOBJ_ResolveIndex(face[i].m_nrmIndex, 0);
+			}
+			if (LoadOBJ_IsFaceValid(face, f.m_numIndices)) {
+				indices.resize(f.m_numIndices);
+				for (uint32 i = 0; i < f.m_numIndices; i++) {
+					const auto it = vertexMap.find(face[i]);
+					if (it == vertexMap.end()) {
+						const uint32 numVerts = (uint32)mesh.m_verts.size();
+						indices[i] = vertexMap[face[i]] = numVerts;
+						MeshAssert((uint32)face[i].m_posIndex < verts.size());
+						mesh.m_verts.push_back(verts[face[i].m_posIndex]);
+						if (hasVertColors) {
+							if (mesh.m_colors == NULL)
+								mesh.m_colors = new std::vector<Vec4V>;
+							if (mesh.m_colors->size() < numVerts) {
+								const uint32 numColors = (uint32)mesh.m_colors->size();
+								mesh.m_colors->resize(numVerts);
+								for (uint32 i = numColors; i < numVerts; i++)
+									mesh.m_colors->operator[](i) = Vec4V(V_WAXIS);
 							}
-							if (face[i].m_nrmIndex >= 0) {
-								if (mesh.m_normals == NULL)
-									mesh.m_normals = new std::vector<Vec3V>;
-								if (mesh.m_normals->size() < numVerts) {
-									const uint32 numNormals = (uint32)mesh.m_normals->size();
-									mesh.m_normals->resize(numVerts);
-									memset(&mesh.m_normals->operator[](numNormals), 0, (numVerts - numNormals)*sizeof(Vec3V));
-								}
-								MeshAssert(face[i].m_nrmIndex < normals.size());
-								mesh.m_normals->push_back(normals[face[i].m_nrmIndex]);
+							mesh.m_colors->push_back((uint32)face[i].m_posIndex < vertColors.size() ? vertColors[face[i].m_posIndex] : Vec4V(V_WAXIS));
+						}
+						if (face[i].m_nrmIndex >= 0) {
+							if (mesh.m_normals == NULL)
+								mesh.m_normals = new std::vector<Vec3V>;
+							if (mesh.m_normals->size() < numVerts) {
+								const uint32 numNormals = (uint32)mesh.m_normals->size();
+								mesh.m_normals->resize(numVerts);
+								memset(&mesh.m_normals->operator[](numNormals), 0, (numVerts - numNormals)*sizeof(Vec3V));
 							}
-							if (face[i].m_texIndex >= 0) {
-								if (mesh.m_texcoords == NULL)
-									mesh.m_texcoords = new std::vector<Vec2V>;
-								if (mesh.m_texcoords->size() < numVerts) {
-									const uint32 numTexcoords = (uint32)mesh.m_texcoords->size();
-									mesh.m_texcoords->resize(numVerts);
-									memset(&mesh.m_texcoords->operator[](numTexcoords), 0, (numVerts - numTexcoords)*sizeof(Vec2V));
-								}
-								MeshAssert(face[i].m_texIndex < texcoords.size());
-								mesh.m_texcoords->push_back(texcoords[face[i].m_texIndex]);
+							MeshAssert((uint32)face[i].m_nrmIndex < normals.size());
+							mesh.m_normals->push_back(normals[face[i].m_nrmIndex]);
+						}
+						if (face[i].m_texIndex >= 0) {
+							if (mesh.m_texcoords == NULL)
+								mesh.m_texcoords = new std::vector<Vec2V>;
+							if (mesh.m_texcoords->size() < numVerts) {
+								const uint32 numTexcoords = (uint32)mesh.m_texcoords->size();
+								mesh.m_texcoords->resize(numVerts);
+								memset(&mesh.m_texcoords->operator[](numTexcoords), 0, (numVerts - numTexcoords)*sizeof(Vec2V));
 							}
-						} else
-							indices[i] = f->second;
-					}
-					IndexedPolyType::AddPolys(mesh.m_polys, vertStart, &indices.front(), numIndices, currentGroup);
+							MeshAssert((uint32)face[i].m_texIndex < texcoords.size());
+							mesh.m_texcoords->push_back(texcoords[face[i].m_texIndex]);
+						}
+					} else
+						indices[i] = it->second;
 				}
+				IndexedPolyType::AddPolys(mesh.m_polys, vertStart, indices.data(), f.m_numIndices, currentGroup);
 			}
 		}
-		fclose(file);
-		return true;
-	} else {
-		fprintf(stderr, "failed to load OBJ %s!\n", path);
+		LoadOBJ_ApplyLines(mesh, chunk, lineIndex, chunk.m_faces.size(), currentGroup);
+		chunkVertStart += (uint32)chunk.m_positions.size();
+	}
+	return true;
+}
+
+#define MESHBIN_MAGIC             (0x4E42534D) // "MSBN"
+#define MESHBIN_VERSION           (1)
+#define MESHBIN_SECTION_ALIGNMENT (64)
+#define MESHBIN_HAS_NORMALS       (0x0001) // stream pointer was non-NULL, the count may still be 0
+#define MESHBIN_HAS_TEXCOORDS     (0x0002)
+#define MESHBIN_HAS_COLORS        (0x0004)
+
+#define OBJ_LOAD_MESHBIN_CACHE (1) // LoadOBJ reads/writes a .meshbin next to the .obj
+
+// file layout: MeshBinHeader | verts | normals | texcoords | colors | polys | strings, each section 64-byte aligned
+// strings are the group names followed by the info lines, each '\0'-terminated
+class MeshBinHeader
+{
+public:
+	uint32 m_magic;
+	uint32 m_version;
+	uint32 m_headerSize; // sizeof(MeshBinHeader) when written, so later versions can append fields
+	uint32 m_flags; // MESHBIN_HAS_*
+	uint64 m_key; // see SaveMeshBin
+	uint32 m_polyNumVerts; // 3 for TriangleMesh, 4 for QuadMesh
+	uint32 m_polySize; // sizeof(IndexedPolyType)
+	uint32 m_vertCount;
+	uint32 m_normalCount;
+	uint32 m_texcoordCount;
+	uint32 m_colorCount;
+	uint32 m_polyCount;
+	uint32 m_groupCount;
+	uint32 m_infoCount;
+	uint32 m_reserved;
+	uint64 m_vertOffset; // byte offsets from start of file
+	uint64 m_normalOffset;
+	uint64 m_texcoordOffset;
+	uint64 m_colorOffset;
+	uint64 m_polyOffset;
+	uint64 m_stringOffset;
+	uint64 m_stringSize;
+	uint64 m_fileSize;
+};
+
+static uint64 MeshBin_AlignSection(uint64 offset)
+{
+	return (offset + MESHBIN_SECTION_ALIGNMENT - 1) & ~(uint64)(MESHBIN_SECTION_ALIGNMENT - 1);
+}
+
+static bool MeshBin_WriteSection(FILE* f, uint64& offset, uint64 sectionOffset, const void* data, size_t size)
+{
+	static const uint8 zeros[MESHBIN_SECTION_ALIGNMENT] = {0};
+	MeshAssert(sectionOffset >= offset && sectionOffset - offset < MESHBIN_SECTION_ALIGNMENT);
+	if (sectionOffset > offset && fwrite(zeros, (size_t)(sectionOffset - offset), 1, f) != 1)
+		return false;
+	if (size > 0 && fwrite(data, size, 1, f) != 1)
+		return false;
+	offset = sectionOffset + size;
+	return true;
+}
+
+template <typename MeshType> static bool SaveMeshBin_T(const char* path, const MeshType& mesh, uint64 key)
+{
+	typedef typename MeshType::IndexedPolyType IndexedPolyType;
+	std::string strings;
+	for (size_t i = 0; i < mesh.m_groupNames.size(); i++)
+		strings.append(mesh.m_groupNames[i].c_str(), mesh.m_groupNames[i].size() + 1);
+	for (size_t i = 0; i < mesh.m_info.size(); i++)
+		strings.append(mesh.m_info[i].c_str(), mesh.m_info[i].size() + 1);
+
+	MeshBinHeader header;
+	memset(&header, 0, sizeof(header));
+	header.m_magic = MESHBIN_MAGIC;
+	header.m_version = MESHBIN_VERSION;
+	header.m_headerSize = sizeof(MeshBinHeader);
+	header.m_flags = (mesh.m_normals ? MESHBIN_HAS_NORMALS : 0) | (mesh.m_texcoords ? MESHBIN_HAS_TEXCOORDS : 0) | (mesh.m_colors ? MESHBIN_HAS_COLORS : 0);
+	header.m_key = key;
+	header.m_polyNumVerts = IndexedPolyType::NumVerts;
+	header.m_polySize = sizeof(IndexedPolyType);
+	header.m_vertCount = (uint32)mesh.m_verts.size();
+	header.m_normalCount = mesh.m_normals ? (uint32)mesh.m_normals->size() : 0;
+	header.m_texcoordCount = mesh.m_texcoords ? (uint32)mesh.m_texcoords->size() : 0;
+	header.m_colorCount = mesh.m_colors ? (uint32)mesh.m_colors->size() : 0;
+	header.m_polyCount = (uint32)mesh.m_polys.size();
+	header.m_groupCount = (uint32)mesh.m_groupNames.size();
+	header.m_infoCount = (uint32)mesh.m_info.size();
+	header.m_vertOffset = MeshBin_AlignSection(sizeof(MeshBinHeader));
+	header.m_normalOffset = MeshBin_AlignSection(header.m_vertOffset + header.m_vertCount*sizeof(Vec3V));
+	header.m_texcoordOffset = MeshBin_AlignSection(header.m_normalOffset + header.m_normalCount*sizeof(Vec3V));
+	header.m_colorOffset = MeshBin_AlignSection(header.m_texcoordOffset + header.m_texcoordCount*sizeof(Vec2V));
+	header.m_polyOffset = MeshBin_AlignSection(header.m_colorOffset + header.m_colorCount*sizeof(Vec4V));
+	header.m_stringOffset = MeshBin_AlignSection(header.m_polyOffset + header.m_polyCount*sizeof(IndexedPolyType));
+	header.m_stringSize = strings.size();
+	header.m_fileSize = header.m_stringOffset + header.m_stringSize;
+
+	char path2[512];
+	strcpy(path2, PathExt(path, ".meshbin"));
+	FILE* f = fopen(path2, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "failed to save mesh %s!\n", path2);
 		return false;
 	}
+	uint64 offset = 0;
+	bool ok = MeshBin_WriteSection(f, offset, 0, &header, sizeof(header));
+	ok = ok && MeshBin_WriteSection(f, offset, header.m_vertOffset, mesh.m_verts.data(), header.m_vertCount*sizeof(Vec3V));
+	ok = ok && MeshBin_WriteSection(f, offset, header.m_normalOffset, mesh.m_normals ? mesh.m_normals->data() : NULL, header.m_normalCount*sizeof(Vec3V));
+	ok = ok && MeshBin_WriteSection(f, offset, header.m_texcoordOffset, mesh.m_texcoords ? mesh.m_texcoords->data() : NULL, header.m_texcoordCount*sizeof(Vec2V));
+	ok = ok && MeshBin_WriteSection(f, offset, header.m_colorOffset, mesh.m_colors ? mesh.m_colors->data() : NULL, header.m_colorCount*sizeof(Vec4V));
+	ok = ok && MeshBin_WriteSection(f, offset, header.m_polyOffset, mesh.m_polys.data(), header.m_polyCount*sizeof(IndexedPolyType));
+	ok = ok && MeshBin_WriteSection(f, offset, header.m_stringOffset, strings.data(), strings.size());
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "failed to write mesh %s!\n", path2);
+		remove(path2); // don't leave a truncated file behind for the next load to reject
+	}
+	return ok;
 }
 
-bool LoadOBJ(const char* path, TriangleMesh& mesh, bool loadTexcoordsAndNormals, const Mat34V* transform)
+template <typename MeshType> static bool LoadMeshBin_T(const char* path, MeshType& mesh, uint64 key)
 {
-	if (loadTexcoordsAndNormals)
-		return LoadOBJ_PosTexNrm_T(path, mesh, transform);
-	else
-		return LoadOBJ_T(path, mesh, transform);
+	typedef typename MeshType::IndexedPolyType IndexedPolyType;
+	char path2[512];
+	strcpy(path2, PathExt(path, ".meshbin"));
+	MappedFile file;
+	if (!file.Open(path2)) {
+		fprintf(stderr, "failed to load mesh %s!\n", path2);
+		return false;
+	}
+	const uint8* data = file.GetData();
+	const uint64 size = file.GetSize();
+	const MeshBinHeader* header = reinterpret_cast<const MeshBinHeader*>(data);
+	const char* error = NULL;
+	if (size < sizeof(MeshBinHeader) || header->m_magic != MESHBIN_MAGIC)
+		error = "not a meshbin file";
+	else if (header->m_version != MESHBIN_VERSION || header->m_headerSize < sizeof(MeshBinHeader))
+		error = "unsupported version";
+	else if (key != 0 && header->m_key != key)
+		return false; // stale cache, not an error
+	else if (header->m_polyNumVerts != IndexedPolyType::NumVerts || header->m_polySize != sizeof(IndexedPolyType))
+		error = "wrong poly type";
+	else if (header->m_fileSize != size)
+		error = "file is truncated";
+	else if (header->m_vertOffset + (uint64)header->m_vertCount*sizeof(Vec3V) > size ||
+		header->m_normalOffset + (uint64)header->m_normalCount*sizeof(Vec3V) > size ||
+		header->m_texcoordOffset + (uint64)header->m_texcoordCount*sizeof(Vec2V) > size ||
+		header->m_colorOffset + (uint64)header->m_colorCount*sizeof(Vec4V) > size ||
+		header->m_polyOffset + (uint64)header->m_polyCount*sizeof(IndexedPolyType) > size ||
+		header->m_stringOffset + header->m_stringSize > size)
+		error = "sections are out of range";
+	else if ((header->m_vertOffset|header->m_normalOffset|header->m_texcoordOffset|header->m_colorOffset|header->m_polyOffset) & (MESHBIN_SECTION_ALIGNMENT - 1))
+		error = "sections are misaligned";
+	const char* strings = reinterpret_cast<const char*>(data + (error ? 0 : header->m_stringOffset));
+	const IndexedPolyType* polys = reinterpret_cast<const IndexedPolyType*>(data + (error ? 0 : header->m_polyOffset));
+	if (error == NULL) {
+		uint64 numStrings = 0;
+		for (uint64 i = 0; i < header->m_stringSize; i++)
+			numStrings += strings[i] == '\0' ? 1 : 0;
+		if (numStrings != (uint64)header->m_groupCount + header->m_infoCount || (header->m_stringSize > 0 && strings[header->m_stringSize - 1] != '\0'))
+			error = "strings are corrupt";
+	}
+	for (uint32 polyIndex = 0; error == NULL && polyIndex < header->m_polyCount; polyIndex++) {
+		for (unsigned i = 0; i < IndexedPolyType::NumVerts; i++) {
+			if (polys[polyIndex].m_indices[i] >= header->m_vertCount)
+				error = "poly indices are out of range";
+		}
+		if (polys[polyIndex].m_group < -1 || polys[polyIndex].m_group >= (int)header->m_groupCount)
+			error = "poly groups are out of range";
+	}
+	if (error) {
+		fprintf(stderr, "failed to load mesh %s! (%s)\n", path2, error);
+		return false;
+	}
+
+	mesh.Clear();
+	const Vec3V* verts = reinterpret_cast<const Vec3V*>(data + header->m_vertOffset);
+	mesh.m_verts.assign(verts, verts + header->m_vertCount);
+	if (header->m_flags & MESHBIN_HAS_NORMALS) {
+		const Vec3V* normals = reinterpret_cast<const Vec3V*>(data + header->m_normalOffset);
+		mesh.m_normals = new std::vector<Vec3V>(normals, normals + header->m_normalCount);
+	}
+	if (header->m_flags & MESHBIN_HAS_TEXCOORDS) {
+		const Vec2V* texcoords = reinterpret_cast<const Vec2V*>(data + header->m_texcoordOffset);
+		mesh.m_texcoords = new std::vector<Vec2V>(texcoords, texcoords + header->m_texcoordCount);
+	}
+	if (header->m_flags & MESHBIN_HAS_COLORS) {
+		const Vec4V* colors = reinterpret_cast<const Vec4V*>(data + header->m_colorOffset);
+		mesh.m_colors = new std::vector<Vec4V>(colors, colors + header->m_colorCount);
+	}
+	mesh.m_polys.assign(polys, polys + header->m_polyCount);
+	for (uint32 i = 0; i < header->m_groupCount + header->m_infoCount; i++) {
+		const size_t len = strlen(strings);
+		if (i < header->m_groupCount) {
+			mesh.m_groupNameMap[strings] = (int)mesh.m_groupNames.size();
+			mesh.m_groupNames.push_back(strings);
+		} else
+			mesh.m_info.push_back(strings);
+		strings += len + 1;
+	}
+	return true;
+}
+
+bool SaveMeshBin(const char* path, const TriangleMesh& mesh, uint64 key) { return SaveMeshBin_T(path, mesh, key); }
+bool SaveMeshBin(const char* path, const QuadMesh& mesh, uint64 key) { return SaveMeshBin_T(path, mesh, key); }
+bool LoadMeshBin(const char* path, TriangleMesh& mesh, uint64 key) { return LoadMeshBin_T(path, mesh, key); }
+bool LoadMeshBin(const char* path, QuadMesh& mesh, uint64 key) { return LoadMeshBin_T(path, mesh, key); }
+
+// identifies what a LoadOBJ call would produce - the source file's size and last write time plus everything that changes how
+// it's loaded, returns 0 if the file doesn't exist (or the platform can't tell when it changed)
+// the file contents aren't hashed, a cache hit shouldn't have to read a multi-GB scan
+static uint64 LoadOBJ_GetCacheKey(const char* path, bool loadTexcoordsAndNormals, const Mat34V* transform, uint32 polyNumVerts)
+{
+	uint64 fileSize = 0;
+	uint64 fileTime = 0;
+	if (!GetFileSizeAndTime(path, fileSize, fileTime))
+		return 0;
+	uint64 key = Crc64(fileSize);
+	key = Crc64(fileTime, key);
+	key = Crc64(polyNumVerts, key);
+	key = Crc64(loadTexcoordsAndNormals, key);
+	if (transform) { // only the 12 matrix elements, the w components of the columns are undefined
+		const float m[12] = {VEC3V_ARGS(transform->a()), VEC3V_ARGS(transform->b()), VEC3V_ARGS(transform->c()), VEC3V_ARGS(transform->d())};
+		key = Crc64(m, key);
+	}
+	return key ? key : 1;
+}
+
+template <typename MeshType> static bool LoadOBJ_Cached_T(const char* path, MeshType& mesh, bool loadTexcoordsAndNormals, const Mat34V* transform, TaskScheduler* scheduler)
+{
+	uint64 key = 0;
+	char cachePath[512] = "";
+#if OBJ_LOAD_MESHBIN_CACHE
+	// the cache holds a whole mesh, so it's only used when loading into an empty one
+	if (mesh.m_verts.empty() && mesh.m_polys.empty() && mesh.m_groupNames.empty() && mesh.m_info.empty() &&
+		mesh.m_normals == NULL && mesh.m_texcoords == NULL && mesh.m_colors == NULL) {
+		char path2[512];
+		strcpy(path2, PathExt(path, ".obj"));
+		key = LoadOBJ_GetCacheKey(path2, loadTexcoordsAndNormals, transform, MeshType::IndexedPolyType::NumVerts);
+		strcpy(cachePath, PathExt(path2, ".meshbin"));
+		if (key && FileExists(cachePath) && LoadMeshBin(cachePath, mesh, key))
+			return true;
+	}
+#endif // OBJ_LOAD_MESHBIN_CACHE
+	const bool ok = loadTexcoordsAndNormals ? LoadOBJ_PosTexNrm_T(path, mesh, transform, scheduler) : LoadOBJ_T(path, mesh, transform, scheduler);
+	if (ok && key)
+		SaveMeshBin(cachePath, mesh, key);
+	return ok;
 }
 
-bool LoadOBJ(const char* path, QuadMesh& mesh, bool loadTexcoordsAndNormals, const Mat34V* transform)
+bool LoadOBJ(const char* path, TriangleMesh& mesh, bool loadTexcoordsAndNormals, const Mat34V* transform, TaskScheduler* scheduler)
 {
-	if (loadTexcoordsAndNormals)
-		return LoadOBJ_PosTexNrm_T(path, mesh, transform);
-	else
-		return LoadOBJ_T(path, mesh, transform);
+	return LoadOBJ_Cached_T(path, mesh, loadTexcoordsAndNormals, transform, scheduler);
+}
+
+bool LoadOBJ(const char* path, QuadMesh& mesh, bool loadTexcoordsAndNormals, const Mat34V* transform, TaskScheduler* scheduler)
+{
+	return LoadOBJ_Cached_T(path, mesh, loadTexcoordsAndNormals, transform, scheduler);
 }
 
 template <typename MeshType> static void SaveOBJStream_T(FILE* file, uint32& vrtIndex, uint32& nrmIndex, uint32& texIndex, const MeshType& mesh, const std::map<std::string_mappable,std::string>* materialMap)
@@ -1684,7 +2211,7 @@ template <typename MeshType> static uint32 AddGeometry_T(MeshType& mesh, const M
 					numPolysAdded += IndexedPolyType::AddPolys(mesh.m_polys, 0, indices, srcCount, group);
 				}
 			}
-			mesh.m_vertexMap.clear(); // currently we only maintain this map for a single instance
+			mesh.m_vertexWelder.Clear(); // currently we only maintain this map for a single instance
 		}
 	}
 	return numPolysAdded;
@@ -1729,41 +2256,95 @@ void ConstructNormals(QuadMesh& mesh)
 	ConstructNormals_T<QuadMesh,Quad3V>(mesh);
 }
 
+void TriangleMeshEdges::Build(const TriangleMesh& mesh)
+{
+	const uint32 numTris = (uint32)mesh.m_polys.size();
+	const uint32 numVerts = (uint32)mesh.m_verts.size();
+
+	// counting sort of the sides on their lower vertex index, each entry is (upper vertex index << 32)|(triIndex*3 + side)
+	std::vector<uint32> sideStart(numVerts + 1, 0);
+	for (uint32 triIndex = 0; triIndex < numTris; triIndex++) {
+		const IndexedTriangle& tri = mesh.m_polys[triIndex];
+		for (unsigned side = 0; side < 3; side++)
+			sideStart[Min(tri.m_indices[side], tri.m_indices[(side + 1)%3]) + 1]++;
+	}
+	for (uint32 vertIndex = 0; vertIndex < numVerts; vertIndex++)
+		sideStart[vertIndex + 1] += sideStart[vertIndex];
+	std::vector<uint32> sideNext(sideStart.begin(), sideStart.end() - 1);
+	std::vector<uint64> sides(numTris*3);
+	for (uint32 triIndex = 0; triIndex < numTris; triIndex++) {
+		const IndexedTriangle& tri = mesh.m_polys[triIndex];
+		for (unsigned side = 0; side < 3; side++) {
+			const uint32 index0 = tri.m_indices[side];
+			const uint32 index1 = tri.m_indices[(side + 1)%3];
+			sides[sideNext[Min(index0, index1)]++] = ((uint64)Max(index0, index1) << 32)|(triIndex*3 + side);
+		}
+	}
+
+	// sorting each bucket on the upper vertex index groups the sides of each edge together - buckets are about as large as
+	// the vertex valence, so this is still linear in practice
+	m_edges.clear();
+	m_triEdges.resize(numTris*3);
+	m_vertEdgeStart.resize(numVerts + 1);
+	for (uint32 vertIndex = 0; vertIndex < numVerts; vertIndex++) {
+		m_vertEdgeStart[vertIndex] = (uint32)m_edges.size();
+		std::sort(sides.begin() + sideStart[vertIndex], sides.begin() + sideStart[vertIndex + 1]);
+		for (uint32 i = sideStart[vertIndex]; i < sideStart[vertIndex + 1]; i++) {
+			const uint32 upper = (uint32)(sides[i] >> 32);
+			const uint32 sideRef = (uint32)sides[i];
+			if (i == sideStart[vertIndex] || (uint32)(sides[i - 1] >> 32) != upper) {
+				Edge edge;
+				edge.m_verts[0] = vertIndex;
+				edge.m_verts[1] = upper;
+				edge.m_tris[0] = sideRef/3;
+				edge.m_tris[1] = INVALID_INDEX;
+				m_edges.push_back(edge);
+			} else if (m_edges.back().m_tris[1] == INVALID_INDEX)
+				m_edges.back().m_tris[1] = sideRef/3;
+			m_triEdges[sideRef] = (uint32)m_edges.size() - 1;
+		}
+	}
+	m_vertEdgeStart[numVerts] = (uint32)m_edges.size();
+}
+
+uint32 TriangleMeshEdges::GetAdjacentTriangle(uint32 triIndex, unsigned side) const
+{
+	const Edge& edge = m_edges[GetEdgeIndex(triIndex, side)];
+	return edge.m_tris[0] == triIndex ? edge.m_tris[1] : edge.m_tris[0];
+}
+
+uint32 TriangleMeshEdges::FindEdge(uint32 index0, uint32 index1) const
+{
+	const uint32 lower = Min(index0, index1);
+	const uint32 upper = Max(index0, index1);
+	if (lower + 1 >= m_vertEdgeStart.size())
+		return INVALID_INDEX;
+	const auto first = m_edges.begin() + m_vertEdgeStart[lower];
+	const auto last = m_edges.begin() + m_vertEdgeStart[lower + 1];
+	const auto f = std::lower_bound(first, last, upper, [](const Edge& edge, uint32 index) { return edge.m_verts[1] < index; });
+	return (f != last && f->m_verts[1] == upper) ? (uint32)(f - m_edges.begin()) : INVALID_INDEX;
+}
+
 void Tessellate4(TriangleMesh& mesh)
 {
 	mesh.CheckVertexStreams();
-	std::map<uint32,uint32> midpointIndexMap;
-	for (uint32 triIndex0 = 0; triIndex0 < mesh.m_polys.size(); triIndex0++) {
-		for (unsigned side0 = 0; side0 < 3; side0++) {
-			const uint32 indexA0 = mesh.m_polys[triIndex0].m_indices[side0];
-			const uint32 indexB0 = mesh.m_polys[triIndex0].m_indices[(side0 + 1)%3];
-			bool found = false; // is this side is shared, we can create a single shared midpoint vertex
-			for (uint32 triIndex1 = triIndex0 + 1; triIndex1 < mesh.m_polys.size() && !found; triIndex1++) {
-				for (unsigned side1 = 0; side1 < 3; side1++) {
-					const uint32 indexA1 = mesh.m_polys[triIndex1].m_indices[side1];
-					const uint32 indexB1 = mesh.m_polys[triIndex1].m_indices[(side1 + 1)%3];
-					if (indexA0 == indexB1 && indexB0 == indexA1) {
-						const uint32 index = mesh.AddInterpolatedVertex(indexA0, indexB0, ScalarV(0.5f), true, true);
-						midpointIndexMap[(triIndex0 << 2)|side0] = index;
-						midpointIndexMap[(triIndex1 << 2)|side1] = index;
-						found = true;
-						break;
-					}
-				}
-			}
-			if (!found) {
-				if (midpointIndexMap.find((triIndex0 << 2)|side0) == midpointIndexMap.end()) {
-					const uint32 index = mesh.AddInterpolatedVertex(indexA0, indexB0, ScalarV(0.5f), true, true);
-					midpointIndexMap[(triIndex0 << 2)|side0] = index;
-				}
+	const TriangleMeshEdges edges(mesh);
+	const uint32 numTris = (uint32)mesh.m_polys.size();
+	std::vector<uint32> midpoints(edges.GetEdgeCount(), TriangleMeshEdges::INVALID_INDEX);
+	for (uint32 triIndex = 0; triIndex < numTris; triIndex++) { // midpoints are added in the order their sides are first seen
+		for (unsigned side = 0; side < 3; side++) {
+			uint32& midpoint = midpoints[edges.GetEdgeIndex(triIndex, side)];
+			if (midpoint == TriangleMeshEdges::INVALID_INDEX) {
+				const uint32 indexA = mesh.m_polys[triIndex].m_indices[side];
+				const uint32 indexB = mesh.m_polys[triIndex].m_indices[(side + 1)%3];
+				midpoint = mesh.AddInterpolatedVertex(indexA, indexB, ScalarV(0.5f), true, false);
 			}
 		}
 	}
-	const uint32 numTris = (uint32)mesh.m_polys.size();
 	for (uint32 i = 0; i < numTris; i++) {
-		const uint32 mid01 = midpointIndexMap[(i << 2)|0];
-		const uint32 mid12 = midpointIndexMap[(i << 2)|1];
-		const uint32 mid20 = midpointIndexMap[(i << 2)|2];
+		const uint32 mid01 = midpoints[edges.GetEdgeIndex(i, 0)];
+		const uint32 mid12 = midpoints[edges.GetEdgeIndex(i, 1)];
+		const uint32 mid20 = midpoints[edges.GetEdgeIndex(i, 2)];
 		mesh.m_polys.push_back(IndexedTriangle(0, mesh.m_polys[i].m_indices[0], mid01, mid20, mesh.m_polys[i].m_group));
 		mesh.m_polys.push_back(IndexedTriangle(0, mesh.m_polys[i].m_indices[1], mid12, mid01, mesh.m_polys[i].m_group));
 		mesh.m_polys.push_back(IndexedTriangle(0, mesh.m_polys[i].m_indices[2], mid20, mid12, mesh.m_polys[i].m_group));
@@ -1773,47 +2354,166 @@ void Tessellate4(TriangleMesh& mesh)
 	}
 }
 
-void TessellateToEdgeLength(TriangleMesh& mesh, float edgeLength, ProgressDisplay* progress, int progressPeriod)
+static inline uint64 GetEdgeKey(uint32 index0, uint32 index1)
+{
+	return index0 < index1 ? (((uint64)index0 << 32)|index1) : (((uint64)index1 << 32)|index0);
+}
+
+// the side to bisect is the longest one, or -1 if none are longer than the edge length - side lengths don't depend on the
+// direction they're measured in, so triangles on either side of an edge make the same decision for it
+static int GetTessellateSplitSide(const Vec3V pos[3], float edgeLengthSqr)
+{
+	const ScalarV edgeLengthsSqr[] = {
+		MagSqr(pos[1] - pos[0]),
+		MagSqr(pos[2] - pos[1]),
+		MagSqr(pos[0] - pos[2]),
+	};
+	const ScalarV edgeLengthSqrMax = Max(edgeLengthsSqr[0], edgeLengthsSqr[1], edgeLengthsSqr[2]);
+	if (edgeLengthSqrMax > edgeLengthSqr) {
+		if      (edgeLengthSqrMax == edgeLengthsSqr[0]) return 0; // split between verts 0 and 1
+		else if (edgeLengthSqrMax == edgeLengthsSqr[1]) return 1; // split between verts 1 and 2
+		else                                            return 2; // split between verts 2 and 0
+	}
+	return -1;
+}
+
+void TessellateToEdgeLength(TriangleMesh& mesh, float edgeLength, ProgressDisplay* progress, int progressPeriod, TaskScheduler* scheduler)
 {
 	mesh.CheckVertexStreams();
 	const float edgeLengthSqr = edgeLength*edgeLength;
 	if (progressPeriod <= 1)
 		progressPeriod = 1;
-	for (uint32 triIndex = 0; triIndex < mesh.m_polys.size(); triIndex++) {
-		if (progress && triIndex%progressPeriod == 0)
-			progress->Update(triIndex, mesh.m_polys.size());
-		while (true) {
-			const Vec3V pos[] = {
-				mesh.GetTriangleVertexPos(triIndex, 0),
-				mesh.GetTriangleVertexPos(triIndex, 1),
-				mesh.GetTriangleVertexPos(triIndex, 2),
-			};
-			const ScalarV edgeLengthsSqr[] = {
-				MagSqr(pos[1] - pos[0]),
-				MagSqr(pos[2] - pos[1]),
-				MagSqr(pos[0] - pos[2]),
-			};
-			const ScalarV edgeLengthSqrMax = Max(edgeLengthsSqr[0], edgeLengthsSqr[1], edgeLengthsSqr[2]);
-			if (edgeLengthSqrMax > edgeLengthSqr) {
-				unsigned splitSideIndex;
-				if      (edgeLengthSqrMax == edgeLengthsSqr[0]) splitSideIndex = 0; // split between verts 0 and 1
-				else if (edgeLengthSqrMax == edgeLengthsSqr[1]) splitSideIndex = 1; // split between verts 1 and 2
-				else                                            splitSideIndex = 2; // split between verts 2 and 0
-				const uint32 index0 = mesh.m_polys[triIndex].m_indices[splitSideIndex];
-				const uint32 index1 = mesh.m_polys[triIndex].m_indices[(splitSideIndex + 1)%3];
-				const uint32 index = mesh.AddInterpolatedVertex(index0, index1, ScalarV(0.5f), true, true);
-				IndexedTriangle triCopy = mesh.m_polys[triIndex]; // copy
-				mesh.m_polys[triIndex].m_indices[(splitSideIndex + 1)%3] = index;
-				triCopy.m_indices[splitSideIndex] = index;
-				mesh.m_polys.push_back(triCopy);
-			} else
-				break;
+	const uint32 numTris = (uint32)mesh.m_polys.size();
+
+	// bisect the mesh edges first, since these are the only vertices shared between triangles - each edge is split into the
+	// same pieces the triangles on either side of it will split it into, and midpoints are always interpolated from the lower
+	// vertex index so they come out the same from both sides
+	std::unordered_map<uint64,uint32> edgeMidpoints;
+	{
+		const TriangleMeshEdges edges(mesh);
+		std::vector<std::pair<uint32,uint32>> stack;
+		for (uint32 edgeIndex = 0; edgeIndex < edges.GetEdgeCount(); edgeIndex++) {
+			stack.push_back(std::make_pair(edges.GetEdge(edgeIndex).m_verts[0], edges.GetEdge(edgeIndex).m_verts[1]));
+			while (!stack.empty()) {
+				const uint32 index0 = stack.back().first;
+				const uint32 index1 = stack.back().second;
+				stack.pop_back();
+				if (MagSqr(mesh.m_verts[index1] - mesh.m_verts[index0]) > edgeLengthSqr) {
+					const uint32 index = mesh.AddInterpolatedVertex(index0, index1, ScalarV(0.5f), true, false);
+					edgeMidpoints[GetEdgeKey(index0, index1)] = index;
+					stack.push_back(std::make_pair(index0, index)); // new vertices have the highest index, so pairs stay ordered
+					stack.push_back(std::make_pair(index1, index));
+				}
+			}
 		}
 	}
+
+	// then tessellate chunks of triangles independently - vertices added inside a triangle are only shared by its own pieces,
+	// they're indexed with localVertexFlag until the chunks are merged
+	class Chunk
+	{
+	public:
+		std::vector<MeshBase::Vertex> m_verts;
+		std::vector<IndexedTriangle> m_replaced; // one per triangle in the chunk
+		std::vector<IndexedTriangle> m_added;
+	};
+	const uint32 localVertexFlag = 0x80000000;
+	const uint32 chunkSize = 1024;
+	const uint32 numChunks = (numTris + chunkSize - 1)/chunkSize;
+	MeshAssert(mesh.m_verts.size() < localVertexFlag);
+	std::vector<Chunk> chunks(numChunks);
+	std::atomic<uint32> numTrisDone(0);
+	uint32 numTrisDoneUpdate = 0; // only touched by thread 0
+	const auto TessellateChunks = [&](unsigned begin, unsigned end, unsigned threadIndex) {
+		std::unordered_map<uint64,uint32> interiorMidpoints;
+		std::vector<IndexedTriangle> stack;
+		for (uint32 chunkIndex = begin; chunkIndex < end; chunkIndex++) {
+			Chunk& chunk = chunks[chunkIndex];
+			const auto GetVertex = [&](uint32 index) { return (index & localVertexFlag) ? chunk.m_verts[index & ~localVertexFlag] : mesh.GetVertex(index); };
+			const auto GetVertexPos = [&](uint32 index) { return (index & localVertexFlag) ? chunk.m_verts[index & ~localVertexFlag].m_pos : mesh.m_verts[index]; };
+			const uint32 triStart = chunkIndex*chunkSize;
+			const uint32 triEnd = Min(triStart + chunkSize, numTris);
+			for (uint32 triIndex = triStart; triIndex < triEnd; triIndex++) {
+				if (!interiorMidpoints.empty())
+					interiorMidpoints.clear();
+				bool replaced = false;
+				stack.push_back(mesh.m_polys[triIndex]);
+				while (!stack.empty()) {
+					IndexedTriangle tri = stack.back();
+					stack.pop_back();
+					const Vec3V pos[] = {
+						GetVertexPos(tri.m_indices[0]),
+						GetVertexPos(tri.m_indices[1]),
+						GetVertexPos(tri.m_indices[2]),
+					};
+					const int splitSideIndex = GetTessellateSplitSide(pos, edgeLengthSqr);
+					if (splitSideIndex != -1) {
+						const uint32 index0 = tri.m_indices[splitSideIndex];
+						const uint32 index1 = tri.m_indices[(splitSideIndex + 1)%3];
+						const uint64 key = GetEdgeKey(index0, index1);
+						uint32 index;
+						const auto f = edgeMidpoints.find(key);
+						if (f != edgeMidpoints.end())
+							index = f->second;
+						else {
+							const auto g = interiorMidpoints.find(key);
+							if (g != interiorMidpoints.end())
+								index = g->second;
+							else {
+								index = localVertexFlag|(uint32)chunk.m_verts.size();
+								chunk.m_verts.push_back(MeshBase::Interpolate(GetVertex(Min(index0, index1)), GetVertex(Max(index0, index1)), ScalarV(0.5f), true));
+								interiorMidpoints[key] = index;
+							}
+						}
+						IndexedTriangle triCopy = tri; // copy
+						tri.m_indices[(splitSideIndex + 1)%3] = index;
+						triCopy.m_indices[splitSideIndex] = index;
+						stack.push_back(triCopy);
+						stack.push_back(tri); // next, so the original triangle is replaced by the piece at its first vertex as before
+					} else if (!replaced) {
+						chunk.m_replaced.push_back(tri);
+						replaced = true;
+					} else
+						chunk.m_added.push_back(tri);
+				}
+			}
+			const uint32 done = numTrisDone += triEnd - triStart;
+			if (progress && threadIndex == 0 && done - numTrisDoneUpdate >= (uint32)progressPeriod) {
+				progress->Update(done, numTris);
+				numTrisDoneUpdate = done;
+			}
+		}
+	};
+	if (scheduler)
+		scheduler->ParallelFor(numChunks, 1, TessellateChunks);
+	else
+		TessellateChunks(0, numChunks, 0);
+
+	// merge in chunk order, so the result doesn't depend on how the chunks were scheduled
+	for (uint32 chunkIndex = 0; chunkIndex < numChunks; chunkIndex++) {
+		Chunk& chunk = chunks[chunkIndex];
+		const uint32 vertStart = (uint32)mesh.m_verts.size();
+		for (size_t i = 0; i < chunk.m_verts.size(); i++)
+			mesh.AddVertex(chunk.m_verts[i], false);
+		const auto Remap = [&](IndexedTriangle tri) {
+			for (unsigned i = 0; i < 3; i++) {
+				if (tri.m_indices[i] & localVertexFlag)
+					tri.m_indices[i] = vertStart + (tri.m_indices[i] & ~localVertexFlag);
+			}
+			return tri;
+		};
+		MeshAssert(chunk.m_replaced.size() == Min(chunkSize, numTris - chunkIndex*chunkSize));
+		for (size_t i = 0; i < chunk.m_replaced.size(); i++)
+			mesh.m_polys[chunkIndex*chunkSize + i] = Remap(chunk.m_replaced[i]);
+		for (size_t i = 0; i < chunk.m_added.size(); i++)
+			mesh.m_polys.push_back(Remap(chunk.m_added[i]));
+		chunk = Chunk(); // free it now, the merged mesh may be large
+	}
 }
 
-template <typename MeshType> static void WeldPositions_T(MeshType& mesh, float tolerance)
+template <typename MeshType> static void WeldPositionsBands_T(MeshType& mesh, float tolerance)
 {
+	mesh.m_vertexWelder.Clear();
 	class Bucket
 	{
 	public:
@@ -1889,14 +2589,277 @@ template <typename MeshType> static void WeldPositions_T(MeshType& mesh, float t
 	}
 }
 
-void WeldPositions(TriangleMesh& mesh, float tolerance)
+#define WELD_CELL_COORD_BITS (21) // per axis, cells are made larger than tolerance if the mesh doesn't fit
+
+static inline bool IsPolyDegenerate(const IndexedTriangle& tri)
+{
+	return tri.m_indices[0] == tri.m_indices[1] || tri.m_indices[1] == tri.m_indices[2] || tri.m_indices[2] == tri.m_indices[0];
+}
+
+static inline bool IsPolyDegenerate(const IndexedQuad& quad) // a quad with one repeated corner is a triangle, which is fine
+{
+	const uint32* q = quad.m_indices;
+	return q[0] == q[2] || q[1] == q[3] || (q[0] == q[1] && q[2] == q[3]) || (q[1] == q[2] && q[3] == q[0]);
+}
+
+// sorts ranges in parallel and then merges pairs of ranges in parallel until there is one
+template <typename T> static void ParallelSort(std::vector<T>& elements, TaskScheduler* scheduler)
+{
+	const uint32 count = (uint32)elements.size();
+	const uint32 numRanges = scheduler ? Min(scheduler->GetNumThreads()*4, Max(1U, count/65536)) : 1;
+	if (numRanges <= 1) {
+		std::sort(elements.begin(), elements.end());
+		return;
+	}
+	std::vector<uint32> rangeStart(numRanges + 1);
+	for (uint32 i = 0; i <= numRanges; i++)
+		rangeStart[i] = (uint32)((uint64)count*i/numRanges);
+	scheduler->ParallelFor(numRanges, 1, [&](unsigned begin, unsigned end, unsigned) {
+		for (unsigned i = begin; i < end; i++)
+			std::sort(elements.begin() + rangeStart[i], elements.begin() + rangeStart[i + 1]);
+	});
+	for (uint32 width = 1; width < numRanges; width *= 2) {
+		const uint32 numMerges = (numRanges + width*2 - 1)/(width*2);
+		scheduler->ParallelFor(numMerges, 1, [&](unsigned begin, unsigned end, unsigned) {
+			for (unsigned i = begin; i < end; i++) {
+				const uint32 first = i*width*2;
+				const uint32 middle = Min(first + width, numRanges);
+				const uint32 last = Min(first + width*2, numRanges);
+				if (middle < last)
+					std::inplace_merge(elements.begin() + rangeStart[first], elements.begin() + rangeStart[middle], elements.begin() + rangeStart[last]);
+			}
+		});
+	}
+}
+
+// every vertex either becomes a "leader" or moves onto the position of the lowest-indexed leader within tolerance of it, so
+// nothing moves further than tolerance and clusters can't chain together. vertices are bucketed in a grid of tolerance-sized
+// cells, so only the 3x3x3 cells around a vertex need to be searched. cells are processed in 27 passes by (x,y,z) mod 3,
+// so the cells in one pass never search each other's vertices and can run in parallel, and the result doesn't depend on the
+// number of threads
+template <typename MeshType> static uint32 WeldPositions_T(MeshType& mesh, float tolerance, bool remapPolys, TaskScheduler* scheduler)
+{
+	typedef typename MeshType::IndexedPolyType IndexedPolyType;
+	mesh.m_vertexWelder.Clear();
+	const uint32 numVerts = (uint32)mesh.m_verts.size();
+	if (numVerts == 0)
+		return 0;
+	const auto ParallelFor = [scheduler](uint32 count, uint32 grain, const std::function<void(unsigned,unsigned,unsigned)>& func) {
+		if (scheduler)
+			scheduler->ParallelFor(count, grain, func);
+		else
+			func(0, count, 0);
+	};
+	const float toleranceSq = Max(0.0f, tolerance)*Max(0.0f, tolerance);
+	const Box3V bounds = mesh.GetBounds();
+	const Vec3V boundsMin = bounds.GetMin();
+	const Vec3V boundsSize = bounds.GetMax() - boundsMin;
+	const uint64 coordMax = (1 << WELD_CELL_COORD_BITS) - 3; // cell coordinates are 1..coordMax+1, so their neighbours fit too
+	const uint64 coordMask = (1ULL << WELD_CELL_COORD_BITS) - 1;
+	float cellSize = Max(tolerance, Max(boundsSize.xf(), Max(boundsSize.yf(), boundsSize.zf()))/(float)coordMax); // any size >= tolerance works
+	if (!(cellSize > 0.0f))
+		cellSize = 1.0f; // all vertices are equal and tolerance is 0
+	const float invCellSize = 1.0f/cellSize;
+	const auto GetCellCoord = [=](float x, float x0) -> uint64 {
+		const float c = floorf((x - x0)*invCellSize);
+		return 1 + ((c >= (float)coordMax) ? coordMax : (c >= 0.0f) ? (uint64)c : 0); // NaN goes to the first cell
+	};
+	const auto GetCellKey = [=](uint64 x, uint64 y, uint64 z) -> uint64 {
+		return x | (y << WELD_CELL_COORD_BITS) | (z << (WELD_CELL_COORD_BITS*2));
+	};
+
+	// vertices sorted by cell, and by index within each cell
+	class Entry
+	{
+	public:
+		bool operator <(const Entry& rhs) const { return m_key < rhs.m_key || (m_key == rhs.m_key && m_index < rhs.m_index); }
+		uint64 m_key;
+		uint32 m_index;
+	};
+	std::vector<Entry> entries(numVerts);
+	ParallelFor(numVerts, 4096, [&](unsigned begin, unsigned end, unsigned) {
+		for (uint32 i = begin; i < end; i++) {
+			const Vec3V p = mesh.m_verts[i];
+			entries[i].m_key = GetCellKey(GetCellCoord(p.xf(), boundsMin.xf()), GetCellCoord(p.yf(), boundsMin.yf()), GetCellCoord(p.zf(), boundsMin.zf()));
+			entries[i].m_index = i;
+		}
+	});
+	ParallelSort(entries, scheduler);
+
+	class Cell
+	{
+	public:
+		uint64 m_key;
+		uint32 m_start; // into entries
+		uint32 m_end;
+	};
+	std::vector<Cell> cells;
+	VertexWelder cellMap; // keyed by cell coordinates rather than vertex positions, but it's the same kind of index table
+	for (uint32 i = 0; i < numVerts; i++) {
+		if (i == 0 || entries[i].m_key != entries[i - 1].m_key) {
+			Cell cell;
+			cell.m_key = entries[i].m_key;
+			cell.m_start = i;
+			cells.push_back(cell);
+		}
+		cells.back().m_end = i + 1;
+	}
+	const auto HashCellKey = [](uint64 key) -> uint32 {
+		key = (key ^ (key >> 33))*0xFF51AFD7ED558CCDULL;
+		key = (key ^ (key >> 33))*0xC4CEB9FE1A85EC53ULL;
+		return (uint32)(key ^ (key >> 33));
+	};
+	cellMap.Reserve((uint32)cells.size());
+	for (uint32 i = 0; i < (uint32)cells.size(); i++)
+		cellMap.Insert(HashCellKey(cells[i].m_key), i);
+
+	// group the cells by (x,y,z) mod 3
+	std::vector<uint32> passStart(27 + 1, 0);
+	std::vector<uint32> passCells(cells.size());
+	const auto GetPass = [=](uint64 key) -> uint32 {
+		return (uint32)((key & coordMask)%3 + (((key >> WELD_CELL_COORD_BITS) & coordMask)%3)*3 + ((key >> (WELD_CELL_COORD_BITS*2))%3)*9);
+	};
+	for (size_t i = 0; i < cells.size(); i++)
+		passStart[GetPass(cells[i].m_key) + 1]++;
+	for (uint32 pass = 0; pass < 27; pass++)
+		passStart[pass + 1] += passStart[pass];
+	{
+		std::vector<uint32> passNext(passStart.begin(), passStart.end() - 1);
+		for (uint32 i = 0; i < (uint32)cells.size(); i++)
+			passCells[passNext[GetPass(cells[i].m_key)]++] = i;
+	}
+
+	std::vector<uint32> leaders(numVerts, VertexWelder::INVALID_INDEX);
+	for (uint32 pass = 0; pass < 27; pass++) {
+		ParallelFor(passStart[pass + 1] - passStart[pass], 16, [&](unsigned begin, unsigned end, unsigned) {
+			for (uint32 k = passStart[pass] + begin; k < passStart[pass] + end; k++) {
+				const Cell& cell = cells[passCells[k]];
+				const uint64 x = cell.m_key & coordMask;
+				const uint64 y = (cell.m_key >> WELD_CELL_COORD_BITS) & coordMask;
+				const uint64 z = cell.m_key >> (WELD_CELL_COORD_BITS*2);
+				const Cell* neighbours[27];
+				unsigned numNeighbours = 0;
+				for (uint64 dz = 0; dz < 3; dz++) {
+					for (uint64 dy = 0; dy < 3; dy++) {
+						for (uint64 dx = 0; dx < 3; dx++) {
+							const uint64 key = GetCellKey(x + dx - 1, y + dy - 1, z + dz - 1);
+							const uint32 index = cellMap.Find(HashCellKey(key), [&cells, key](uint32 i) { return cells[i].m_key == key; });
+							if (index != VertexWelder::INVALID_INDEX)
+								neighbours[numNeighbours++] = &cells[index];
+						}
+					}
+				}
+				for (uint32 i = cell.m_start; i < cell.m_end; i++) {
+					const uint32 vertIndex = entries[i].m_index;
+					const Vec3V p = mesh.m_verts[vertIndex];
+					uint32 leader = VertexWelder::INVALID_INDEX;
+					for (unsigned j = 0; j < numNeighbours; j++) {
+						for (uint32 e = neighbours[j]->m_start; e < neighbours[j]->m_end && entries[e].m_index < leader; e++) {
+							const uint32 index = entries[e].m_index;
+							if (leaders[index] == index && MagSqr(mesh.m_verts[index] - p).f() <= toleranceSq)
+								leader = index; // entries are sorted by index within the cell, so this is the lowest in this cell
+						}
+					}
+					leaders[vertIndex] = (leader != VertexWelder::INVALID_INDEX) ? leader : vertIndex;
+				}
+			}
+		});
+	}
+
+	uint32 numWelded = 0;
+	for (uint32 vertIndex = 0; vertIndex < numVerts; vertIndex++) {
+		if (leaders[vertIndex] != vertIndex) {
+			mesh.m_verts[vertIndex] = mesh.m_verts[leaders[vertIndex]]; // leaders never move, so the order doesn't matter
+			numWelded++;
+		}
+	}
+	if (remapPolys) {
+		const uint32 numPolys = (uint32)mesh.m_polys.size();
+		std::vector<uint8> degenerate(numPolys);
+		ParallelFor(numPolys, 4096, [&](unsigned begin, unsigned end, unsigned) {
+			for (uint32 polyIndex = begin; polyIndex < end; polyIndex++) {
+				IndexedPolyType& poly = mesh.m_polys[polyIndex];
+				for (unsigned i = 0; i < IndexedPolyType::NumVerts; i++)
+					poly.m_indices[i] = leaders[poly.m_indices[i]];
+				degenerate[polyIndex] = IsPolyDegenerate(poly) ? 1 : 0;
+			}
+		});
+		uint32 numPolysKept = 0;
+		for (uint32 polyIndex = 0; polyIndex < numPolys; polyIndex++) {
+			if (!degenerate[polyIndex])
+				mesh.m_polys[numPolysKept++] = mesh.m_polys[polyIndex];
+		}
+		mesh.m_polys.resize(numPolysKept);
+	}
+	return numWelded;
+}
+
+uint32 WeldPositions(TriangleMesh& mesh, float tolerance, bool remapPolys, TaskScheduler* scheduler)
+{
+	return WeldPositions_T(mesh, tolerance, remapPolys, scheduler);
+}
+
+uint32 WeldPositions(QuadMesh& mesh, float tolerance, bool remapPolys, TaskScheduler* scheduler)
+{
+	return WeldPositions_T(mesh, tolerance, remapPolys, scheduler);
+}
+
+void WeldPositionsBands(TriangleMesh& mesh, float tolerance)
+{
+	WeldPositionsBands_T(mesh, tolerance);
+}
+
+void WeldPositionsBands(QuadMesh& mesh, float tolerance)
+{
+	WeldPositionsBands_T(mesh, tolerance);
+}
+
+template <typename MeshType> static uint32 WeldVertices_T(MeshType& mesh)
+{
+	typedef typename MeshType::IndexedPolyType IndexedPolyType;
+	mesh.CheckVertexStreams();
+	const uint32 numVerts = (uint32)mesh.m_verts.size();
+	VertexWelder welder;
+	welder.Reserve(numVerts);
+	std::vector<uint32> remap(numVerts);
+	uint32 numUnique = 0;
+	for (uint32 vertIndex = 0; vertIndex < numVerts; vertIndex++) {
+		// unique vertices are compacted in place - everything below numUnique is already moved, everything from vertIndex up is untouched
+		const uint32 hash = VertexWelder::HashPosition(mesh.m_verts[vertIndex]);
+		uint32 index = welder.Find(hash, [&mesh, vertIndex](uint32 i) { return mesh.IsVertexEqual(i, vertIndex); });
+		if (index == VertexWelder::INVALID_INDEX) {
+			index = numUnique++;
+			if (index != vertIndex) {
+				mesh.m_verts[index] = mesh.m_verts[vertIndex];
+				if (mesh.m_normals  ) mesh.m_normals  ->operator[](index) = mesh.m_normals  ->operator[](vertIndex);
+				if (mesh.m_texcoords) mesh.m_texcoords->operator[](index) = mesh.m_texcoords->operator[](vertIndex);
+				if (mesh.m_colors   ) mesh.m_colors   ->operator[](index) = mesh.m_colors   ->operator[](vertIndex);
+			}
+			welder.Insert(hash, index);
+		}
+		remap[vertIndex] = index;
+	}
+	mesh.m_verts.resize(numUnique);
+	if (mesh.m_normals  ) mesh.m_normals  ->resize(numUnique);
+	if (mesh.m_texcoords) mesh.m_texcoords->resize(numUnique);
+	if (mesh.m_colors   ) mesh.m_colors   ->resize(numUnique);
+	for (size_t polyIndex = 0; polyIndex < mesh.m_polys.size(); polyIndex++) {
+		IndexedPolyType& poly = mesh.m_polys[polyIndex];
+		for (unsigned i = 0; i < IndexedPolyType::NumVerts; i++)
+			poly.m_indices[i] = remap[poly.m_indices[i]];
+	}
+	mesh.m_vertexWelder = welder;
+	return numVerts - numUnique;
+}
+
+uint32 WeldVertices(TriangleMesh& mesh)
 {
-	WeldPositions_T(mesh, tolerance);
+	return WeldVertices_T(mesh);
 }
 
-void WeldPositions(QuadMesh& mesh, float tolerance)
+uint32 WeldVertices(QuadMesh& mesh)
 {
-	WeldPositions_T(mesh, tolerance);
+	return WeldVertices_T(mesh);
 }
 
 void ConvertQuadMeshToTriangleMesh(TriangleMesh& mesh, const QuadMesh& quadMesh)
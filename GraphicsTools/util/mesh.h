@@ -13,6 +13,7 @@
 #include "vmath/vmath_vec4.h"
 
 class ProgressDisplay;
+class TaskScheduler;
 
 class Box3V;
 class Plane3V;
@@ -171,6 +172,50 @@ const Triangle3V_SOA4 MakePoly_SOA4(const IndexedTriangle tris[4], const std::ve
 const Triangle3V_SOA8 MakePoly_SOA8(const IndexedTriangle tris[8], const std::vector<Vec3V>& verts);
 #endif // HAS_VEC8V
 
+// flat open-addressing (linear probing) table of vertex indices, used to find duplicate vertices - slots only hold an index
+// and its hash, equality is provided by the caller comparing its own vertex data, so the same table works for any
+// combination of vertex streams
+class VertexWelder
+{
+public:
+	enum { INVALID_INDEX = 0xFFFFFFFF };
+
+	VertexWelder() : m_count(0) {}
+
+	void Clear() { m_slots.clear(); m_count = 0; }
+	void Reserve(uint32 count); // so that count entries can be inserted without rehashing
+	uint32 GetCount() const { return m_count; }
+
+	// returns the first index with this hash for which equal(index) is true, or INVALID_INDEX
+	template <typename EqualFunc> uint32 Find(uint32 hash, EqualFunc equal) const
+	{
+		if (m_count == 0)
+			return INVALID_INDEX;
+		const uint32 mask = (uint32)m_slots.size() - 1;
+		for (uint32 i = hash & mask; m_slots[i].m_index != INVALID_INDEX; i = (i + 1) & mask) {
+			if (m_slots[i].m_hash == hash && equal(m_slots[i].m_index))
+				return m_slots[i].m_index;
+		}
+		return INVALID_INDEX;
+	}
+
+	void Insert(uint32 hash, uint32 index); // doesn't check for an equal entry, call Find first
+
+	// hash of the position bits only, so vertices which differ in other streams share a hash and are told apart by equal()
+	static uint32 HashPosition(Vec3V_arg pos);
+
+private:
+	class Slot
+	{
+	public:
+		uint32 m_index; // INVALID_INDEX if empty
+		uint32 m_hash;
+	};
+
+	std::vector<Slot> m_slots; // power of 2 size, at most half full
+	uint32 m_count;
+};
+
 class MeshBase
 {
 public:
@@ -206,15 +251,17 @@ public:
 	};
 
 	const Vertex GetVertex(uint32 index) const;
+	bool IsVertexEqual(uint32 index, const Vertex& v) const; // bitwise, only compares the streams the mesh has
+	bool IsVertexEqual(uint32 index0, uint32 index1) const;
 	static const Vertex Interpolate(const Vertex& v0, const Vertex& v1, ScalarV_arg t, bool normalize); // v0 + (v1 - v0)*t
-	uint32 AddVertex(const Vertex& v, bool useMap);
+	uint32 AddVertex(const Vertex& v, bool useMap); // if useMap, returns an equal vertex previously added with useMap instead
 	uint32 AddInterpolatedVertex(uint32 index0, uint32 index1, ScalarV_arg t, bool normalize, bool useMap);
 
 	void Clear()
 	{
 		m_groupNames.clear();
 		m_groupNameMap.clear();
-		m_vertexMap.clear();
+		m_vertexWelder.Clear();
 		m_verts.clear();
 		if (m_normals) { delete m_normals; m_normals = NULL; }
 		if (m_texcoords) { delete m_texcoords; m_texcoords = NULL; }
@@ -224,7 +271,7 @@ public:
 
 	std::vector<std::string> m_groupNames; // indexed by poly->m_group
 	std::map<String_mappable,int> m_groupNameMap; // index into m_groupNames
-	std::map<uint64,uint32> m_vertexMap; // maps vertex crc hash -> vertex index
+	VertexWelder m_vertexWelder; // vertices added with AddVertex(useMap), clear it if m_verts is changed any other way
 	std::vector<Vec3V> m_verts;
 	std::vector<Vec3V>* m_normals; // optional
 	std::vector<Vec2V>* m_texcoords; // optional
@@ -256,8 +303,19 @@ public:
 float CalculateMeshSurfaceArea(const TriangleMesh& mesh, bool textureSpace);
 float CalculateMeshSurfaceArea(const QuadMesh& mesh, bool textureSpace);
 
-bool LoadOBJ(const char* path, TriangleMesh& mesh, bool loadTexcoordsAndNormals = true, const Mat34V* transform = NULL);
-bool LoadOBJ(const char* path, QuadMesh& mesh, bool loadTexcoordsAndNormals = true, const Mat34V* transform = NULL);
+// the file is mapped and parsed in line-aligned chunks, one task per chunk if a scheduler is given - the result is the same either way
+// when loading into an empty mesh, the result is cached in a .meshbin next to the .obj and reused until the .obj's size or
+// write time or the load arguments change
+bool LoadOBJ(const char* path, TriangleMesh& mesh, bool loadTexcoordsAndNormals = true, const Mat34V* transform = NULL, TaskScheduler* scheduler = NULL);
+bool LoadOBJ(const char* path, QuadMesh& mesh, bool loadTexcoordsAndNormals = true, const Mat34V* transform = NULL, TaskScheduler* scheduler = NULL);
+
+// binary mesh (.meshbin) - vertex streams, polys, group names and info lines in 64-byte aligned sections, so loading is
+// just a mapped copy. key is stored in the header, LoadMeshBin fails quietly if it doesn't match (0 accepts any key)
+// LoadMeshBin replaces the contents of the mesh
+bool SaveMeshBin(const char* path, const TriangleMesh& mesh, uint64 key = 0);
+bool SaveMeshBin(const char* path, const QuadMesh& mesh, uint64 key = 0);
+bool LoadMeshBin(const char* path, TriangleMesh& mesh, uint64 key = 0);
+bool LoadMeshBin(const char* path, QuadMesh& mesh, uint64 key = 0);
 
 bool SaveOBJ(const char* path, const TriangleMesh& mesh, const char* materialLib = NULL, const std::map<std::string,std::string>* materialMap = NULL, bool saveUniqueElements = true);
 bool SaveOBJ(const char* path, const QuadMesh& mesh, const char* materialLib = NULL, const std::map<std::string,std::string>* materialMap = NULL, bool saveUniqueElements = true);
@@ -310,11 +368,60 @@ uint32 AddGeometry(QuadMesh& mesh, const QuadMesh& object, const Mat34V* objectT
 void ConstructNormals(TriangleMesh& mesh);
 void ConstructNormals(QuadMesh& mesh);
 
-void Tessellate4(TriangleMesh& mesh); // tessellates each triangle into 4 triangles
-void TessellateToEdgeLength(TriangleMesh& mesh, float edgeLength, ProgressDisplay* progress = NULL, int progressPeriod = 1);
+// undirected edges of a TriangleMesh - every pair of vertex indices used by a triangle side gets one edge index, shared by all
+// the triangles on that side regardless of their winding. built in linear time by bucketing the sides on their lower vertex
+// index, so it doesn't need a map
+class TriangleMeshEdges
+{
+public:
+	enum { INVALID_INDEX = 0xFFFFFFFF };
+
+	class Edge
+	{
+	public:
+		uint32 m_verts[2]; // m_verts[0] <= m_verts[1]
+		uint32 m_tris[2]; // the first two triangles using this edge, m_tris[1] is INVALID_INDEX on boundaries
+	};
+
+	TriangleMeshEdges() {}
+	TriangleMeshEdges(const TriangleMesh& mesh) { Build(mesh); }
+
+	void Build(const TriangleMesh& mesh); // must be rebuilt if the mesh changes
+
+	inline uint32 GetEdgeCount() const { return (uint32)m_edges.size(); }
+	inline const Edge& GetEdge(uint32 edgeIndex) const { return m_edges[edgeIndex]; }
+	inline uint32 GetEdgeIndex(uint32 triIndex, unsigned side) const { return m_triEdges[triIndex*3 + side]; } // side i goes from vertex i to vertex (i + 1)%3
+	uint32 GetAdjacentTriangle(uint32 triIndex, unsigned side) const; // INVALID_INDEX on boundaries
+	uint32 FindEdge(uint32 index0, uint32 index1) const; // INVALID_INDEX if no triangle has this side
+
+	std::vector<Edge> m_edges; // sorted by m_verts[0], then m_verts[1]
+	std::vector<uint32> m_triEdges; // 3 per triangle
+	std::vector<uint32> m_vertEdgeStart; // edges whose lower vertex is v are [m_vertEdgeStart[v],m_vertEdgeStart[v + 1])
+};
 
-void WeldPositions(TriangleMesh& mesh, float tolerance);
-void WeldPositions(QuadMesh& mesh, float tolerance);
+void Tessellate4(TriangleMesh& mesh); // tessellates each triangle into 4 triangles, shared edges get a single midpoint vertex
+
+// bisects the longest side of each triangle until no side is longer than edgeLength - edges are bisected the same way from
+// both sides and the midpoints are shared, so there are no T-junctions. triangles are tessellated in parallel if a scheduler is
+// given, the result is the same for any number of threads
+void TessellateToEdgeLength(TriangleMesh& mesh, float edgeLength, ProgressDisplay* progress = NULL, int progressPeriod = 1, TaskScheduler* scheduler = NULL);
+
+// moves vertices onto the position of a vertex within tolerance (a 3D radius) of them, so nothing moves further than tolerance
+// and distant vertices are never chained together. if remapPolys, poly indices are redirected to the vertex whose position
+// was taken and polys which become degenerate are removed (the moved vertices are left unused, but not removed). runs in
+// parallel if a scheduler is given, the result is the same for any number of threads. returns the number of vertices moved
+uint32 WeldPositions(TriangleMesh& mesh, float tolerance, bool remapPolys = false, TaskScheduler* scheduler = NULL);
+uint32 WeldPositions(QuadMesh& mesh, float tolerance, bool remapPolys = false, TaskScheduler* scheduler = NULL);
+
+// previous implementation, kept for comparison - clusters vertices whose coordinates fall in the same 1D tolerance band on
+// every axis and moves each cluster to its center, so clusters can be larger than tolerance
+void WeldPositionsBands(TriangleMesh& mesh, float tolerance);
+void WeldPositionsBands(QuadMesh& mesh, float tolerance);
+
+// merges vertices which are bitwise equal in every stream and remaps the polys, returns the number of vertices removed
+// afterwards m_vertexWelder holds every vertex, so AddVertex(useMap) reuses any of them
+uint32 WeldVertices(TriangleMesh& mesh);
+uint32 WeldVertices(QuadMesh& mesh);
 
 void ConvertQuadMeshToTriangleMesh(TriangleMesh& mesh, const QuadMesh& quadMesh);
 
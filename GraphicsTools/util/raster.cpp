@@ -10,7 +10,7 @@ TODO
 - parameter interpolation (V4's)
 - scissor clipping
 - antialiasing? (possible to do perfect antialiasing if guaranteed uniform coverage)
-- homogeneous coords, viewport clipping, z-buffer
+- homogeneous coords, viewport clipping, z-buffer (RasterizeDepth handles these, but only for depth)
 - SSE / vector optimize
 NOTE
 - floating-point texture coordinates (T) and positions (P) are pixel CORNERS, i.e. [0.5,0.5] is the center of the topleft pixel
@@ -22,6 +22,7 @@ NOTE
 */
 
 #include "raster.h"
+#include "taskscheduler.h"
 
 namespace raster {
 
@@ -451,4 +452,143 @@ void Rasterize(Vec4V* image, int w, int h, const Vert& v0, const Vert& v1, const
 	}
 }
 
+class DepthTri
+{
+public:
+	// with p0,p1,p2 relative to the origin, the ray along dir hits the plane of the triangle at t = det/(e0 + e1 + e2), where
+	// ek = dot(dir,cross(p[k+1],p[k+2])) and det = dot(p0,cross(p1,p2)), and the hit is inside the triangle (and in front of the
+	// origin) if every ek has the same sign as det. dir is linear in [i,j] and so are the ek, without dividing by depth
+	bool Setup(const Triangle3V& triangle, Vec3V_arg origin, Vec3V_arg dir00, Vec3V_arg dirStepX, Vec3V_arg dirStepY, const Vec3V invDir[3], unsigned w, unsigned h, bool twosided)
+	{
+		const Vec3V p[3] = {triangle.m_positions[0] - origin, triangle.m_positions[1] - origin, triangle.m_positions[2] - origin};
+		const Vec3V n[3] = {Cross(p[1], p[2]), Cross(p[2], p[0]), Cross(p[0], p[1])};
+		const float det = Dot(p[0], n[0]).f();
+		if (twosided ? (det == 0.0f) : (det >= 0.0f)) // edge-on or back-facing, front faces have det < 0 as in Triangle3V::IntersectsRay
+			return false;
+		const float sign = det < 0.0f ? -1.0f : 1.0f; // negating is exact, so triangles sharing an edge get exactly opposite edge functions and no cracks
+		for (unsigned k = 0; k < 3; k++) {
+			m_edge00[k] = sign*Dot(n[k], dir00).f();
+			m_edgeStepX[k] = sign*Dot(n[k], dirStepX).f();
+			m_edgeStepY[k] = sign*Dot(n[k], dirStepY).f();
+		}
+		m_det = sign*det;
+
+		// pixel bounds of the projected vertices - if any vertex is behind the origin the projection wraps around, so the
+		// triangle might cover anything on screen and the edge functions have to do all the work
+		float xmin = +FLT_MAX, ymin = +FLT_MAX;
+		float xmax = -FLT_MAX, ymax = -FLT_MAX;
+		unsigned numInFront = 0;
+		for (unsigned k = 0; k < 3; k++) {
+			const float t = Dot(invDir[0], p[k]).f();
+			if (t > 0.0f) {
+				const float x = Dot(invDir[1], p[k]).f()/t;
+				const float y = Dot(invDir[2], p[k]).f()/t;
+				xmin = Min(x, xmin), xmax = Max(x, xmax);
+				ymin = Min(y, ymin), ymax = Max(y, ymax);
+				numInFront++;
+			}
+		}
+		if (numInFront == 0)
+			return false;
+		else if (numInFront < 3) {
+			xmin = ymin = 0.0f;
+			xmax = (float)(w - 1);
+			ymax = (float)(h - 1);
+		}
+		if (xmin > (float)(w - 1) || ymin > (float)(h - 1) || xmax < 0.0f || ymax < 0.0f)
+			return false;
+		m_x0 = (unsigned)ceilf(Max(xmin, 0.0f));
+		m_y0 = (unsigned)ceilf(Max(ymin, 0.0f));
+		m_x1 = (unsigned)floorf(Min(xmax, (float)(w - 1)));
+		m_y1 = (unsigned)floorf(Min(ymax, (float)(h - 1)));
+		return m_x0 <= m_x1 && m_y0 <= m_y1;
+	}
+
+	// tile bounds are inclusive, x0 and x1 + 1 must be multiples of 4
+	void RasterizeTile(float* zbuf, unsigned w, unsigned x0, unsigned y0, unsigned x1, unsigned y1) const
+	{
+		x0 = Max(x0, m_x0 & ~3U);
+		y0 = Max(y0, m_y0);
+		x1 = Min(x1, m_x1);
+		y1 = Min(y1, m_y1);
+		const Vec4V offsetX(0.0f, 1.0f, 2.0f, 3.0f);
+		const Vec4V det(m_det);
+		for (unsigned j = y0; j <= y1; j++) {
+			const float edgeRow0 = m_edge00[0] + m_edgeStepY[0]*(float)j;
+			const float edgeRow1 = m_edge00[1] + m_edgeStepY[1]*(float)j;
+			const float edgeRow2 = m_edge00[2] + m_edgeStepY[2]*(float)j;
+			float* zrow = zbuf + j*w;
+			for (unsigned i = x0; i <= x1; i += 4) {
+				const Vec4V x = Vec4V((float)i) + offsetX;
+				const Vec4V e0 = Vec4V(edgeRow0) + Vec4V(m_edgeStepX[0])*x;
+				const Vec4V e1 = Vec4V(edgeRow1) + Vec4V(m_edgeStepX[1])*x;
+				const Vec4V e2 = Vec4V(edgeRow2) + Vec4V(m_edgeStepX[2])*x;
+				const Vec4V::BoolV inside = Min(e0, e1, e2) >= Vec4V(V_ZERO);
+				if (Any(inside)) {
+					Vec4V* dst = reinterpret_cast<Vec4V*>(zrow + i);
+					const Vec4V z = Vec4V::LoadUnaligned(dst);
+					Select(z, Min(det/(e0 + e1 + e2), z), inside).StoreUnaligned(dst);
+				}
+			}
+		}
+	}
+
+	float m_edge00[3]; // edge functions at pixel [0,0], scaled so they're all >= 0 inside
+	float m_edgeStepX[3];
+	float m_edgeStepY[3];
+	float m_det; // > 0, depth is m_det/(e0 + e1 + e2)
+	unsigned m_x0, m_y0, m_x1, m_y1; // inclusive pixel bounds, clipped to the screen
+};
+
+void RasterizeDepth(float* zbuf, unsigned w, unsigned h, const Triangle3V* triangles, size_t numTriangles, Vec3V_arg origin, Vec3V_arg dir00, Vec3V_arg dirStepX, Vec3V_arg dirStepY, bool twosided, TaskScheduler* scheduler)
+{
+	ForceAssert(w%4 == 0);
+	const unsigned tileSize = RASTER_DEPTH_TILE_SIZE;
+	const unsigned numTilesX = (w + tileSize - 1)/tileSize;
+	const unsigned numTilesY = (h + tileSize - 1)/tileSize;
+	const unsigned numTiles = numTilesX*numTilesY;
+	const unsigned numThreads = scheduler ? scheduler->GetNumThreads() : 1;
+
+	// rows of the inverse of [dir00 dirStepX dirStepY], which takes a position relative to the origin to [t, t*i, t*j]
+	const Vec3V invDir0 = Cross(dirStepX, dirStepY);
+	const float invDet = 1.0f/Dot(dir00, invDir0).f();
+	const Vec3V invDir[3] = {invDir0*invDet, Cross(dirStepY, dir00)*invDet, Cross(dir00, dirStepX)*invDet};
+
+	// each thread bins the triangles it sets up into its own lists, so binning needs no locks and a tile's triangles are
+	// the concatenation of every thread's list for that tile (order doesn't matter, the depth test is a min)
+	std::vector<DepthTri> tris(numTriangles);
+	std::vector<std::vector<uint32>> bins(numThreads*numTiles);
+	const auto SetupTriangles = [&](unsigned begin, unsigned end, unsigned threadIndex) {
+		std::vector<uint32>* threadBins = &bins[threadIndex*numTiles];
+		for (unsigned k = begin; k < end; k++) {
+			DepthTri& tri = tris[k];
+			if (tri.Setup(triangles[k], origin, dir00, dirStepX, dirStepY, invDir, w, h, twosided)) {
+				for (unsigned ty = tri.m_y0/tileSize; ty <= tri.m_y1/tileSize; ty++)
+					for (unsigned tx = tri.m_x0/tileSize; tx <= tri.m_x1/tileSize; tx++)
+						threadBins[tx + ty*numTilesX].push_back(k);
+			}
+		}
+	};
+	const auto RasterizeTiles = [&](unsigned begin, unsigned end, unsigned threadIndex) {
+		for (unsigned tileIndex = begin; tileIndex < end; tileIndex++) {
+			const unsigned x0 = (tileIndex%numTilesX)*tileSize;
+			const unsigned y0 = (tileIndex/numTilesX)*tileSize;
+			const unsigned x1 = Min(x0 + tileSize, w) - 1;
+			const unsigned y1 = Min(y0 + tileSize, h) - 1;
+			for (unsigned thread = 0; thread < numThreads; thread++) {
+				const std::vector<uint32>& bin = bins[thread*numTiles + tileIndex];
+				for (size_t k = 0; k < bin.size(); k++)
+					tris[bin[k]].RasterizeTile(zbuf, w, x0, y0, x1, y1);
+			}
+		}
+	};
+	if (scheduler) {
+		scheduler->ParallelFor((unsigned)numTriangles, 4096, SetupTriangles);
+		scheduler->ParallelFor(numTiles, 1, RasterizeTiles); // tiles don't overlap, so they can write zbuf without synchronization
+	} else {
+		SetupTriangles(0, (unsigned)numTriangles, 0);
+		RasterizeTiles(0, numTiles, 0);
+	}
+}
+
 } // namespace raster
\ No newline at end of file
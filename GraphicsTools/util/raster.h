@@ -9,6 +9,9 @@
 
 #include "vmath/vmath_common.h"
 #include "vmath/vmath_vec4.h"
+#include "vmath/vmath_triangle.h"
+
+class TaskScheduler;
 
 #define RASTER_DEBUG (0)
 #if RASTER_DEBUG
@@ -17,6 +20,8 @@
 #define RASTER_DEBUG_ONLY(...)
 #endif
 
+#define RASTER_DEPTH_TILE_SIZE (32) // pixels, must be a multiple of 4
+
 namespace raster {
 
 class Vert
@@ -33,6 +38,13 @@ inline Vec2V_out FlipUV(Vec2V_arg uv) { return Vec2V(uv.x(), ScalarV(V_ONE) - uv
 
 void Rasterize(Vec4V* image, int w, int h, const Vert& v0, const Vert& v1, const Vert& v2, Vec4V_arg blend = Vec4V(V_ONE), bool coverage = false);
 
+// depth-only rasterizer which matches a ray traced z-buffer - unlike Rasterize, pixel [i,j] is sampled at integer coordinates
+// along the ray origin + t*(dir00 + i*dirStepX + j*dirStepY) and t is written, so it can be compared directly with the output
+// of the BVH renderers. triangles are binned to RASTER_DEPTH_TILE_SIZE tiles and the tiles are rasterized 4 pixels at a time,
+// in parallel if a scheduler is given. zbuf must be cleared by the caller and w must be a multiple of 4
+// edge functions are set up in homogeneous form, so triangles crossing the plane of the origin don't need clipping
+void RasterizeDepth(float* zbuf, unsigned w, unsigned h, const Triangle3V* triangles, size_t numTriangles, Vec3V_arg origin, Vec3V_arg dir00, Vec3V_arg dirStepX, Vec3V_arg dirStepY, bool twosided = TRIANGLE_TWOSIDED_DEFAULT, TaskScheduler* scheduler = NULL);
+
 } // namespace raster
 
 #endif // _INCLUDE_COMMON_RASTER_H_
\ No newline at end of file
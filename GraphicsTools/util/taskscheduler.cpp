@@ -0,0 +1,127 @@
+// ========================
+// common/taskscheduler.cpp
+// ========================
+
+#include "taskscheduler.h"
+
+static thread_local const TaskScheduler* s_currentScheduler = NULL;
+static thread_local unsigned s_currentThreadIndex = 0;
+
+TaskScheduler::TaskScheduler(unsigned numThreads) : m_numQueued(0), m_quit(false)
+{
+	m_numThreads = numThreads ? numThreads : GetHardwareThreadCount();
+	m_queues = new Queue[m_numThreads];
+	m_workers.reserve(m_numThreads - 1);
+	for (unsigned i = 1; i < m_numThreads; i++)
+		m_workers.push_back(std::thread(&TaskScheduler::WorkerThread, this, i));
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex);
+		m_quit = true;
+	}
+	m_wakeCondition.notify_all();
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i].join();
+	delete[] m_queues;
+}
+
+unsigned TaskScheduler::GetCurrentThreadIndex() const
+{
+	return s_currentScheduler == this ? s_currentThreadIndex : 0;
+}
+
+unsigned TaskScheduler::GetHardwareThreadCount()
+{
+	return Max(1U, std::thread::hardware_concurrency());
+}
+
+void TaskScheduler::Submit(TaskGroup& group, const Task& task)
+{
+	Queue& queue = m_queues[GetCurrentThreadIndex()];
+	group.m_pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		Entry entry;
+		entry.m_task = task;
+		entry.m_group = &group;
+		m_numQueued.fetch_add(1, std::memory_order_release); // before the entry is visible, so PopOrSteal's decrement can't wrap the count
+		queue.m_entries.push_back(entry);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_wakeMutex); // avoids a lost wakeup between a sleeping thread's check and its wait
+	}
+	m_wakeCondition.notify_one();
+}
+
+void TaskScheduler::Wait(TaskGroup& group)
+{
+	const unsigned threadIndex = GetCurrentThreadIndex();
+	while (!group.IsDone()) {
+		Entry entry;
+		if (PopOrSteal(threadIndex, entry)) {
+			Execute(entry, threadIndex);
+			continue;
+		}
+		// remaining tasks are in flight on other threads - sleep until one of them finishes the group or queues more work
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wakeCondition.wait(lock, [this, &group]() { return group.IsDone() || m_numQueued.load(std::memory_order_acquire) > 0; });
+	}
+}
+
+bool TaskScheduler::PopOrSteal(unsigned threadIndex, Entry& entry)
+{
+	if (m_numQueued.load(std::memory_order_acquire) == 0)
+		return false;
+	{ // newest task from our own queue first (depth-first, cache warm)
+		Queue& queue = m_queues[threadIndex];
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		if (!queue.m_entries.empty()) {
+			entry = queue.m_entries.back();
+			queue.m_entries.pop_back();
+			m_numQueued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	for (unsigned i = 1; i < m_numThreads; i++) { // oldest task from someone else's queue (tends to be the biggest chunk)
+		Queue& queue = m_queues[(threadIndex + i)%m_numThreads];
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		if (!queue.m_entries.empty()) {
+			entry = queue.m_entries.front();
+			queue.m_entries.pop_front();
+			m_numQueued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void TaskScheduler::Execute(Entry& entry, unsigned threadIndex)
+{
+	entry.m_task(threadIndex);
+	if (entry.m_group->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) { // last task in the group, wake anyone blocked in Wait()
+		{
+			std::lock_guard<std::mutex> lock(m_wakeMutex);
+		}
+		m_wakeCondition.notify_all();
+	}
+}
+
+void TaskScheduler::WorkerThread(unsigned threadIndex)
+{
+	s_currentScheduler = this;
+	s_currentThreadIndex = threadIndex;
+	while (true) {
+		Entry entry;
+		if (PopOrSteal(threadIndex, entry)) {
+			Execute(entry, threadIndex);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_wakeMutex);
+		m_wakeCondition.wait(lock, [this]() { return m_quit || m_numQueued.load(std::memory_order_acquire) > 0; });
+		if (m_quit)
+			break;
+	}
+}
\ No newline at end of file
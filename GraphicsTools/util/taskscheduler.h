@@ -0,0 +1,88 @@
+// ======================
+// common/taskscheduler.h
+// ======================
+
+#ifndef _INCLUDE_COMMON_TASKSCHEDULER_H_
+#define _INCLUDE_COMMON_TASKSCHEDULER_H_
+
+#include "common/common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// portable work-stealing task scheduler built on std::thread
+// each thread owns a deque - tasks are pushed and popped at the back by the owner, idle threads steal from the front
+// the thread which calls Wait() participates as thread 0, so a scheduler with N threads spawns N-1 workers
+// NOTE -- only one external thread should drive a given scheduler, since it always maps to thread index 0
+class TaskScheduler
+{
+public:
+	typedef std::function<void(unsigned threadIndex)> Task;
+
+	class TaskGroup
+	{
+	public:
+		TaskGroup() : m_pending(0) {}
+		inline bool IsDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class TaskScheduler;
+		std::atomic<uint32> m_pending;
+	};
+
+	TaskScheduler(unsigned numThreads = 0); // 0 means one thread per hardware thread
+	~TaskScheduler();
+
+	inline unsigned GetNumThreads() const { return m_numThreads; }
+	unsigned GetCurrentThreadIndex() const; // 0 for threads not owned by this scheduler
+	static unsigned GetHardwareThreadCount();
+
+	void Submit(TaskGroup& group, const Task& task);
+	void Wait(TaskGroup& group); // executes (or steals) tasks until the group is done, blocks while there's nothing to take
+
+	// calls func(begin,end,threadIndex) over [0,count) in chunks of grainSize, returns when all chunks are done
+	template <typename Func> void ParallelFor(unsigned count, unsigned grainSize, const Func& func)
+	{
+		TaskGroup group;
+		grainSize = Max(1U, grainSize);
+		for (unsigned begin = 0; begin < count; begin += grainSize) {
+			const unsigned end = Min(begin + grainSize, count);
+			Submit(group, [&func,begin,end](unsigned threadIndex) { func(begin, end, threadIndex); });
+		}
+		Wait(group);
+	}
+
+private:
+	class Entry
+	{
+	public:
+		Task m_task;
+		TaskGroup* m_group;
+	};
+
+	class Queue
+	{
+	public:
+		std::mutex m_mutex;
+		std::deque<Entry> m_entries;
+		char m_pad[64]; // keep neighbouring queues off the same cache line
+	};
+
+	bool PopOrSteal(unsigned threadIndex, Entry& entry);
+	void Execute(Entry& entry, unsigned threadIndex);
+	void WorkerThread(unsigned threadIndex);
+
+	unsigned m_numThreads;
+	Queue* m_queues;
+	std::vector<std::thread> m_workers;
+	std::atomic<uint32> m_numQueued;
+	std::mutex m_wakeMutex;
+	std::condition_variable m_wakeCondition;
+	bool m_quit;
+};
+
+#endif // _INCLUDE_COMMON_TASKSCHEDULER_H_
\ No newline at end of file
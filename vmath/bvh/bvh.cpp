@@ -3,8 +3,10 @@
 // ==================
 
 #include "bvh.h"
+#include "GraphicsTools/util/memory.h"
 #include "GraphicsTools/util/mesh.h"
 #include "GraphicsTools/util/stringutil.h"
+#include "GraphicsTools/util/taskscheduler.h"
 #include "vmath/vmath_triangle.h"
 
 #if defined(_EMBREE)
@@ -118,7 +120,8 @@ static void EmbreeSaveBVH4Internal(FILE* f,embree::BVH4::NodeRef ref,BVHCounts&
 		uint32 count = 0;
 		for (size_t i = 0; i < num; i++)
 			count += (uint32)tris[i].size();
-		fwrite(&count,sizeof(count),1,f);
+		const uint32 countAndFlags = count | BVH_FILE_LEAF_HAS_PRIM_IDS;
+		fwrite(&countAndFlags,sizeof(countAndFlags),1,f);
 		counts.m_leafCount++;
 		counts.m_triCount += count;
 		for (size_t i = 0; i < num; i++) {
@@ -132,6 +135,12 @@ static void EmbreeSaveBVH4Internal(FILE* f,embree::BVH4::NodeRef ref,BVHCounts&
 				fwrite(&v2,3*sizeof(float),1,f);
 			}
 		}
+		for (size_t i = 0; i < num; i++) {
+			for (size_t j = 0; j < tris[i].size(); j++) {
+				const uint32 primID = tris[i].primID(j);
+				fwrite(&primID,sizeof(primID),1,f);
+			}
+		}
 	}
 }
 
@@ -168,6 +177,97 @@ bool EmbreeSaveBVH4(const char* path,RTCScene scene,const geomesh::TriangleMesh*
 }
 #endif // defined(_EMBREE)
 
+#if BVH_COUNTERS
+thread_local BVHCounters* BVHCounters::s_current = NULL;
+
+BVHCounters& BVHCounters::operator +=(const BVHCounters& counters)
+{
+	m_numRays += counters.m_numRays;
+	m_numTraversals += counters.m_numTraversals;
+	m_nodesVisited += counters.m_nodesVisited;
+	m_boxesTested += counters.m_boxesTested;
+	m_leavesVisited += counters.m_leavesVisited;
+	m_trianglesTested += counters.m_trianglesTested;
+	m_activeLanes += counters.m_activeLanes;
+	m_laneSlots += counters.m_laneSlots;
+	m_maxStackDepth = Max(counters.m_maxStackDepth,m_maxStackDepth);
+	return *this;
+}
+
+// name and value of each exported field, shared by Report, SaveJSON and AppendCSV so they can't disagree
+static unsigned GetCounterFields(const BVHCounters& counters,const char* names[],double values[])
+{
+	const double numRays = (double)Max<uint64>(counters.m_numRays,1);
+	unsigned count = 0;
+	auto Add = [&](const char* name,double value) { names[count] = name; values[count++] = value; };
+	Add("rays",(double)counters.m_numRays);
+	Add("traversals",(double)counters.m_numTraversals);
+	Add("nodes",(double)counters.m_nodesVisited);
+	Add("boxes",(double)counters.m_boxesTested);
+	Add("leaves",(double)counters.m_leavesVisited);
+	Add("triangles",(double)counters.m_trianglesTested);
+	Add("active_lanes",(double)counters.m_activeLanes);
+	Add("lane_slots",(double)counters.m_laneSlots);
+	Add("max_stack_depth",(double)counters.m_maxStackDepth);
+	Add("nodes_per_ray",(double)counters.m_nodesVisited/numRays);
+	Add("boxes_per_ray",(double)counters.m_boxesTested/numRays);
+	Add("leaves_per_ray",(double)counters.m_leavesVisited/numRays);
+	Add("triangles_per_ray",(double)counters.m_trianglesTested/numRays);
+	Add("lane_utilization",counters.m_laneSlots ? (double)counters.m_activeLanes/(double)counters.m_laneSlots : 1.0);
+	return count;
+}
+
+void BVHCounters::Report(const char* label) const
+{
+	const char* names[16];
+	double values[countof(names)];
+	const unsigned count = GetCounterFields(*this,names,values);
+	printf("%s:",label);
+	for (unsigned i = 0; i < count; i++)
+		printf("%s%s=%.6g",i ? "," : " ",names[i],values[i]);
+	printf("\n");
+}
+
+bool BVHCounters::SaveJSON(const char* path,const char* label) const
+{
+	FILE* f = fopen(path,"w");
+	if (f == NULL)
+		return false;
+	const char* names[16];
+	double values[countof(names)];
+	const unsigned count = GetCounterFields(*this,names,values);
+	fprintf(f,"{\n\t\"label\": \"%s\"",label); // label is written as is, don't put quotes in it
+	for (unsigned i = 0; i < count; i++)
+		fprintf(f,",\n\t\"%s\": %.17g",names[i],values[i]);
+	fprintf(f,"\n}\n");
+	fclose(f);
+	return true;
+}
+
+bool BVHCounters::AppendCSV(const char* path,const char* label) const
+{
+	FILE* f = fopen(path,"a");
+	if (f == NULL)
+		return false;
+	const char* names[16];
+	double values[countof(names)];
+	const unsigned count = GetCounterFields(*this,names,values);
+	fseek(f,0,SEEK_END);
+	if (ftell(f) == 0) {
+		fprintf(f,"label");
+		for (unsigned i = 0; i < count; i++)
+			fprintf(f,",%s",names[i]);
+		fprintf(f,"\n");
+	}
+	fprintf(f,"\"%s\"",label);
+	for (unsigned i = 0; i < count; i++)
+		fprintf(f,",%.17g",values[i]);
+	fprintf(f,"\n");
+	fclose(f);
+	return true;
+}
+#endif // BVH_COUNTERS
+
 #if BVH_STATS
 //#if !defined(VISUAL_STUDIO_VERSION) || VISUAL_STUDIO_VERSION == 2017 // what?
 //#define __popcnt16(x) (uint16)_popcnt32((int)x)
@@ -225,18 +325,30 @@ static Vec3V_out FlipYZ(Vec3V_arg v,bool flipYZ)
 		return v;
 }
 
-void BVH4Node::Leaf::SetPrimitives(const Triangle3V* triangles,uint32 count)
+size_t BVH4Node::Leaf::GetSizeForCount(uint32 count)
+{
+	const uint32 countSOA = (count + BVH_LEAF_NUM_TRIANGLES_SOA - 1)/BVH_LEAF_NUM_TRIANGLES_SOA;
+	return HEADER_SIZE + countSOA*sizeof(TriangleType) BVH_LEAF_PRIM_IDS_ONLY(+ count*sizeof(uint32));
+}
+
+BVH4Node::Leaf* BVH4Node::Leaf::Create(const Triangle3V* triangles,uint32 count,void* mem,const uint32* primIDs)
 {
+	StaticAssert(sizeof(Leaf) <= HEADER_SIZE);
+	if (mem == NULL)
+		mem = AlignedAlloc<uint8>(GetSizeForCount(count),HEADER_SIZE);
+	Leaf* leaf = reinterpret_cast<Leaf*>(mem);
 	const uint32 countSOA = (count + BVH_LEAF_NUM_TRIANGLES_SOA - 1)/BVH_LEAF_NUM_TRIANGLES_SOA;
 	const uint32 countRoundedUp = countSOA*BVH_LEAF_NUM_TRIANGLES_SOA;
-	resize(countSOA);
+	leaf->m_size = countSOA;
+	leaf->m_count = count;
+	BVH_STATS_ONLY(leaf->m_depth = 0);
 	if (count == 0)
-		return; // what??
+		return leaf; // what??
+	TriangleType* dst = leaf->data();
 #if BVH_LEAF_NUM_TRIANGLES_SOA == 1
 	for (uint32 i = 0; i < count; i++)
-		operator[](i) = triangles[i];
+		dst[i] = triangles[i];
 #else
-	m_count = count;
 	std::vector<Triangle3V> trianglesPadded;
 	if (countRoundedUp > count) {
 		trianglesPadded.resize(countRoundedUp);
@@ -246,18 +358,29 @@ void BVH4Node::Leaf::SetPrimitives(const Triangle3V* triangles,uint32 count)
 		triangles = trianglesPadded.data();
 	}
 	for (uint32 i = 0; i < countSOA; i++)
-		operator[](i) = TriangleType(triangles + i*BVH_LEAF_NUM_TRIANGLES_SOA);
+		dst[i] = TriangleType(triangles + i*BVH_LEAF_NUM_TRIANGLES_SOA);
 #endif
+#if BVH_LEAF_PRIM_IDS
+	uint32* dstPrimIDs = leaf->GetPrimIDs();
+	for (uint32 i = 0; i < count; i++)
+		dstPrimIDs[i] = primIDs ? primIDs[i] : BVH_INVALID_PRIM_ID;
+#endif // BVH_LEAF_PRIM_IDS
+	return leaf;
+}
+
+void BVH4Node::Leaf::Release()
+{
+	AlignedFree(this);
 }
 
 BVH4Node::Leaf* BVH4Node::Leaf::LoadInternal(FILE* f,const Mat34V* transform BVH_STATS_ONLY(,uint32 depth))
 {
 	if (transform == NULL)
 		transform = &Mat34V::StaticIdentity();
-	Leaf* leaf = new BVH4Node::Leaf();
-	BVH_STATS_ONLY(leaf->m_depth = depth);
 	uint32 count;
 	fread(&count,sizeof(count),1,f);
+	const bool hasPrimIDs = (count & BVH_FILE_LEAF_HAS_PRIM_IDS) != 0;
+	count &= ~BVH_FILE_LEAF_HAS_PRIM_IDS;
 	Triangle3V* triangles = new Triangle3V[count];
 	for (uint32 i = 0; i < count; i++) {
 		const Vec3V v0 = transform->Transform(ReadFile<Vec3V,3*sizeof(float)>(f));
@@ -265,8 +388,15 @@ BVH4Node::Leaf* BVH4Node::Leaf::LoadInternal(FILE* f,const Mat34V* transform BVH
 		const Vec3V v2 = transform->Transform(ReadFile<Vec3V,3*sizeof(float)>(f));
 		triangles[i] = Triangle3V(v0,v1,v2);
 	}
-	leaf->SetPrimitives(triangles,count);
+	uint32* primIDs = NULL;
+	if (hasPrimIDs) {
+		primIDs = new uint32[count];
+		fread(primIDs,sizeof(uint32),count,f);
+	}
+	Leaf* leaf = Create(triangles,count,NULL,primIDs);
+	BVH_STATS_ONLY(leaf->m_depth = depth);
 	delete[] triangles;
+	delete[] primIDs;
 	return leaf;
 }
 
@@ -287,7 +417,7 @@ void BVH4Node::Leaf::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA4_arg origin,Vec3V_
 	for (size_t i = 0; i < size(); i++) {
 		BVH_STATS_ONLY(stats.TestAgainstTriangle(mask,m_depth));
 		Vec4V t_;
-		if (operator[](i).IntersectsRay(origin,dir,t_,-1)) // TODO -- only process active rays
+		if (operator[](i).IntersectsRay(origin,dir,t_,Vec4V::BoolV::MaskAll)) // TODO -- only process active rays
 			t = Min(t_,t);
 	}
 }
@@ -299,12 +429,102 @@ void BVH4Node::Leaf::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA8_arg origin,Vec3V_
 	for (size_t i = 0; i < size(); i++) {
 		BVH_STATS_ONLY(stats.TestAgainstTriangle(mask,m_depth));
 		Vec8V t_;
-		if (operator[](i).IntersectsRay(origin,dir,t_,-1)) // TODO -- only process active rays
+		if (operator[](i).IntersectsRay(origin,dir,t_,Vec8V::BoolV::MaskAll)) // TODO -- only process active rays
 			t = Min(t_,t);
 	}
 }
 #endif // HAS_VEC8V
 
+bool BVH4Node::Leaf::IntersectsRayClosest(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,uint32& triIndex) const
+{
+	bool improved = false;
+	for (unsigned i = 0; i < size(); i++) {
+		ScalarV t_;
+		if (operator[](i).IntersectsRay(origin,dir,t_) && t_ < t) {
+		#if BVH_LEAF_NUM_TRIANGLES_SOA > 1
+			// the SOA test only returns the closest t, find which triangle it was (only happens when the hit improves)
+			const unsigned first = i*BVH_LEAF_NUM_TRIANGLES_SOA;
+			const unsigned last = Min(first + BVH_LEAF_NUM_TRIANGLES_SOA,GetTriCount());
+			for (unsigned j = first; j < last; j++) {
+				if (GetTriangle(j).IntersectsRay(origin,dir,t_) && t_ < t) {
+					t = t_;
+					triIndex = j;
+					improved = true;
+				}
+			}
+		#else
+			t = t_;
+			triIndex = i;
+			improved = true;
+		#endif
+		}
+	}
+	return improved;
+}
+
+bool BVH4Node::Leaf::Occluded(Vec3V_arg origin,Vec3V_arg dir,ScalarV_arg tmax) const
+{
+	for (unsigned i = 0; i < size(); i++) {
+		ScalarV t_;
+		if (operator[](i).IntersectsRay(origin,dir,t_) && t_ < tmax)
+			return true;
+	}
+	return false;
+}
+
+const Box3V BVH4Node::Leaf::Refit(const geomesh::TriangleMesh& mesh,const Mat34V* transform)
+{
+	Box3V bounds = Box3V::Invalid();
+	TriangleType* dst = data();
+	for (unsigned i = 0; i < size(); i++) {
+		Triangle3V triangles[BVH_LEAF_NUM_TRIANGLES_SOA];
+		for (unsigned j = 0; j < BVH_LEAF_NUM_TRIANGLES_SOA; j++) {
+			const uint32 primID = GetPrimID(Min(i*BVH_LEAF_NUM_TRIANGLES_SOA + j,GetTriCount() - 1)); // pad by repeating the last triangle, like Create
+			ForceAssertf(primID < mesh.m_polys.size(),"primID=%u",primID); // leaves loaded without primitive IDs can't be refit
+			for (unsigned k = 0; k < 3; k++) {
+				Vec3V p = mesh.m_verts[mesh.m_polys[primID].m_indices[k]];
+				if (transform)
+					p = transform->Transform(p);
+				triangles[j].m_positions[k] = p;
+			}
+			bounds.Grow(triangles[j].GetBounds());
+		}
+	#if BVH_LEAF_NUM_TRIANGLES_SOA == 1
+		dst[i] = triangles[0];
+	#else
+		dst[i] = TriangleType(triangles);
+	#endif
+	}
+	return bounds;
+}
+
+bool BVH4Node::Leaf::GetDistanceSqrToPoint(Vec3V_arg pos,ScalarV& distSqr,uint32& triIndex) const
+{
+	bool improved = false;
+	for (unsigned i = 0; i < size(); i++) {
+	#if BVH_LEAF_NUM_TRIANGLES_SOA > 1
+		typedef TriangleType::T::ComponentType ComponentType;
+		const ComponentType d = operator[](i).GetDistanceSqrToPoint(pos);
+		uint32 mask = (d < ComponentType(distSqr.f())).GetMask(); // padding lanes repeat the last triangle, so they never improve on it
+		for (unsigned lane = 0; mask; mask >>= 1, lane++) {
+			if ((mask & 1) && d[lane] < distSqr.f()) {
+				distSqr = ScalarV(d[lane]);
+				triIndex = i*BVH_LEAF_NUM_TRIANGLES_SOA + lane;
+				improved = true;
+			}
+		}
+	#else
+		const ScalarV d = operator[](i).GetDistanceSqrToPoint(pos);
+		if (d < distSqr) {
+			distSqr = d;
+			triIndex = i;
+			improved = true;
+		}
+	#endif
+	}
+	return improved;
+}
+
 void BVH4Node::Leaf::IntersectsRaySign(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,ScalarV& sign) const
 {
 	for (unsigned i = 0; i < GetTriCount(); i++) {
@@ -333,7 +553,7 @@ void BVH4Node::Leaf::IntersectsRaySignAccum(Vec3V_arg origin,Vec3V_arg dir,Scala
 	}
 }
 
-BVH4Node* BVH4Node::Load(const char* path,const Mat34V* transform)
+BVH4Node* BVH4Node::Load(const char* path,const Mat34V* transform,Layout layout)
 {
 	BVH4Node* root = NULL;
 	char path2[512];
@@ -350,6 +570,9 @@ BVH4Node* BVH4Node::Load(const char* path,const Mat34V* transform)
 		ForceAssert(counts2.m_leafCount == counts.m_leafCount);
 		ForceAssertf(counts2.m_triCount == counts.m_triCount,"tri count doesn't match! expected %u, got %u",counts.m_triCount,counts2.m_triCount);
 	#endif
+		BVH4Node* nodes = root;
+		root = Linearize(nodes,layout);
+		nodes->ReleaseNodes();
 	} else
 		fprintf(stderr,"failed to load BVH %s!\n",path2);
 	return root;
@@ -388,20 +611,299 @@ BVH4Node* BVH4Node::LoadInternal(FILE* f,const Mat34V* transform BVH_STATS_ONLY(
 		else
 			DEBUG_ASSERT(false);
 	}
+#if BVH_CHILD_ORDER
+	node->ComputeChildOrder(); // needs the children, the split tags are stored in them
+#endif // BVH_CHILD_ORDER
 	return node;
 }
 
+void BVHCommon::ResolveHit(const Leaf* leaf,uint32 triIndex,Vec3V_arg origin,Vec3V_arg dir,BVHHit& hit,uint32 fields)
+{
+	if (leaf == NULL) {
+		if (fields & BVH_HIT_PRIM_ID)
+			hit.m_primID = BVH_INVALID_PRIM_ID;
+		return;
+	}
+	if (fields & BVH_HIT_PRIM_ID)
+		hit.m_primID = leaf->GetPrimID(triIndex);
+	if (fields & (BVH_HIT_UV|BVH_HIT_NORMAL)) {
+		const Triangle3V triangle = leaf->GetTriangle(triIndex);
+		if (fields & BVH_HIT_UV) {
+			float t,u,v;
+			if (triangle.IntersectsRay(origin,dir,t,u,v)) {
+				hit.m_u = u;
+				hit.m_v = v;
+			} else { // traversal found this triangle, so this only happens for hits right on an edge
+				hit.m_u = 0.0f;
+				hit.m_v = 0.0f;
+			}
+		}
+		if (fields & BVH_HIT_NORMAL)
+			hit.m_normal = triangle.GetNormal();
+	}
+}
+
+void BVH4Node::TraceHit(Vec3V_arg origin,Vec3V_arg dir,BVHHit& hit,uint32 fields) const
+{
+	const Vec3V invdir = Recip(dir);
+	const unsigned octant = GetDirectionOctant(dir);
+	BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+	BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+	ScalarV t(hit.m_t);
+	const Leaf* hitLeaf = NULL;
+	uint32 hitIndex = 0;
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(this)};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+			if (leaf->IntersectsRayClosest(origin,dir,t,hitIndex))
+				hitLeaf = leaf;
+		} else {
+			const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+		#if BVH_SOA_BOUNDS
+			uint32 childMask = node->m_bounds.IntersectsRay(origin,invdir,t); // intersect all child bounds at once
+		#else
+			uint32 childMask = 0;
+			for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++)
+				childMask |= node->GetChildBounds(i).IntersectsRay(origin,invdir,t) ? (1 << i) : 0;
+		#endif
+			const unsigned order = node->GetChildOrder(octant);
+			for (unsigned k = 0; childMask && k < N; k++) {
+				const unsigned i = GetChildPushIndex(order,k);
+				if ((childMask & (1 << i)) && node->IsChildNonEmpty(i)) {
+					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+					stack[stackIndex++] = node->GetChildRef(i);
+					childMask &= ~(1 << i);
+				}
+			}
+		}
+	}
+	hit.m_t = t.f();
+	ResolveHit(hitLeaf,hitIndex,origin,dir,hit,fields);
+}
+
+bool BVH4Node::Occluded(Vec3V_arg origin,Vec3V_arg dir,float tmax_) const
+{
+	const Vec3V invdir = Recip(dir);
+	const ScalarV tmax(tmax_);
+	BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+	BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(this)};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+			if (leaf->Occluded(origin,dir,tmax))
+				return true;
+		} else {
+			const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+		#if BVH_SOA_BOUNDS
+			uint32 childMask = node->m_bounds.IntersectsRay(origin,invdir,tmax); // intersect all child bounds at once
+		#else
+			uint32 childMask = 0;
+			for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++)
+				childMask |= node->GetChildBounds(i).IntersectsRay(origin,invdir,tmax) ? (1 << i) : 0;
+		#endif
+			for (unsigned i = 0; childMask && node->IsChildNonEmpty(i); i++, childMask >>= 1) {
+				if (childMask & 1) {
+					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+					stack[stackIndex++] = node->GetChildRef(i);
+				}
+			}
+		}
+	}
+	return false;
+}
+
+bool BVH4Node::FindClosestPoint(Vec3V_arg pos,BVHClosestPoint& result,float maxDistance) const
+{
+	ScalarV distSqr(maxDistance < sqrtf(FLT_MAX) ? maxDistance*maxDistance : FLT_MAX);
+	const Leaf* closestLeaf = NULL;
+	uint32 closestIndex = 0;
+	// children are pushed far-to-near so the nearest is popped first, entries further than the closest triangle found since
+	// they were pushed are skipped
+	uintptr_t stack[BVH_STACK_MAX_DEPTH*(N - 1) + 1] = {reinterpret_cast<uintptr_t>(this)};
+	float stackDistSqr[countof(stack)] = {0.0f};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		stackIndex--;
+		if (stackDistSqr[stackIndex] >= distSqr.f())
+			continue;
+		const uintptr_t ref = stack[stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+			if (leaf->GetDistanceSqrToPoint(pos,distSqr,closestIndex))
+				closestLeaf = leaf;
+		} else {
+			const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+		#if BVH_SOA_BOUNDS
+			const Vec4V boundsDistSqr = node->m_bounds.GetDistanceSqrToPoint(pos); // distance to all child bounds at once
+		#endif
+			unsigned order[N];
+			float orderDistSqr[N];
+			unsigned count = 0;
+			for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
+			#if BVH_SOA_BOUNDS
+				const float d = boundsDistSqr[i];
+			#else
+				const float d = node->m_bounds[i].GetDistanceSqrToPoint(pos).f();
+			#endif
+				if (d < distSqr.f()) {
+					unsigned j = count++;
+					for (; j > 0 && orderDistSqr[j - 1] < d; j--) { // insertion sort, far-to-near
+						orderDistSqr[j] = orderDistSqr[j - 1];
+						order[j] = order[j - 1];
+					}
+					orderDistSqr[j] = d;
+					order[j] = i;
+				}
+			}
+			for (unsigned k = 0; k < count; k++) {
+				DEBUG_ASSERT(stackIndex < countof(stack));
+				stackDistSqr[stackIndex] = orderDistSqr[k];
+				stack[stackIndex++] = node->GetChildRef(order[k]);
+			}
+		}
+	}
+	if (closestLeaf == NULL) {
+		result.m_point = pos;
+		result.m_normal = Vec3V(V_ZERO);
+		result.m_distance = maxDistance;
+		result.m_sign = 1.0f;
+		result.m_primID = BVH_INVALID_PRIM_ID;
+		return false;
+	}
+	const Triangle3V triangle = closestLeaf->GetTriangle(closestIndex);
+	result.m_point = triangle.GetClosestPoint(pos);
+	result.m_normal = triangle.GetNormal();
+	result.m_distance = Mag(pos - result.m_point).f();
+	result.m_sign = Dot(pos - result.m_point,result.m_normal) < 0.0f ? -1.0f : 1.0f;
+	result.m_primID = closestLeaf->GetPrimID(closestIndex);
+	return true;
+}
+
 void BVH4Node::Release()
+{
+	AlignedFree(this);
+}
+
+void BVH4Node::ReleaseNodes()
 {
 	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
 		if (IsChildLeaf(i))
 			GetChildLeaf(i)->Release();
 		else
-			GetChildNode(i)->Release();
+			GetChildNode(i)->ReleaseNodes();
 	}
 	delete this;
 }
 
+template <typename NodeType> static unsigned GetTreeHeight(const NodeType* node)
+{
+	unsigned height = 0;
+	for (unsigned i = 0; i < NodeType::N && node->IsChildNonEmpty(i); i++) {
+		if (!node->IsChildLeaf(i))
+			height = Max(GetTreeHeight(node->GetChildNode(i)),height);
+	}
+	return height + 1;
+}
+
+template <typename NodeType> static void GetNodesAtDepth(const NodeType* node,unsigned depth,std::vector<const NodeType*>& nodes)
+{
+	if (depth == 0)
+		nodes.push_back(node);
+	else {
+		for (unsigned i = 0; i < NodeType::N && node->IsChildNonEmpty(i); i++) {
+			if (!node->IsChildLeaf(i))
+				GetNodesAtDepth(node->GetChildNode(i),depth - 1,nodes);
+		}
+	}
+}
+
+template <typename NodeType> static void GetNodeOrder_DepthFirst(const NodeType* node,std::vector<const NodeType*>& order)
+{
+	order.push_back(node);
+	for (unsigned i = 0; i < NodeType::N && node->IsChildNonEmpty(i); i++) {
+		if (!node->IsChildLeaf(i))
+			GetNodeOrder_DepthFirst(node->GetChildNode(i),order);
+	}
+}
+
+// van Emde Boas order - lay out the top half of the tree (by height) recursively, followed by each of the bottom subtrees
+template <typename NodeType> static void GetNodeOrder_VEB(const NodeType* node,unsigned height,std::vector<const NodeType*>& order)
+{
+	if (height <= 1)
+		order.push_back(node);
+	else {
+		const unsigned topHeight = height/2;
+		GetNodeOrder_VEB(node,topHeight,order);
+		std::vector<const NodeType*> bottom;
+		GetNodesAtDepth(node,topHeight,bottom);
+		for (size_t i = 0; i < bottom.size(); i++)
+			GetNodeOrder_VEB(bottom[i],height - topHeight,order);
+	}
+}
+
+template <typename NodeType> static NodeType* LinearizeInternal(const NodeType* root,BVHCommon::Layout layout,size_t* arenaSize)
+{
+	typedef BVHCommon::Leaf Leaf;
+	std::vector<const NodeType*> order;
+	if (layout == BVHCommon::BVH_LAYOUT_VEB)
+		GetNodeOrder_VEB(root,GetTreeHeight(root),order);
+	else
+		GetNodeOrder_DepthFirst(root,order);
+
+	// assign offsets - each node starts a cache line and is followed by its leaves
+	std::map<const void*,size_t> offsets;
+	size_t size = 0;
+	for (size_t j = 0; j < order.size(); j++) {
+		const NodeType* node = order[j];
+		size = (size + BVH_ARENA_ALIGNMENT - 1) & ~(size_t)(BVH_ARENA_ALIGNMENT - 1);
+		offsets[node] = size;
+		size += sizeof(NodeType);
+		for (unsigned i = 0; i < NodeType::N && node->IsChildNonEmpty(i); i++) {
+			if (node->IsChildLeaf(i)) {
+				const Leaf* leaf = node->GetChildLeaf(i);
+				size = (size + Leaf::HEADER_SIZE - 1) & ~(size_t)(Leaf::HEADER_SIZE - 1);
+				offsets[leaf] = size;
+				size += leaf->GetSize();
+			}
+		}
+	}
+	DEBUG_ASSERT(offsets[root] == 0);
+
+	uint8* arena = AlignedAlloc<uint8>(size,BVH_ARENA_ALIGNMENT);
+	for (size_t j = 0; j < order.size(); j++) {
+		const NodeType* node = order[j];
+		NodeType* dst = reinterpret_cast<NodeType*>(arena + offsets[node]);
+		memcpy(dst,node,sizeof(NodeType));
+		for (unsigned i = 0; i < NodeType::N && node->IsChildNonEmpty(i); i++) {
+			const uintptr_t tag = node->m_children[i] & BVHCommon::BVH_CHILD_TAG_MASK; // keeps the child order
+			if (node->IsChildLeaf(i)) {
+				const Leaf* leaf = node->GetChildLeaf(i);
+				memcpy(arena + offsets[leaf],leaf,leaf->GetSize());
+				dst->m_children[i] = reinterpret_cast<uintptr_t>(arena + offsets[leaf]) | BVHCommon::BVH_LEAF_FLAG | tag;
+			} else
+				dst->m_children[i] = reinterpret_cast<uintptr_t>(arena + offsets[node->GetChildNode(i)]) | tag;
+		}
+	}
+	if (arenaSize)
+		*arenaSize = size;
+	return reinterpret_cast<NodeType*>(arena);
+}
+
+BVH4Node* BVH4Node::Linearize(const BVH4Node* root,Layout layout,size_t* arenaSize)
+{
+	return LinearizeInternal(root,layout,arenaSize);
+}
+
 const BVHCounts BVH4Node::Count() const
 {
 	BVHCounts counts(1,0,0);
@@ -423,6 +925,165 @@ const Box3V BVH4Node::GetBounds() const
 	return bounds;
 }
 
+void BVH4Node::SetChildBounds(const Box3V bounds[N])
+{
+#if BVH_SOA_BOUNDS
+	m_bounds = Box3V_SOA4(bounds);
+#else
+	for (unsigned i = 0; i < N; i++)
+		m_bounds[i] = bounds[i];
+#endif
+#if BVH_CHILD_ORDER
+	ComputeChildOrder(true);
+#endif // BVH_CHILD_ORDER
+}
+
+#if BVH_CHILD_ORDER
+void BVH4Node::UpdateChildOrder(bool frontToBack)
+{
+	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
+		if (!IsChildLeaf(i))
+			GetChildNode(i)->UpdateChildOrder(frontToBack);
+	}
+	ComputeChildOrder(frontToBack);
+}
+
+// Embree style split tags - the order is made of three splits (children 0,1 vs 2,3, 0 vs 1 and 2 vs 3), each is ordered along
+// the axis which separates the centers of its two sides the most, rays going the negative way along it visit the upper side
+// first - overlapping children have no true front-to-back order, but this is the order a ray most likely reaches them in
+// the tags live in the alignment bits of children 0, 1 and 2, a split whose child is empty only orders empty children
+void BVH4Node::ComputeChildOrder(bool frontToBack)
+{
+	static const unsigned sides[3][2] = {{0x3,0xC},{0x1,0x2},{0x4,0x8}}; // child masks on either side of each split
+	for (unsigned i = 0; i < N; i++)
+		m_children[i] &= ~BVH_CHILD_TAG_MASK; // Rotate moves children between nodes, so stale tags can end up anywhere
+	for (unsigned split = 0; split < 3; split++) {
+		if (!IsChildNonEmpty(split))
+			continue;
+		uintptr_t tag = (3 << 1) | (1 << 3); // no axis and reversed, i.e. last child first (what traversal did without the child order)
+		if (frontToBack) {
+			Box3V side[2] = {Box3V::Invalid(),Box3V::Invalid()};
+			unsigned sideCount[2] = {0,0};
+			for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
+				for (unsigned j = 0; j < 2; j++) {
+					if (sides[split][j] & (1 << i)) {
+						side[j].Grow(GetChildBounds(i));
+						sideCount[j]++;
+					}
+				}
+			}
+			tag = 0;
+			if (sideCount[0] && sideCount[1]) {
+				const Vec3V delta = side[1].GetCenter() - side[0].GetCenter();
+				unsigned axis = 0;
+				for (unsigned k = 1; k < 3; k++) {
+					if (fabsf(delta[k]) > fabsf(delta[axis]))
+						axis = k;
+				}
+				tag = (axis << 1) | (delta[axis] < 0.0f ? (1 << 3) : 0);
+			}
+		}
+		m_children[split] |= tag;
+	}
+}
+#endif // BVH_CHILD_ORDER
+
+const Box3V BVH4Node::Refit(const geomesh::TriangleMesh& mesh,const Mat34V* transform,TaskScheduler* scheduler)
+{
+	return RefitInternal(mesh,transform,scheduler,0);
+}
+
+const Box3V BVH4Node::RefitInternal(const geomesh::TriangleMesh& mesh,const Mat34V* transform,TaskScheduler* scheduler,unsigned depth)
+{
+	Box3V bounds[N];
+	TaskScheduler::TaskGroup group;
+	for (unsigned i = 0; i < N; i++) {
+		if (!IsChildNonEmpty(i))
+			bounds[i] = Box3V::Invalid();
+		else if (IsChildLeaf(i))
+			bounds[i] = GetChildLeaf(i)->Refit(mesh,transform);
+		else if (scheduler && depth < BVH_REFIT_PARALLEL_DEPTH) { // subtrees are disjoint, so they can be refit independently
+			BVH4Node* child = GetChildNode(i);
+			Box3V* childBounds = &bounds[i];
+			scheduler->Submit(group,[&mesh,transform,scheduler,depth,child,childBounds](unsigned) { *childBounds = child->RefitInternal(mesh,transform,scheduler,depth + 1); });
+		} else
+			bounds[i] = GetChildNode(i)->RefitInternal(mesh,transform,NULL,depth + 1);
+	}
+	if (scheduler)
+		scheduler->Wait(group); // child bounds must be done before we use them
+	SetChildBounds(bounds);
+	Box3V result = Box3V::Invalid();
+	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++)
+		result.Grow(bounds[i]);
+	return result;
+}
+
+static float GetHalfSurfaceArea(const Box3V& bounds)
+{
+	const Vec3V size = bounds.GetSize();
+	return size.xf()*size.yf() + size.yf()*size.zf() + size.zf()*size.xf();
+}
+
+unsigned BVH4Node::Rotate()
+{
+	unsigned numRotations = 0;
+	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
+		if (!IsChildLeaf(i))
+			numRotations += GetChildNode(i)->Rotate();
+	}
+	Box3V bounds[N];
+	for (unsigned i = 0; i < N; i++)
+		bounds[i] = IsChildNonEmpty(i) ? GetChildBounds(i) : Box3V::Invalid();
+	// swapping child i with grandchild k of child j only changes the bounds of child j
+	float bestGain = 0.0f;
+	unsigned bestI = 0;
+	unsigned bestJ = 0;
+	unsigned bestK = 0;
+	for (unsigned j = 0; j < N && IsChildNonEmpty(j); j++) {
+		if (IsChildLeaf(j))
+			continue;
+		const BVH4Node* node = GetChildNode(j);
+		const float area = GetHalfSurfaceArea(bounds[j]);
+		for (unsigned k = 0; k < N && node->IsChildNonEmpty(k); k++) {
+			Box3V others = Box3V::Invalid(); // child j's bounds without grandchild k
+			for (unsigned kk = 0; kk < N && node->IsChildNonEmpty(kk); kk++) {
+				if (kk != k)
+					others.Grow(node->GetChildBounds(kk));
+			}
+			for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
+				if (i == j)
+					continue;
+				Box3V swapped = others;
+				swapped.Grow(bounds[i]);
+				const float gain = area - GetHalfSurfaceArea(swapped);
+				if (bestGain < gain) {
+					bestGain = gain;
+					bestI = i;
+					bestJ = j;
+					bestK = k;
+				}
+			}
+		}
+	}
+	if (bestGain > 0.0f) {
+		BVH4Node* node = GetChildNode(bestJ);
+		Box3V childBounds[N];
+		for (unsigned k = 0; k < N; k++)
+			childBounds[k] = node->IsChildNonEmpty(k) ? node->GetChildBounds(k) : Box3V::Invalid();
+		const uintptr_t grandchild = node->m_children[bestK];
+		const Box3V grandchildBounds = childBounds[bestK];
+		node->m_children[bestK] = m_children[bestI];
+		childBounds[bestK] = bounds[bestI];
+		node->SetChildBounds(childBounds);
+		m_children[bestI] = grandchild;
+		bounds[bestI] = grandchildBounds;
+		bounds[bestJ] = node->GetBounds();
+		SetChildBounds(bounds);
+		numRotations++;
+	}
+	return numRotations;
+}
+
 bool BVH4Node::IntersectsSphere(const Sphere3V& sphere BVH_INSIDE_OUTSIDE_TEST_VIA_SPHERE_TEST_ONLY(,const Leaf*& leaf_,unsigned& index_)) const
 {
 #if BVH_SOA_BOUNDS_INTERSECT_SINGLE_RAYS_AGAINST_ALL_CHILDREN_SIMULTANEOUSLY
@@ -470,7 +1131,6 @@ bool BVH4Node::IntersectsSphere(const Sphere3V& sphere BVH_INSIDE_OUTSIDE_TEST_V
 	return false;
 }
 
-#if BVH_LEAF_NUM_TRIANGLES_SOA <= 4
 bool BVH4Node::IntersectsBox(const Box3V& box) const
 {
 #if BVH_SOA_BOUNDS_INTERSECT_SINGLE_RAYS_AGAINST_ALL_CHILDREN_SIMULTANEOUSLY
@@ -512,11 +1172,22 @@ bool BVH4Node::IntersectsBox(const Box3V& box) const
 #endif
 	return false;
 }
-#endif // BVH_LEAF_NUM_TRIANGLES_SOA <= 4
 
 // TODO -- this method is quite fast since it doesn't involve shooting out hundreds of rays
 // however, it's difficult to determine inside/outside with respect to the mesh ..
 float BVH4Node::FindMinimumDistanceToSurface(Vec3V_arg pos,float startRadius,float step,unsigned numSteps) const
+{
+#if BVH_CLOSEST_POINT_EXACT
+	(void)numSteps;
+	BVHClosestPoint closest;
+	FindClosestPoint(pos,closest,startRadius + (step == 0.0f ? startRadius : step)); // the bisection search never goes beyond this radius
+	return closest.m_distance BVH_INSIDE_OUTSIDE_TEST_VIA_SPHERE_TEST_ONLY(*closest.m_sign);
+#else
+	return FindMinimumDistanceToSurfaceBisection(pos,startRadius,step,numSteps);
+#endif
+}
+
+float BVH4Node::FindMinimumDistanceToSurfaceBisection(Vec3V_arg pos,float startRadius,float step,unsigned numSteps) const
 {
 	float radius = startRadius;
 	if (step == 0.0f)
@@ -562,7 +1233,7 @@ float BVH4Node::FindMinimumDistanceToSurfaceEx(Vec3V_arg pos,Vec3V_arg cellSize,
 		const unsigned sx = subCellResMinMax;
 		const unsigned sy = subCellResMinMax;
 		const unsigned sz = subCellResMinMax;
-		float* g = new float[sx*sy*sz];
+		std::vector<float> g(sx*sy*sz);
 		float dmin = +FLT_MAX;
 		float dmax = -FLT_MAX;
 		for (unsigned k = 0; k < sz; k++) {
@@ -599,7 +1270,6 @@ float BVH4Node::FindMinimumDistanceToSurfaceEx(Vec3V_arg pos,Vec3V_arg cellSize,
 		}
 		dcenter = g[(sx/2) + ((sy/2) + (sz/2)*sy)*sx];
 		dcenterValid = true;
-		delete[] g;
 	}
 	if (!dcenterValid) {
 		dcenter = FindMinimumDistanceToSurface(pos,startRadius,step,numSteps);
@@ -622,120 +1292,102 @@ float BVH4Node::FindMinimumDistanceToSurfaceEx(Vec3V_arg pos,Vec3V_arg cellSize,
 }
 
 #if BVH_TILES
-// TODO -- vectorize this loop, maybe storing frustum in SOA form?
-BVHCommon::IntersectionCode BVHCommon::GetIntersectionCode(const Box3V& bounds,const Plane3V frustum[4])
+BVHFrustum::BVHFrustum(const Plane3V planes[4])
 {
-	const Vec3V bmin = bounds.GetMin();
-	const Vec3V bmax = bounds.GetMax();
-	IntersectionCode result = BVH_INSIDE;
 	for (unsigned j = 0; j < 4; j++) {
-		const Vec3V::BoolV n(frustum[j].GetNormal()); // select bounds min/max components via sign of normal components
-		if (frustum[j].GetDistanceToPoint(Select(bmax,bmin,n)) < 0.0f) // select n < 0 ? bmin : bmax, on a per-component basis
-			return BVH_OUTSIDE; // bounds is completely outside of this plane
-		else if (frustum[j].GetDistanceToPoint(Select(bmin,bmax,n)) < 0.0f) // select n < 0 ? bmax : bmin, on a per-component basis
-			result = BVH_INTERSECTED; // bounds is partially outside of this plane, therefore not completely inside frustum
+		const Vec3V normal = planes[j].GetNormal();
+		m_normalX[j] = Vec4V(normal.x());
+		m_normalY[j] = Vec4V(normal.y());
+		m_normalZ[j] = Vec4V(normal.z());
+		m_distance[j] = Vec4V(planes[j].GetDistance());
+		m_signs[j] = (normal.xf() < 0.0f ? 1 : 0) | (normal.yf() < 0.0f ? 2 : 0) | (normal.zf() < 0.0f ? 4 : 0);
 	}
-	return result;
 }
 
-#if BVH_TILES_PATHCOMPRESSION
-void BVHCommon::PathCompressionNode::Release()
+uint32 BVHFrustum::Classify(const Box3V_SOA4& boxes,uint32 planeMask,uint32 boxPlaneMasks[4]) const
 {
-	delete this;
+	const Vec3V_SOA4 bmin = boxes.GetMin();
+	const Vec3V_SOA4 bmax = boxes.GetMax();
+	uint32 outside = 0;
+	uint32 inside[4] = {0}; // per plane, mask of boxes completely inside it
+	for (unsigned j = 0; j < 4; j++) {
+		if (planeMask & (1 << j)) {
+			// the corner furthest along the normal is behind the plane only if the whole box is, the nearest corner is in
+			// front of the plane only if the whole box is
+			const uint32 signs = m_signs[j];
+			const Vec4V farDist =
+				((signs & 1) ? bmin.x() : bmax.x())*m_normalX[j] +
+				((signs & 2) ? bmin.y() : bmax.y())*m_normalY[j] +
+				((signs & 4) ? bmin.z() : bmax.z())*m_normalZ[j] + m_distance[j];
+			const Vec4V nearDist =
+				((signs & 1) ? bmax.x() : bmin.x())*m_normalX[j] +
+				((signs & 2) ? bmax.y() : bmin.y())*m_normalY[j] +
+				((signs & 4) ? bmax.z() : bmin.z())*m_normalZ[j] + m_distance[j];
+			outside |= GetBoolMask(farDist < Vec4V(V_ZERO));
+			inside[j] = GetBoolMask(nearDist >= Vec4V(V_ZERO));
+		}
+	}
+	for (unsigned i = 0; i < 4; i++) {
+		boxPlaneMasks[i] = planeMask;
+		for (unsigned j = 0; j < 4; j++) {
+			if (inside[j] & (1 << i))
+				boxPlaneMasks[i] &= ~(1 << j);
+		}
+	}
+	return outside;
 }
-#endif // BVH_TILES_PATHCOMPRESSION
 
-// see An Improved Multi-Level Raytracing Algorithm - Joshua Barczak
-// TODO -- implement path compression, not just Entry Point Search
-uintptr_t BVH4Node::EntryPointSearch(const Plane3V frustum[4] BVH_STATS_ONLY(,EntryPointSearchStats& stats)) const
+unsigned BVH4Node::PathCompression(uintptr_t ref,const BVHFrustum& frustum,uintptr_t entries[],unsigned maxEntries BVH_STATS_ONLY(,EntryPointSearchStats& stats))
 {
-	IntersectionCode codes[N];
-	bool all_out = true;
-	bool all_in = true;
-	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
-		codes[i] = GetIntersectionCode(GetChildBounds(i),frustum);
-		switch (codes[i]) {
-		case BVH_OUTSIDE: all_in = false; break;
-		case BVH_INSIDE: all_out = false; break;
-		default: all_in = all_out = false;
-		}
-		BVH_STATS_ONLY(stats.m_child_codes[codes[i]]++);
+	DEBUG_ASSERT(maxEntries > 0);
+	return PathCompressionInternal(ref,frustum,0x0F,entries,maxEntries BVH_STATS_ONLY(,stats));
+}
+
+unsigned BVH4Node::PathCompressionInternal(uintptr_t ref,const BVHFrustum& frustum,uint32 planeMask,uintptr_t entries[],unsigned maxEntries BVH_STATS_ONLY(,EntryPointSearchStats& stats))
+{
+	if ((ref & BVH_LEAF_FLAG) || planeMask == 0) { // leaves were already tested by their parent, subtrees completely inside are entered at their root
+		entries[0] = ref;
+		return 1;
 	}
+	const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+	uint32 childPlaneMasks[N];
+#if BVH_SOA_BOUNDS
+	const uint32 outside = frustum.Classify(node->m_bounds,planeMask,childPlaneMasks);
+#else
+	const uint32 outside = frustum.Classify(Box3V_SOA4(node->m_bounds),planeMask,childPlaneMasks);
+#endif
 #if BVH_STATS
-	ForceAssert(!(all_out && all_in));
-	if (all_out)
+	uint32 all = 0;
+	uint32 inside = 0;
+	for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
+		const IntersectionCode code = (outside & (1 << i)) ? BVH_OUTSIDE : (childPlaneMasks[i] ? BVH_INTERSECTED : BVH_INSIDE);
+		stats.m_child_codes[code]++;
+		all |= 1 << i;
+		inside |= (code == BVH_INSIDE) ? (1 << i) : 0;
+	}
+	if ((outside & all) == all)
 		stats.m_all_outs++;
-	else if (all_in)
+	else if (inside == all)
 		stats.m_all_ins++;
 	else
 		stats.m_mixed_ins_outs++;
 #endif // BVH_STATS
-	if (all_out)
-		return 0;
-	else if (all_in)
-		return reinterpret_cast<uintptr_t>(this);
-	else {
-		uintptr_t only = 0;
-		for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
-			if (codes[i] != BVH_OUTSIDE) {
-				uintptr_t child = m_children[i]; // node or leaf
-				if (codes[i] == BVH_INTERSECTED && !IsChildLeaf(i))
-					child = reinterpret_cast<const BVH4Node*>(child)->EntryPointSearch(frustum BVH_STATS_ONLY(,stats));
-				if (child) {
-					if (only == 0)
-						only = child;
-					else
-						return reinterpret_cast<uintptr_t>(this); // multiple children intersect, so return this node
-				}
+	unsigned count = 0;
+	for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
+		if (outside & (1 << i))
+			continue;
+		if (count == maxEntries) { // out of entry points, so this node becomes the entry point if this child has anything inside either
+			uintptr_t entry;
+			if (PathCompressionInternal(node->GetChildRef(i),frustum,childPlaneMasks[i],&entry,1 BVH_STATS_ONLY(,stats))) {
+				entries[0] = ref;
+				return 1;
 			}
+			continue;
 		}
-		return only;
+		count += PathCompressionInternal(node->GetChildRef(i),frustum,childPlaneMasks[i],entries + count,maxEntries - count BVH_STATS_ONLY(,stats));
 	}
+	return count;
 }
-
-#if BVH_TILES_PATHCOMPRESSION
-BVHCommon::PathCompressionNode* BVH4Node::PathCompression(const Plane3V frustum[4]) const
-{
-	ForceAssert(false); // TODO -- this code is not written yet! see http://www.joshbarczak.com/pathcompression.pdf. i have not assigned PathCompressionNode children, etc ..
-	IntersectionCode codes[N];
-	bool all_out = true;
-	bool all_in = true;
-	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
-		codes[i] = GetIntersectionCode(GetChildBounds(i),frustum);
-		switch (codes[i]) {
-		case BVH_OUTSIDE: all_in = false; break;
-		case BVH_INSIDE: all_out = false; break;
-		default: all_in = all_out = false;
-		}
-	}
-	if (all_out)
-		return 0;
-	else if (all_in)
-		return new PathCompressionNode(reinterpret_cast<uintptr_t>(this));
-	else {
-		PathCompressionNode* only = NULL;
-		for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
-			if (codes[i] != BVH_OUTSIDE) {
-				PathCompressionNode* child; // node or leaf
-				if (codes[i] == BVH_INTERSECTED && !IsChildLeaf(i))
-					child = reinterpret_cast<const BVH4Node*>(child)->PathCompression(frustum);
-				else
-					child = new PathCompressionNode(m_children[i]);
-				if (child) {
-					if (only == NULL)
-						only = child;
-					else {
-						only->Release();
-						child->Release();
-						return new PathCompressionNode(reinterpret_cast<uintptr_t>(this)); // multiple children intersect, so return this node
-					}
-				}
-			}
-		}
-		return only;
-	}
-}
-#endif // BVH_TILES_PATHCOMPRESSION
 #endif // BVH_TILES
 
 #if BVH_STATS
@@ -759,4 +1411,58 @@ void BVH4Node::ReportTriCountsInternal(std::vector<size_t>& histogram) const
 			GetChildNode(i)->ReportTriCountsInternal(histogram);
 	}
 }
-#endif // BVH_STATS
\ No newline at end of file
+#endif // BVH_STATS
+
+#if HAS_VEC8V
+void* BVH8Node::operator new(size_t size)
+{
+	return AlignedAlloc<uint8>(size,32);
+}
+
+void BVH8Node::operator delete(void* ptr)
+{
+	AlignedFree(ptr);
+}
+
+BVH8Node* BVH8Node::Linearize(const BVH8Node* root,Layout layout,size_t* arenaSize)
+{
+	return LinearizeInternal(root,layout,arenaSize);
+}
+
+void BVH8Node::Release()
+{
+	AlignedFree(this);
+}
+
+void BVH8Node::ReleaseNodes()
+{
+	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
+		if (IsChildLeaf(i))
+			GetChildLeaf(i)->Release();
+		else
+			GetChildNode(i)->ReleaseNodes();
+	}
+	delete this;
+}
+
+const BVHCounts BVH8Node::Count() const
+{
+	BVHCounts counts(1,0,0);
+	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++) {
+		if (IsChildLeaf(i)) {
+			counts.m_leafCount++;
+			counts.m_triCount += GetChildLeaf(i)->GetTriCount();
+		} else
+			counts += GetChildNode(i)->Count();
+	}
+	return counts;
+}
+
+const Box3V BVH8Node::GetBounds() const
+{
+	Box3V bounds = Box3V::Invalid();
+	for (unsigned i = 0; i < N && IsChildNonEmpty(i); i++)
+		bounds.Grow(GetChildBounds(i));
+	return bounds;
+}
+#endif // HAS_VEC8V
\ No newline at end of file
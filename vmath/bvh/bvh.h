@@ -6,7 +6,7 @@
 #define _INCLUDE_BVH_H_
 
 /*
-performance reference (work PC):
+performance reference (work PC) - old numbers, bvh_benchmark.cpp (BVHBenchmarkMain) writes comparable results as JSON lines:
 ------------------------------------------------------------------------------------
 loaded obj/dragon.obj - 50000 vertices, 100000 triangles
 loaded obj/dragon.bvh4 - 9512 nodes, 23829 leaves, 100000 triangles
@@ -57,26 +57,29 @@ Press any key to continue . . .
 
 // ================================================================================================
 // TODO -- BVH4 performance
-// - frustum culling to eliminate BVH nodes on a screen tile basis
-//    - entry point search - i've implemented this, not sure it's working right yet
-//    - path compression - this seems like a great idea
-//    - hierarchical tiles
-//    - frustum plane masking (instead of recalculating the in/out codes for each plane all the time)
-//    - SOA frustum calculations (4 frustum planes against each child, or each plane vs all four children)
-//    - support frustum culling with ray packets
+// + frustum culling to eliminate BVH nodes on a screen tile basis (RenderTriangles_BVH_TILES)
+//    + entry point search - tile planes were not on pixel boundaries (and flipped vertically), which is why it looked broken
+//    + path compression - flattened into a short list of entry points per tile rather than a tree
+//    + hierarchical tiles
+//    + frustum plane masking (instead of recalculating the in/out codes for each plane all the time)
+//    + SOA frustum calculations (each plane vs all four children)
+//    + support frustum culling with ray packets
 //    - currently my frustum culling only rejects bounds vs frustum planes - this is not perfect culling
-//    - also, not sure if even my Entry Point Search code is correct. for example maybe two child bounds are inside
-//      the frustum so the parent node will be returned, but actually one of those child bounds contains *no* children
-//      which are intersecting the frustum at all, so really the other child node should have been returned instead.
-// - order-traversal - consider BVH children in front-to-back order along ray
+//    + child bounds which are inside the frustum but contain nothing that is are now skipped, entry point search recurses
+//      into each surviving child before deciding whether the parent is needed
+// + order-traversal - consider BVH children in front-to-back order along ray
 //    - tried this, improved traversal in terms of calculations but actually ran slower .. TRAVERSE_FRONT_TO_BACK
-//    - maybe there is a better way to do this?
-//    - could try as a comparison pre-sorting the children in each node as a separate pass, and then compare rendering times
+//    + children are now pre-sorted per ray octant when nodes are built (BVH_CHILD_ORDER), Embree style split axes are kept
+//      in the child references so nodes stay 128 bytes - BenchmarkChildOrder compares this against index order
 //    - also not sure how to evaluate front-to-back ordering when ranges overlap (which they usually do)
 // + skip BVH children which are further along the ray than the current hit
 // - ray packets which lose too many rays along BVH traversal could be "collected" into new packets
+//    + BVHRayStream (bvh_stream.h) does this for incoherent rays - streams are sorted by octant/origin and compacted per node
 //    - need to store rays associated with the nodes
 //    - not sure how useful this is, as the collected rays would be more divergent
+// + large packets (8x8, 16x16 pixels) as many SOA sub-packets, culled per node with interval arithmetic for the whole packet
+//   and first active sub-packet tracking below that (BVH_LARGE_PACKETS) - BenchmarkLargePackets
+//    - last active tracking would also skip trailing sub-packets at leaves
 // - consider single ray vs BVH packets (ray-vs-box8) and triangle packets (ray-vs-tri8)
 // x Box3V::IntersectsRay could eliminate the Min/Max calculation of tmin,tmax if i split the traversal into octants ..?
 //    - seems like this would be diminishing returns
@@ -87,7 +90,7 @@ Press any key to continue . . .
 // + multithreading
 // 
 // - render random rays from surface of a sphere onto the model (incoherent)
-// - render from different directions (this will stress the order traversal more uniformly)
+// + render from different directions (this will stress the order traversal more uniformly) - BenchmarkChildOrder
 // + tessellate the bunny model to test high density scene
 // ================================================================================================
 
@@ -101,6 +104,8 @@ Press any key to continue . . .
 
 #include "GraphicsTools/util/mesh.h"
 
+class TaskScheduler;
+
 #if defined(_EMBREE)// && PLATFORM_PC && VISUAL_STUDIO_VERSION < 2017
 //#define _EMBREE
 #include "../../../embree-2.17.2/kernels/bvh/bvh.h"
@@ -125,6 +130,13 @@ Press any key to continue . . .
 #define BVH_STATS_ONLY(...)
 #endif
 
+#define BVH_COUNTERS (1) // runtime switchable traversal counters (BVHCounters), cheap enough for optimized builds - a thread local load per traversal when off
+#if BVH_COUNTERS
+#define BVH_COUNTERS_ONLY(...) __VA_ARGS__
+#else
+#define BVH_COUNTERS_ONLY(...)
+#endif
+
 #define BVH_SOA_BOUNDS (1) // stores BVH bounds in SOA - allows for single ray tracing to intersect all child bounds simultaneously
 #define BVH_SOA_BOUNDS_INTERSECT_SINGLE_RAYS_AGAINST_ALL_CHILDREN_SIMULTANEOUSLY (1 && BVH_SOA_BOUNDS)
 
@@ -137,14 +149,36 @@ Press any key to continue . . .
 #define BVH_INSIDE_OUTSIDE_TEST_VIA_SPHERE_TEST_ONLY(...)
 #endif
 
-#define BVH_LEAF_NUM_TRIANGLES_SOA (1) // 1,4,8 (TODO -- this currently crashes with values other than 1)
-// occlusion render however works with SOA triangles
+#define BVH_CLOSEST_POINT_EXACT (1) // FindMinimumDistanceToSurface uses FindClosestPoint rather than bisecting the radius with sphere tests
+
+#define BVH_LEAF_NUM_TRIANGLES_SOA (4) // 1,4,8 - leaves store triangles in SOA batches, the last batch is padded by repeating the last triangle
+// packet traversal used to crash with values other than 1 (the per-ray loop in Triangle3V_SOA4/8 walked past the packet when passed mask=-1)
 // bunny model with 2048 samples/vertex runs in 50.7 secs with single triangles, 20.4 secs with SOA4, and 20.1 secs with SOA8 (i don't think the data is optimized for SOA8 though)
 
 #define BVH_STACK_MAX_DEPTH 32
 
-#define BVH_TILES (0) // entry point search, path compression, etc. (TODO -- not working yet)
-#define BVH_TILES_PATHCOMPRESSION (0 && BVH_TILES)
+#define BVH_LEAF_PRIM_IDS (1) // leaves store each triangle's source primitive index after the triangles (so ray/triangle tests never touch them)
+#if BVH_LEAF_PRIM_IDS
+#define BVH_LEAF_PRIM_IDS_ONLY(...) __VA_ARGS__
+#else
+#define BVH_LEAF_PRIM_IDS_ONLY(...)
+#endif
+#define BVH_INVALID_PRIM_ID (~0U) // misses, or leaves loaded from .bvh4 files written without primitive indices
+#define BVH_FILE_LEAF_HAS_PRIM_IDS (0x80000000) // set in a .bvh4 leaf's triangle count if a uint32 primitive index per triangle follows the triangles
+
+#define BVH_ARENA_ALIGNMENT 64 // linearized trees start each node on a cache line
+
+#define BVH_REFIT_PARALLEL_DEPTH (3) // Refit submits subtrees down to this depth as separate tasks (up to 4^3 tasks)
+
+#define BVH_TILES (1) // frustum culled screen tiles - each tile's rays start at the tile's entry point rather than the root
+#define BVH_TILES_PATHCOMPRESSION (1 && BVH_TILES) // several entry points per tile instead of their common ancestor
+#define BVH_TILES_MAX_ENTRY_POINTS (8)
+#define BVH_TILES_MIN_SIZE (8) // pixels, tiles are split into quadrants (searching from the parent tile's entry points) down to this size
+
+#define BVH_LARGE_PACKETS (1) // packets of many SOA sub-packets traced together (BVH4Node::TraceLargePacket), nodes are culled for the whole packet with interval arithmetic
+#define BVH_LARGE_PACKET_MAX_SUBPACKETS (64) // e.g. 16x16 pixels as 4x1 or 2x2 sub-packets, 16x32 as 8x1
+
+#define BVH_CHILD_ORDER (1) // BVH4 nodes store split axis tags in the alignment bits of their child references, which give the children's front-to-back order for each ray direction octant
 
 #if defined(_EMBREE)
 #if defined(_EMBREE_SOURCE)
@@ -174,6 +208,55 @@ public:
 	uint32 m_triCount;
 };
 
+#if BVH_COUNTERS
+// traversal counters which are switched on at runtime - unlike BVHStats they don't change any signatures, traversal finds
+// the calling thread's counters through a thread local pointer which is only set inside a Scope
+// every traversal the renders use is instrumented - BVH4Node Trace, TraceLargePacket, TraceHit and Occluded, BVH8Node and
+// BVH4Flat Trace (single rays and packets) and BVHRayStream, each thread counts into its own BVHCounters and they are
+// merged with += when the threads are done
+class BVHCounters
+{
+public:
+	VMATH_INLINE BVHCounters() { Reset(); }
+	VMATH_INLINE void Reset() { memset(this,0,sizeof(*this)); }
+
+	BVHCounters& operator +=(const BVHCounters& counters);
+
+	VMATH_INLINE void VisitNode(unsigned numBoxes,unsigned stackDepth) { m_nodesVisited++; m_boxesTested += numBoxes; m_maxStackDepth = Max(m_maxStackDepth,(uint32)stackDepth); }
+	VMATH_INLINE void VisitLeaf(uint32 triCount) { m_leavesVisited++; m_trianglesTested += triCount; }
+	VMATH_INLINE void PushChild(uint32 laneMask,unsigned numLanes) { m_activeLanes += __popcnt(laneMask); m_laneSlots += numLanes; } // packets only
+
+	// counts into 'counters' on the calling thread until the scope ends, NULL turns counting off - scopes can be nested
+	class Scope
+	{
+	public:
+		VMATH_INLINE Scope(BVHCounters* counters) : m_prev(s_current) { s_current = counters; }
+		VMATH_INLINE ~Scope() { s_current = m_prev; }
+	private:
+		BVHCounters* m_prev;
+	};
+
+	VMATH_INLINE static BVHCounters* GetCurrent() { return s_current; }
+
+	void Report(const char* label) const;
+	bool SaveJSON(const char* path,const char* label) const; // one object per file
+	bool AppendCSV(const char* path,const char* label) const; // one row per call, the header is written if the file is empty
+
+	uint64 m_numRays; // set by whoever traced the rays (traversal only sees calls), the per ray averages divide by this
+	uint64 m_numTraversals; // calls, a packet counts once
+	uint64 m_nodesVisited;
+	uint64 m_boxesTested; // child bounds, N per node visited (the SOA test does all of them at once)
+	uint64 m_leavesVisited;
+	uint64 m_trianglesTested; // a packet testing a triangle counts once
+	uint64 m_activeLanes; // packets only - number of rays entering each pushed child, summed
+	uint64 m_laneSlots; // packets only - packet width summed the same way, m_activeLanes/m_laneSlots is the lane utilization
+	uint32 m_maxStackDepth;
+
+private:
+	static thread_local BVHCounters* s_current;
+};
+#endif // BVH_COUNTERS
+
 #if BVH_STATS
 class BVHStats : public BVHCounts
 {
@@ -278,36 +361,215 @@ public:
 	size_t m_all_ins;
 	size_t m_mixed_ins_outs;
 	size_t m_child_codes[3]; // BVH4Node::IntersectionCode
+
+	VMATH_INLINE EntryPointSearchStats& operator +=(const EntryPointSearchStats& stats)
+	{
+		m_all_outs += stats.m_all_outs;
+		m_all_ins += stats.m_all_ins;
+		m_mixed_ins_outs += stats.m_mixed_ins_outs;
+		for (unsigned i = 0; i < countof(m_child_codes); i++)
+			m_child_codes[i] += stats.m_child_codes[i];
+		return *this;
+	}
 };
 #endif // BVH_TILES
 #endif // BVH_STATS
 
+#if BVH_TILES
+// four inward facing planes through the camera (no near or far plane), stored as broadcast components so each plane is
+// tested against all four child bounds of a BVH4 node at once
+class BVHFrustum
+{
+public:
+	BVHFrustum(const Plane3V planes[4]);
+
+	// returns the mask of boxes completely outside, boxPlaneMasks[i] is the subset of planeMask which box i is not
+	// completely inside of - children of box i only need to be tested against those planes
+	uint32 Classify(const Box3V_SOA4& boxes,uint32 planeMask,uint32 boxPlaneMasks[4]) const;
+
+private:
+	Vec4V m_normalX[4];
+	Vec4V m_normalY[4];
+	Vec4V m_normalZ[4];
+	Vec4V m_distance[4];
+	uint32 m_signs[4]; // per plane, bit per axis set where the normal is negative (selects the box corner furthest along the normal)
+};
+#endif // BVH_TILES
+
+#if BVH_LARGE_PACKETS
+// conservative bounds of a packet of rays - per axis intervals of the origins and reciprocal directions, so the entry and
+// exit distances of every ray in the packet are bounded by interval arithmetic and four child boxes are classified for the
+// whole packet with a single SOA test, regardless of how many rays are in it
+// the reciprocal direction intervals are only finite if every ray's direction has the same sign on each axis
+class BVHRayInterval
+{
+public:
+	// returns false if the directions don't share an octant (or a component is zero), the intervals are unusable then
+	template <typename OriginType,typename DirType> bool Set(const OriginType origins[],const DirType dirs[],unsigned numPackets)
+	{
+		Vec3V originMin(FLT_MAX),originMax(-FLT_MAX);
+		Vec3V dirMin(FLT_MAX),dirMax(-FLT_MAX);
+		for (unsigned p = 0; p < numPackets; p++) {
+			Grow(originMin,originMax,origins[p]);
+			Grow(dirMin,dirMax,dirs[p]);
+		}
+		m_octant = 0;
+		for (unsigned axis = 0; axis < 3; axis++) {
+			const float d0 = dirMin[axis];
+			const float d1 = dirMax[axis];
+			if (d1 < 0.0f)
+				m_octant |= 1 << axis;
+			else if (!(d0 > 0.0f))
+				return false;
+			m_originMin[axis] = Vec4V(ScalarV(originMin[axis]));
+			m_originMax[axis] = Vec4V(ScalarV(originMax[axis]));
+			m_invdirMin[axis] = Vec4V(ScalarV(1.0f/d1)); // 1/d is decreasing on either side of zero
+			m_invdirMax[axis] = Vec4V(ScalarV(1.0f/d0));
+		}
+		return true;
+	}
+
+	// missMask has a bit set for each box every ray misses, hitMask for each box every ray hits (before tmin, the smallest t in
+	// the packet) - boxes in neither mask are partially covered and need per-ray tests, tmax is the largest t in the packet
+	VMATH_INLINE void Classify(const Box3V_SOA4& boxes,ScalarV_arg tmin,ScalarV_arg tmax,uint32& missMask,uint32& hitMask) const
+	{
+		const Vec4V bmin[3] = {boxes.GetMin().x(),boxes.GetMin().y(),boxes.GetMin().z()};
+		const Vec4V bmax[3] = {boxes.GetMax().x(),boxes.GetMax().y(),boxes.GetMax().z()};
+		Vec4V entryLo(V_ZERO),entryHi(V_ZERO); // bounds of each box's entry distance over all rays, rays start at t = 0
+		Vec4V exitLo(tmin),exitHi(tmax);
+		for (unsigned axis = 0; axis < 3; axis++) {
+			const bool negative = (m_octant & (1 << axis)) != 0;
+			Vec4V lo,hi;
+			GetDistanceInterval(negative ? bmax[axis] : bmin[axis],axis,lo,hi);
+			entryLo = Max(lo,entryLo);
+			entryHi = Max(hi,entryHi);
+			GetDistanceInterval(negative ? bmin[axis] : bmax[axis],axis,lo,hi);
+			exitLo = Min(lo,exitLo);
+			exitHi = Min(hi,exitHi);
+		}
+		missMask = GetBoolMask(entryLo > exitHi);
+		hitMask = GetBoolMask(entryHi <= exitLo) & ~missMask;
+	}
+
+private:
+	VMATH_INLINE static void Grow(Vec3V& vmin,Vec3V& vmax,Vec3V_arg v) { vmin = Min(v,vmin); vmax = Max(v,vmax); }
+	template <typename T> VMATH_INLINE static void Grow(Vec3V& vmin,Vec3V& vmax,const T& v)
+	{
+		for (unsigned lane = 0; lane < T::ComponentType::NumElements; lane++)
+			Grow(vmin,vmax,v.GetVector(lane));
+	}
+
+	// (plane - origin)*invdir over the origin and invdir intervals - the product's bounds are at the interval endpoints
+	VMATH_INLINE void GetDistanceInterval(Vec4V_arg plane,unsigned axis,Vec4V& lo,Vec4V& hi) const
+	{
+		const Vec4V x0 = plane - m_originMax[axis];
+		const Vec4V x1 = plane - m_originMin[axis];
+		const Vec4V a = x0*m_invdirMin[axis];
+		const Vec4V b = x0*m_invdirMax[axis];
+		const Vec4V c = x1*m_invdirMin[axis];
+		const Vec4V d = x1*m_invdirMax[axis];
+		lo = Min(Min(a,b),Min(c,d));
+		hi = Max(Max(a,b),Max(c,d));
+	}
+
+	Vec4V m_originMin[3]; // broadcast, so each axis is tested against four boxes at once
+	Vec4V m_originMax[3];
+	Vec4V m_invdirMin[3];
+	Vec4V m_invdirMax[3];
+	unsigned m_octant;
+};
+#endif // BVH_LARGE_PACKETS
+
+enum BVHHitFields
+{
+	BVH_HIT_PRIM_ID = 1,
+	BVH_HIT_UV      = 2,
+	BVH_HIT_NORMAL  = 4,
+	BVH_HIT_ALL     = BVH_HIT_PRIM_ID|BVH_HIT_UV|BVH_HIT_NORMAL,
+};
+
+// closest hit returned by BVH4Node::TraceHit, m_t is the ray's tmax on input and is unchanged on a miss
+// fields not requested are left untouched
+class BVHHit
+{
+public:
+	Vec3V m_normal; // geometric normal (unit length, not flipped towards the ray)
+	float m_t;
+	float m_u; // barycentrics, hit point = (1 - u - v)*p0 + u*p1 + v*p2
+	float m_v;
+	uint32 m_primID; // BVH_INVALID_PRIM_ID on a miss
+};
+
+template <typename DirType> class BVHHitPacket
+{
+public:
+	typedef typename DirType::ComponentType ComponentType;
+	enum { NumRays = ComponentType::NumElements };
+
+	DirType m_normal;
+	ComponentType m_t;
+	ComponentType m_u;
+	ComponentType m_v;
+	uint32 m_primID[NumRays];
+};
+
+// closest point on the surface returned by BVH4Node::FindClosestPoint
+class BVHClosestPoint
+{
+public:
+	Vec3V m_point; // pos if nothing was found
+	Vec3V m_normal; // geometric normal of the closest triangle (unit length)
+	float m_distance; // unsigned, maxDistance if nothing was found
+	float m_sign; // -1 if pos is behind the closest triangle, otherwise +1 (not robust where pos is equidistant to several triangles across a sharp edge)
+	uint32 m_primID; // BVH_INVALID_PRIM_ID if nothing was found
+};
+
 class BVHCommon
 {
 public:
 	enum NodeType { BVH_NODETYPE_EMPTY = 0, BVH_NODETYPE_NODE = 1, BVH_NODETYPE_LEAF = 2 };
 	enum IntersectionCode { BVH_OUTSIDE = 0, BVH_INSIDE = 1, BVH_INTERSECTED = 2 };
 	static const uintptr_t BVH_LEAF_FLAG = 1;
+	static const uintptr_t BVH_CHILD_TAG_MASK = BVH_CHILD_ORDER ? 14 : 0; // BVH4Node split tags, child references are at least 16 byte aligned
 
 #if BVH_LEAF_NUM_TRIANGLES_SOA > 1
 	typedef typename Triangle3V_SOA_T<BVH_LEAF_NUM_TRIANGLES_SOA>::TriangleType TriangleType;
 #else
 	typedef Triangle3V TriangleType;
 #endif
-	class Leaf : public std::vector<TriangleType>
+	enum Layout
+	{
+		BVH_LAYOUT_DEPTH_FIRST = 0, // nodes in depth-first order
+		BVH_LAYOUT_VEB         = 1, // van Emde Boas (cache-oblivious) order
+	};
+
+	// leaf header followed by its triangles, so each leaf is a single block (standalone or inside a linearized tree's arena)
+	class Leaf
 	{
 	public:
-		void SetPrimitives(const Triangle3V* triangles,uint32 count);
+		enum { HEADER_SIZE = alignof(TriangleType) > 16 ? alignof(TriangleType) : 16 };
+
+		static Leaf* Create(const Triangle3V* triangles,uint32 count,void* mem = NULL,const uint32* primIDs = NULL); // allocates if mem is NULL
 		static Leaf* LoadInternal(FILE* f,const Mat34V* transform BVH_STATS_ONLY(,uint32 depth));
+		static size_t GetSizeForCount(uint32 count);
 
-		VMATH_INLINE void Release() { delete this; }
+		void Release(); // standalone leaves only
 
-	#if BVH_LEAF_NUM_TRIANGLES_SOA == 1
-		VMATH_INLINE unsigned GetTriCount() const { return (unsigned)size(); }
+	#if BVH_LEAF_PRIM_IDS
+		VMATH_INLINE size_t GetSize() const { return HEADER_SIZE + m_size*sizeof(TriangleType) + m_count*sizeof(uint32); }
+		VMATH_INLINE const uint32* GetPrimIDs() const { return reinterpret_cast<const uint32*>(data() + m_size); }
+		VMATH_INLINE uint32* GetPrimIDs() { return reinterpret_cast<uint32*>(data() + m_size); }
+		VMATH_INLINE uint32 GetPrimID(unsigned i) const { DEBUG_ASSERT(i < GetTriCount()); return GetPrimIDs()[i]; }
 	#else
+		VMATH_INLINE size_t GetSize() const { return HEADER_SIZE + m_size*sizeof(TriangleType); }
+		VMATH_INLINE uint32 GetPrimID(unsigned) const { return BVH_INVALID_PRIM_ID; }
+	#endif // BVH_LEAF_PRIM_IDS
 		VMATH_INLINE unsigned GetTriCount() const { return m_count; }
-		unsigned m_count;
-	#endif
+
+		VMATH_INLINE unsigned size() const { return m_size; }
+		VMATH_INLINE const TriangleType* data() const { return reinterpret_cast<const TriangleType*>(reinterpret_cast<const uint8*>(this) + HEADER_SIZE); }
+		VMATH_INLINE TriangleType* data() { return reinterpret_cast<TriangleType*>(reinterpret_cast<uint8*>(this) + HEADER_SIZE); }
+		VMATH_INLINE const TriangleType& operator[](unsigned i) const { DEBUG_ASSERT(i < m_size); return data()[i]; }
 
 		VMATH_INLINE const Triangle3V GetTriangle(unsigned i) const
 		{
@@ -328,34 +590,97 @@ public:
 		void IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA8_arg origin,Vec3V_SOA8_arg dir,Vec8V& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const;
 	#endif // HAS_VEC8V
 
+		// closest hit which also reports which triangle it was, returns true (or the mask of rays) if t improved
+		// triIndex is only written for improved rays
+		bool IntersectsRayClosest(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,uint32& triIndex) const;
+		template <typename OriginType,typename DirType> VMATH_INLINE uint32 IntersectsRayClosest(const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t,uint32 triIndex[]) const
+		{
+			typedef typename DirType::ComponentType ComponentType;
+			uint32 improved = 0;
+			for (unsigned i = 0; i < size(); i++) {
+				ComponentType t_;
+				const uint32 mask = operator[](i).IntersectsRay(origin,dir,t_,-1) & (t_ < t).GetMask();
+				if (mask) {
+				#if BVH_LEAF_NUM_TRIANGLES_SOA > 1
+					// the SOA test only returns the closest t per ray, find which triangle it was for the rays which improved
+					const unsigned first = i*BVH_LEAF_NUM_TRIANGLES_SOA;
+					const unsigned last = Min(first + BVH_LEAF_NUM_TRIANGLES_SOA,GetTriCount());
+					for (unsigned j = first; j < last; j++) {
+						ComponentType tj;
+						const uint32 closer = GetTriangle(j).IntersectsRay(origin,dir,tj,mask) & (tj < t).GetMask() & mask;
+						for (uint32 bits = closer, lane = 0; bits; bits >>= 1, lane++) {
+							if (bits & 1) {
+								t[lane] = tj[lane];
+								triIndex[lane] = j;
+							}
+						}
+						improved |= closer;
+					}
+				#else
+					for (uint32 bits = mask, lane = 0; bits; bits >>= 1, lane++) {
+						if (bits & 1) {
+							t[lane] = t_[lane];
+							triIndex[lane] = i;
+						}
+					}
+					improved |= mask;
+				#endif
+				}
+			}
+			return improved;
+		}
+
+		// any hit closer than tmax, returns true (or the mask of occluded rays out of the active ones)
+		bool Occluded(Vec3V_arg origin,Vec3V_arg dir,ScalarV_arg tmax) const;
+		template <typename OriginType,typename DirType> VMATH_INLINE uint32 Occluded(const OriginType& origin,const DirType& dir,typename DirType::ComponentType::ArgType tmax,uint32 active) const
+		{
+			typedef typename DirType::ComponentType ComponentType;
+			uint32 occluded = 0;
+			for (unsigned i = 0; i < size(); i++) {
+				ComponentType t_;
+				const uint32 hitMask = operator[](i).IntersectsRay(origin,dir,t_,active & ~occluded);
+				if (hitMask) {
+					occluded |= (t_ < tmax).GetMask() & hitMask; // lanes which missed have t_ = ZBUFFER_DEFAULT, which can be closer than tmax
+					if (occluded == active)
+						break;
+				}
+			}
+			return occluded;
+		}
+
+		// rewrites the triangles in place from the mesh's current vertex positions (by primitive ID), returns the new bounds
+		const Box3V Refit(const geomesh::TriangleMesh& mesh,const Mat34V* transform);
+
+		// closest triangle to pos, returns true if distSqr improved (triIndex is only written then)
+		bool GetDistanceSqrToPoint(Vec3V_arg pos,ScalarV& distSqr,uint32& triIndex) const;
+
 		void IntersectsRaySign(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,ScalarV& sign) const;
 		void IntersectsRaySignAccum(Vec3V_arg origin,Vec3V_arg dir,ScalarV& sign) const;
 
+		uint32 m_size; // number of TriangleType's following the header
+		uint32 m_count; // number of triangles (the last SOA element is padded by repeating the last triangle)
 	#if BVH_STATS
 		uint32 m_depth;
 	#endif // BVH_STATS
 	};
 
-#if BVH_TILES
-	static IntersectionCode GetIntersectionCode(const Box3V& bounds,const Plane3V frustum[4]);
-#if BVH_TILES_PATHCOMPRESSION
-	class PathCompressionNode
-	{
-	public:
-		enum { N = 4 };
+	// fills in the requested BVHHitFields for the closest triangle found by traversal (leaf is NULL for a miss)
+	static void ResolveHit(const Leaf* leaf,uint32 triIndex,Vec3V_arg origin,Vec3V_arg dir,BVHHit& hit,uint32 fields);
 
-		VMATH_INLINE PathCompressionNode(uintptr_t ref = 0): m_ref(ref)
-		{
-			memset(m_children,0,sizeof(m_children));
-		}
+	VMATH_INLINE static Vec3V_out GetPacketVector(Vec3V_arg v,unsigned) { return v; } // shared packet origin
+	template <typename T> VMATH_INLINE static Vec3V_out GetPacketVector(const T& v,unsigned i) { return v.GetVector(i); }
 
-		void Release();
+	// bits 0,1,2 are set for negative x,y,z - packets use the octant of their summed directions, which is exact for coherent
+	// packets and only affects traversal order (not results) for the rest
+	VMATH_INLINE static unsigned GetDirectionOctant(Vec3V_arg dir) { return (dir.xf() < 0.0f ? 1 : 0) | (dir.yf() < 0.0f ? 2 : 0) | (dir.zf() < 0.0f ? 4 : 0); }
+	template <typename DirType> VMATH_INLINE static unsigned GetDirectionOctant(const DirType& dir)
+	{
+		Vec3V sum(V_ZERO);
+		for (unsigned lane = 0; lane < DirType::ComponentType::NumElements; lane++)
+			sum += dir.GetVector(lane);
+		return GetDirectionOctant(sum);
+	}
 
-		uintptr_t m_ref; // references a BVH node or leaf
-		PathCompressionNode* m_children[N];
-	};
-#endif // BVH_TILES_PATHCOMPRESSION
-#endif // BVH_TILES
 };
 
 class BVH4Node : public BVHCommon
@@ -364,15 +689,38 @@ public:
 	enum { N = 4 };
 
 	VMATH_INLINE static const char* GetClassName_() { return "BVH4"; } // wanted to call this "GetClassName" but windows has defined it, apparently ..
-	static BVH4Node* Load(const char* path,const Mat34V* transform = NULL);
+	static BVH4Node* Load(const char* path,const Mat34V* transform = NULL,Layout layout = BVH_LAYOUT_DEPTH_FIRST);
 private:
 	static BVH4Node* LoadInternal(FILE* f,const Mat34V* transform BVH_STATS_ONLY(,uint32 depth = 0));
 public:
-	void Release();
+	// copies a tree into a single aligned arena, each node's leaves are stored immediately after it
+	// the returned root is at the start of the arena, so Release() frees everything at once
+	static BVH4Node* Linearize(const BVH4Node* root,Layout layout = BVH_LAYOUT_DEPTH_FIRST,size_t* arenaSize = NULL);
+	void Release(); // linearized trees only
+	void ReleaseNodes(); // trees with individually allocated nodes and leaves (LoadInternal, BVHBuilder::BuildNode)
 
 	const BVHCounts Count() const;
 	const Box3V GetBounds() const;
 
+	// updates leaf triangles and bounds bottom-up for new vertex positions of the mesh the tree was built from (same topology,
+	// leaves must have primitive IDs), subtrees near the root are refit as separate tasks if a scheduler is given
+	const Box3V Refit(const geomesh::TriangleMesh& mesh,const Mat34V* transform = NULL,TaskScheduler* scheduler = NULL);
+	// cheap restructuring for refit trees - bottom-up, each node swaps a child with a grandchild if that shrinks the grandchild's
+	// parent the most (SAH cost of everything else is unchanged), returns the number of swaps
+	unsigned Rotate();
+#if BVH_CHILD_ORDER
+	// recomputes the child order of every node in the tree - the builder, Load and SetChildBounds keep it up to date, this is
+	// for comparing against frontToBack = false, which stores the order traversal used before (last child first)
+	void UpdateChildOrder(bool frontToBack = true);
+	// recomputes this node's child order from its child bounds (not recursive), for code which writes the bounds directly
+	void ComputeChildOrder(bool frontToBack = true);
+#endif // BVH_CHILD_ORDER
+private:
+	const Box3V RefitInternal(const geomesh::TriangleMesh& mesh,const Mat34V* transform,TaskScheduler* scheduler,unsigned depth);
+	void SetChildBounds(const Box3V bounds[N]); // also updates the child order
+	friend class BVHInstanceTree; // builds top-level nodes over instances
+public:
+
 #if BVH_SOA_BOUNDS
 	template <typename BoxType> VMATH_INLINE const BoxType GetChildBounds_BroadcastSOA(unsigned i) const { DEBUG_ASSERT(i < N); return m_bounds.GetIndexed_BroadcastSOA<BoxType>(i); }
 	VMATH_INLINE const Box3V GetChildBounds(unsigned i) const { DEBUG_ASSERT(i < N); return m_bounds.GetIndexed(i); } // don't call this!
@@ -382,8 +730,33 @@ public:
 #endif
 	VMATH_INLINE bool IsChildNonEmpty(unsigned i) const { DEBUG_ASSERT(i < N); return m_children[i] != 0; }
 	VMATH_INLINE bool IsChildLeaf(unsigned i) const { DEBUG_ASSERT(i < N); return (m_children[i] & BVH_LEAF_FLAG) != 0; }
-	VMATH_INLINE BVH4Node* GetChildNode(unsigned i) const { DEBUG_ASSERT(i < N && !IsChildLeaf(i)); return reinterpret_cast<BVH4Node*>(m_children[i]); }
-	VMATH_INLINE Leaf* GetChildLeaf(unsigned i) const { DEBUG_ASSERT(i < N && IsChildLeaf(i)); return reinterpret_cast<Leaf*>(m_children[i] & ~BVH_LEAF_FLAG); }
+	VMATH_INLINE BVH4Node* GetChildNode(unsigned i) const { DEBUG_ASSERT(i < N && !IsChildLeaf(i)); return reinterpret_cast<BVH4Node*>(m_children[i] & ~BVH_CHILD_TAG_MASK); }
+	VMATH_INLINE Leaf* GetChildLeaf(unsigned i) const { DEBUG_ASSERT(i < N && IsChildLeaf(i)); return reinterpret_cast<Leaf*>(m_children[i] & ~(BVH_LEAF_FLAG | BVH_CHILD_TAG_MASK)); }
+	VMATH_INLINE uintptr_t GetChildRef(unsigned i) const { DEBUG_ASSERT(i < N); return m_children[i] & ~BVH_CHILD_TAG_MASK; } // what goes on the traversal stack
+
+	// push order for rays in the given octant, 2 bits per child index with the farthest in the low bits (so it's pushed first
+	// and popped last) - the order may put empty children anywhere, callers must skip them
+#if BVH_CHILD_ORDER
+	VMATH_INLINE unsigned GetChildOrder(unsigned octant) const
+	{
+		DEBUG_ASSERT(octant < 8);
+		const unsigned r0 = GetSplitReversed(0,octant); // children 2,3 are nearer than 0,1
+		const unsigned r1 = GetSplitReversed(1,octant); // child 1 is nearer than child 0
+		const unsigned r2 = GetSplitReversed(2,octant); // child 3 is nearer than child 2
+		const unsigned order01 = (r1^1) | (r1 << 2); // far child in the low bits
+		const unsigned order23 = (2 + (r2^1)) | ((2 + r2) << 2);
+		return r0 ? (order01 | (order23 << 4)) : (order23 | (order01 << 4));
+	}
+#else
+	VMATH_INLINE unsigned GetChildOrder(unsigned) const { return 0xE4; } // index order, child 0 pushed first
+#endif
+	// index of the k'th child to push onto a traversal stack - the last one pushed is popped first, so k = N - 1 is the nearest
+	VMATH_INLINE static unsigned GetChildPushIndex(unsigned order,unsigned k) { DEBUG_ASSERT(k < N); return (order >> (k*2)) & 3; }
+#if BVH_SOA_BOUNDS
+	VMATH_INLINE const Box3V_SOA4& GetChildBoundsSOA() const { return m_bounds; }
+#else
+	VMATH_INLINE const Box3V_SOA4 GetChildBoundsSOA() const { return Box3V_SOA4(m_bounds); }
+#endif
 
 	template <typename OriginType,typename DirType> VMATH_INLINE void Trace(const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
 	{
@@ -396,6 +769,9 @@ public:
 	template <typename OriginType,typename DirType> VMATH_INLINE static void TraceStatic(uintptr_t ref_,const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,uint32 mask_,BVHStats& stats))
 	{
 		const DirType invdir = Recip(dir);
+		const unsigned octant = GetDirectionOctant(dir);
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
 	#if BVH_STATS
 		const unsigned numMaskBits = 8;
 		const uintptr_t refMask = (uintptr_t)-1 >> numMaskBits;
@@ -406,13 +782,20 @@ public:
 		while (stackIndex > 0) {
 			const uintptr_t ref = stack[--stackIndex] BVH_STATS_ONLY(& refMask);
 			BVH_STATS_ONLY(mask_ = (uint32)(stack[stackIndex] >> (64 - numMaskBits)));
-			if (ref & BVH_LEAF_FLAG)
-				reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG)->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,mask_,stats));
-			else {
+			if (ref & BVH_LEAF_FLAG) {
+				const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+				leaf->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,mask_,stats));
+			} else {
 				const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
 				BVH_STATS_ONLY(stats.EnterNode(mask_,node->m_depth));
-				for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
-					BVH_STATS_ONLY(DEBUG_ASSERT((node->m_children[i] & refMask) == 0));
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				const unsigned order = node->GetChildOrder(octant);
+				for (unsigned k = 0; k < N; k++) {
+					const unsigned i = GetChildPushIndex(order,k);
+					if (!node->IsChildNonEmpty(i))
+						continue;
+					BVH_STATS_ONLY(DEBUG_ASSERT((node->GetChildRef(i) & refMask) == 0));
 					const uint32 mask = node->GetChildBounds(i).IntersectsRay(origin,invdir,t);
 					//const uint32 mask = node->GetChildBounds_BroadcastSOA<Box3V_SOA_T<DirType>>(i).IntersectsRay(origin,invdir,t);
 					if (mask) {
@@ -420,12 +803,13 @@ public:
 						// TODO -- to split into multiple single rays, use _blsr_u32 to scan through mask bits
 						if (__popcnt(mask) == 1) {
 							const uint32 rayIndex = _tzcnt_u32(mask);
-							TraceStatic(m_children[i],origin,dir.GetVector(rayIndex),t[rayIndex] BVH_STATS_ONLY(,0x0001,stats));
+							TraceStatic(node->GetChildRef(i),origin,dir.GetVector(rayIndex),t[rayIndex] BVH_STATS_ONLY(,0x0001,stats));
 						} else
 					#endif // BVH_SWITCH_TO_SINGLE_RAYS
 						{
 							DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
-							stack[stackIndex++] = node->m_children[i] BVH_STATS_ONLY(| ((uintptr_t)mask << (64 - numMaskBits)));
+							stack[stackIndex++] = node->GetChildRef(i) BVH_STATS_ONLY(| ((uintptr_t)mask << (64 - numMaskBits)));
+							BVH_COUNTERS_ONLY(if (counters) counters->PushChild(mask,DirType::ComponentType::NumElements));
 						}
 					}
 				}
@@ -433,6 +817,200 @@ public:
 		}
 	}
 
+#if BVH_LARGE_PACKETS
+	// large coherent packets, e.g. a 16x16 pixel tile as 64 4x1 sub-packets - each node's children are first classified for
+	// the whole packet with one interval test (BVHRayInterval), children every ray hits are pushed without testing any rays
+	// and only partially covered children fall back to per sub-packet tests, starting at the first sub-packet which is still
+	// active in the parent's subtree (sub-packets before it missed some ancestor, so they're skipped for the whole subtree)
+	// packets whose directions don't share an octant can't use the interval test, but still get first active tracking
+	template <typename OriginType,typename DirType> VMATH_INLINE void TraceLargePacket(const OriginType origins[],const DirType dirs[],typename DirType::ComponentType t[],unsigned numPackets BVH_STATS_ONLY(,BVHStats& stats)) const
+	{
+		TraceLargePacketStatic(reinterpret_cast<uintptr_t>(this),origins,dirs,t,numPackets BVH_STATS_ONLY(,stats));
+	}
+
+	template <typename OriginType,typename DirType> static void TraceLargePacketStatic(uintptr_t ref_,const OriginType origins[],const DirType dirs[],typename DirType::ComponentType t[],unsigned numPackets BVH_STATS_ONLY(,BVHStats& stats))
+	{
+		typedef typename DirType::ComponentType ComponentType;
+		BVH_STATS_ONLY(const uint32 all = (uint32)((1ULL << ComponentType::NumElements) - 1));
+		DEBUG_ASSERT(numPackets > 0 && numPackets <= BVH_LARGE_PACKET_MAX_SUBPACKETS);
+		DirType invdirs[BVH_LARGE_PACKET_MAX_SUBPACKETS];
+		for (unsigned p = 0; p < numPackets; p++)
+			invdirs[p] = Recip(dirs[p]);
+		BVHRayInterval interval;
+		const bool useInterval = interval.Set(origins,dirs,numPackets);
+		const unsigned octant = GetDirectionOctant(dirs[numPackets/2]); // children are ordered for the middle of the packet
+		ScalarV tmin,tmax; // range of t over the packet, shrinks as leaves are hit
+		auto UpdateRange = [&]() {
+			ComponentType lo = t[0];
+			ComponentType hi = t[0];
+			for (unsigned p = 1; p < numPackets; p++) {
+				lo = Min(t[p],lo);
+				hi = Max(t[p],hi);
+			}
+			tmin = MinElement(lo);
+			tmax = MaxElement(hi);
+		};
+		if (useInterval)
+			UpdateRange();
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+		uintptr_t stack[BVH_STACK_MAX_DEPTH] = {ref_};
+		uint8 stackFirst[BVH_STACK_MAX_DEPTH] = {0}; // first active sub-packet of each stack entry
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uintptr_t ref = stack[--stackIndex];
+			const unsigned first = stackFirst[stackIndex];
+			if (ref & BVH_LEAF_FLAG) {
+				const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+				for (unsigned p = first; p < numPackets; p++) {
+					BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+					leaf->IntersectsRay(origins[p],dirs[p],t[p] BVH_STATS_ONLY(,all,stats));
+				}
+				if (useInterval)
+					UpdateRange();
+			} else {
+				const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				uint32 missMask = 0;
+				uint32 hitMask = 0;
+				if (useInterval)
+					interval.Classify(node->GetChildBoundsSOA(),tmin,tmax,missMask,hitMask);
+				const unsigned order = node->GetChildOrder(octant);
+				for (unsigned k = 0; k < N; k++) {
+					const unsigned i = GetChildPushIndex(order,k);
+					if (!node->IsChildNonEmpty(i) || (missMask & (1 << i)))
+						continue;
+					unsigned childFirst = first;
+					if ((hitMask & (1 << i)) == 0) { // partially covered (or no interval test), find the first sub-packet which hits
+						const Box3V_SOA_T<DirType> bounds = node->GetChildBounds_BroadcastSOA<Box3V_SOA_T<DirType>>(i);
+						while (childFirst < numPackets && bounds.IntersectsRay(origins[childFirst],invdirs[childFirst],t[childFirst]) == 0)
+							childFirst++;
+						BVH_COUNTERS_ONLY(if (counters) counters->m_boxesTested += childFirst - first + (childFirst < numPackets ? 1 : 0));
+						if (childFirst == numPackets)
+							continue;
+					}
+					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+					stackFirst[stackIndex] = (uint8)childFirst;
+					stack[stackIndex++] = node->GetChildRef(i);
+				#if BVH_COUNTERS
+					if (counters) { // lanes are sub-packets here, all of them from childFirst on are active
+						counters->m_activeLanes += numPackets - childFirst;
+						counters->m_laneSlots += numPackets;
+					}
+				#endif // BVH_COUNTERS
+				}
+			}
+		}
+	}
+#endif // BVH_LARGE_PACKETS
+
+	// closest hit with the requested BVHHitFields, hit.m_t is the ray's tmax
+	// traversal only tracks which leaf triangle is closest, the fields are computed once for that triangle at the end
+	void TraceHit(Vec3V_arg origin,Vec3V_arg dir,BVHHit& hit,uint32 fields = BVH_HIT_ALL) const;
+
+	template <typename OriginType,typename DirType> VMATH_INLINE void TraceHit(const OriginType& origin,const DirType& dir,BVHHitPacket<DirType>& hit,uint32 fields = BVH_HIT_ALL) const
+	{
+		typedef typename DirType::ComponentType ComponentType;
+		enum { NumRays = ComponentType::NumElements };
+		const DirType invdir = Recip(dir);
+		const unsigned octant = GetDirectionOctant(dir);
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+		ComponentType t = hit.m_t;
+		const Leaf* hitLeaf[NumRays];
+		uint32 hitIndex[NumRays];
+		for (unsigned lane = 0; lane < NumRays; lane++)
+			hitLeaf[lane] = NULL;
+		uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(this)};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uintptr_t ref = stack[--stackIndex];
+			if (ref & BVH_LEAF_FLAG) {
+				const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+				for (uint32 improved = leaf->IntersectsRayClosest(origin,dir,t,hitIndex), lane = 0; improved; improved >>= 1, lane++) {
+					if (improved & 1)
+						hitLeaf[lane] = leaf;
+				}
+			} else {
+				const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				const unsigned order = node->GetChildOrder(octant);
+				for (unsigned k = 0; k < N; k++) {
+					const unsigned i = GetChildPushIndex(order,k);
+					const uint32 mask = node->IsChildNonEmpty(i) ? node->GetChildBounds(i).IntersectsRay(origin,invdir,t) : 0;
+					if (mask) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node->GetChildRef(i);
+						BVH_COUNTERS_ONLY(if (counters) counters->PushChild(mask,NumRays));
+					}
+				}
+			}
+		}
+		hit.m_t = t;
+		if (fields) {
+			Vec3V normals[NumRays];
+			if (fields & BVH_HIT_NORMAL)
+				hit.m_normal.GetVectors(normals);
+			for (unsigned lane = 0; lane < NumRays; lane++) {
+				BVHHit laneHit;
+				ResolveHit(hitLeaf[lane],hitIndex[lane],GetPacketVector(origin,lane),dir.GetVector(lane),laneHit,fields);
+				if (fields & BVH_HIT_PRIM_ID)
+					hit.m_primID[lane] = laneHit.m_primID;
+				if ((fields & BVH_HIT_UV) && hitLeaf[lane]) {
+					hit.m_u[lane] = laneHit.m_u;
+					hit.m_v[lane] = laneHit.m_v;
+				}
+				if ((fields & BVH_HIT_NORMAL) && hitLeaf[lane])
+					normals[lane] = laneHit.m_normal;
+			}
+			if (fields & BVH_HIT_NORMAL)
+				hit.m_normal = DirType(normals);
+		}
+	}
+
+	// any-hit queries for shadow and AO rays, traversal stops at the first hit closer than tmax
+	bool Occluded(Vec3V_arg origin,Vec3V_arg dir,float tmax = ZBUFFER_DEFAULT) const;
+
+	// returns the mask of occluded rays out of the active ones - occluded rays are done and stop being tested, traversal stops
+	// once all rays are done (inactive rays start out done)
+	template <typename OriginType,typename DirType> VMATH_INLINE uint32 Occluded(const OriginType& origin,const DirType& dir,typename DirType::ComponentType::ArgType tmax,uint32 active = (uint32)-1) const
+	{
+		typedef typename DirType::ComponentType ComponentType;
+		const uint32 all = (uint32)((1ULL << ComponentType::NumElements) - 1);
+		const DirType invdir = Recip(dir);
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+		active &= all;
+		if (active == 0)
+			return 0;
+		uint32 done = all & ~active;
+		uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(this)};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uintptr_t ref = stack[--stackIndex];
+			if (ref & BVH_LEAF_FLAG) {
+				const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+				done |= leaf->Occluded(origin,dir,tmax,all & ~done);
+				if (done == all)
+					break;
+			} else {
+				const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
+					const uint32 mask = node->GetChildBounds(i).IntersectsRay(origin,invdir,tmax) & ~done; // only rays which are still looking for a hit
+					if (mask) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node->GetChildRef(i);
+						BVH_COUNTERS_ONLY(if (counters) counters->PushChild(mask,ComponentType::NumElements));
+					}
+				}
+			}
+		}
+		return done & active;
+	}
+
 	// returns sign of intersection (front/back)
 	VMATH_INLINE void TraceSign(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,ScalarV& sign) const
 	{
@@ -449,7 +1027,7 @@ public:
 					const uint32 mask = node->GetChildBounds(i).IntersectsRay(origin,invdir,t);
 					if (mask) {
 						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
-						stack[stackIndex++] = node->m_children[i];
+						stack[stackIndex++] = node->GetChildRef(i);
 					}
 				}
 			}
@@ -472,7 +1050,7 @@ public:
 					const uint32 mask = node->GetChildBounds(i).IntersectsRay(origin,invdir,t);
 					if (mask) {
 						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
-						stack[stackIndex++] = node->m_children[i];
+						stack[stackIndex++] = node->GetChildRef(i);
 					}
 				}
 			}
@@ -480,17 +1058,30 @@ public:
 	}
 
 	bool IntersectsSphere(const Sphere3V& sphere BVH_INSIDE_OUTSIDE_TEST_VIA_SPHERE_TEST_ONLY(,const Leaf*& leaf_,unsigned& index_)) const;
-#if BVH_LEAF_NUM_TRIANGLES_SOA <= 4
 	bool IntersectsBox(const Box3V& box) const;
-#endif // BVH_LEAF_NUM_TRIANGLES_SOA <= 4
+	// exact closest point within maxDistance - best-first traversal ordered by the distance to the child bounds, returns false if nothing was found
+	bool FindClosestPoint(Vec3V_arg pos,BVHClosestPoint& result,float maxDistance = FLT_MAX) const;
+
 	float FindMinimumDistanceToSurface(Vec3V_arg pos,float startRadius,float step = 0.0f,unsigned numSteps = 24) const;
+	float FindMinimumDistanceToSurfaceBisection(Vec3V_arg pos,float startRadius,float step = 0.0f,unsigned numSteps = 24) const; // binary search on IntersectsSphere
 	float FindMinimumDistanceToSurfaceEx(Vec3V_arg pos,Vec3V_arg cellSize,unsigned subCellResMinMax,unsigned subCellResGrad,float startRadius,float step = 0.0f,unsigned numSteps = 24,float* out_dmin = nullptr,float* out_dmax = nullptr,Vec4V* out_dgrad = nullptr) const;
 
 #if BVH_TILES
-	uintptr_t EntryPointSearch(const Plane3V frustum[4] BVH_STATS_ONLY(,EntryPointSearchStats& stats)) const;
-#if BVH_TILES_PATHCOMPRESSION
-	PathCompressionNode* PathCompression(const Plane3V frustum[4]) const;
-#endif // BVH_TILES_PATHCOMPRESSION
+	// see An Improved Multi-Level Raytracing Algorithm - Joshua Barczak
+	// entry point search returns the deepest node (or leaf) below ref which contains everything ref has inside the frustum,
+	// or 0 if nothing is - rays inside the frustum can start traversal there instead of at ref
+	VMATH_INLINE static uintptr_t EntryPointSearch(uintptr_t ref,const BVHFrustum& frustum BVH_STATS_ONLY(,EntryPointSearchStats& stats))
+	{
+		uintptr_t entry = 0;
+		PathCompression(ref,frustum,&entry,1 BVH_STATS_ONLY(,stats));
+		return entry;
+	}
+	// path compression generalizes this to up to maxEntries disjoint subtrees, so a tile which sees two distant parts of the
+	// tree doesn't fall back to their common ancestor - returns the number of entry points written
+	static unsigned PathCompression(uintptr_t ref,const BVHFrustum& frustum,uintptr_t entries[],unsigned maxEntries BVH_STATS_ONLY(,EntryPointSearchStats& stats));
+private:
+	static unsigned PathCompressionInternal(uintptr_t ref,const BVHFrustum& frustum,uint32 planeMask,uintptr_t entries[],unsigned maxEntries BVH_STATS_ONLY(,EntryPointSearchStats& stats));
+public:
 #endif // BVH_TILES
 
 #if BVH_STATS
@@ -513,7 +1104,13 @@ public:
 #else
 	Box3V m_bounds[N];
 #endif
-	uintptr_t m_children[N];
+	uintptr_t m_children[N]; // with BVH_CHILD_ORDER, children 0, 1 and 2 carry the tags of the splits 01|23, 0|1 and 2|3 (see ComputeChildOrder)
+
+private:
+#if BVH_CHILD_ORDER
+	// tag bits 1-2 are the split axis (3 means no axis, the order is fixed) and bit 3 is set if the first side is the upper one
+	VMATH_INLINE unsigned GetSplitReversed(unsigned split,unsigned octant) const { const unsigned tag = (unsigned)m_children[split] >> 1; return ((octant >> (tag & 3)) ^ (tag >> 2)) & 1; }
+#endif // BVH_CHILD_ORDER
 };
 
 #if BVH_SOA_BOUNDS_INTERSECT_SINGLE_RAYS_AGAINST_ALL_CHILDREN_SIMULTANEOUSLY
@@ -521,22 +1118,39 @@ public:
 template <> VMATH_INLINE void BVH4Node::TraceStatic<Vec3V,Vec3V>(uintptr_t ref_,const Vec3V& origin,const Vec3V& dir,ScalarV& t BVH_STATS_ONLY(,uint32 mask_,BVHStats& stats))
 {
 	const Vec3V invdir = Recip(dir);
+#if BVH_CHILD_ORDER
+	const unsigned octant = GetDirectionOctant(dir);
+#endif // BVH_CHILD_ORDER
+	BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+	BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
 	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {ref_};
 	unsigned stackIndex = 1;
 	while (stackIndex > 0) {
 		const uintptr_t ref = stack[--stackIndex];
-		if (ref & BVH_LEAF_FLAG)
-			reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG)->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,0x0001,stats));
-		else {
+		if (ref & BVH_LEAF_FLAG) {
+			const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+			leaf->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,0x0001,stats));
+		} else {
 			const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
 			BVH_STATS_ONLY(stats.EnterNode(0x0001,node->m_depth));
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
 			uint32 childMask = node->m_bounds.IntersectsRay(origin,invdir,t); // intersect all child bounds at once
-		#if 0 && PLATFORM_PC // use _tzcnt_u32 and _blsr_u32 (this hasn't shown improvement in my tests)
+		#if BVH_CHILD_ORDER
+			for (unsigned order = node->GetChildOrder(octant), k = 0; childMask && k < N; k++, order >>= 2) { // farthest child first, in the low bits
+				const unsigned childIndex = order & 3;
+				if ((childMask & (1 << childIndex)) && node->IsChildNonEmpty(childIndex)) { // IsChildNonEmpty, see below
+					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+					stack[stackIndex++] = node->GetChildRef(childIndex);
+					childMask &= ~(1 << childIndex);
+				}
+			}
+		#elif 0 && PLATFORM_PC // use _tzcnt_u32 and _blsr_u32 (this hasn't shown improvement in my tests)
 			unsigned childIndex = _tzcnt_u32(childMask);
 			while (childIndex < 32 && node->IsChildNonEmpty(childIndex)) { // lame .. need to test IsChildNonEmpty because apparently my IntersectsRay code can return positive results for FLT_MAX bounding boxes
 				DEBUG_ASSERT(childIndex < N)// && node->IsChildNonEmpty(childIndex));
 				DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
-				stack[stackIndex++] = node->m_children[childIndex];
+				stack[stackIndex++] = node->GetChildRef(childIndex);
 				childMask = _blsr_u32(childMask);
 				childIndex = _tzcnt_u32(childMask);
 			}
@@ -546,7 +1160,7 @@ template <> VMATH_INLINE void BVH4Node::TraceStatic<Vec3V,Vec3V>(uintptr_t ref_,
 				if (childMask & 1) {
 					DEBUG_ASSERT(childIndex < N);// && node->IsChildNonEmpty(childIndex));
 					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
-					stack[stackIndex++] = node->m_children[childIndex];
+					stack[stackIndex++] = node->GetChildRef(childIndex);
 				}
 				childMask >>= 1;
 				childIndex++;
@@ -572,4 +1186,109 @@ VMATH_INLINE void BVH4Node::TraceStatic(uintptr_t ref,Vec3V_arg origin,Vec3V_arg
 	t_ = t.f();
 }
 
+#if HAS_VEC8V
+// same as BVH4Node but eight children per node, single rays intersect all eight child bounds in one Vec8V pass
+// nodes are allocated 32-byte aligned (Box3V_SOA8), built via BuildBVH8 and linearized like BVH4Node
+class BVH8Node : public BVHCommon
+{
+public:
+	enum { N = 8 };
+
+	VMATH_INLINE static const char* GetClassName_() { return "BVH8"; }
+
+	void* operator new(size_t size);
+	void operator delete(void* ptr);
+
+	static BVH8Node* Linearize(const BVH8Node* root,Layout layout = BVH_LAYOUT_DEPTH_FIRST,size_t* arenaSize = NULL);
+	void Release(); // linearized trees only
+	void ReleaseNodes(); // trees with individually allocated nodes and leaves (BVHBuilder::BuildNode)
+
+	const BVHCounts Count() const;
+	const Box3V GetBounds() const;
+
+	VMATH_INLINE const Box3V GetChildBounds(unsigned i) const { DEBUG_ASSERT(i < N); return m_bounds.GetIndexed(i); }
+	VMATH_INLINE bool IsChildNonEmpty(unsigned i) const { DEBUG_ASSERT(i < N); return m_children[i] != 0; }
+	VMATH_INLINE bool IsChildLeaf(unsigned i) const { DEBUG_ASSERT(i < N); return (m_children[i] & BVH_LEAF_FLAG) != 0; }
+	VMATH_INLINE BVH8Node* GetChildNode(unsigned i) const { DEBUG_ASSERT(i < N && !IsChildLeaf(i)); return reinterpret_cast<BVH8Node*>(m_children[i]); }
+	VMATH_INLINE Leaf* GetChildLeaf(unsigned i) const { DEBUG_ASSERT(i < N && IsChildLeaf(i)); return reinterpret_cast<Leaf*>(m_children[i] & ~BVH_LEAF_FLAG); }
+
+	template <typename OriginType,typename DirType> VMATH_INLINE void Trace(const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
+	{
+		TraceStatic(reinterpret_cast<uintptr_t>(this),origin,dir,t BVH_STATS_ONLY(,mask,stats));
+	}
+
+	VMATH_INLINE void Trace(Vec3V_arg origin,Vec3V_arg dir,float& t_ BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const;
+
+	template <typename OriginType,typename DirType> VMATH_INLINE static void TraceStatic(uintptr_t ref_,const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats))
+	{
+		const DirType invdir = Recip(dir);
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+		uintptr_t stack[BVH_STACK_MAX_DEPTH] = {ref_};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uintptr_t ref = stack[--stackIndex];
+			if (ref & BVH_LEAF_FLAG) {
+				const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+				leaf->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,mask,stats));
+			} else {
+				const BVH8Node* node = reinterpret_cast<const BVH8Node*>(ref);
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
+					const uint32 mask = node->GetChildBounds(i).IntersectsRay(origin,invdir,t);
+					if (mask) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node->m_children[i];
+						BVH_COUNTERS_ONLY(if (counters) counters->PushChild(mask,DirType::ComponentType::NumElements));
+					}
+				}
+			}
+		}
+	}
+
+	Box3V_SOA8 m_bounds;
+	uintptr_t m_children[N];
+};
+
+// have to define this outside of the BVH8Node class for PS4 (see BVH4Node::TraceStatic<Vec3V,Vec3V>)
+template <> VMATH_INLINE void BVH8Node::TraceStatic<Vec3V,Vec3V>(uintptr_t ref_,const Vec3V& origin,const Vec3V& dir,ScalarV& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats))
+{
+	const Vec3V invdir = Recip(dir);
+	BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+	BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {ref_};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const Leaf* leaf = reinterpret_cast<const Leaf*>(ref & ~BVH_LEAF_FLAG);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(leaf->m_count));
+			leaf->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,0x0001,stats));
+		} else {
+			const BVH8Node* node = reinterpret_cast<const BVH8Node*>(ref);
+			BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+			uint32 childMask = node->m_bounds.IntersectsRay(origin,invdir,t); // intersect all eight child bounds at once
+			unsigned childIndex = 0;
+			while (childMask && node->IsChildNonEmpty(childIndex)) {
+				if (childMask & 1) {
+					DEBUG_ASSERT(childIndex < N);
+					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+					stack[stackIndex++] = node->m_children[childIndex];
+				}
+				childMask >>= 1;
+				childIndex++;
+			}
+		}
+	}
+}
+
+VMATH_INLINE void BVH8Node::Trace(Vec3V_arg origin,Vec3V_arg dir,float& t_ BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
+{
+	ScalarV t(t_);
+	TraceStatic(reinterpret_cast<uintptr_t>(this),origin,dir,t BVH_STATS_ONLY(,mask,stats));
+	t_ = t.f();
+}
+#endif // HAS_VEC8V
+
 #endif // _INCLUDE_BVH_H_
\ No newline at end of file
@@ -0,0 +1,469 @@
+// ============================
+// common/bvh/bvh_benchmark.cpp
+// ============================
+
+#include "common/common.h"
+
+#include "GraphicsTools/util/mesh.h"
+#include "GraphicsTools/util/progressdisplay.h"
+#include "GraphicsTools/util/taskscheduler.h"
+
+#include "vmath/bvh/bvh.h"
+#include "vmath/bvh/bvh_benchmark.h"
+#include "vmath/bvh/bvh_builder.h"
+#include "vmath/bvh/bvh_render.h"
+
+#include "vmath/vmath.h"
+#include "vmath/vmath_sphere.h"
+
+// one JSON object per line - every record starts with the scene and the test, the rest of the fields depend on the test
+class BVHBenchmarkOutput
+{
+public:
+	BVHBenchmarkOutput(FILE* f, const char* scene, uint32 numTris) : m_file(f), m_scene(scene), m_numTris(numTris) {}
+
+	void Write(const char* test, const char* variant, unsigned numThreads, const char* format, ...) const
+	{
+		fprintf(m_file, "{\"scene\": \"%s\", \"tris\": %u, \"test\": \"%s\", \"variant\": \"%s\", \"threads\": %u", m_scene, m_numTris, test, variant, numThreads);
+		va_list args;
+		va_start(args, format);
+		vfprintf(m_file, format, args);
+		va_end(args);
+		fprintf(m_file, "}\n");
+		fflush(m_file); // keep partial results if a later scene crashes or is killed
+	}
+
+private:
+	FILE* m_file;
+	const char* m_scene;
+	uint32 m_numTris;
+};
+
+// scene names go into JSON strings as is, so strip the directory and extension and replace anything which would need escaping
+static const std::string GetSceneName(const char* path)
+{
+	const char* name = path;
+	for (const char* s = path; *s; s++) {
+		if (*s == '/' || *s == '\\' || *s == ':')
+			name = s + 1;
+	}
+	std::string sceneName(name);
+	const size_t ext = sceneName.find_last_of('.');
+	if (ext != std::string::npos && ext > 0)
+		sceneName.resize(ext);
+	for (size_t i = 0; i < sceneName.size(); i++) {
+		if (sceneName[i] == '"' || (unsigned char)sceneName[i] < 32)
+			sceneName[i] = '_';
+	}
+	return sceneName;
+}
+
+// bytes of nodes and leaves, excluding the alignment padding between them in the arena
+static size_t GetTreeMemory(const BVH4Node* node)
+{
+	size_t size = sizeof(BVH4Node);
+	for (unsigned i = 0; i < BVH4Node::N && node->IsChildNonEmpty(i); i++) {
+		if (node->IsChildLeaf(i))
+			size += node->GetChildLeaf(i)->GetSize();
+		else
+			size += GetTreeMemory(node->GetChildNode(i));
+	}
+	return size;
+}
+
+// directions on a spherical Fibonacci spiral, so any number of views covers the sphere evenly and every run uses the same views
+static void GetBenchmarkViews(std::vector<Vec3V>& views, unsigned numViews)
+{
+	views.resize(numViews);
+	for (unsigned i = 0; i < numViews; i++) {
+		const float y = 1.0f - (float)(2*i + 1)/(float)numViews;
+		const float r = sqrtf(Max(0.0f, 1.0f - y*y));
+		const float phi = (float)i*2.39996323f; // golden angle
+		views[i] = Vec3V(r*cosf(phi), y, r*sinf(phi));
+	}
+}
+
+template <typename Func> static float GetBestTimeInSeconds(unsigned numRepeats, Func func)
+{
+	float best = FLT_MAX;
+	for (unsigned i = 0; i < Max(1U, numRepeats); i++) {
+		const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		func();
+		best = Min(ProgressDisplay::GetTimeInSeconds(startTime), best);
+	}
+	return best;
+}
+
+template <typename NodeType> class BVHBenchmarkRenderVariant
+{
+public:
+	typedef void (*RenderFunc)(const NodeType*, Mat34V_arg, float, float*, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+	const char* m_name;
+	RenderFunc m_render;
+};
+
+#if BVH_LARGE_PACKETS
+typedef void (*RenderLargeFunc)(const BVH4Node*, Mat34V_arg, float, float*, unsigned, unsigned, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+
+// fits the large packet renders into the same table as the others
+template <RenderLargeFunc renderLarge, unsigned largeSize> static void RenderLarge(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	renderLarge(root, camera, tanVFOV, zbuf, w, h, largeSize, largeSize, zclear, zscale, zoffset, calc_z_range, path BVH_THREADS_ONLY(, scheduler));
+}
+#endif // BVH_LARGE_PACKETS
+
+// rasterizes every view with each thread count - the z-buffers are kept in references (w*h floats per view) and every render
+// is checked against them
+static void BenchmarkRaster(const BVHBenchmarkOutput& output, const std::vector<Triangle3V>& triangles, const Box3V& bounds, const std::vector<Vec3V>& views, const std::vector<unsigned>& threadCounts, const std::vector<TaskScheduler*>& schedulers, const BVHBenchmarkParams& params, float* references)
+{
+	const unsigned w = params.m_w;
+	const unsigned h = params.m_h;
+	float zscale = 1.0f;
+	float zoffset = 0.0f;
+	bool calc_z_range = false;
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		const unsigned numThreads = threadCounts[t];
+		for (size_t j = 0; j < views.size(); j++) {
+			const Vec3V forward = views[j];
+			const Mat34V camera = GetBoundsViewCamera(bounds, forward, params.m_tanVFOV);
+			float* zbuf = references + j*w*h; // the same for every thread count, the depth test doesn't depend on triangle order
+			const float seconds = GetBestTimeInSeconds(params.m_numRepeats, [&]() {
+				RenderTriangles_RASTER(triangles, camera, params.m_tanVFOV, zbuf, w, h, true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, schedulers[t]));
+			});
+			output.Write("raster", "tiled", numThreads, ", \"view\": %u, \"dir\": [%.4f, %.4f, %.4f], \"pixels\": %u, \"ms\": %.4f, \"mpixels_per_sec\": %.4f", (unsigned)j, forward.xf(), forward.yf(), forward.zf(), w*h, seconds*1000.0f, (float)(w*h)/(seconds*1000000.0f));
+		}
+	}
+}
+
+template <typename NodeType, size_t NumVariants> static void BenchmarkRender(const BVHBenchmarkOutput& output, const NodeType* root, const BVHBenchmarkRenderVariant<NodeType> (&variants)[NumVariants], const std::vector<Vec3V>& views, const std::vector<unsigned>& threadCounts, const std::vector<TaskScheduler*>& schedulers, const BVHBenchmarkParams& params, const float* references)
+{
+	const unsigned w = params.m_w;
+	const unsigned h = params.m_h;
+	const Box3V bounds = root->GetBounds();
+	float* zbuf = AlignedAlloc<float>(w*h, 64);
+	float zscale = 1.0f;
+	float zoffset = 0.0f;
+	bool calc_z_range = false;
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		const unsigned numThreads = threadCounts[t];
+		for (size_t i = 0; i < NumVariants; i++) {
+			for (size_t j = 0; j < views.size(); j++) {
+				const Vec3V forward = views[j];
+				const Mat34V camera = GetBoundsViewCamera(bounds, forward, params.m_tanVFOV);
+				const float seconds = GetBestTimeInSeconds(params.m_numRepeats, [&]() {
+					variants[i].m_render(root, camera, params.m_tanVFOV, zbuf, w, h, true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, schedulers[t])); // NULL path keeps the raw z values
+				});
+				unsigned numCoverageMismatches = 0;
+				const unsigned numMismatches = CountZBufferMismatches(zbuf, references + j*w*h, w, h, 0.001f, &numCoverageMismatches);
+				output.Write("render", variants[i].m_name, numThreads, ", \"view\": %u, \"dir\": [%.4f, %.4f, %.4f], \"rays\": %u, \"ms\": %.4f, \"mrays_per_sec\": %.4f, \"mismatches\": %u, \"coverage_mismatches\": %u", (unsigned)j, forward.xf(), forward.yf(), forward.zf(), w*h, seconds*1000.0f, (float)(w*h)/(seconds*1000000.0f), numMismatches, numCoverageMismatches);
+			}
+		}
+	}
+	AlignedFree(zbuf);
+}
+
+// WeldPositions against the previous sort-based WeldPositionsBands, each run on a fresh copy of the positions
+static void BenchmarkWeld(const BVHBenchmarkOutput& output, const geomesh::TriangleMesh& mesh, const std::vector<unsigned>& threadCounts, const std::vector<TaskScheduler*>& schedulers, const BVHBenchmarkParams& params)
+{
+	geomesh::TriangleMesh copy;
+	auto BenchmarkVariant = [&](const char* variant, unsigned numThreads, const std::function<void()>& weld) {
+		float seconds = FLT_MAX;
+		for (unsigned i = 0; i < Max(1U, params.m_numRepeats); i++) {
+			copy.m_verts = mesh.m_verts; // outside the timed region
+			copy.m_polys = mesh.m_polys;
+			const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+			weld();
+			seconds = Min(ProgressDisplay::GetTimeInSeconds(startTime), seconds);
+		}
+		uint32 numMoved = 0;
+		for (size_t i = 0; i < mesh.m_verts.size(); i++)
+			numMoved += Any(copy.m_verts[i] != mesh.m_verts[i]) ? 1 : 0;
+		output.Write("weld", variant, numThreads, ", \"verts\": %u, \"tolerance\": %f, \"moved\": %u, \"polys_removed\": %u, \"ms\": %.4f", (unsigned)mesh.m_verts.size(), params.m_weldTolerance, numMoved, (unsigned)(mesh.m_polys.size() - copy.m_polys.size()), seconds*1000.0f);
+	};
+	BenchmarkVariant("bands", 1, [&]() { geomesh::WeldPositionsBands(copy, params.m_weldTolerance); });
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		TaskScheduler* scheduler = threadCounts[t] > 1 ? schedulers[t] : NULL;
+		BenchmarkVariant("grid", threadCounts[t], [&]() { geomesh::WeldPositions(copy, params.m_weldTolerance, false, scheduler); });
+		BenchmarkVariant("grid remap", threadCounts[t], [&]() { geomesh::WeldPositions(copy, params.m_weldTolerance, true, scheduler); });
+	}
+}
+
+// WeldVertices and AddVertex(useMap) on a triangle soup of the mesh, every corner its own vertex so both have duplicates to find
+static void BenchmarkWeldVertices(const BVHBenchmarkOutput& output, const geomesh::TriangleMesh& mesh, const BVHBenchmarkParams& params)
+{
+	geomesh::TriangleMesh soup;
+	soup.m_verts.reserve(mesh.m_polys.size()*3);
+	soup.m_polys.reserve(mesh.m_polys.size());
+	for (size_t i = 0; i < mesh.m_polys.size(); i++) {
+		const uint32 vertStart = (uint32)soup.m_verts.size();
+		for (unsigned j = 0; j < 3; j++)
+			soup.m_verts.push_back(mesh.m_verts[mesh.m_polys[i].m_indices[j]]);
+		soup.m_polys.push_back(geomesh::IndexedTriangle(0, vertStart, vertStart + 1, vertStart + 2, mesh.m_polys[i].m_group));
+	}
+	geomesh::TriangleMesh copy;
+	auto BenchmarkVariant = [&](const char* variant, const std::function<void()>& reset, const std::function<void()>& weld) {
+		float seconds = FLT_MAX;
+		for (unsigned i = 0; i < Max(1U, params.m_numRepeats); i++) {
+			reset(); // outside the timed region
+			const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+			weld();
+			seconds = Min(ProgressDisplay::GetTimeInSeconds(startTime), seconds);
+		}
+		output.Write("weld", variant, 1, ", \"verts\": %u, \"unique\": %u, \"ms\": %.4f", (unsigned)soup.m_verts.size(), (unsigned)copy.m_verts.size(), seconds*1000.0f);
+	};
+	BenchmarkVariant("vertices",
+		[&]() { copy.m_verts = soup.m_verts; copy.m_polys = soup.m_polys; },
+		[&]() { geomesh::WeldVertices(copy); });
+	BenchmarkVariant("add_vertex map",
+		[&]() { copy.Clear(); copy.m_polys.clear(); },
+		[&]() {
+			for (uint32 i = 0; i < (uint32)soup.m_verts.size(); i++)
+				copy.AddVertex(soup.GetVertex(i), true);
+		});
+}
+
+static void BenchmarkScene(FILE* f, const char* name, geomesh::TriangleMesh& mesh, const std::vector<unsigned>& threadCounts, const std::vector<TaskScheduler*>& schedulers, const BVHBenchmarkParams& params)
+{
+	typedef BVHBuilder<BVH4Node,BVHCommon::Leaf,Triangle3V> Builder;
+	const BVHBenchmarkOutput output(f, name, (uint32)mesh.m_polys.size());
+	printf("benchmarking %s (%u verts, %u tris)\n", name, (unsigned)mesh.m_verts.size(), (unsigned)mesh.m_polys.size());
+
+	if (params.m_weldTolerance > 0.0f)
+		BenchmarkWeld(output, mesh, threadCounts, schedulers, params);
+	BenchmarkWeldVertices(output, mesh, params);
+
+	// builds - median and binned SAH on the calling thread, then binned SAH with each thread count
+	const BVHBuildParams median(BVHBuildParams::BVH_SPLIT_MEDIAN);
+	const BVHBuildParams sah(BVHBuildParams::BVH_SPLIT_BINNED_SAH);
+	auto BenchmarkBuild = [&](const char* variant, const BVHBuildParams& buildParams) {
+		BVH4Node* root = NULL;
+		float seconds = FLT_MAX;
+		for (unsigned i = 0; i < Max(1U, params.m_numRepeats); i++) {
+			if (root)
+				root->Release(); // outside the timed region
+			const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+			root = BuildBVH4(mesh, nullptr, buildParams);
+			seconds = Min(ProgressDisplay::GetTimeInSeconds(startTime), seconds);
+		}
+		const BVHCounts counts = root->Count();
+		const size_t memory = GetTreeMemory(root);
+		const unsigned numThreads = buildParams.m_scheduler ? buildParams.m_scheduler->GetNumThreads() : 1;
+		output.Write("build", variant, numThreads, ", \"build_ms\": %.4f, \"sah_cost\": %.4f, \"nodes\": %u, \"leaves\": %u, \"memory_bytes\": %u, \"bytes_per_tri\": %.2f", seconds*1000.0f, Builder::GetSAHCost(root, median), counts.m_nodeCount, counts.m_leafCount, (unsigned)memory, (float)memory/(float)Max(1U, counts.m_triCount)); // all trees measured with the same cost model
+		root->Release();
+	};
+	BenchmarkBuild("median", median);
+	BenchmarkBuild("binned SAH", sah);
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		if (threadCounts[t] > 1) {
+			BVHBuildParams sahThreaded(BVHBuildParams::BVH_SPLIT_BINNED_SAH);
+			sahThreaded.m_scheduler = schedulers[t];
+			BenchmarkBuild("binned SAH", sahThreaded);
+		}
+	}
+
+	// renders - the rasterized references, then every packet shape from every view
+	std::vector<Vec3V> views;
+	GetBenchmarkViews(views, params.m_numViews);
+	BVH4Node* root = BuildBVH4(mesh, nullptr, sah);
+	std::vector<Triangle3V> triangles(mesh.m_polys.size());
+	for (size_t i = 0; i < triangles.size(); i++)
+		triangles[i] = geomesh::MakePoly(mesh.m_polys[i], mesh.m_verts);
+	float* references = AlignedAlloc<float>(views.size()*params.m_w*params.m_h, 64);
+	BenchmarkRaster(output, triangles, root->GetBounds(), views, threadCounts, schedulers, params, references);
+	const BVHBenchmarkRenderVariant<BVH4Node> variants[] = {
+		{"BVH4 1x1", RenderTriangles_BVH_1x1},
+		{"BVH4 4x1", RenderTriangles_BVH_4x1},
+		{"BVH4 2x2", RenderTriangles_BVH_2x2},
+	#if HAS_VEC8V
+		{"BVH4 8x1", RenderTriangles_BVH_8x1},
+		{"BVH4 4x2", RenderTriangles_BVH_4x2},
+	#endif // HAS_VEC8V
+	#if BVH_LARGE_PACKETS
+		{"BVH4 4x1 large 16x16", RenderLarge<RenderTriangles_BVH_LARGE_4x1, 16>},
+		{"BVH4 2x2 large 16x16", RenderLarge<RenderTriangles_BVH_LARGE_2x2, 16>},
+	#if HAS_VEC8V
+		{"BVH4 8x1 large 16x16", RenderLarge<RenderTriangles_BVH_LARGE_8x1, 16>},
+		{"BVH4 4x2 large 16x16", RenderLarge<RenderTriangles_BVH_LARGE_4x2, 16>},
+	#endif // HAS_VEC8V
+	#endif // BVH_LARGE_PACKETS
+	};
+	BenchmarkRender(output, root, variants, views, threadCounts, schedulers, params, references);
+#if HAS_VEC8V
+	{
+		BVH8Node* root8 = BuildBVH8(mesh, nullptr, sah);
+		const BVHBenchmarkRenderVariant<BVH8Node> variants8[] = {
+			{"BVH8 1x1", RenderTriangles_BVH8_1x1},
+			{"BVH8 4x1", RenderTriangles_BVH8_4x1},
+			{"BVH8 2x2", RenderTriangles_BVH8_2x2},
+			{"BVH8 8x1", RenderTriangles_BVH8_8x1},
+			{"BVH8 4x2", RenderTriangles_BVH8_4x2},
+		};
+		BenchmarkRender(output, root8, variants8, views, threadCounts, schedulers, params, references);
+		root8->Release();
+	}
+#endif // HAS_VEC8V
+	AlignedFree(references);
+
+	// occlusion - every mode, from (a subset of) the mesh vertices
+	if (params.m_numOcclusionSamples > 0) {
+		if (mesh.m_normals == NULL)
+			geomesh::ConstructNormals(mesh);
+		const size_t stride = (mesh.m_verts.size() + params.m_maxOcclusionVerts - 1)/Max(1U, params.m_maxOcclusionVerts);
+		std::vector<Vec3V> verts;
+		std::vector<Vec3V> normals;
+		for (size_t i = 0; i < mesh.m_verts.size(); i += Max<size_t>(1, stride)) {
+			verts.push_back(mesh.m_verts[i]);
+			normals.push_back(mesh.m_normals->operator[](i));
+		}
+		const OcclusionMode modes[] = {OCCLUSION_TRACE, OCCLUSION_RAY_STREAM, OCCLUSION_OCCLUDED, OCCLUSION_OCCLUDED_PACKETS};
+		const uint64 numRays = (uint64)verts.size()*params.m_numOcclusionSamples;
+		std::vector<float> occlusion;
+		for (size_t t = 0; t < threadCounts.size(); t++) {
+			const unsigned numThreads = threadCounts[t];
+			for (unsigned i = 0; i < countof(modes); i++) {
+				const float seconds = GetBestTimeInSeconds(params.m_numRepeats, [&]() {
+					RenderOcclusion(root, verts, normals, occlusion, params.m_numOcclusionSamples BVH_THREADS_ONLY(, schedulers[t]), modes[i]);
+				});
+				output.Write("occlusion", GetOcclusionModeName(modes[i]), numThreads, ", \"verts\": %u, \"samples\": %u, \"rays\": %llu, \"ms\": %.4f, \"mrays_per_sec\": %.4f", (unsigned)verts.size(), params.m_numOcclusionSamples, numRays, seconds*1000.0f, (float)numRays/(seconds*1000000.0f));
+			}
+		}
+	}
+	root->Release();
+}
+
+bool RunBVHBenchmarks(const std::vector<const char*>& objPaths, const BVHBenchmarkParams& params)
+{
+	if (params.m_w == 0 || params.m_h == 0 || params.m_w%8 != 0 || params.m_h%8 != 0) {
+		fprintf(stderr, "benchmark resolution %ux%u must be a non-zero multiple of 8!\n", params.m_w, params.m_h);
+		return false;
+	}
+	FILE* f = stdout;
+	if (params.m_outputPath) {
+		f = fopen(params.m_outputPath, "w");
+		if (f == NULL) {
+			fprintf(stderr, "failed to open %s!\n", params.m_outputPath);
+			return false;
+		}
+	}
+#if BVH_THREADS
+	std::vector<unsigned> threadCounts = params.m_threadCounts;
+	if (threadCounts.empty())
+		threadCounts.push_back(0);
+#else
+	const std::vector<unsigned> threadCounts(1, 1);
+#endif
+	// one scheduler per thread count for the whole run, so the timings don't include starting and joining threads
+	std::vector<TaskScheduler*> schedulers(threadCounts.size(), NULL);
+#if BVH_THREADS
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		if (threadCounts[t] > 0)
+			schedulers[t] = new TaskScheduler(threadCounts[t]);
+	}
+#endif // BVH_THREADS
+	fprintf(f, "{\"test\": \"config\", \"w\": %u, \"h\": %u, \"tan_vfov\": %.4f, \"views\": %u, \"repeats\": %u, \"edge_length\": %.4f, \"weld_tolerance\": %f, \"occlusion_samples\": %u, \"node_size\": %u, \"leaf_tris\": %u, \"child_order\": %u, \"vec8\": %u}\n",
+		params.m_w, params.m_h, params.m_tanVFOV, params.m_numViews, params.m_numRepeats, params.m_edgeLength, params.m_weldTolerance, params.m_numOcclusionSamples, (unsigned)sizeof(BVH4Node), (unsigned)BVH_LEAF_NUM_TRIANGLES_SOA, (unsigned)BVH_CHILD_ORDER, (unsigned)HAS_VEC8V);
+
+	// procedural scenes are unit sized and tessellated to the same edge length, so triangle counts scale with surface area
+	const Vec3V origin(V_ZERO);
+	{
+		geomesh::TriangleMesh mesh;
+		geomesh::ConstructSphere(mesh, Sphere3V(origin, 0.5f));
+		geomesh::TessellateToEdgeLength(mesh, params.m_edgeLength);
+		BenchmarkScene(f, "sphere", mesh, threadCounts, schedulers, params);
+	}
+	{
+		geomesh::TriangleMesh mesh;
+		geomesh::ConstructRoundBox(mesh, Box3V(Vec3V(-0.5f), Vec3V(0.5f)), 0.125f);
+		geomesh::TessellateToEdgeLength(mesh, params.m_edgeLength);
+		BenchmarkScene(f, "roundbox", mesh, threadCounts, schedulers, params);
+	}
+	{
+		// mostly empty space with varying sphere sizes, so traversal can't just hit the first box it enters
+		enum { GRID_SIZE = 4 };
+		geomesh::TriangleMesh mesh;
+		for (unsigned k = 0; k < GRID_SIZE; k++) {
+			for (unsigned j = 0; j < GRID_SIZE; j++) {
+				for (unsigned i = 0; i < GRID_SIZE; i++) {
+					const Vec3V center = (Vec3V((float)i, (float)j, (float)k) + Vec3V(0.5f))*(1.0f/(float)GRID_SIZE) - Vec3V(0.5f);
+					const float radius = (0.15f + 0.2f*(float)((i + j*3 + k*7)%5)/4.0f)/(float)GRID_SIZE;
+					geomesh::ConstructSphere(mesh, Sphere3V(center, radius), NULL, 16, 20);
+				}
+			}
+		}
+		geomesh::TessellateToEdgeLength(mesh, params.m_edgeLength);
+		BenchmarkScene(f, "sphere_grid", mesh, threadCounts, schedulers, params);
+	}
+	for (size_t i = 0; i < objPaths.size(); i++) {
+		geomesh::TriangleMesh mesh;
+		if (!geomesh::LoadOBJ(objPaths[i], mesh, false) || mesh.m_polys.empty()) {
+			fprintf(stderr, "failed to load %s, skipping!\n", objPaths[i]);
+			continue;
+		}
+		BenchmarkScene(f, GetSceneName(objPaths[i]).c_str(), mesh, threadCounts, schedulers, params);
+	}
+	for (size_t t = 0; t < schedulers.size(); t++)
+		delete schedulers[t];
+	if (f != stdout)
+		fclose(f);
+	return true;
+}
+
+int BVHBenchmarkMain(int argc, const char* argv[])
+{
+	BVHBenchmarkParams params;
+	std::vector<const char*> objPaths;
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (arg[0] != '-') {
+			objPaths.push_back(arg);
+			continue;
+		} else if (value == NULL) {
+			fprintf(stderr, "missing value for %s!\n", arg);
+			return 1;
+		}
+		i++;
+		if (strcmp(arg, "-w") == 0)
+			params.m_w = (unsigned)atoi(value);
+		else if (strcmp(arg, "-h") == 0)
+			params.m_h = (unsigned)atoi(value);
+		else if (strcmp(arg, "-views") == 0)
+			params.m_numViews = (unsigned)atoi(value);
+		else if (strcmp(arg, "-repeat") == 0)
+			params.m_numRepeats = (unsigned)atoi(value);
+		else if (strcmp(arg, "-edge") == 0)
+			params.m_edgeLength = (float)atof(value);
+		else if (strcmp(arg, "-samples") == 0)
+			params.m_numOcclusionSamples = (unsigned)atoi(value);
+		else if (strcmp(arg, "-weld") == 0)
+			params.m_weldTolerance = (float)atof(value);
+		else if (strcmp(arg, "-o") == 0)
+			params.m_outputPath = value;
+		else if (strcmp(arg, "-threads") == 0) { // comma separated list
+			params.m_threadCounts.clear();
+			for (const char* s = value; *s; ) {
+				char* end = NULL;
+				params.m_threadCounts.push_back((unsigned)strtoul(s, &end, 10));
+				if (end == s)
+					break;
+				s = (*end == ',') ? end + 1 : end;
+			}
+		} else {
+			fprintf(stderr, "unknown option %s!\n", arg);
+			fprintf(stderr, "usage: bvh_benchmark [-w width] [-h height] [-threads 1,4,8] [-views n] [-repeat n] [-edge length] [-samples n] [-weld tolerance] [-o output.jsonl] [file.obj ...]\n");
+			return 1;
+		}
+	}
+	if (params.m_edgeLength <= 0.0f) {
+		fprintf(stderr, "edge length must be positive!\n");
+		return 1;
+	}
+	return RunBVHBenchmarks(objPaths, params) ? 0 : 1;
+}
+
+#if defined(BVH_BENCHMARK_MAIN) // define this when compiling the suite as its own executable
+int main(int argc, const char* argv[])
+{
+	return BVHBenchmarkMain(argc, argv);
+}
+#endif // defined(BVH_BENCHMARK_MAIN)
\ No newline at end of file
@@ -0,0 +1,56 @@
+// ==========================
+// common/bvh/bvh_benchmark.h
+// ==========================
+
+#ifndef _INCLUDE_BVH_BENCHMARK_H_
+#define _INCLUDE_BVH_BENCHMARK_H_
+
+#include "common/common.h"
+
+#include "vmath/bvh/bvh.h"
+
+// standalone benchmark suite - builds procedural scenes (a sphere, a round box and a grid of spheres, tessellated to
+// m_edgeLength so the density is controlled) plus any OBJ files given, then for each scene times WeldPositions against the
+// previous implementation, the BVH4 builders, and renders every packet shape and occlusion mode at each thread count from a
+// fixed set of views - each view is also rasterized (RenderTriangles_RASTER) and every render reports how many pixels don't
+// match the rasterized z-buffer
+// results are written as JSON lines (one object per measurement) so runs on different machines/commits can be diffed,
+// instead of hand-pasting numbers into the comment at the top of bvh.h
+class BVHBenchmarkParams
+{
+public:
+	BVHBenchmarkParams() :
+		m_w(512),
+		m_h(512),
+		m_tanVFOV(0.5f),
+		m_numViews(8),
+		m_numRepeats(3),
+		m_edgeLength(0.02f),
+		m_weldTolerance(0.001f),
+		m_numOcclusionSamples(64),
+		m_maxOcclusionVerts(16384),
+		m_outputPath(NULL)
+	{
+		m_threadCounts.push_back(1);
+	}
+
+	unsigned m_w, m_h; // must be multiples of the largest packet size (8x1, 4x2)
+	float m_tanVFOV;
+	unsigned m_numViews; // spread evenly over the sphere of directions, the same for every run
+	unsigned m_numRepeats; // each measurement is the best of this many runs
+	float m_edgeLength; // procedural scenes are unit sized, smaller edges give denser meshes
+	float m_weldTolerance; // WeldPositions radius for the weld benchmark, 0 skips it
+	unsigned m_numOcclusionSamples; // per vertex
+	unsigned m_maxOcclusionVerts; // larger meshes are subsampled for RenderOcclusion
+	std::vector<unsigned> m_threadCounts; // 0 renders on the calling thread (ignored without BVH_THREADS)
+	const char* m_outputPath; // NULL writes to stdout
+};
+
+// returns false if the output can't be opened, OBJ files which fail to load are reported and skipped
+bool RunBVHBenchmarks(const std::vector<const char*>& objPaths, const BVHBenchmarkParams& params);
+
+// command line front end - bvh_benchmark [-w width] [-h height] [-threads 1,4,8] [-views n] [-repeat n] [-edge length]
+// [-samples n] [-weld tolerance] [-o output.jsonl] [file.obj ...], returns the process exit code
+int BVHBenchmarkMain(int argc, const char* argv[]);
+
+#endif // _INCLUDE_BVH_BENCHMARK_H_
\ No newline at end of file
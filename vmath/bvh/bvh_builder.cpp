@@ -3,14 +3,13 @@
 // ==========================
 
 #include "bvh_builder.h"
+#include "bvh_quantized.h"
 //#include "../mesh.h"
+#include "vmath/vmath_random.h"
 
-BVH4Node* BuildBVH4(const geomesh::TriangleMesh& mesh, const Mat34V* transform)
+static void GetMeshTriangles(const geomesh::TriangleMesh& mesh, const Mat34V* transform, std::vector<Triangle3V>& triangles)
 {
-	ProgressDisplay progress("building BVH4");
-	std::vector<Triangle3V> triangles;
-	const uint32 numTriangles = (uint32)mesh.m_polys.size();
-	triangles.resize(numTriangles);
+	triangles.resize(mesh.m_polys.size());
 	for (uint32 i = 0; i < mesh.m_polys.size(); i++) {
 		//triangles[i] = MakePoly(mesh.m_polys[i], mesh.m_verts);
 		for (uint32 k = 0; k < 3; k++) {
@@ -20,7 +19,281 @@ BVH4Node* BuildBVH4(const geomesh::TriangleMesh& mesh, const Mat34V* transform)
 			triangles[i].m_positions[k] = p;
 		}
 	}
-	BVH4Node* node = BVHBuilder<BVH4Node,BVHCommon::Leaf,Triangle3V>::BuildNode(triangles, 0, numTriangles);
+}
+
+template <typename NodeType> static NodeType* BuildBVH_T(const geomesh::TriangleMesh& mesh, const Mat34V* transform, const BVHBuildParams& params)
+{
+	ProgressDisplay progress("building %s (%s, %u threads)", NodeType::GetClassName_(), params.m_splitMethod == BVHBuildParams::BVH_SPLIT_BINNED_SAH ? "binned SAH" : "median", params.m_scheduler ? params.m_scheduler->GetNumThreads() : 1);
+	std::vector<Triangle3V> meshTriangles;
+	GetMeshTriangles(mesh, transform, meshTriangles);
+	std::vector<BVHBuildTriangle> triangles(meshTriangles.size()); // leaves get the mesh poly index as primitive ID
+	for (uint32 i = 0; i < meshTriangles.size(); i++)
+		triangles[i] = BVHBuildTriangle(meshTriangles[i], i);
+	NodeType* nodes = BVHBuilder<NodeType,BVHCommon::Leaf,BVHBuildTriangle>::BuildNode(triangles, 0, (uint32)triangles.size(), params);
+	NodeType* root = NodeType::Linearize(nodes, params.m_layout);
+	nodes->ReleaseNodes();
 	progress.End();
-	return node;
+	return root;
+}
+
+BVH4Node* BuildBVH4(const geomesh::TriangleMesh& mesh, const Mat34V* transform, const BVHBuildParams& params)
+{
+	return BuildBVH_T<BVH4Node>(mesh, transform, params);
+}
+
+#if HAS_VEC8V
+BVH8Node* BuildBVH8(const geomesh::TriangleMesh& mesh, const Mat34V* transform, const BVHBuildParams& params)
+{
+	return BuildBVH_T<BVH8Node>(mesh, transform, params);
+}
+#endif // HAS_VEC8V
+
+float RefitBVH4(BVH4Node* root, const geomesh::TriangleMesh& mesh, const Mat34V* transform, float buildCost, float maxCostRatio, const BVHBuildParams& params)
+{
+	typedef BVHBuilder<BVH4Node,BVHCommon::Leaf,BVHBuildTriangle> Builder;
+	root->Refit(mesh, transform, params.m_scheduler);
+	float cost = Builder::GetSAHCost(root, params);
+	if (cost > buildCost*maxCostRatio && root->Rotate() > 0)
+		cost = Builder::GetSAHCost(root, params);
+	return cost;
+}
+
+void BenchmarkBVH4Builders(const geomesh::TriangleMesh& mesh, unsigned numThreads)
+{
+	typedef BVHBuilder<BVH4Node,BVHCommon::Leaf,Triangle3V> Builder;
+	TaskScheduler scheduler(numThreads);
+	BVHBuildParams median(BVHBuildParams::BVH_SPLIT_MEDIAN);
+	BVHBuildParams sah(BVHBuildParams::BVH_SPLIT_BINNED_SAH);
+	BVHBuildParams sahThreaded(BVHBuildParams::BVH_SPLIT_BINNED_SAH);
+	sahThreaded.m_scheduler = &scheduler;
+	const BVHBuildParams* configs[] = {&median, &sah, &sahThreaded};
+	const char* names[] = {"median", "binned SAH", "binned SAH (threaded)"};
+	float medianTime = 0.0f;
+	for (unsigned i = 0; i < countof(configs); i++) {
+		const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		BVH4Node* root = BuildBVH4(mesh, nullptr, *configs[i]);
+		const float buildTime = ProgressDisplay::GetTimeInSeconds(startTime);
+		if (i == 0)
+			medianTime = buildTime;
+		const BVHCounts counts = root->Count();
+		const float cost = Builder::GetSAHCost(root, median); // measure all trees with the same cost model
+		printf("%-24s %.3f secs (%.2fx), SAH cost=%.3f, nodes=%u, leaves=%u, tris=%u\n", names[i], buildTime, medianTime/buildTime, cost, counts.m_nodeCount, counts.m_leafCount, counts.m_triCount);
+		root->Release();
+	}
+}
+
+// direct-mapped model of a 32KB L1 data cache, only used to compare memory layouts (not to predict real miss counts)
+class BVHCacheModel
+{
+public:
+	enum { LINE_SIZE = 64, NUM_LINES = 512 };
+
+	BVHCacheModel() : m_accesses(0), m_misses(0) { memset(m_tags, 0xff, sizeof(m_tags)); }
+
+	void Touch(const void* ptr, size_t size)
+	{
+		const uintptr_t first = reinterpret_cast<uintptr_t>(ptr)/LINE_SIZE;
+		const uintptr_t last = (reinterpret_cast<uintptr_t>(ptr) + size - 1)/LINE_SIZE;
+		for (uintptr_t line = first; line <= last; line++) {
+			m_accesses++;
+			if (m_tags[line%NUM_LINES] != line) {
+				m_tags[line%NUM_LINES] = line;
+				m_misses++;
+			}
+		}
+	}
+
+	uintptr_t m_tags[NUM_LINES];
+	uint64 m_accesses;
+	uint64 m_misses;
+};
+
+// same traversal order as BVH4Node::TraceStatic, but records every node and leaf it touches
+static void TraceWithCacheModel(const BVH4Node* root, Vec3V_arg origin, Vec3V_arg dir, ScalarV& t, BVHCacheModel& cache)
+{
+	const Vec3V invdir = Recip(dir);
+	const unsigned octant = BVHCommon::GetDirectionOctant(dir);
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(root)};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVHCommon::BVH_LEAF_FLAG) {
+			const BVHCommon::Leaf* leaf = reinterpret_cast<const BVHCommon::Leaf*>(ref & ~BVHCommon::BVH_LEAF_FLAG);
+			cache.Touch(leaf, leaf->GetSize());
+			for (unsigned i = 0; i < leaf->GetTriCount(); i++) {
+				ScalarV t_;
+				if (leaf->GetTriangle(i).IntersectsRay(origin, dir, t_))
+					t = Min(t_, t);
+			}
+		} else {
+			const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+			cache.Touch(node, sizeof(BVH4Node));
+			const unsigned order = node->GetChildOrder(octant);
+			for (unsigned k = 0; k < BVH4Node::N; k++) {
+				const unsigned i = BVH4Node::GetChildPushIndex(order, k);
+				if (node->IsChildNonEmpty(i) && node->GetChildBounds(i).IntersectsRay(origin, invdir, t)) {
+					DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+					stack[stackIndex++] = node->GetChildRef(i);
+				}
+			}
+		}
+	}
+}
+
+// coherent rays form a pinhole camera looking down -z at the bounds, incoherent rays connect random points inside the bounds
+static unsigned GenerateBenchmarkRays(const Box3V& bounds, unsigned numRays, std::vector<Vec3V> origins[2], std::vector<Vec3V> dirs[2])
+{
+	const Vec3V center = bounds.GetCenter();
+	const Vec3V extent = bounds.GetExtent();
+	const float radius = Mag(extent).f();
+	const unsigned side = Max(1U, (unsigned)sqrtf((float)numRays));
+	numRays = side*side;
+	uint32 state = 0x12345678;
+	for (unsigned i = 0; i < numRays; i++) {
+		const Vec3V eye = center + Vec3V(0.0f, 0.0f, 2.0f*radius);
+		const float u = ((float)(i%side) + 0.5f)/(float)side - 0.5f;
+		const float v = ((float)(i/side) + 0.5f)/(float)side - 0.5f;
+		origins[0].push_back(eye);
+		dirs[0].push_back(Normalize(center + Vec3V(u*2.0f*radius, v*2.0f*radius, 0.0f) - eye));
+		const Vec3V p0 = bounds.GetMin() + extent*Vec3V(XorShift_LRL_32_13_17_5(state), XorShift_LRL_32_13_17_5(state), XorShift_LRL_32_13_17_5(state));
+		const Vec3V p1 = bounds.GetMin() + extent*Vec3V(XorShift_LRL_32_13_17_5(state), XorShift_LRL_32_13_17_5(state), XorShift_LRL_32_13_17_5(state));
+		origins[1].push_back(p0);
+		dirs[1].push_back(Normalize(p1 - p0 + Vec3V(FLT_EPSILON)));
+	}
+	return numRays;
+}
+
+template <typename BVHType> static float TraceBenchmarkRays(const BVHType* root, const std::vector<Vec3V>& origins, const std::vector<Vec3V>& dirs, float& checksum)
+{
+	BVH_STATS_ONLY(BVHStats stats);
+	checksum = 0.0f;
+	const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+	for (size_t j = 0; j < origins.size(); j++) {
+		float t = FLT_MAX;
+		root->Trace(origins[j], dirs[j], t BVH_STATS_ONLY(, 0x0001, stats));
+		if (t < FLT_MAX)
+			checksum += t;
+	}
+	const float traceTime = ProgressDisplay::GetTimeInSeconds(startTime);
+	return (float)origins.size()/(traceTime*1000000.0f);
+}
+
+void BenchmarkBVH4Layouts(const geomesh::TriangleMesh& mesh, unsigned numRays)
+{
+	typedef BVHBuilder<BVH4Node,BVHCommon::Leaf,Triangle3V> Builder;
+	std::vector<Triangle3V> triangles;
+	GetMeshTriangles(mesh, nullptr, triangles);
+	const BVHBuildParams params(BVHBuildParams::BVH_SPLIT_BINNED_SAH);
+	BVH4Node* nodes = Builder::BuildNode(triangles, 0, (uint32)triangles.size(), params);
+	size_t dfsSize = 0;
+	size_t vebSize = 0;
+	BVH4Node* dfs = BVH4Node::Linearize(nodes, BVHCommon::BVH_LAYOUT_DEPTH_FIRST, &dfsSize);
+	BVH4Node* veb = BVH4Node::Linearize(nodes, BVHCommon::BVH_LAYOUT_VEB, &vebSize);
+
+	std::vector<Vec3V> origins[2];
+	std::vector<Vec3V> dirs[2];
+	numRays = GenerateBenchmarkRays(nodes->GetBounds(), numRays, origins, dirs);
+
+	const BVH4Node* roots[] = {nodes, dfs, veb};
+	const char* names[] = {"heap (unordered)", "arena depth-first", "arena van Emde Boas"};
+	const char* rayNames[] = {"coherent", "incoherent"};
+	printf("BVH4 layouts: %u rays, arena size %.2fMB (depth-first), %.2fMB (van Emde Boas)\n", numRays, (float)dfsSize/(1024.0f*1024.0f), (float)vebSize/(1024.0f*1024.0f));
+	for (unsigned r = 0; r < countof(rayNames); r++) {
+		for (unsigned i = 0; i < countof(roots); i++) {
+			float checksum;
+			const float mrays = TraceBenchmarkRays(roots[i], origins[r], dirs[r], checksum);
+			BVHCacheModel cache;
+			for (unsigned j = 0; j < numRays; j++) {
+				ScalarV t(FLT_MAX);
+				TraceWithCacheModel(roots[i], origins[r][j], dirs[r][j], t, cache);
+			}
+			printf("%-10s %-20s %.2f Mrays/sec, %.2f lines/ray, %.2f misses/ray (%.1f%%), checksum=%f\n", rayNames[r], names[i], mrays,
+				(float)cache.m_accesses/(float)numRays, (float)cache.m_misses/(float)numRays, 100.0f*(float)cache.m_misses/(float)Max<uint64>(1, cache.m_accesses), checksum);
+		}
+	}
+	dfs->Release();
+	veb->Release();
+	nodes->ReleaseNodes();
+}
+
+void BenchmarkBVH4Quantized(const geomesh::TriangleMesh& mesh, unsigned numRays)
+{
+	typedef BVHBuilder<BVH4Node,BVHCommon::Leaf,Triangle3V> Builder;
+	std::vector<Triangle3V> triangles;
+	GetMeshTriangles(mesh, nullptr, triangles);
+	BVH4Node* nodes = Builder::BuildNode(triangles, 0, (uint32)triangles.size(), BVHBuildParams(BVHBuildParams::BVH_SPLIT_BINNED_SAH));
+	size_t arenaSize = 0;
+	BVH4Node* root = BVH4Node::Linearize(nodes, BVHCommon::BVH_LAYOUT_DEPTH_FIRST, &arenaSize);
+	nodes->ReleaseNodes();
+	BVH4Quantized8* q8 = BVH4Quantized8::Create(root);
+	BVH4Quantized16* q16 = BVH4Quantized16::Create(root);
+	const BVHCounts counts = root->Count();
+	std::vector<Vec3V> origins[2];
+	std::vector<Vec3V> dirs[2];
+	numRays = GenerateBenchmarkRays(root->GetBounds(), numRays, origins, dirs);
+	const char* rayNames[] = {"coherent", "incoherent"};
+	printf("BVH4 quantized: %u rays, %u nodes, %u leaves, %u tris\n", numRays, counts.m_nodeCount, counts.m_leafCount, counts.m_triCount);
+	printf("node size: %u bytes (BVH4), %u bytes (BVH4Q16), %u bytes (BVH4Q8)\n", (unsigned)sizeof(BVH4Node), (unsigned)sizeof(BVH4Quantized16::Node), (unsigned)sizeof(BVH4Quantized8::Node));
+	printf("memory/tri: %.1f bytes (BVH4), %.1f bytes (BVH4Q16), %.1f bytes (BVH4Q8)\n", (float)arenaSize/(float)counts.m_triCount, (float)q16->GetArenaSize()/(float)counts.m_triCount, (float)q8->GetArenaSize()/(float)counts.m_triCount);
+	for (unsigned r = 0; r < countof(rayNames); r++) {
+		float checksum[3];
+		const float mrays0 = TraceBenchmarkRays(root, origins[r], dirs[r], checksum[0]);
+		const float mrays1 = TraceBenchmarkRays(q16, origins[r], dirs[r], checksum[1]);
+		const float mrays2 = TraceBenchmarkRays(q8, origins[r], dirs[r], checksum[2]);
+		printf("%-10s %.2f Mrays/sec (BVH4), %.2f Mrays/sec (BVH4Q16), %.2f Mrays/sec (BVH4Q8), checksum=%f,%f,%f\n", rayNames[r], mrays0, mrays1, mrays2, checksum[0], checksum[1], checksum[2]);
+	}
+	q8->Release();
+	q16->Release();
+	root->Release();
+}
+
+// twists the mesh around the vertical axis of its bounds, by 'angle' radians at the top
+static void TwistMesh(const geomesh::TriangleMesh& mesh, geomesh::TriangleMesh& twisted, const Box3V& bounds, float angle)
+{
+	const Vec3V center = bounds.GetCenter();
+	const float height = Max(FLT_MIN, bounds.GetSize().yf());
+	for (size_t i = 0; i < mesh.m_verts.size(); i++) {
+		const Vec3V p = mesh.m_verts[i] - center;
+		const float a = angle*(p.yf() + height*0.5f)/height;
+		const float c = cosf(a);
+		const float s = sinf(a);
+		twisted.m_verts[i] = center + Vec3V(p.xf()*c - p.zf()*s, p.yf(), p.xf()*s + p.zf()*c);
+	}
+}
+
+void BenchmarkBVH4Refit(const geomesh::TriangleMesh& mesh, unsigned numFrames, unsigned numRays, unsigned numThreads)
+{
+	typedef BVHBuilder<BVH4Node,BVHCommon::Leaf,BVHBuildTriangle> Builder;
+	TaskScheduler scheduler(numThreads);
+	BVHBuildParams params(BVHBuildParams::BVH_SPLIT_BINNED_SAH);
+	params.m_scheduler = &scheduler;
+	geomesh::TriangleMesh animated = mesh;
+	BVH4Node* refit = BuildBVH4(mesh, nullptr, params);
+	const Box3V bounds = refit->GetBounds();
+	const float buildCost = Builder::GetSAHCost(refit, params);
+	std::vector<Vec3V> origins[2];
+	std::vector<Vec3V> dirs[2];
+	numRays = GenerateBenchmarkRays(bounds, numRays, origins, dirs);
+	printf("BVH4 refit: %u frames, %u incoherent rays/frame, %u threads, SAH cost=%.3f\n", numFrames, numRays, scheduler.GetNumThreads(), buildCost);
+	float totalTime[2] = {0.0f, 0.0f}; // refit+trace, rebuild+trace
+	for (unsigned frame = 1; frame <= numFrames; frame++) {
+		TwistMesh(mesh, animated, bounds, 0.5f*PI*(float)frame/(float)numFrames);
+		uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		const float refitCost = RefitBVH4(refit, animated, nullptr, buildCost, 1.25f, params);
+		const float refitTime = ProgressDisplay::GetTimeInSeconds(startTime);
+		float checksum[2];
+		const float refitMrays = TraceBenchmarkRays(refit, origins[1], dirs[1], checksum[0]);
+		startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		BVH4Node* rebuilt = BuildBVH4(animated, nullptr, params);
+		const float rebuildTime = ProgressDisplay::GetTimeInSeconds(startTime);
+		const float rebuildCost = Builder::GetSAHCost(rebuilt, params);
+		const float rebuildMrays = TraceBenchmarkRays(rebuilt, origins[1], dirs[1], checksum[1]);
+		rebuilt->Release();
+		const float traceTime[2] = {(float)numRays/(refitMrays*1000000.0f), (float)numRays/(rebuildMrays*1000000.0f)};
+		totalTime[0] += refitTime + traceTime[0];
+		totalTime[1] += rebuildTime + traceTime[1];
+		printf("frame %2u: refit %.3f+%.3f secs (SAH %.3f), rebuild %.3f+%.3f secs (SAH %.3f), checksum=%f,%f\n", frame, refitTime, traceTime[0], refitCost, rebuildTime, traceTime[1], rebuildCost, checksum[0], checksum[1]);
+	}
+	printf("total: refit+trace %.3f secs, rebuild+trace %.3f secs (%.2fx)\n", totalTime[0], totalTime[1], totalTime[1]/totalTime[0]);
+	refit->Release();
 }
\ No newline at end of file
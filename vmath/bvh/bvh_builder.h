@@ -8,6 +8,50 @@
 #include "bvh.h"
 #include "GraphicsTools/util/mesh.h"
 #include "GraphicsTools/util/progressdisplay.h"
+#include "GraphicsTools/util/taskscheduler.h"
+
+#define BVH_BUILDER_MAX_BINS (32)
+#define BVH_BUILDER_DEFAULT_MAX_PRIMS_PER_LEAF (BVH_LEAF_NUM_TRIANGLES_SOA > 4 ? BVH_LEAF_NUM_TRIANGLES_SOA : 4) // at least one full SOA batch
+
+class BVHBuildParams
+{
+public:
+	enum SplitMethod
+	{
+		BVH_SPLIT_MEDIAN     = 0, // sort along the largest centroid extent, split at the center
+		BVH_SPLIT_BINNED_SAH = 1, // bin centroids along each axis, split at the lowest SAH cost bin boundary
+	};
+
+	BVHBuildParams(SplitMethod splitMethod = BVH_SPLIT_MEDIAN, uint32 maxPrimsPerLeaf = BVH_BUILDER_DEFAULT_MAX_PRIMS_PER_LEAF) :
+		m_splitMethod(splitMethod),
+		m_maxPrimsPerLeaf(maxPrimsPerLeaf),
+		m_numBins(16),
+		m_traversalCost(1.0f),
+		m_primitiveCost(1.0f),
+		m_parallelThreshold(4096),
+		m_scheduler(NULL),
+		m_layout(BVHCommon::BVH_LAYOUT_DEPTH_FIRST)
+	{}
+
+	SplitMethod m_splitMethod;
+	uint32 m_maxPrimsPerLeaf; // ranges larger than this are always split
+	uint32 m_numBins; // binned SAH only, clamped to [2..BVH_BUILDER_MAX_BINS]
+	float m_traversalCost; // SAH cost of visiting a node ..
+	float m_primitiveCost; // .. relative to the cost of intersecting a primitive
+	uint32 m_parallelThreshold; // subtrees with at least this many prims are built as separate tasks
+	TaskScheduler* m_scheduler; // NULL builds everything on the calling thread
+	BVHCommon::Layout m_layout; // node order of the linearized tree returned by BuildBVH4
+};
+
+// triangle which remembers its index in the source mesh, so leaves can report primitive IDs after the builder has reordered them
+class BVHBuildTriangle : public Triangle3V
+{
+public:
+	BVHBuildTriangle() {}
+	BVHBuildTriangle(const Triangle3V& triangle, uint32 primID) : Triangle3V(triangle), m_primID(primID) {}
+
+	uint32 m_primID;
+};
 
 template <typename NodeType, typename LeafType, typename PrimType> class BVHBuilder
 {
@@ -15,10 +59,8 @@ private:
 	class PrimRef : public PrimType
 	{
 	public:
-		inline static uint32& dim() { static uint32 s_dim; return s_dim; }
 		PrimRef() {}
 		PrimRef(const PrimType& prim) : PrimType(prim), m_centroid(prim.GetBounds().GetCenter()) {}
-		bool operator <(const PrimRef& rhs) const { return m_centroid[dim()] < rhs.m_centroid[dim()]; }
 		Vec3V m_centroid;
 	};
 
@@ -48,164 +90,275 @@ private:
 			return 0.0f;
 	}
 
-	static uint32 SplitRange(std::vector<PrimType>& prims, uint32 start, uint32 end, uint32 maxPrimsPerLeaf)
+	// leaves are intersected one SOA batch at a time, so a leaf with 5 triangles costs as much as one with 8 (for SOA4)
+	static float GetLeafCost(uint32 numPrims)
 	{
-		ForceAssertf(start <= end,"start=%d,end=%u",start,end);
-		if (end - start > maxPrimsPerLeaf) {
-		#if 1 // try something simpler .. max centroid extent median split
-			Box3V bounds = Box3V::Invalid();
-			for (uint32 i = start; i < end; i++)
-				bounds.Grow(prims[i].GetBounds().GetCenter()); // centroid bounds
-			const Vec3V center = bounds.GetCenter();
-			const Vec3V extent = bounds.GetExtent();
-			std::vector<PrimRef> refs;
-			refs.resize(end - start);
-			for (uint32 i = start; i < end; i++)
-				refs[i - start] = PrimRef(prims[i]);
-			const uint32 dim = PrimRef::dim() = MaxElementIndex(extent);
-			std::sort(refs.begin(), refs.end());
-			uint32 split = end;
-			for (uint32 i = start; i < end; i++) {
-				prims[i] = refs[i - start]; // copy sorted prims in place
-				if (split == end && prims[i].GetBounds().GetCenter()[dim] > center[dim])
-					split = i;
+		return (float)((numPrims + BVH_LEAF_NUM_TRIANGLES_SOA - 1)/BVH_LEAF_NUM_TRIANGLES_SOA);
+	}
+
+	static uint32 SplitRange_Median(std::vector<PrimType>& prims, uint32 start, uint32 end)
+	{
+		// max centroid extent median split
+		Box3V bounds = Box3V::Invalid();
+		for (uint32 i = start; i < end; i++)
+			bounds.Grow(prims[i].GetBounds().GetCenter()); // centroid bounds
+		const Vec3V center = bounds.GetCenter();
+		const Vec3V extent = bounds.GetExtent();
+		std::vector<PrimRef> refs;
+		refs.resize(end - start);
+		for (uint32 i = start; i < end; i++)
+			refs[i - start] = PrimRef(prims[i]);
+		const uint32 dim = MaxElementIndex(extent);
+		std::sort(refs.begin(), refs.end(), [dim](const PrimRef& a, const PrimRef& b) { return a.m_centroid[dim] < b.m_centroid[dim]; });
+		uint32 split = end;
+		for (uint32 i = start; i < end; i++) {
+			prims[i] = refs[i - start]; // copy sorted prims in place
+			if (split == end && prims[i].GetBounds().GetCenter()[dim] > center[dim])
+				split = i;
+		}
+		if (split == start)
+			split++;
+		else if (split == end)
+			split--;
+		return split;
+	}
+
+	class Binning
+	{
+	public:
+		Binning(const Box3V& centroidBounds, uint32 numBins) : m_numBins(numBins)
+		{
+			const Vec3V bmin = centroidBounds.GetMin();
+			const Vec3V bmax = centroidBounds.GetMax();
+			for (uint32 dim = 0; dim < 3; dim++) {
+				const float extent = bmax[dim] - bmin[dim];
+				m_origin[dim] = bmin[dim];
+				m_scale[dim] = extent > 0.0f ? (float)numBins*(1.0f - 1e-5f)/extent : 0.0f; // keep max centroid in the last bin
 			}
-			if (split == start)
-				split++;
-			else if (split == end)
-				split--;
-			return split;
-		#else
-			const float traversalCost = 0.0f; // TODO -- tune these? expose these?
-			const float primitiveCost = 1.0f;
-			Vec3V lowestCostV(FLT_MAX);
-			uint32 lowestCostSplit[3] = {0,0,0};
-			std::vector<PrimRef> refs[3];
+		}
+
+		inline uint32 GetBinIndex(const PrimType& prim, uint32 dim) const
+		{
+			const float f = (prim.GetBounds().GetCenter()[dim] - m_origin[dim])*m_scale[dim];
+			return Min((uint32)Max(0.0f, f), m_numBins - 1);
+		}
+
+		uint32 m_numBins;
+		float m_origin[3];
+		float m_scale[3]; // 0 if the centroids are flat along this axis
+	};
+
+	static uint32 SplitRange_BinnedSAH(std::vector<PrimType>& prims, uint32 start, uint32 end, const BVHBuildParams& params)
+	{
+		const uint32 numPrims = end - start;
+		const uint32 numBins = Clamp(params.m_numBins, 2U, (uint32)BVH_BUILDER_MAX_BINS);
+		Box3V bounds = Box3V::Invalid();
+		Box3V centroidBounds = Box3V::Invalid();
+		for (uint32 i = start; i < end; i++) {
+			const Box3V primBounds = prims[i].GetBounds();
+			bounds.Grow(primBounds);
+			centroidBounds.Grow(primBounds.GetCenter());
+		}
+		const Binning binning(centroidBounds, numBins);
+		Box3V binBounds[3][BVH_BUILDER_MAX_BINS];
+		uint32 binCounts[3][BVH_BUILDER_MAX_BINS];
+		for (uint32 dim = 0; dim < 3; dim++) {
+			for (uint32 bin = 0; bin < numBins; bin++) {
+				binBounds[dim][bin] = Box3V::Invalid();
+				binCounts[dim][bin] = 0;
+			}
+		}
+		for (uint32 i = start; i < end; i++) {
+			const Box3V primBounds = prims[i].GetBounds();
 			for (uint32 dim = 0; dim < 3; dim++) {
-				PrimRef::dim() = dim;
-				refs[dim].resize(end - start);
-				for (uint32 i = start; i < end; i++)
-					refs[dim][i - start] = PrimRef(prims[i]);
-				std::sort(refs[dim].begin(), refs[dim].end());
-			#if 0 // O(N^3), gross.
-				for (uint32 split = start + 1; split < end; split++) {
-					const float leftCost = primitiveCost*GetRangeArea(refs[dim], 0, split - start)*(float)(split - start);
-					const float rightCost = primitiveCost*GetRangeArea(refs[dim], split - start, end - start)*(float)(end - split);
-					const float cost = traversalCost + leftCost + rightCost;
-					if (lowestCostV[dim] > cost) {
-						lowestCostV[dim] = cost;
-						lowestCostSplit[dim] = split;
-					}
-				}
-			#else
-				std::vector<float> leftAreas;
-				std::vector<float> rightAreas;
-				leftAreas.resize(end - start - 1);
-				rightAreas.resize(end - start - 1);
-				Box3V bounds = Box3V::Invalid();
-				for (uint32 split = start + 1; split < end; split++) {
-					bounds.Grow(refs[dim][split - start - 1].GetBounds());
-					leftAreas[split - start - 1] = GetArea(bounds);
-				}
-				bounds = Box3V::Invalid();
-				for (uint32 split = end - 1; split > start; split--) {
-					bounds.Grow(refs[dim][split - start].GetBounds());
-					rightAreas[split - start - 1] = GetArea(bounds);
-				}
-				for (uint32 split = start + 1; split < end; split++) {
-					const float leftCost = primitiveCost*leftAreas[split - start - 1]*(float)(split - start);
-					const float rightCost = primitiveCost*rightAreas[split - start - 1]*(float)(end - split);
-					const float cost = traversalCost + leftCost + rightCost;
-					if (lowestCostV[dim] > cost) {
-						lowestCostV[dim] = cost;
-						lowestCostSplit[dim] = split;
-					}
-				}
-			#endif
+				const uint32 bin = binning.GetBinIndex(prims[i], dim);
+				binBounds[dim][bin].Grow(primBounds);
+				binCounts[dim][bin]++;
+			}
+		}
+		float bestCost = FLT_MAX; // sum of area*leaf cost over both sides
+		uint32 bestDim = 0;
+		uint32 bestBin = 0; // prims in bins [0..bestBin) go to the left
+		for (uint32 dim = 0; dim < 3; dim++) {
+			if (binning.m_scale[dim] == 0.0f)
+				continue;
+			float rightAreas[BVH_BUILDER_MAX_BINS];
+			uint32 rightCounts[BVH_BUILDER_MAX_BINS];
+			Box3V right = Box3V::Invalid();
+			uint32 rightCount = 0;
+			for (uint32 bin = numBins - 1; bin > 0; bin--) {
+				right.Grow(binBounds[dim][bin]);
+				rightCount += binCounts[dim][bin];
+				rightAreas[bin] = GetArea(right);
+				rightCounts[bin] = rightCount;
 			}
-			const uint32 dim = MinElementIndex(lowestCostV);
-			const float baseCost = primitiveCost*GetRangeArea(prims, start, end)*(float)(end - start);
-			const float splitCost = lowestCostV[dim];
-			if (splitCost < baseCost) {
-				for (uint32 i = start; i < end; i++)
-					prims[i] = refs[dim][i - start]; // copy sorted prims in place
-				return lowestCostSplit[dim];
+			Box3V left = Box3V::Invalid();
+			uint32 leftCount = 0;
+			for (uint32 bin = 1; bin < numBins; bin++) {
+				left.Grow(binBounds[dim][bin - 1]);
+				leftCount += binCounts[dim][bin - 1];
+				if (leftCount == 0 || rightCounts[bin] == 0)
+					continue;
+				const float cost = GetArea(left)*GetLeafCost(leftCount) + rightAreas[bin]*GetLeafCost(rightCounts[bin]);
+				if (bestCost > cost) {
+					bestCost = cost;
+					bestDim = dim;
+					bestBin = bin;
+				}
 			}
-		#endif
 		}
+		if (bestCost == FLT_MAX) // all centroids coincide, any split is as good as another
+			return numPrims > params.m_maxPrimsPerLeaf ? start + numPrims/2 : end;
+		if (numPrims <= params.m_maxPrimsPerLeaf) { // small enough for a leaf, only split if SAH says it's cheaper
+			const float area = GetArea(bounds);
+			const float leafCost = params.m_primitiveCost*GetLeafCost(numPrims);
+			const float splitCost = params.m_traversalCost + (area > 0.0f ? params.m_primitiveCost*bestCost/area : 0.0f);
+			if (splitCost >= leafCost)
+				return end;
+		}
+		const PrimType* first = prims.data();
+		const PrimType* split = std::partition(prims.data() + start, prims.data() + end, [&binning,bestDim,bestBin](const PrimType& prim) { return binning.GetBinIndex(prim, bestDim) < bestBin; });
+		return (uint32)(split - first);
+	}
+
+	static uint32 SplitRange(std::vector<PrimType>& prims, uint32 start, uint32 end, const BVHBuildParams& params)
+	{
+		ForceAssertf(start <= end,"start=%d,end=%u",start,end);
+		if (params.m_splitMethod == BVHBuildParams::BVH_SPLIT_BINNED_SAH) {
+			if (end - start > 1)
+				return SplitRange_BinnedSAH(prims, start, end, params);
+		} else if (end - start > params.m_maxPrimsPerLeaf)
+			return SplitRange_Median(prims, start, end);
 		return end; // no split
 	}
 
-	static void AddChild(NodeType* node, Box3V bounds[4], uint32& childCount, std::vector<PrimType>& prims, uint32 start, uint32 end, uint32 maxPrimsPerLeaf)
+	static LeafType* CreateLeaf(const Triangle3V* prims, uint32 count)
+	{
+		return LeafType::Create(prims, count);
+	}
+
+	static LeafType* CreateLeaf(const BVHBuildTriangle* prims, uint32 count)
+	{
+		std::vector<Triangle3V> triangles(count);
+		std::vector<uint32> primIDs(count);
+		for (uint32 i = 0; i < count; i++) {
+			triangles[i] = prims[i];
+			primIDs[i] = prims[i].m_primID;
+		}
+		return LeafType::Create(triangles.data(), count, NULL, primIDs.data());
+	}
+
+	static void AddChild(NodeType* node, Box3V bounds[NodeType::N], uint32& childCount, std::vector<PrimType>& prims, uint32 start, uint32 end, const BVHBuildParams& params, TaskScheduler::TaskGroup& group)
 	{
 		ForceAssertf(start <= end,"start=%d,end=%u",start,end);
 		const uint32 numPrims = end - start;
 		if (numPrims > 0) {
 			bounds[childCount] = GetRangeBounds(prims, start, end);
-			if (numPrims > maxPrimsPerLeaf) {
-				const NodeType* child = BuildNode(prims, start, end, maxPrimsPerLeaf);
-				node->m_children[childCount] = (uintptr_t)child;
+			if (numPrims > params.m_maxPrimsPerLeaf) {
+				uintptr_t* child = &node->m_children[childCount];
+				if (params.m_scheduler && numPrims >= params.m_parallelThreshold) // subtrees touch disjoint prim ranges, so they can be built independently
+					params.m_scheduler->Submit(group, [&prims,&params,child,start,end](unsigned) { *child = (uintptr_t)BuildNode(prims, start, end, params); });
+				else
+					*child = (uintptr_t)BuildNode(prims, start, end, params);
 			} else {
-				LeafType* leaf = new LeafType;
-				for (uint32 i = start; i < end; i++)
-					leaf->SetPrimitives(prims.data() + start, end - start);
+				LeafType* leaf = CreateLeaf(prims.data() + start, end - start);
 				node->m_children[childCount] = BVHCommon::BVH_LEAF_FLAG | (uintptr_t)leaf;
 			}
 			childCount++;
 		}
 	}
 
+#if BVH_CHILD_ORDER
+	static void ComputeChildOrder(BVH4Node* node) { node->ComputeChildOrder(); } // bounds are written directly, so heap trees get their child order here
+#endif // BVH_CHILD_ORDER
+	template <typename T> static void ComputeChildOrder(T*) {}
+
+	static float GetSAHCostInternal(const NodeType* node, const BVHBuildParams& params)
+	{
+		float cost = 0.0f;
+		for (unsigned i = 0; i < NodeType::N && node->IsChildNonEmpty(i); i++) {
+			const float area = GetArea(node->GetChildBounds(i));
+			if (node->IsChildLeaf(i))
+				cost += params.m_primitiveCost*area*GetLeafCost(node->GetChildLeaf(i)->GetTriCount());
+			else
+				cost += params.m_traversalCost*area + GetSAHCostInternal(node->GetChildNode(i), params);
+		}
+		return cost;
+	}
+
 public:
-	static NodeType* BuildNode(std::vector<PrimType>& prims, uint32 start, uint32 end, uint32 maxPrimsPerLeaf = 4)
+	// nodes and leaves are allocated individually, use NodeType::Linearize to pack them into a single arena
+	static NodeType* BuildNode(std::vector<PrimType>& prims, uint32 start, uint32 end, const BVHBuildParams& params = BVHBuildParams())
 	{
 		ForceAssertf(start <= end,"start=%d,end=%u",start,end);
 		NodeType* node = new NodeType;
 		Box3V bounds[NodeType::N];
 		uint32 childCount = 0;
+		TaskScheduler::TaskGroup group;
 		if (NodeType::N == 2) {
-			const uint32 split1 = SplitRange(prims, start, end, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, start, split1, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split1, end, maxPrimsPerLeaf);
+			const uint32 split1 = SplitRange(prims, start, end, params);
+			AddChild(node, bounds, childCount, prims, start, split1, params, group);
+			AddChild(node, bounds, childCount, prims, split1, end, params, group);
 		} else if (NodeType::N == 4) {
-			const uint32 split1 = SplitRange(prims, start, end, maxPrimsPerLeaf);
-			const uint32 split2 = SplitRange(prims, start, split1, maxPrimsPerLeaf);
-			const uint32 split3 = SplitRange(prims, split1, end, maxPrimsPerLeaf);
+			const uint32 split1 = SplitRange(prims, start, end, params);
+			const uint32 split2 = SplitRange(prims, start, split1, params);
+			const uint32 split3 = SplitRange(prims, split1, end, params);
 			//printf("start=%u,split2=%u,split1=%u,split3=%u,end=%u\n",start,split2,split1,split3,end);
-			AddChild(node, bounds, childCount, prims, start, split2, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split2, split1, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split1, split3, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split3, end, maxPrimsPerLeaf);
+			AddChild(node, bounds, childCount, prims, start, split2, params, group);
+			AddChild(node, bounds, childCount, prims, split2, split1, params, group);
+			AddChild(node, bounds, childCount, prims, split1, split3, params, group);
+			AddChild(node, bounds, childCount, prims, split3, end, params, group);
 		} else if (NodeType::N == 8) {
-			const uint32 split1 = SplitRange(prims, start, end, maxPrimsPerLeaf);
-			const uint32 split2 = SplitRange(prims, start, split1, maxPrimsPerLeaf);
-			const uint32 split3 = SplitRange(prims, split1, end, maxPrimsPerLeaf);
-			const uint32 split4 = SplitRange(prims, start, split2, maxPrimsPerLeaf);
-			const uint32 split5 = SplitRange(prims, split2, split1, maxPrimsPerLeaf);
-			const uint32 split6 = SplitRange(prims, split1, split3, maxPrimsPerLeaf);
-			const uint32 split7 = SplitRange(prims, split3, end, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, start, split4, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split4, split2, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split2, split5, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split5, split1, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split1, split6, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split6, split3, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split3, split7, maxPrimsPerLeaf);
-			AddChild(node, bounds, childCount, prims, split7, end, maxPrimsPerLeaf);
+			const uint32 split1 = SplitRange(prims, start, end, params);
+			const uint32 split2 = SplitRange(prims, start, split1, params);
+			const uint32 split3 = SplitRange(prims, split1, end, params);
+			const uint32 split4 = SplitRange(prims, start, split2, params);
+			const uint32 split5 = SplitRange(prims, split2, split1, params);
+			const uint32 split6 = SplitRange(prims, split1, split3, params);
+			const uint32 split7 = SplitRange(prims, split3, end, params);
+			AddChild(node, bounds, childCount, prims, start, split4, params, group);
+			AddChild(node, bounds, childCount, prims, split4, split2, params, group);
+			AddChild(node, bounds, childCount, prims, split2, split5, params, group);
+			AddChild(node, bounds, childCount, prims, split5, split1, params, group);
+			AddChild(node, bounds, childCount, prims, split1, split6, params, group);
+			AddChild(node, bounds, childCount, prims, split6, split3, params, group);
+			AddChild(node, bounds, childCount, prims, split3, split7, params, group);
+			AddChild(node, bounds, childCount, prims, split7, end, params, group);
 		} else
 			ForceAssert(false); // not supported
 		for (uint32 i = childCount; i < NodeType::N; i++) {
 			bounds[i] = Box3V::Invalid();
 			node->m_children[i] = 0;
 		}
+		if (params.m_scheduler)
+			params.m_scheduler->Wait(group); // children being built as tasks must be done before we return
 	#if BVH_SOA_BOUNDS
 		node->m_bounds = bounds;
 	#else
 		memcpy(node->m_bounds, bounds, sizeof(bounds));
 	#endif
+		ComputeChildOrder(node);
 		return node;
 	}
+
+	// SAH cost of a built tree, relative to the area of the root bounds
+	static float GetSAHCost(const NodeType* root, const BVHBuildParams& params)
+	{
+		const float rootArea = GetArea(root->GetBounds());
+		return rootArea > 0.0f ? params.m_traversalCost + GetSAHCostInternal(root, params)/rootArea : 0.0f;
+	}
 };
 
-BVH4Node* BuildBVH4(const geomesh::TriangleMesh& mesh, const Mat34V* transform = nullptr);
+BVH4Node* BuildBVH4(const geomesh::TriangleMesh& mesh, const Mat34V* transform = nullptr, const BVHBuildParams& params = BVHBuildParams());
+#if HAS_VEC8V
+BVH8Node* BuildBVH8(const geomesh::TriangleMesh& mesh, const Mat34V* transform = nullptr, const BVHBuildParams& params = BVHBuildParams());
+#endif // HAS_VEC8V
+// refits a tree built by BuildBVH4 to the mesh's current vertex positions, then runs a rotation pass if its SAH cost has grown
+// to more than maxCostRatio times buildCost (GetSAHCost when it was built), returns the new SAH cost
+float RefitBVH4(BVH4Node* root, const geomesh::TriangleMesh& mesh, const Mat34V* transform, float buildCost, float maxCostRatio = 1.25f, const BVHBuildParams& params = BVHBuildParams());
+void BenchmarkBVH4Builders(const geomesh::TriangleMesh& mesh, unsigned numThreads = 0);
+void BenchmarkBVH4Refit(const geomesh::TriangleMesh& mesh, unsigned numFrames = 16, unsigned numRays = 1<<18, unsigned numThreads = 0); // refit+trace vs. rebuild+trace per frame
+void BenchmarkBVH4Layouts(const geomesh::TriangleMesh& mesh, unsigned numRays = 1<<20);
+void BenchmarkBVH4Quantized(const geomesh::TriangleMesh& mesh, unsigned numRays = 1<<20);
 
 #endif // _INCLUDE_BVH_BUILDER_H_
\ No newline at end of file
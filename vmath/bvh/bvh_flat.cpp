@@ -0,0 +1,187 @@
+// =======================
+// common/bvh/bvh_flat.cpp
+// =======================
+
+#include "bvh_flat.h"
+#include "GraphicsTools/util/stringutil.h"
+
+#define BVH4FLAT_SECTION_ALIGNMENT (64)
+
+static uint64 AlignSection(uint64 offset)
+{
+	return (offset + BVH4FLAT_SECTION_ALIGNMENT - 1) & ~(uint64)(BVH4FLAT_SECTION_ALIGNMENT - 1);
+}
+
+static bool WriteSection(FILE* f,uint64& offset,uint64 sectionOffset,const void* data,size_t size)
+{
+	static const uint8 zeros[BVH4FLAT_SECTION_ALIGNMENT] = {0};
+	DEBUG_ASSERT(sectionOffset >= offset && sectionOffset - offset < BVH4FLAT_SECTION_ALIGNMENT);
+	if (sectionOffset > offset && fwrite(zeros,(size_t)(sectionOffset - offset),1,f) != 1)
+		return false;
+	if (size > 0 && fwrite(data,size,1,f) != 1)
+		return false;
+	offset = sectionOffset + size;
+	return true;
+}
+
+// depth-first pre-order, so the root ends up at index 0 and siblings' subtrees are contiguous
+static uint32 FlattenInternal(const BVH4Node* node,std::vector<BVH4Flat::Node>& nodes,std::vector<BVH4Flat::Leaf>& leaves,std::vector<Triangle3V>& triangles)
+{
+	const uint32 nodeIndex = (uint32)nodes.size();
+	nodes.push_back(BVH4Flat::Node());
+	Box3V bounds[BVH4Flat::N];
+	uint32 children[BVH4Flat::N];
+	for (unsigned i = 0; i < BVH4Flat::N; i++) {
+		if (node->IsChildNonEmpty(i)) {
+			bounds[i] = node->GetChildBounds(i);
+			if (node->IsChildLeaf(i)) {
+				const BVH4Node::Leaf* leaf = node->GetChildLeaf(i);
+				BVH4Flat::Leaf flatLeaf;
+				flatLeaf.m_firstTri = (uint32)triangles.size();
+				flatLeaf.m_triCount = leaf->GetTriCount();
+				for (unsigned j = 0; j < flatLeaf.m_triCount; j++)
+					triangles.push_back(leaf->GetTriangle(j));
+				children[i] = (uint32)leaves.size() | BVH4FLAT_LEAF_FLAG;
+				leaves.push_back(flatLeaf);
+			} else
+				children[i] = FlattenInternal(node->GetChildNode(i),nodes,leaves,triangles);
+		} else {
+			bounds[i] = Box3V(Vec3V(FLT_MAX),Vec3V(FLT_MAX)); // Box3V::Invalid() won't return empty intersection ..
+			children[i] = 0;
+		}
+	}
+	nodes[nodeIndex].m_bounds = Box3V_SOA4(bounds);
+	for (unsigned i = 0; i < BVH4Flat::N; i++)
+		nodes[nodeIndex].m_children[i] = children[i];
+	return nodeIndex;
+}
+
+// one pass over the nodes and leaves so traversal never has to range check - children come after their parent in
+// depth-first pre-order, which also rules out cycles
+static const char* ValidateReferences(const BVH4Flat::Header* header,const BVH4Flat::Node* nodes,const BVH4Flat::Leaf* leaves)
+{
+	const BVHCounts& counts = header->m_counts;
+	for (uint32 nodeIndex = 0; nodeIndex < counts.m_nodeCount; nodeIndex++) {
+		for (unsigned i = 0; i < BVH4Flat::N; i++) {
+			const uint32 ref = nodes[nodeIndex].m_children[i];
+			if (ref == 0)
+				continue;
+			else if (ref & BVH4FLAT_LEAF_FLAG) {
+				if ((ref & ~BVH4FLAT_LEAF_FLAG) >= counts.m_leafCount)
+					return "leaf index is out of range";
+			} else if (ref <= nodeIndex || ref >= counts.m_nodeCount)
+				return "node index is out of range";
+		}
+	}
+	for (uint32 leafIndex = 0; leafIndex < counts.m_leafCount; leafIndex++) {
+		if ((uint64)leaves[leafIndex].m_firstTri + leaves[leafIndex].m_triCount > counts.m_triCount)
+			return "leaf triangles are out of range";
+	}
+	return NULL;
+}
+
+BVH4Flat* BVH4Flat::Load(const char* path)
+{
+	char path2[512];
+	strcpy(path2,PathExt(path,".bvh4f"));
+	BVH4Flat* bvh = new BVH4Flat();
+	if (!bvh->m_file.Open(path2)) {
+		fprintf(stderr,"failed to load BVH %s!\n",path2);
+		delete bvh;
+		return NULL;
+	}
+	const uint8* data = bvh->m_file.GetData();
+	const uint64 size = bvh->m_file.GetSize();
+	const Header* header = reinterpret_cast<const Header*>(data);
+	const char* error = NULL;
+	if (size < sizeof(Header) || header->m_magic != BVH4FLAT_MAGIC)
+		error = "not a flat BVH4 file";
+	else if (header->m_version != BVH4FLAT_VERSION || header->m_headerSize < sizeof(Header))
+		error = "unsupported version";
+	else if (header->m_fileSize != size)
+		error = "file is truncated";
+	else if (header->m_counts.m_nodeCount == 0 ||
+		header->m_nodeOffset + (uint64)header->m_counts.m_nodeCount*sizeof(Node) > size ||
+		header->m_leafOffset + (uint64)header->m_counts.m_leafCount*sizeof(Leaf) > size ||
+		header->m_triOffset + (uint64)header->m_counts.m_triCount*sizeof(Triangle3V) > size)
+		error = "sections are out of range";
+	else if ((header->m_nodeOffset|header->m_leafOffset|header->m_triOffset) & (BVH4FLAT_SECTION_ALIGNMENT - 1))
+		error = "sections are misaligned";
+	else
+		error = ValidateReferences(header,reinterpret_cast<const Node*>(data + header->m_nodeOffset),reinterpret_cast<const Leaf*>(data + header->m_leafOffset));
+	if (error) {
+		fprintf(stderr,"failed to load BVH %s! (%s)\n",path2,error);
+		delete bvh;
+		return NULL;
+	}
+	bvh->m_header = header;
+	bvh->m_nodes = reinterpret_cast<const Node*>(data + header->m_nodeOffset);
+	bvh->m_leaves = reinterpret_cast<const Leaf*>(data + header->m_leafOffset);
+	bvh->m_triangles = reinterpret_cast<const Triangle3V*>(data + header->m_triOffset);
+	return bvh;
+}
+
+bool BVH4Flat::Save(const char* path,const BVH4Node* root)
+{
+	std::vector<Node> nodes;
+	std::vector<Leaf> leaves;
+	std::vector<Triangle3V> triangles;
+	FlattenInternal(root,nodes,leaves,triangles);
+
+	Header header;
+	memset(&header,0,sizeof(header));
+	header.m_magic = BVH4FLAT_MAGIC;
+	header.m_version = BVH4FLAT_VERSION;
+	header.m_headerSize = sizeof(Header);
+	header.m_counts = BVHCounts((uint32)nodes.size(),(uint32)leaves.size(),(uint32)triangles.size());
+	header.m_nodeOffset = AlignSection(sizeof(Header));
+	header.m_leafOffset = AlignSection(header.m_nodeOffset + nodes.size()*sizeof(Node));
+	header.m_triOffset = AlignSection(header.m_leafOffset + leaves.size()*sizeof(Leaf));
+	header.m_fileSize = header.m_triOffset + triangles.size()*sizeof(Triangle3V);
+
+	char path2[512];
+	strcpy(path2,PathExt(path,".bvh4f"));
+	FILE* f = fopen(path2,"wb");
+	if (f == NULL) {
+		fprintf(stderr,"failed to save BVH %s!\n",path2);
+		return false;
+	}
+	uint64 offset = 0;
+	bool ok = WriteSection(f,offset,0,&header,sizeof(header));
+	ok = ok && WriteSection(f,offset,header.m_nodeOffset,nodes.data(),nodes.size()*sizeof(Node));
+	ok = ok && WriteSection(f,offset,header.m_leafOffset,leaves.data(),leaves.size()*sizeof(Leaf));
+	ok = ok && WriteSection(f,offset,header.m_triOffset,triangles.data(),triangles.size()*sizeof(Triangle3V));
+	fclose(f);
+	if (!ok)
+		fprintf(stderr,"failed to write BVH %s!\n",path2);
+	return ok;
+}
+
+bool BVH4Flat::ConvertBVH4(const char* srcPath,const char* dstPath,const Mat34V* transform)
+{
+	BVH4Node* root = BVH4Node::Load(srcPath,transform);
+	if (root == NULL)
+		return false;
+	const bool ok = Save(dstPath,root);
+	if (ok) {
+		const BVHCounts counts = root->Count();
+		printf("converted %s -> %s (%u nodes, %u leaves, %u triangles)\n",srcPath,dstPath,counts.m_nodeCount,counts.m_leafCount,counts.m_triCount);
+	}
+	root->Release();
+	return ok;
+}
+
+void BVH4Flat::Release()
+{
+	m_file.Close();
+	delete this;
+}
+
+const Box3V BVH4Flat::GetBounds() const
+{
+	const Node& root = m_nodes[0];
+	Box3V bounds = Box3V::Invalid();
+	for (unsigned i = 0; i < N && root.m_children[i]; i++)
+		bounds.Grow(root.m_bounds.GetIndexed(i));
+	return bounds;
+}
\ No newline at end of file
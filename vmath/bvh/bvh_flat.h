@@ -0,0 +1,158 @@
+// =====================
+// common/bvh/bvh_flat.h
+// =====================
+
+#ifndef _INCLUDE_BVH_FLAT_H_
+#define _INCLUDE_BVH_FLAT_H_
+
+#include "bvh.h"
+#include "GraphicsTools/util/fileutil.h"
+
+// flat, pointer-free BVH4 which is traversed directly from a memory mapped .bvh4f file (no deserialization)
+// file layout: Header | Node[nodeCount] | Leaf[leafCount] | Triangle3V[triCount], each section 64-byte aligned
+// nodes are stored depth-first with the root at index 0, so a child reference of 0 means empty
+// child references are 32-bit: BVH4FLAT_LEAF_FLAG|leafIndex for leaves, nodeIndex otherwise
+#define BVH4FLAT_MAGIC     (0x46485642) // "BVHF"
+#define BVH4FLAT_VERSION   (1)
+#define BVH4FLAT_LEAF_FLAG (0x80000000)
+
+class BVH4Flat
+{
+public:
+	enum { N = 4 };
+
+	class Header
+	{
+	public:
+		uint32 m_magic;
+		uint32 m_version;
+		uint32 m_headerSize; // sizeof(Header) when written, so later versions can append fields
+		uint32 m_flags; // reserved
+		BVHCounts m_counts;
+		uint32 m_reserved;
+		uint64 m_nodeOffset; // byte offsets from start of file
+		uint64 m_leafOffset;
+		uint64 m_triOffset;
+		uint64 m_fileSize;
+	};
+
+	class Node
+	{
+	public:
+		Box3V_SOA4 m_bounds; // empty children have FLT_MAX bounds
+		uint32 m_children[N];
+	};
+
+	class Leaf
+	{
+	public:
+		uint32 m_firstTri;
+		uint32 m_triCount;
+	};
+
+	VMATH_INLINE static const char* GetClassName_() { return "BVH4Flat"; }
+
+	static BVH4Flat* Load(const char* path);
+	static bool Save(const char* path,const BVH4Node* root);
+	static bool ConvertBVH4(const char* srcPath,const char* dstPath,const Mat34V* transform = NULL); // .bvh4 (or EmbreeSaveBVH4 output) -> .bvh4f
+	void Release();
+
+	VMATH_INLINE const BVHCounts& Count() const { return m_header->m_counts; }
+	const Box3V GetBounds() const;
+
+	VMATH_INLINE void Trace(Vec3V_arg origin,Vec3V_arg dir,float& t_ BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
+	{
+		ScalarV t(t_);
+		Trace(origin,dir,t BVH_STATS_ONLY(,mask,stats));
+		t_ = t.f();
+	}
+
+	// single ray, intersects all child bounds at once
+	VMATH_INLINE void Trace(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t BVH_STATS_ONLY(,uint32,BVHStats&)) const
+	{
+		const Vec3V invdir = Recip(dir);
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+		uint32 stack[BVH_STACK_MAX_DEPTH] = {0};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uint32 ref = stack[--stackIndex];
+			if (ref & BVH4FLAT_LEAF_FLAG) {
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(m_leaves[ref & ~BVH4FLAT_LEAF_FLAG].m_triCount));
+				IntersectsLeaf(ref & ~BVH4FLAT_LEAF_FLAG,origin,dir,t);
+			} else {
+				const Node& node = m_nodes[ref];
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				uint32 childMask = node.m_bounds.IntersectsRay(origin,invdir,t);
+				for (unsigned childIndex = 0; childMask && node.m_children[childIndex]; childIndex++, childMask >>= 1) {
+					if (childMask & 1) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node.m_children[childIndex];
+					}
+				}
+			}
+		}
+	}
+
+	// ray packets
+	template <typename OriginType,typename DirType> VMATH_INLINE void Trace(const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,uint32,BVHStats&)) const
+	{
+		const DirType invdir = Recip(dir);
+		BVH_COUNTERS_ONLY(BVHCounters* counters = BVHCounters::GetCurrent());
+		BVH_COUNTERS_ONLY(if (counters) counters->m_numTraversals++);
+		uint32 stack[BVH_STACK_MAX_DEPTH] = {0};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uint32 ref = stack[--stackIndex];
+			if (ref & BVH4FLAT_LEAF_FLAG) {
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitLeaf(m_leaves[ref & ~BVH4FLAT_LEAF_FLAG].m_triCount));
+				IntersectsLeaf(ref & ~BVH4FLAT_LEAF_FLAG,origin,dir,t);
+			} else {
+				const Node& node = m_nodes[ref];
+				BVH_COUNTERS_ONLY(if (counters) counters->VisitNode(N,stackIndex + 1));
+				for (unsigned i = 0; i < N && node.m_children[i]; i++) {
+					const uint32 mask = node.m_bounds.GetIndexed(i).IntersectsRay(origin,invdir,t);
+					if (mask) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node.m_children[i];
+						BVH_COUNTERS_ONLY(if (counters) counters->PushChild(mask,DirType::ComponentType::NumElements));
+					}
+				}
+			}
+		}
+	}
+
+private:
+	BVH4Flat() : m_header(NULL), m_nodes(NULL), m_leaves(NULL), m_triangles(NULL) {}
+
+	VMATH_INLINE void IntersectsLeaf(uint32 leafIndex,Vec3V_arg origin,Vec3V_arg dir,ScalarV& t) const
+	{
+		const Leaf& leaf = m_leaves[leafIndex];
+		const Triangle3V* triangles = m_triangles + leaf.m_firstTri;
+		for (uint32 i = 0; i < leaf.m_triCount; i++) {
+			ScalarV t_;
+			if (triangles[i].IntersectsRay(origin,dir,t_))
+				t = Min(t_,t);
+		}
+	}
+
+	template <typename OriginType,typename DirType> VMATH_INLINE void IntersectsLeaf(uint32 leafIndex,const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t) const
+	{
+		typedef typename DirType::ComponentType ComponentType;
+		const Leaf& leaf = m_leaves[leafIndex];
+		const Triangle3V* triangles = m_triangles + leaf.m_firstTri;
+		for (uint32 i = 0; i < leaf.m_triCount; i++) {
+			ComponentType t_;
+			if (triangles[i].IntersectsRay(origin,dir,t_,-1))
+				t = Min(t_,t);
+		}
+	}
+
+	MappedFile m_file;
+	const Header* m_header;
+	const Node* m_nodes;
+	const Leaf* m_leaves;
+	const Triangle3V* m_triangles;
+};
+
+#endif // _INCLUDE_BVH_FLAT_H_
\ No newline at end of file
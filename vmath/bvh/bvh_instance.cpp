@@ -0,0 +1,220 @@
+// ===========================
+// common/bvh/bvh_instance.cpp
+// ===========================
+
+#include "bvh_instance.h"
+
+BVHInstanceTree::~BVHInstanceTree()
+{
+	if (m_nodes)
+		AlignedFree(m_nodes);
+}
+
+uint32 BVHInstanceTree::AddInstance(const BVH4Node* root,Mat34V_arg transform)
+{
+	ForceAssert(root);
+	const uint32 index = (uint32)m_instances.size();
+	BVHInstance instance;
+	instance.m_root = root;
+	m_instances.push_back(instance);
+	SetTransform(index,transform);
+	m_root = NULL; // leaves point into m_instances, which may have moved
+	return index;
+}
+
+void BVHInstanceTree::SetTransform(uint32 index,Mat34V_arg transform)
+{
+	BVHInstance& instance = m_instances[index];
+	instance.m_transform = transform;
+	instance.m_invTransform = InvertAffine(transform);
+	instance.m_bounds = transform.TransformBox(instance.m_root->GetBounds());
+}
+
+void BVHInstanceTree::Clear()
+{
+	m_instances.clear();
+	m_nodeCount = 0;
+	m_root = NULL;
+}
+
+const Box3V BVHInstanceTree::GetBounds() const
+{
+	Box3V bounds = Box3V::Invalid();
+	for (size_t i = 0; i < m_instances.size(); i++)
+		bounds.Grow(m_instances[i].m_bounds);
+	return bounds;
+}
+
+void BVHInstanceTree::Build()
+{
+	const uint32 count = (uint32)m_instances.size();
+	m_nodeCount = 0;
+	m_root = NULL;
+	if (count == 0)
+		return;
+	const uint32 maxNodes = Max(1U,count - 1); // every node has at least two children, except a root over a single instance
+	if (maxNodes > m_nodeCapacity) {
+		if (m_nodes)
+			AlignedFree(m_nodes);
+		m_nodeCapacity = Max(maxNodes,m_nodeCapacity*2);
+		m_nodes = AlignedAlloc<BVH4Node>(m_nodeCapacity,BVH_ARENA_ALIGNMENT);
+	}
+	m_indices.resize(count);
+	for (uint32 i = 0; i < count; i++)
+		m_indices[i] = i;
+	BVH4Node* root = &m_nodes[m_nodeCount++];
+	BuildNode(root,m_indices.data(),count BVH_STATS_ONLY(,0));
+	m_root = root;
+}
+
+void BVHInstanceTree::BuildNode(BVH4Node* node,uint32* indices,uint32 count BVH_STATS_ONLY(,uint32 depth))
+{
+	enum { N = BVH4Node::N };
+	DEBUG_ASSERT(count > 0);
+	// split into up to four ranges - one instance each for small ranges, otherwise two levels of median splits along the
+	// longest axis of the range's centroid bounds
+	uint32 split[N + 1] = {0};
+	uint32 numRanges = 0;
+	if (count <= N) {
+		for (numRanges = 0; numRanges <= count; numRanges++)
+			split[numRanges] = numRanges;
+		numRanges = count;
+	} else {
+		auto MedianSplit = [this](uint32* first,uint32 n) -> uint32 {
+			Box3V centroidBounds = Box3V::Invalid();
+			for (uint32 i = 0; i < n; i++)
+				centroidBounds.Grow(m_instances[first[i]].m_bounds.GetCenter());
+			const unsigned axis = MaxElementIndex(centroidBounds.GetSize());
+			std::nth_element(first,first + n/2,first + n,[this,axis](uint32 a,uint32 b) { return m_instances[a].m_bounds.GetCenter()[axis] < m_instances[b].m_bounds.GetCenter()[axis]; });
+			return n/2;
+		};
+		const uint32 mid = MedianSplit(indices,count);
+		split[0] = 0;
+		split[1] = MedianSplit(indices,mid);
+		split[2] = mid;
+		split[3] = mid + MedianSplit(indices + mid,count - mid);
+		split[4] = count;
+		numRanges = N;
+	}
+	Box3V bounds[N];
+	memset(node->m_children,0,sizeof(node->m_children));
+	for (uint32 i = 0; i < N; i++) {
+		bounds[i] = Box3V::Invalid();
+		if (i < numRanges) {
+			const uint32 first = split[i];
+			const uint32 n = split[i + 1] - first;
+			for (uint32 j = 0; j < n; j++)
+				bounds[i].Grow(m_instances[indices[first + j]].m_bounds);
+			if (n == 1)
+				node->m_children[i] = BVH_LEAF_FLAG | reinterpret_cast<uintptr_t>(&m_instances[indices[first]]);
+			else {
+				DEBUG_ASSERT(m_nodeCount < m_nodeCapacity);
+				BVH4Node* child = &m_nodes[m_nodeCount++];
+				BuildNode(child,indices + first,n BVH_STATS_ONLY(,depth + 1));
+				node->m_children[i] = reinterpret_cast<uintptr_t>(child);
+			}
+		}
+	}
+	node->SetChildBounds(bounds);
+#if BVH_STATS
+	node->m_depth = depth;
+#endif // BVH_STATS
+}
+
+void BVHInstanceTree::PushChildren(const BVH4Node* node,unsigned octant,Vec3V_arg origin,Vec3V_arg invdir,ScalarV_arg t,uintptr_t stack[],unsigned& stackIndex)
+{
+#if BVH_SOA_BOUNDS
+	uint32 childMask = node->m_bounds.IntersectsRay(origin,invdir,t); // intersect all child bounds at once
+#else
+	uint32 childMask = 0;
+	for (unsigned i = 0; i < BVH4Node::N && node->IsChildNonEmpty(i); i++)
+		childMask |= node->GetChildBounds(i).IntersectsRay(origin,invdir,t) ? (1 << i) : 0;
+#endif
+	const unsigned order = node->GetChildOrder(octant);
+	for (unsigned k = 0; childMask && k < BVH4Node::N; k++) {
+		const unsigned i = BVH4Node::GetChildPushIndex(order,k);
+		if ((childMask & (1 << i)) && node->IsChildNonEmpty(i)) {
+			DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+			stack[stackIndex++] = node->GetChildRef(i);
+			childMask &= ~(1 << i);
+		}
+	}
+}
+
+void BVHInstanceTree::Trace(Vec3V_arg origin,Vec3V_arg dir,float& t BVH_STATS_ONLY(,BVHStats& stats)) const
+{
+	if (m_root == NULL)
+		return;
+	const Vec3V invdir = Recip(dir);
+	const unsigned octant = BVHCommon::GetDirectionOctant(dir);
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(m_root)};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const BVHInstance* instance = reinterpret_cast<const BVHInstance*>(ref & ~BVH_LEAF_FLAG);
+			instance->m_root->Trace(instance->TransformPoint(origin),instance->TransformDir(dir),t BVH_STATS_ONLY(,0x0001,stats));
+		} else {
+			PushChildren(reinterpret_cast<const BVH4Node*>(ref),octant,origin,invdir,ScalarV(t),stack,stackIndex);
+		}
+	}
+}
+
+bool BVHInstanceTree::TraceHit(Vec3V_arg origin,Vec3V_arg dir,BVHHit& hit,uint32& instanceIndex,uint32 fields) const
+{
+	instanceIndex = BVH_INVALID_PRIM_ID;
+	if (m_root == NULL)
+		return false;
+	const Vec3V invdir = Recip(dir);
+	const unsigned octant = BVHCommon::GetDirectionOctant(dir);
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(m_root)};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const BVHInstance* instance = reinterpret_cast<const BVHInstance*>(ref & ~BVH_LEAF_FLAG);
+			BVHHit instanceHit; // BVH4Node::TraceHit writes the fields on a miss too, so each instance gets its own
+			instanceHit.m_t = hit.m_t;
+			instance->m_root->TraceHit(instance->TransformPoint(origin),instance->TransformDir(dir),instanceHit,fields);
+			if (instanceHit.m_t < hit.m_t) {
+				if (fields & BVH_HIT_PRIM_ID)
+					hit.m_primID = instanceHit.m_primID;
+				if (fields & BVH_HIT_UV) {
+					hit.m_u = instanceHit.m_u;
+					hit.m_v = instanceHit.m_v;
+				}
+				if (fields & BVH_HIT_NORMAL)
+					hit.m_normal = instance->TransformNormal(instanceHit.m_normal);
+				hit.m_t = instanceHit.m_t;
+				instanceIndex = (uint32)(instance - m_instances.data());
+			}
+		} else {
+			PushChildren(reinterpret_cast<const BVH4Node*>(ref),octant,origin,invdir,ScalarV(hit.m_t),stack,stackIndex);
+		}
+	}
+	if (instanceIndex == BVH_INVALID_PRIM_ID && (fields & BVH_HIT_PRIM_ID))
+		hit.m_primID = BVH_INVALID_PRIM_ID;
+	return instanceIndex != BVH_INVALID_PRIM_ID;
+}
+
+bool BVHInstanceTree::Occluded(Vec3V_arg origin,Vec3V_arg dir,float tmax) const
+{
+	if (m_root == NULL)
+		return false;
+	const Vec3V invdir = Recip(dir);
+	const unsigned octant = BVHCommon::GetDirectionOctant(dir);
+	const ScalarV tmax_(tmax);
+	uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(m_root)};
+	unsigned stackIndex = 1;
+	while (stackIndex > 0) {
+		const uintptr_t ref = stack[--stackIndex];
+		if (ref & BVH_LEAF_FLAG) {
+			const BVHInstance* instance = reinterpret_cast<const BVHInstance*>(ref & ~BVH_LEAF_FLAG);
+			if (instance->m_root->Occluded(instance->TransformPoint(origin),instance->TransformDir(dir),tmax))
+				return true;
+		} else {
+			PushChildren(reinterpret_cast<const BVH4Node*>(ref),octant,origin,invdir,tmax_,stack,stackIndex);
+		}
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+// =========================
+// common/bvh/bvh_instance.h
+// =========================
+
+#ifndef _INCLUDE_BVH_INSTANCE_H_
+#define _INCLUDE_BVH_INSTANCE_H_
+
+#include "bvh.h"
+#include "vmath/vmath_matrix.h"
+
+// one placement of a shared object-space BVH4 - the tree is not owned, so any number of instances can reference it and
+// memory scales with the unique geometry rather than with the number of placements
+class BVHInstance
+{
+public:
+	const BVH4Node* m_root;
+	Mat34V m_transform; // object to world
+	Mat34V m_invTransform; // world to object
+	Box3V m_bounds; // world space
+
+	// rays are transformed into object space without renormalizing the direction, so t means the same thing in both spaces
+	// and the instance can be traced with the world space t
+	VMATH_INLINE Vec3V_out TransformPoint(Vec3V_arg v) const { return m_invTransform.Transform(v); }
+	template <typename T> VMATH_INLINE const T TransformPoint(const T& v) const { return TransformDir(v) + T(m_invTransform.d()); }
+	VMATH_INLINE Vec3V_out TransformDir(Vec3V_arg v) const { return m_invTransform.TransformDir(v); }
+	template <typename T> VMATH_INLINE const T TransformDir(const T& v) const { return T(m_invTransform.a())*v.x() + T(m_invTransform.b())*v.y() + T(m_invTransform.c())*v.z(); }
+	VMATH_INLINE Vec3V_out TransformNormal(Vec3V_arg n) const { return Normalize(m_invTransform.TransformTransposeDir(n)); } // inverse transpose, handles non-uniform scale
+};
+
+// two-level BVH - a top-level BVH4 over the world bounds of instances, whose leaves are instances rather than triangles
+// moving instances only requires SetTransform and Build, the instanced trees are untouched
+// the top-level nodes are stored in one aligned array which is reused by later builds, so rebuilding every frame doesn't allocate
+class BVHInstanceTree
+{
+public:
+	BVHInstanceTree() : m_nodes(NULL),m_nodeCapacity(0),m_nodeCount(0),m_root(NULL) {}
+	~BVHInstanceTree();
+
+	// adding instances invalidates the top level until the next Build
+	uint32 AddInstance(const BVH4Node* root,Mat34V_arg transform);
+	void SetTransform(uint32 index,Mat34V_arg transform); // call Build before tracing again
+	void Clear();
+
+	VMATH_INLINE uint32 GetInstanceCount() const { return (uint32)m_instances.size(); }
+	VMATH_INLINE const BVHInstance& GetInstance(uint32 index) const { DEBUG_ASSERT(index < m_instances.size()); return m_instances[index]; }
+	VMATH_INLINE uint32 GetNodeCount() const { return m_nodeCount; }
+	const Box3V GetBounds() const;
+
+	// median split over instance centroids, O(n log n) and much cheaper than a SAH build - the top level is small and
+	// is expected to be rebuilt whenever instances move
+	void Build();
+
+	void Trace(Vec3V_arg origin,Vec3V_arg dir,float& t BVH_STATS_ONLY(,BVHStats& stats)) const;
+	bool TraceHit(Vec3V_arg origin,Vec3V_arg dir,BVHHit& hit,uint32& instanceIndex,uint32 fields = BVH_HIT_ALL) const; // hit.m_normal is in world space
+	bool Occluded(Vec3V_arg origin,Vec3V_arg dir,float tmax = ZBUFFER_DEFAULT) const;
+
+	template <typename OriginType,typename DirType> VMATH_INLINE void Trace(const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,BVHStats& stats)) const
+	{
+		enum { N = BVH4Node::N };
+		BVH_STATS_ONLY(const uint32 all = (uint32)((1ULL << DirType::ComponentType::NumElements) - 1));
+		if (m_root == NULL)
+			return;
+		const DirType invdir = Recip(dir);
+		const unsigned octant = BVHCommon::GetDirectionOctant(dir);
+		uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(m_root)};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uintptr_t ref = stack[--stackIndex];
+			if (ref & BVH_LEAF_FLAG) {
+				const BVHInstance* instance = reinterpret_cast<const BVHInstance*>(ref & ~BVH_LEAF_FLAG);
+				instance->m_root->Trace(instance->TransformPoint(origin),instance->TransformDir(dir),t BVH_STATS_ONLY(,all,stats));
+			} else {
+				const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+				const unsigned order = node->GetChildOrder(octant);
+				for (unsigned k = 0; k < N; k++) {
+					const unsigned i = BVH4Node::GetChildPushIndex(order,k);
+					if (node->IsChildNonEmpty(i) && node->GetChildBounds_BroadcastSOA<Box3V_SOA_T<DirType>>(i).IntersectsRay(origin,invdir,t)) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node->GetChildRef(i);
+					}
+				}
+			}
+		}
+	}
+
+	// returns the mask of occluded rays
+	template <typename OriginType,typename DirType> VMATH_INLINE uint32 Occluded(const OriginType& origin,const DirType& dir,typename DirType::ComponentType::ArgType tmax) const
+	{
+		enum { N = BVH4Node::N };
+		const uint32 all = (uint32)((1ULL << DirType::ComponentType::NumElements) - 1);
+		if (m_root == NULL)
+			return 0;
+		const DirType invdir = Recip(dir);
+		uint32 done = 0;
+		uintptr_t stack[BVH_STACK_MAX_DEPTH] = {reinterpret_cast<uintptr_t>(m_root)};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uintptr_t ref = stack[--stackIndex];
+			if (ref & BVH_LEAF_FLAG) {
+				const BVHInstance* instance = reinterpret_cast<const BVHInstance*>(ref & ~BVH_LEAF_FLAG);
+				done |= instance->m_root->Occluded(instance->TransformPoint(origin),instance->TransformDir(dir),tmax,all & ~done); // rays occluded by earlier instances aren't traced again
+				if (done == all)
+					break;
+			} else {
+				const BVH4Node* node = reinterpret_cast<const BVH4Node*>(ref);
+				for (unsigned i = 0; i < N && node->IsChildNonEmpty(i); i++) {
+					if (node->GetChildBounds_BroadcastSOA<Box3V_SOA_T<DirType>>(i).IntersectsRay(origin,invdir,tmax) & ~done) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node->GetChildRef(i);
+					}
+				}
+			}
+		}
+		return done;
+	}
+
+private:
+	static void PushChildren(const BVH4Node* node,unsigned octant,Vec3V_arg origin,Vec3V_arg invdir,ScalarV_arg t,uintptr_t stack[],unsigned& stackIndex);
+	void BuildNode(BVH4Node* node,uint32* indices,uint32 count BVH_STATS_ONLY(,uint32 depth));
+
+	std::vector<BVHInstance> m_instances; // leaves point into this, so it must not be resized between Build and tracing
+	std::vector<uint32> m_indices; // scratch for Build
+	BVH4Node* m_nodes;
+	uint32 m_nodeCapacity;
+	uint32 m_nodeCount;
+	const BVH4Node* m_root; // NULL if there are no instances or Build hasn't been called
+};
+
+#endif // _INCLUDE_BVH_INSTANCE_H_
\ No newline at end of file
@@ -0,0 +1,102 @@
+// ============================
+// common/bvh/bvh_quantized.cpp
+// ============================
+
+#include "bvh_quantized.h"
+#include "GraphicsTools/util/memory.h"
+
+template <typename QType> static void QuantizeChildBounds(typename BVH4Quantized_T<QType>::Node& node,const BVH4Node* src)
+{
+	typedef BVH4Quantized_T<QType> BVHType;
+	const Box3V bounds = src->GetBounds();
+	for (unsigned axis = 0; axis < 3; axis++) {
+		const float bmin = bounds.GetMin()[axis];
+		const float bmax = bounds.GetMax()[axis];
+		float scale = (bmax - bmin)/(float)BVHType::QMAX;
+		while (bmin + (float)BVHType::QMAX*scale < bmax)
+			scale = nextafterf(scale,FLT_MAX);
+		node.m_origin[axis] = bmin;
+		node.m_scale[axis] = scale;
+		for (unsigned i = 0; i < BVHType::N; i++) {
+			int qmin = BVHType::QMAX; // empty children get inverted bounds (never tested, since children are packed)
+			int qmax = 0;
+			if (src->IsChildNonEmpty(i)) {
+				const Box3V childBounds = src->GetChildBounds(i);
+				const float cmin = childBounds.GetMin()[axis];
+				const float cmax = childBounds.GetMax()[axis];
+				qmin = scale > 0.0f ? Clamp((int)floorf((cmin - bmin)/scale),0,(int)BVHType::QMAX) : 0;
+				qmax = scale > 0.0f ? Clamp((int)ceilf((cmax - bmin)/scale),0,(int)BVHType::QMAX) : 0;
+				while (qmin > 0 && bmin + (float)qmin*scale > cmin) // make sure rounding error doesn't shrink the box, traversal computes exactly this
+					qmin--;
+				while (qmax < (int)BVHType::QMAX && bmin + (float)qmax*scale < cmax)
+					qmax++;
+			}
+			node.m_qmin[axis][i] = (QType)qmin;
+			node.m_qmax[axis][i] = (QType)qmax;
+		}
+	}
+}
+
+static void GetNodesDepthFirst(const BVH4Node* node,std::vector<const BVH4Node*>& nodes)
+{
+	nodes.push_back(node);
+	for (unsigned i = 0; i < BVH4Node::N && node->IsChildNonEmpty(i); i++) {
+		if (!node->IsChildLeaf(i))
+			GetNodesDepthFirst(node->GetChildNode(i),nodes);
+	}
+}
+
+template <typename QType> BVH4Quantized_T<QType>* BVH4Quantized_T<QType>::Create(const BVH4Node* root)
+{
+	std::vector<const BVH4Node*> nodes;
+	GetNodesDepthFirst(root,nodes);
+
+	std::map<const void*,uint32> offsets;
+	size_t size = 0;
+	for (size_t j = 0; j < nodes.size(); j++) {
+		offsets[nodes[j]] = (uint32)size;
+		size += sizeof(Node);
+	}
+	for (size_t j = 0; j < nodes.size(); j++) {
+		for (unsigned i = 0; i < N && nodes[j]->IsChildNonEmpty(i); i++) {
+			if (nodes[j]->IsChildLeaf(i)) {
+				const BVHCommon::Leaf* leaf = nodes[j]->GetChildLeaf(i);
+				size = (size + BVHCommon::Leaf::HEADER_SIZE - 1) & ~(size_t)(BVHCommon::Leaf::HEADER_SIZE - 1);
+				offsets[leaf] = (uint32)size;
+				size += leaf->GetSize();
+			}
+		}
+	}
+	ForceAssertf(size < 0x80000000,"quantized BVH arena is too large (%llu bytes)",(uint64)size); // offsets are 32-bit
+
+	BVH4Quantized_T* bvh = new BVH4Quantized_T();
+	bvh->m_arena = AlignedAlloc<uint8>(size,BVH_ARENA_ALIGNMENT);
+	bvh->m_arenaSize = size;
+	bvh->m_counts = root->Count();
+	bvh->m_bounds = root->GetBounds();
+	for (size_t j = 0; j < nodes.size(); j++) {
+		const BVH4Node* src = nodes[j];
+		Node& node = *reinterpret_cast<Node*>(bvh->m_arena + offsets[src]);
+		QuantizeChildBounds<QType>(node,src);
+		for (unsigned i = 0; i < N; i++) {
+			if (!src->IsChildNonEmpty(i))
+				node.m_children[i] = 0;
+			else if (src->IsChildLeaf(i)) {
+				const BVHCommon::Leaf* leaf = src->GetChildLeaf(i);
+				memcpy(bvh->m_arena + offsets[leaf],leaf,leaf->GetSize());
+				node.m_children[i] = offsets[leaf] | (uint32)BVHCommon::BVH_LEAF_FLAG;
+			} else
+				node.m_children[i] = offsets[src->GetChildNode(i)];
+		}
+	}
+	return bvh;
+}
+
+template <typename QType> void BVH4Quantized_T<QType>::Release()
+{
+	AlignedFree(m_arena);
+	delete this;
+}
+
+template class BVH4Quantized_T<uint8>;
+template class BVH4Quantized_T<uint16>;
\ No newline at end of file
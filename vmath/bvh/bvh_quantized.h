@@ -0,0 +1,123 @@
+// ==========================
+// common/bvh/bvh_quantized.h
+// ==========================
+
+#ifndef _INCLUDE_BVH_QUANTIZED_H_
+#define _INCLUDE_BVH_QUANTIZED_H_
+
+#include "bvh.h"
+
+VMATH_INLINE Vec4V_out BVHDequantize4(const uint8 q[4]) { return Vec4V(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(*reinterpret_cast<const int*>(q))))); }
+VMATH_INLINE Vec4V_out BVHDequantize4(const uint16 q[4]) { return Vec4V(_mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q))))); }
+
+// BVH4 with child bounds quantized to 8 or 16 bits relative to the node's own bounds
+// the 8-bit node is 64 bytes (one cache line) vs. 128 bytes for BVH4Node, child bounds are rounded outward so traversal stays conservative
+// nodes are stored contiguously in depth-first order at the start of the arena (root first), followed by the leaves
+// child references are 32-bit byte offsets into the arena, leaves are tagged with BVH_LEAF_FLAG and 0 means empty
+template <typename QType> class BVH4Quantized_T
+{
+public:
+	enum { N = 4 };
+	enum { QMAX = (1 << (8*sizeof(QType))) - 1 };
+
+	class Node
+	{
+	public:
+		VMATH_INLINE const Box3V_SOA4 GetChildBounds() const // dequantize all four children at once
+		{
+			const Vec4V ox = Vec4V::LoadScalar(&m_origin[0]);
+			const Vec4V oy = Vec4V::LoadScalar(&m_origin[1]);
+			const Vec4V oz = Vec4V::LoadScalar(&m_origin[2]);
+			const Vec4V sx = Vec4V::LoadScalar(&m_scale[0]);
+			const Vec4V sy = Vec4V::LoadScalar(&m_scale[1]);
+			const Vec4V sz = Vec4V::LoadScalar(&m_scale[2]);
+			const Vec3V_SOA4 bmin(ox + BVHDequantize4(m_qmin[0])*sx,oy + BVHDequantize4(m_qmin[1])*sy,oz + BVHDequantize4(m_qmin[2])*sz);
+			const Vec3V_SOA4 bmax(ox + BVHDequantize4(m_qmax[0])*sx,oy + BVHDequantize4(m_qmax[1])*sy,oz + BVHDequantize4(m_qmax[2])*sz);
+			return Box3V_SOA4(bmin,bmax);
+		}
+
+		float m_origin[3]; // node bounds min
+		float m_scale[3]; // node bounds size/QMAX, rounded up so that origin + QMAX*scale covers the node bounds
+		QType m_qmin[3][N]; // per axis, per child
+		QType m_qmax[3][N];
+		uint32 m_children[N];
+	};
+
+	VMATH_INLINE static const char* GetClassName_() { return sizeof(QType) == 1 ? "BVH4Q8" : "BVH4Q16"; }
+
+	static BVH4Quantized_T* Create(const BVH4Node* root);
+	void Release();
+
+	VMATH_INLINE const BVHCounts& Count() const { return m_counts; }
+	VMATH_INLINE size_t GetArenaSize() const { return m_arenaSize; }
+	VMATH_INLINE const Box3V& GetBounds() const { return m_bounds; }
+
+	VMATH_INLINE const Node& GetNode(uint32 ref) const { return *reinterpret_cast<const Node*>(m_arena + ref); }
+	VMATH_INLINE const BVHCommon::Leaf* GetLeaf(uint32 ref) const { return reinterpret_cast<const BVHCommon::Leaf*>(m_arena + (ref & ~(uint32)BVHCommon::BVH_LEAF_FLAG)); }
+
+	VMATH_INLINE void Trace(Vec3V_arg origin,Vec3V_arg dir,float& t_ BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
+	{
+		ScalarV t(t_);
+		Trace(origin,dir,t BVH_STATS_ONLY(,mask,stats));
+		t_ = t.f();
+	}
+
+	// single ray, intersects all child bounds at once
+	VMATH_INLINE void Trace(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
+	{
+		const Vec3V invdir = Recip(dir);
+		uint32 stack[BVH_STACK_MAX_DEPTH] = {0};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uint32 ref = stack[--stackIndex];
+			if (ref & BVHCommon::BVH_LEAF_FLAG)
+				GetLeaf(ref)->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,mask,stats));
+			else {
+				const Node& node = GetNode(ref);
+				uint32 childMask = node.GetChildBounds().IntersectsRay(origin,invdir,t);
+				for (unsigned childIndex = 0; childMask && node.m_children[childIndex]; childIndex++, childMask >>= 1) {
+					if (childMask & 1) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node.m_children[childIndex];
+					}
+				}
+			}
+		}
+	}
+
+	// ray packets
+	template <typename OriginType,typename DirType> VMATH_INLINE void Trace(const OriginType& origin,const DirType& dir,typename DirType::ComponentType& t BVH_STATS_ONLY(,uint32 mask,BVHStats& stats)) const
+	{
+		const DirType invdir = Recip(dir);
+		uint32 stack[BVH_STACK_MAX_DEPTH] = {0};
+		unsigned stackIndex = 1;
+		while (stackIndex > 0) {
+			const uint32 ref = stack[--stackIndex];
+			if (ref & BVHCommon::BVH_LEAF_FLAG)
+				GetLeaf(ref)->IntersectsRay(origin,dir,t BVH_STATS_ONLY(,mask,stats));
+			else {
+				const Node& node = GetNode(ref);
+				const Box3V_SOA4 bounds = node.GetChildBounds();
+				for (unsigned i = 0; i < N && node.m_children[i]; i++) {
+					if (bounds.GetIndexed(i).IntersectsRay(origin,invdir,t)) {
+						DEBUG_ASSERT(stackIndex < BVH_STACK_MAX_DEPTH);
+						stack[stackIndex++] = node.m_children[i];
+					}
+				}
+			}
+		}
+	}
+
+private:
+	BVH4Quantized_T() : m_arena(NULL), m_arenaSize(0) {}
+
+	uint8* m_arena;
+	size_t m_arenaSize;
+	BVHCounts m_counts;
+	Box3V m_bounds;
+};
+
+typedef BVH4Quantized_T<uint8> BVH4Quantized8;
+typedef BVH4Quantized_T<uint16> BVH4Quantized16;
+
+#endif // _INCLUDE_BVH_QUANTIZED_H_
\ No newline at end of file
@@ -4,17 +4,16 @@
 
 #include "common/common.h"
 
-#if PLATFORM_PC
-#include <windows.h> // WTF why why why why??
-#endif // PLATFORM_PC
-
 #include "GraphicsTools/util/imageutil.h"
-#include "GraphicsTools/util/memory.h"
 #include "GraphicsTools/util/mesh.h"
 #include "GraphicsTools/util/progressdisplay.h"
+#include "GraphicsTools/util/raster.h"
+#include "GraphicsTools/util/taskscheduler.h"
 
 #include "vmath/bvh/bvh.h"
+#include "vmath/bvh/bvh_flat.h"
 #include "vmath/bvh/bvh_render.h"
+#include "vmath/bvh/bvh_stream.h"
 
 #include "vmath/vmath.h"
 #include "vmath/vmath_sampling.h"
@@ -22,16 +21,10 @@
 
 #if PLATFORM_PC && defined(_OFFLINETOOL)
 #define USE_XXX_SAVE_IMAGE (0)
-#define USE_XXX_MULTITASK (0)
 #elif XXX_GAME
 #define USE_XXX_SAVE_IMAGE (1)
-#define USE_XXX_MULTITASK (1)
 #endif
 
-#if USE_XXX_MULTITASK
-#include "Utility/MultiTaskMan.h"
-#endif // USE_XXX_MULTITASK
-
 #if defined(_EMBREE)
 #include "../../../embree-2.17.2/include/embree2/rtcore_ray.h"
 #endif // defined(_EMBREE)
@@ -272,43 +265,159 @@ DEF_RENDER_TRIANGLES_TRI_N(Triangle3V_SOA8,8)
 #endif // HAS_VEC8V
 #undef DEF_RENDER_TRIANGLES_TRI_N
 
+void RenderTriangles_RASTER(const std::vector<Triangle3V>& triangles, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	if (zclear)
+		ClearZBuffer(zbuf, w, h);
+	const Vec3V origin = camera.d();
+	const float tanHFOV = tanVFOV*(float)w/(float)h;
+	const Vec3V dirStepX = +camera.a()*(2.0f*tanHFOV/(float)(w - 1)); // change in dir for each pixel horizontally
+	const Vec3V dirStepY = -camera.b()*(2.0f*tanVFOV/(float)(h - 1)); // change in dir for each pixel vertically
+	const Vec3V dir00 = camera.TransformDir(Vec3V(-tanHFOV, tanVFOV, 1.0f));
+	ProgressDisplay progress("rasterizing %u triangles", (unsigned)triangles.size());
+	raster::RasterizeDepth(zbuf, w, h, triangles.data(), triangles.size(), origin, dir00, dirStepX, dirStepY, TRIANGLE_TWOSIDED_DEFAULT, BVH_THREADS_SWITCH(scheduler, NULL));
+	const float pixelsPerSecond = ((float)(w*h))/progress.GetTimeInSeconds();
+	progress.End("%.4f Mpixels/sec", pixelsPerSecond/1000000.0f);
+	NormalizeAndSaveZBufferImage(zbuf, w, h, zscale, zoffset, calc_z_range, path, "_RASTER");
+}
+
+#if BVH_COUNTERS
+static std::string s_countersJSONPath;
+static std::string s_countersCSVPath;
+
+void SetRenderCountersOutput(const char* jsonPath, const char* csvPath)
+{
+	s_countersJSONPath = jsonPath ? jsonPath : "";
+	s_countersCSVPath = csvPath ? csvPath : "";
+}
+
+// BVHCounters for each thread of one render, only allocated while SetRenderCountersOutput has an output
+class RenderCounters
+{
+public:
+	RenderCounters(unsigned numThreads) : m_enabled(!s_countersJSONPath.empty() || !s_countersCSVPath.empty())
+	{
+		if (m_enabled)
+			m_threadCounters.resize(Max(1U, numThreads));
+	}
+
+	// for the calling thread's whole share of the work - when disabled, traversal keeps counting into whatever the caller set up
+	BVHCounters* Get(unsigned threadIndex) { return m_enabled ? &m_threadCounters[threadIndex] : BVHCounters::GetCurrent(); }
+
+	// for each piece of work handed to a thread - it counts into a local BVHCounters which is added to the thread's once at
+	// the end, so threads aren't writing to neighbouring counters while they trace
+	template <typename Func> void Count(unsigned threadIndex, Func func)
+	{
+		if (m_enabled) {
+			BVHCounters local;
+			{
+				BVHCounters::Scope scope(&local);
+				func();
+			}
+			m_threadCounters[threadIndex] += local;
+		} else
+			func();
+	}
+
+	void Export(const char* label, uint64 numRays) const
+	{
+		if (!m_enabled)
+			return;
+		BVHCounters counters;
+		for (size_t i = 0; i < m_threadCounters.size(); i++)
+			counters += m_threadCounters[i];
+		counters.m_numRays = numRays;
+		if (!s_countersJSONPath.empty() && !counters.SaveJSON(s_countersJSONPath.c_str(), label))
+			fprintf(stderr, "failed to write BVH counters to %s!\n", s_countersJSONPath.c_str());
+		if (!s_countersCSVPath.empty() && !counters.AppendCSV(s_countersCSVPath.c_str(), label))
+			fprintf(stderr, "failed to write BVH counters to %s!\n", s_countersCSVPath.c_str());
+	}
+
+private:
+	bool m_enabled;
+	std::vector<BVHCounters> m_threadCounters;
+};
+#endif // BVH_COUNTERS
+
 #if BVH_THREADS
-template <typename NodeType,typename PacketType,typename ComponentType> class RenderTriangles_BVH_LocalData_T
+// renders take the caller's scheduler (NULL renders on the calling thread), so benchmarks don't start and join threads per frame
+static unsigned GetNumThreads(const TaskScheduler* scheduler)
+{
+	return scheduler ? scheduler->GetNumThreads() : 0;
+}
+
+#define BVH_RENDER_TILE_SIZE (32) // pixels, rounded up to a multiple of the packet size
+
+// screen is split into small tiles which are handed to the task scheduler, so threads which finish early steal the
+// remaining tiles instead of idling (fixed strips scale poorly past ~12 threads, as the strips vary greatly in cost)
+template <typename NodeType,typename PacketType,typename ComponentType> class RenderTriangles_BVH_TileData_T
 {
 public:
-	void Render()
+	void RenderTile(unsigned tileIndex BVH_STATS_ONLY(, BVHStats& stats)) const
 	{
 		const unsigned packetSize = packetW*packetH;
 		const unsigned packetMask = (1 << packetSize) - 1;
-		for (unsigned j = 0; j < h; j += packetH) {
+		const unsigned packetsX = w/packetW;
+		const unsigned packetsY = h/packetH;
+		const unsigned x0 = (tileIndex%numTilesX)*tilePacketsX;
+		const unsigned y0 = (tileIndex/numTilesX)*tilePacketsY;
+		const unsigned x1 = Min(x0 + tilePacketsX, packetsX);
+		const unsigned y1 = Min(y0 + tilePacketsY, packetsY);
+		PacketType dirRowStart = dir00;
+		dirRowStart += dirPacketStepX*(float)x0 + dirPacketStepY*(float)y0;
+		for (unsigned j = y0; j < y1; j++) {
+			ComponentType* zptr = zbuf + j*packetsX + x0; // packets are stored in swizzled order, row-major over packets
 			PacketType dir = dirRowStart;
-			for (unsigned i = 0; i < w; i += packetW) {
-				root->Trace(origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, *stats));
+			for (unsigned i = x0; i < x1; i++) {
+				root->Trace(origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
 				dir += dirPacketStepX;
 			}
 			dirRowStart += dirPacketStepY;
 		}
 	}
-#if PLATFORM_PC
-	static DWORD WINAPI StaticRender(LPVOID param) { reinterpret_cast<RenderTriangles_BVH_LocalData_T*>(param)->Render(); return 0; }
-#elif USE_XXX_MULTITASK
-	static bool StaticRender(MultiTask task) { reinterpret_cast<RenderTriangles_BVH_LocalData_T*>(task)->Render(); return true; }
-#endif
+
+	void Render(TaskScheduler& scheduler BVH_COUNTERS_ONLY(, RenderCounters& counters) BVH_STATS_ONLY(, BVHStats& stats))
+	{
+		tilePacketsX = Max(1U, (BVH_RENDER_TILE_SIZE + packetW - 1)/packetW);
+		tilePacketsY = Max(1U, (BVH_RENDER_TILE_SIZE + packetH - 1)/packetH);
+		numTilesX = (w/packetW + tilePacketsX - 1)/tilePacketsX;
+		const unsigned numTilesY = (h/packetH + tilePacketsY - 1)/tilePacketsY;
+		BVH_STATS_ONLY(BVHStats* threadStats = new BVHStats[scheduler.GetNumThreads()]);
+		scheduler.ParallelFor(numTilesX*numTilesY, 1, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+		#if BVH_COUNTERS
+			counters.Count(threadIndex, [&]() {
+				for (unsigned tileIndex = begin; tileIndex < end; tileIndex++)
+					RenderTile(tileIndex BVH_STATS_ONLY(, threadStats[threadIndex]));
+			});
+		#else
+			for (unsigned tileIndex = begin; tileIndex < end; tileIndex++)
+				RenderTile(tileIndex BVH_STATS_ONLY(, threadStats[threadIndex]));
+		#endif // BVH_COUNTERS
+		});
+	#if BVH_STATS
+		for (unsigned i = 0; i < scheduler.GetNumThreads(); i++)
+			stats += threadStats[i];
+		delete[] threadStats;
+	#endif // BVH_STATS
+	}
+
 	const NodeType* root;
 	unsigned w;
 	unsigned h;
 	unsigned packetW;
 	unsigned packetH;
-	ComponentType* zptr;
+	unsigned tilePacketsX;
+	unsigned tilePacketsY;
+	unsigned numTilesX;
+	ComponentType* zbuf;
 	Vec3V origin;
-	PacketType dirRowStart;
-	PacketType dirPacketStepX;
-	PacketType dirPacketStepY;
-	BVH_STATS_ONLY(BVHStats* stats);
+	PacketType dir00;
+	Vec3V dirPacketStepX;
+	Vec3V dirPacketStepY;
 };
 #endif // BVH_THREADS
 
-template <typename NodeType,unsigned packetW,unsigned packetH> class RenderTriangles_BVH { public: static void func(const NodeType* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads))
+template <typename NodeType,unsigned packetW,unsigned packetH> class RenderTriangles_BVH { public: static void func(const NodeType* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler))
 {
 	const unsigned packetSize = packetW*packetH;
 	const unsigned packetMask = (1 << packetSize) - 1;
@@ -332,68 +441,38 @@ template <typename NodeType,unsigned packetW,unsigned packetH> class RenderTrian
 	ForceAssert((reinterpret_cast<uintptr_t>(zptr) & (packetSize*sizeof(float) - 1)) == 0);
 	BVH_STATS_ONLY(BVHStats stats);
 #if BVH_THREADS
+	const unsigned numThreads = GetNumThreads(scheduler);
 	ProgressDisplay progress("rendering %s - %ux%u ray packets (%u threads)", NodeType::GetClassName_(), packetW, packetH, numThreads);
 #else
 	ProgressDisplay progress("rendering %s - %ux%u ray packets", NodeType::GetClassName_(), packetW, packetH);
 #endif
+	BVH_COUNTERS_ONLY(RenderCounters counters(BVH_THREADS_SWITCH(numThreads, 1)));
 #if BVH_THREADS
-	if (numThreads > 0) {
-		typedef RenderTriangles_BVH_LocalData_T<NodeType,PacketType,ComponentType> LocalData;
-		LocalData* data = AlignedAlloc<LocalData>(numThreads, 32);
-	#if PLATFORM_PC
-		HANDLE* threads = new HANDLE[numThreads];
-	#elif USE_XXX_MULTITASK
-		MultiTask_InitQueue();
-	#endif
-		unsigned stripW = w;
-		unsigned stripH = (h + numThreads - 1)/numThreads; // break into numThreads strips (last strip may be too long)
-		stripH = ((stripH + packetH - 1)/packetH)*packetH; // round up to packetH
-		ForceAssert(stripH%packetH == 0);
-		unsigned j = 0; // track the number of pixel rows for all strips
-		for (unsigned i = 0; i < numThreads; i++) {
-			data[i].root = root;
-			data[i].w = stripW;
-			data[i].h = Min(stripH, h - j); j += data[i].h;
-			data[i].packetW = packetW;
-			data[i].packetH = packetH;
-			data[i].zptr = zptr; zptr += (w/packetW)*(stripH/packetH);
-			data[i].origin = origin;
-			data[i].dirRowStart = dirRowStart; dirRowStart += dirPacketStepY*(float)(stripH/packetH);
-			data[i].dirPacketStepX = dirPacketStepX;
-			data[i].dirPacketStepY = dirPacketStepY;
-			BVH_STATS_ONLY(data[i].stats = new BVHStats);
-		#if PLATFORM_PC
-			threads[i] = CreateThread(NULL, 0, LocalData::StaticRender, &data[i], 0, NULL);
-		#elif USE_XXX_MULTITASK
-			MultiTask_AddTask((MultiTask)&data[i]);
-		#endif
-		}
-		ForceAssert(j == h);
-	#if PLATFORM_PC
-		WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
-	#elif USE_XXX_MULTITASK
-		MultiTask_ProcessQueue(LocalData::StaticRender);
-	#endif
-		for (unsigned i = 0; i < numThreads; i++) {
-		#if PLATFORM_PC
-			CloseHandle(threads[i]);
-		#endif // PLATFORM_PC
-			BVH_STATS_ONLY(stats += *data[i].stats);
-			BVH_STATS_ONLY(delete data[i].stats);
-		}
-		AlignedFree(data);
-	#if PLATFORM_PC
-		delete[] threads;
-	#endif // PLATFORM_PC
+	if (scheduler) {
+		RenderTriangles_BVH_TileData_T<NodeType,PacketType,ComponentType> data;
+		data.root = root;
+		data.w = w;
+		data.h = h;
+		data.packetW = packetW;
+		data.packetH = packetH;
+		data.zbuf = zptr;
+		data.origin = origin;
+		data.dir00 = dirRowStart;
+		data.dirPacketStepX = dirPacketStepX;
+		data.dirPacketStepY = dirPacketStepY;
+		data.Render(*scheduler BVH_COUNTERS_ONLY(, counters) BVH_STATS_ONLY(, stats));
 	} else
 #endif // BVH_THREADS
-	for (unsigned j = 0; j < h; j += packetH) {
-		PacketType dir = dirRowStart;
-		for (unsigned i = 0; i < w; i += packetW) {
-			root->Trace(origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
-			dir += dirPacketStepX;
+	{
+		BVH_COUNTERS_ONLY(BVHCounters::Scope countersScope(counters.Get(0)));
+		for (unsigned j = 0; j < h; j += packetH) {
+			PacketType dir = dirRowStart;
+			for (unsigned i = 0; i < w; i += packetW) {
+				root->Trace(origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
+				dir += dirPacketStepX;
+			}
+			dirRowStart += dirPacketStepY;
 		}
-		dirRowStart += dirPacketStepY;
 	}
 	UnswizzleZBuffer<packetW,packetH>(zbuf, w, h);
 	const float raysPerSecond = ((float)(w*h))/progress.GetTimeInSeconds();
@@ -409,10 +488,11 @@ template <typename NodeType,unsigned packetW,unsigned packetH> class RenderTrian
 #else
 	sprintf(ext, "_%s_%ux%u", NodeType::GetClassName_(), packetW, packetH);
 #endif
+	BVH_COUNTERS_ONLY(counters.Export(ext + 1, w*h));
 	NormalizeAndSaveZBufferImage(zbuf, w, h, zscale, zoffset, calc_z_range, path, ext);
 }};
 
-template <typename NodeType> class RenderTriangles_BVH<NodeType,1,1> { public: static void func(const NodeType* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads))
+template <typename NodeType> class RenderTriangles_BVH<NodeType,1,1> { public: static void func(const NodeType* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler))
 {
 	const unsigned packetMask = 0x0001;
 	if (zclear)
@@ -426,66 +506,38 @@ template <typename NodeType> class RenderTriangles_BVH<NodeType,1,1> { public: s
 	float* zptr = zbuf;
 	BVH_STATS_ONLY(BVHStats stats);
 #if BVH_THREADS
+	const unsigned numThreads = GetNumThreads(scheduler);
 	ProgressDisplay progress("rendering %s - 1x1 ray packets (%u threads)", NodeType::GetClassName_(), numThreads);
 #else
 	ProgressDisplay progress("rendering %s - 1x1 ray packets", NodeType::GetClassName_());
 #endif
+	BVH_COUNTERS_ONLY(RenderCounters counters(BVH_THREADS_SWITCH(numThreads, 1)));
 #if BVH_THREADS
-	if (numThreads > 0) {
-		typedef RenderTriangles_BVH_LocalData_T<NodeType,Vec3V,float> LocalData;
-		LocalData* data = AlignedAlloc<LocalData>(numThreads, 32);
-	#if PLATFORM_PC
-		HANDLE* threads = new HANDLE[numThreads];
-	#elif USE_XXX_MULTITASK
-		MultiTask_InitQueue();
-	#endif
-		unsigned stripW = w;
-		unsigned stripH = (h + numThreads - 1)/numThreads; // break into numThreads strips (last strip may be too long)
-		unsigned j = 0;
-		for (unsigned i = 0; i < numThreads; i++) {
-			data[i].root = root;
-			data[i].w = stripW;
-			data[i].h = Min(stripH, h - j); j += data[i].h;
-			data[i].packetW = 1;
-			data[i].packetH = 1;
-			data[i].zptr = zptr; zptr += w*stripH;
-			data[i].origin = origin;
-			data[i].dirRowStart = dirRowStart; dirRowStart += dirStepY*(float)stripH;
-			data[i].dirPacketStepX = dirStepX;
-			data[i].dirPacketStepY = dirStepY;
-			BVH_STATS_ONLY(data[i].stats = new BVHStats);
-		#if PLATFORM_PC
-			threads[i] = CreateThread(NULL, 0, LocalData::StaticRender, &data[i], 0, NULL);
-		#elif USE_XXX_MULTITASK
-			MultiTask_AddTask((MultiTask)&data[i]);
-		#endif
-		}
-		ForceAssert(j == h);
-	#if PLATFORM_PC
-		WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
-	#elif USE_XXX_MULTITASK
-		MultiTask_ProcessQueue(LocalData::StaticRender);
-	#endif
-		for (unsigned i = 0; i < numThreads; i++) {
-		#if PLATFORM_PC
-			CloseHandle(threads[i]);
-		#endif // PLATFORM_PC
-			BVH_STATS_ONLY(stats += *data[i].stats);
-			BVH_STATS_ONLY(delete data[i].stats);
-		}
-		AlignedFree(data);
-	#if PLATFORM_PC
-		delete[] threads;
-	#endif // PLATFORM_PC
+	if (scheduler) {
+		RenderTriangles_BVH_TileData_T<NodeType,Vec3V,float> data;
+		data.root = root;
+		data.w = w;
+		data.h = h;
+		data.packetW = 1;
+		data.packetH = 1;
+		data.zbuf = zptr;
+		data.origin = origin;
+		data.dir00 = dirRowStart;
+		data.dirPacketStepX = dirStepX;
+		data.dirPacketStepY = dirStepY;
+		data.Render(*scheduler BVH_COUNTERS_ONLY(, counters) BVH_STATS_ONLY(, stats));
 	} else
 #endif // BVH_THREADS
-	for (unsigned j = 0; j < h; j++) {
-		Vec3V dir = dirRowStart;
-		for (unsigned i = 0; i < w; i++) {
-			root->Trace(origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
-			dir += dirStepX;
+	{
+		BVH_COUNTERS_ONLY(BVHCounters::Scope countersScope(counters.Get(0)));
+		for (unsigned j = 0; j < h; j++) {
+			Vec3V dir = dirRowStart;
+			for (unsigned i = 0; i < w; i++) {
+				root->Trace(origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
+				dir += dirStepX;
+			}
+			dirRowStart += dirStepY;
 		}
-		dirRowStart += dirStepY;
 	}
 	const float raysPerSecond = ((float)(w*h))/progress.GetTimeInSeconds();
 #if BVH_STATS
@@ -500,20 +552,35 @@ template <typename NodeType> class RenderTriangles_BVH<NodeType,1,1> { public: s
 #else
 	sprintf(ext, "_%s_1x1", NodeType::GetClassName_());
 #endif
+	BVH_COUNTERS_ONLY(counters.Export(ext + 1, w*h));
 	NormalizeAndSaveZBufferImage(zbuf, w, h, zscale, zoffset, calc_z_range, path, ext);
 }};
 
-#define DEF_RENDER_TRIANGLES_BVH(packetW,packetH) \
-void RenderTriangles_BVH_##packetW##x##packetH(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads)) \
+#define DEF_RENDER_TRIANGLES_BVH(NodeType,name,packetW,packetH) \
+void RenderTriangles_##name##_##packetW##x##packetH(const NodeType* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler)) \
 { \
-	RenderTriangles_BVH<BVH4Node,packetW,packetH>::func(root,camera,tanVFOV,zbuf,w,h,zclear,zscale,zoffset,calc_z_range,path BVH_THREADS_ONLY(,numThreads)); \
+	RenderTriangles_BVH<NodeType,packetW,packetH>::func(root,camera,tanVFOV,zbuf,w,h,zclear,zscale,zoffset,calc_z_range,path BVH_THREADS_ONLY(,scheduler)); \
 }
-DEF_RENDER_TRIANGLES_BVH(1,1)
-DEF_RENDER_TRIANGLES_BVH(4,1)
-DEF_RENDER_TRIANGLES_BVH(2,2)
+DEF_RENDER_TRIANGLES_BVH(BVH4Node,BVH,1,1)
+DEF_RENDER_TRIANGLES_BVH(BVH4Node,BVH,4,1)
+DEF_RENDER_TRIANGLES_BVH(BVH4Node,BVH,2,2)
+#if HAS_VEC8V
+DEF_RENDER_TRIANGLES_BVH(BVH4Node,BVH,8,1)
+DEF_RENDER_TRIANGLES_BVH(BVH4Node,BVH,4,2)
+#endif // HAS_VEC8V
+#if HAS_VEC8V
+DEF_RENDER_TRIANGLES_BVH(BVH8Node,BVH8,1,1)
+DEF_RENDER_TRIANGLES_BVH(BVH8Node,BVH8,4,1)
+DEF_RENDER_TRIANGLES_BVH(BVH8Node,BVH8,2,2)
+DEF_RENDER_TRIANGLES_BVH(BVH8Node,BVH8,8,1)
+DEF_RENDER_TRIANGLES_BVH(BVH8Node,BVH8,4,2)
+#endif // HAS_VEC8V
+DEF_RENDER_TRIANGLES_BVH(BVH4Flat,BVH4Flat,1,1)
+DEF_RENDER_TRIANGLES_BVH(BVH4Flat,BVH4Flat,4,1)
+DEF_RENDER_TRIANGLES_BVH(BVH4Flat,BVH4Flat,2,2)
 #if HAS_VEC8V
-DEF_RENDER_TRIANGLES_BVH(8,1)
-DEF_RENDER_TRIANGLES_BVH(4,2)
+DEF_RENDER_TRIANGLES_BVH(BVH4Flat,BVH4Flat,8,1)
+DEF_RENDER_TRIANGLES_BVH(BVH4Flat,BVH4Flat,4,2)
 #endif // HAS_VEC8V
 #undef DEF_RENDER_TRIANGLES_BVH
 
@@ -633,83 +700,221 @@ static void RenderTriangles_8x1_EMBREE(RTCScene scene, Mat34V_arg camera, float
 }
 #endif // defined(_EMBREE_SOURCE)
 
+// number of pixels which differ between two renders, maxDiff is FLT_MAX if coverage differs
+static unsigned CountZBufferDiffs(const float* zbuf, const float* reference, unsigned count, float& maxDiff)
+{
+	unsigned numDiffs = 0;
+	maxDiff = 0.0f;
+	for (unsigned k = 0; k < count; k++) {
+		if (zbuf[k] != reference[k]) {
+			numDiffs++;
+			if (zbuf[k] != ZBUFFER_DEFAULT && reference[k] != ZBUFFER_DEFAULT)
+				maxDiff = Max(fabsf(zbuf[k] - reference[k]), maxDiff);
+			else
+				maxDiff = FLT_MAX; // coverage differs
+		}
+	}
+	return numDiffs;
+}
+
+unsigned CountZBufferMismatches(const float* zbuf, const float* reference, unsigned w, unsigned h, float tolerance, unsigned* numCoverageMismatches)
+{
+	unsigned numMismatches = 0;
+	unsigned numCoverage = 0;
+	for (unsigned k = 0; k < w*h; k++) {
+		const bool covered = zbuf[k] != ZBUFFER_DEFAULT;
+		if (covered != (reference[k] != ZBUFFER_DEFAULT)) {
+			numMismatches++;
+			numCoverage++;
+		} else if (covered && fabsf(zbuf[k] - reference[k]) > tolerance*fabsf(reference[k]))
+			numMismatches++;
+	}
+	if (numCoverageMismatches)
+		*numCoverageMismatches = numCoverage;
+	return numMismatches;
+}
+
 #if BVH_TILES
-template <unsigned packetW, unsigned packetH> void RenderTriangles_BVH_TILES(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path)
+template <unsigned packetW, unsigned packetH> class RenderTriangles_BVH_TILES_Packet_T
+{
+public:
+	typedef typename SOA_T<packetW*packetH>::Vec3V_SOAType PacketType;
+	typedef typename PacketType::ComponentType ComponentType;
+	static const PacketType Construct(const Vec3V dv[]) { return PacketType(dv); }
+};
+
+template <> class RenderTriangles_BVH_TILES_Packet_T<1,1>
 {
+public:
+	typedef Vec3V PacketType;
+	typedef float ComponentType;
+	static const PacketType Construct(const Vec3V dv[]) { return dv[0]; }
+};
+
+// each screen tile is culled against the BVH with a frustum through its pixel boundaries, and the tile's rays start
+// traversal at the entry points found for it - tiles are split into quadrants down to BVH_TILES_MIN_SIZE, each quadrant
+// searching from its parent's entry points rather than from the root
+template <unsigned packetW, unsigned packetH> class RenderTriangles_BVH_TILES_T
+{
+public:
+	typedef typename RenderTriangles_BVH_TILES_Packet_T<packetW,packetH>::PacketType PacketType;
+	typedef typename RenderTriangles_BVH_TILES_Packet_T<packetW,packetH>::ComponentType ComponentType;
+
+	const Plane3V GetTilePlane(Vec3V_arg dir0, Vec3V_arg dir1, Vec3V_arg inside) const
+	{
+		const Vec3V normal = Cross(dir0, dir1);
+		return Plane3V::ConstructFromPointAndNormal(origin, (Dot(normal, inside) < 0.0f) ? -normal : normal);
+	}
+
+	void RenderTile(const uintptr_t parentEntries[], unsigned numParentEntries, unsigned x0, unsigned y0, unsigned x1, unsigned y1 BVH_STATS_ONLY(, BVHStats& stats, EntryPointSearchStats& epStats)) const
+	{
+		// planes pass half a pixel outside the tile's edge rays, so rounding in the frustum test can't cull anything they hit
+		const float fx0 = (float)x0 - 0.5f;
+		const float fx1 = (float)x1 - 0.5f;
+		const float fy0 = (float)y0 - 0.5f;
+		const float fy1 = (float)y1 - 0.5f;
+		const Vec3V d00 = dir00 + dirStepX*fx0 + dirStepY*fy0;
+		const Vec3V d10 = dir00 + dirStepX*fx1 + dirStepY*fy0;
+		const Vec3V d01 = dir00 + dirStepX*fx0 + dirStepY*fy1;
+		const Vec3V d11 = dir00 + dirStepX*fx1 + dirStepY*fy1;
+		const Vec3V center = (d00 + d11)*0.5f;
+		const Plane3V planes[] = {GetTilePlane(d00, d01, center), GetTilePlane(d10, d11, center), GetTilePlane(d00, d10, center), GetTilePlane(d01, d11, center)};
+		const BVHFrustum frustum(planes);
+		uintptr_t entries[BVH_TILES_MAX_ENTRY_POINTS];
+		unsigned numEntries = 0;
+		for (unsigned k = 0; k < numParentEntries; k++) {
+			const unsigned maxEntries = countof(entries) - numEntries - (numParentEntries - k - 1); // leave room for one entry point per remaining parent entry point
+			numEntries += BVH4Node::PathCompression(parentEntries[k], frustum, entries + numEntries, maxEntries BVH_STATS_ONLY(, epStats));
+		}
+		if (numEntries == 0)
+			return; // nothing in this tile
+		if (x1 - x0 > minTileW || y1 - y0 > minTileH) {
+			const unsigned xm = (x1 - x0 > minTileW) ? x0 + (((x1 - x0)/2 + packetW - 1)/packetW)*packetW : x1;
+			const unsigned ym = (y1 - y0 > minTileH) ? y0 + (((y1 - y0)/2 + packetH - 1)/packetH)*packetH : y1;
+			RenderTile(entries, numEntries, x0, y0, xm, ym BVH_STATS_ONLY(, stats, epStats));
+			if (xm < x1)
+				RenderTile(entries, numEntries, xm, y0, x1, ym BVH_STATS_ONLY(, stats, epStats));
+			if (ym < y1)
+				RenderTile(entries, numEntries, x0, ym, xm, y1 BVH_STATS_ONLY(, stats, epStats));
+			if (xm < x1 && ym < y1)
+				RenderTile(entries, numEntries, xm, ym, x1, y1 BVH_STATS_ONLY(, stats, epStats));
+		} else {
+			const unsigned packetMask = (1 << (packetW*packetH)) - 1;
+			for (unsigned y = y0; y < y1; y += packetH) {
+				ComponentType* zptr = zbuf + (y/packetH)*(w/packetW) + x0/packetW; // packets are stored in swizzled order, row-major over packets
+				PacketType dir = dirPacket00;
+				dir += dirStepX*(float)x0 + dirStepY*(float)y;
+				for (unsigned x = x0; x < x1; x += packetW) {
+					for (unsigned k = 0; k < numEntries; k++)
+						BVH4Node::TraceStatic(entries[k], origin, dir, *zptr BVH_STATS_ONLY(, packetMask, stats));
+					dir += dirPacketStepX;
+					zptr++;
+				}
+			}
+		}
+	}
+
+	void Render(TaskScheduler* scheduler BVH_COUNTERS_ONLY(, RenderCounters& counters) BVH_STATS_ONLY(, BVHStats& stats, EntryPointSearchStats& epStats)) const
+	{
+		const unsigned numTilesX = (w + tileW - 1)/tileW;
+		const unsigned numTilesY = (h + tileH - 1)/tileH;
+		const uintptr_t rootRef = reinterpret_cast<uintptr_t>(root);
+		auto RenderRootTile = [&](unsigned tileIndex BVH_STATS_ONLY(, BVHStats& tileStats, EntryPointSearchStats& tileEPStats)) {
+			const unsigned x0 = (tileIndex%numTilesX)*tileW;
+			const unsigned y0 = (tileIndex/numTilesX)*tileH;
+			RenderTile(&rootRef, 1, x0, y0, Min(x0 + tileW, w), Min(y0 + tileH, h) BVH_STATS_ONLY(, tileStats, tileEPStats));
+		};
+	#if BVH_THREADS
+		if (scheduler) {
+			BVH_STATS_ONLY(BVHStats* threadStats = new BVHStats[scheduler->GetNumThreads()]);
+			BVH_STATS_ONLY(EntryPointSearchStats* threadEPStats = new EntryPointSearchStats[scheduler->GetNumThreads()]);
+			scheduler->ParallelFor(numTilesX*numTilesY, 1, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+			#if BVH_COUNTERS
+				counters.Count(threadIndex, [&]() {
+					for (unsigned tileIndex = begin; tileIndex < end; tileIndex++)
+						RenderRootTile(tileIndex BVH_STATS_ONLY(, threadStats[threadIndex], threadEPStats[threadIndex]));
+				});
+			#else
+				for (unsigned tileIndex = begin; tileIndex < end; tileIndex++)
+					RenderRootTile(tileIndex BVH_STATS_ONLY(, threadStats[threadIndex], threadEPStats[threadIndex]));
+			#endif // BVH_COUNTERS
+			});
+		#if BVH_STATS
+			for (unsigned i = 0; i < scheduler->GetNumThreads(); i++) {
+				stats += threadStats[i];
+				epStats += threadEPStats[i];
+			}
+			delete[] threadStats;
+			delete[] threadEPStats;
+		#endif // BVH_STATS
+		} else
+	#endif // BVH_THREADS
+		{
+			(void)scheduler;
+			BVH_COUNTERS_ONLY(BVHCounters::Scope countersScope(counters.Get(0)));
+			for (unsigned tileIndex = 0; tileIndex < numTilesX*numTilesY; tileIndex++)
+				RenderRootTile(tileIndex BVH_STATS_ONLY(, stats, epStats));
+		}
+	}
+
+	const BVH4Node* root;
+	unsigned w;
+	unsigned h;
+	unsigned tileW;
+	unsigned tileH;
+	unsigned minTileW;
+	unsigned minTileH;
+	ComponentType* zbuf;
+	Vec3V origin;
+	Vec3V dir00; // pixel 0,0
+	Vec3V dirStepX;
+	Vec3V dirStepY;
+	PacketType dirPacket00; // packet 0,0
+	Vec3V dirPacketStepX;
+};
+
+template <unsigned packetW, unsigned packetH> static void RenderTriangles_BVH_TILES(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	typedef RenderTriangles_BVH_TILES_Packet_T<packetW,packetH> Packet;
+	typedef typename Packet::ComponentType ComponentType;
 	const unsigned packetSize = packetW*packetH;
-	const unsigned packetMask = (1 << packetSize) - 1;
-	typedef typename SOA_T<packetSize>::Vec3V_SOAType PacketType;
-	typedef typename SOA_T<packetSize>::Vec3V_SOAType::ComponentType ComponentType;
-	if (tileW%packetW != 0 || tileH%packetH != 0)
-		return;
-	const unsigned numCols = (w + tileW - 1)/tileW;
-	const unsigned numRows = (h + tileH - 1)/tileH;
+	ForceAssert(w%packetW == 0 && h%packetH == 0);
 	if (zclear)
 		ClearZBuffer(zbuf, w, h);
-	const Vec3V origin = camera.d();
 	const float tanHFOV = tanVFOV*(float)w/(float)h;
-	const Vec3V dirStepX = +camera.a()*(2.0f*tanHFOV/(float)(w - 1)); // change in dir for each pixel horizontally
-	const Vec3V dirStepY = -camera.b()*(2.0f*tanVFOV/(float)(h - 1)); // change in dir for each pixel vertically
-	const Vec3V dirPacketStepX = dirStepX*(float)packetW;
-	const Vec3V dirPacketStepY = dirStepY*(float)packetH;
-	const Vec3V dirTileStepX = dirStepX*(float)tileW;
-	const Vec3V dirTileStepY = dirStepY*(float)tileH;
-	const Vec3V dir00 = camera.TransformDir(Vec3V(-tanHFOV, tanVFOV, 1.0f));
+	RenderTriangles_BVH_TILES_T<packetW,packetH> data;
+	data.root = root;
+	data.w = w;
+	data.h = h;
+	data.tileW = Max(1U, (tileW + packetW - 1)/packetW)*packetW; // tiles are whole packets
+	data.tileH = Max(1U, (tileH + packetH - 1)/packetH)*packetH;
+	data.minTileW = Max(1U, (BVH_TILES_MIN_SIZE + packetW - 1)/packetW)*packetW;
+	data.minTileH = Max(1U, (BVH_TILES_MIN_SIZE + packetH - 1)/packetH)*packetH;
+	data.zbuf = reinterpret_cast<ComponentType*>(zbuf);
+	ForceAssert((reinterpret_cast<uintptr_t>(zbuf) & (packetSize*sizeof(float) - 1)) == 0);
+	data.origin = camera.d();
+	data.dirStepX = +camera.a()*(2.0f*tanHFOV/(float)(w - 1)); // change in dir for each pixel horizontally
+	data.dirStepY = -camera.b()*(2.0f*tanVFOV/(float)(h - 1)); // change in dir for each pixel vertically
+	data.dir00 = camera.TransformDir(Vec3V(-tanHFOV, tanVFOV, 1.0f));
 	Vec3V dv[packetSize];
 	for (unsigned j = 0; j < packetH; j++)
 		for (unsigned i = 0; i < packetW; i++)
-			dv[i + j*packetW] = dir00 + dirStepX*(float)i + dirStepY*(float)j;
-	const PacketType dirStart(dv);
-	Plane3V* planesX = new Plane3V[numCols + 1];
-	Plane3V* planesY = new Plane3V[numRows + 1];
-	for (unsigned col = 0; col <= numCols; col++) {
-		const float x = -1.0f + 2.0f*(float)col/(float)numCols; // [-1..1]
-		const Vec3V corner0 = camera.Transform(Vec3V(x*tanHFOV, -tanVFOV, 1.0f)); // flip tanVFOV?
-		const Vec3V corner1 = camera.Transform(Vec3V(x*tanHFOV, +tanVFOV, 1.0f));
-		planesX[col] = Plane3V::ConstructFrom3Points(origin, corner1, corner0);
-	}
-	for (unsigned row = 0; row <= numRows; row++) {
-		const float y = -1.0f + 2.0f*(float)row/(float)numRows; // [-1..1]
-		const Vec3V corner0 = camera.Transform(Vec3V(+tanHFOV, y*tanVFOV, 1.0f)); // flip tanVFOV?
-		const Vec3V corner1 = camera.Transform(Vec3V(-tanHFOV, y*tanVFOV, 1.0f));
-		planesY[row] = Plane3V::ConstructFrom3Points(origin, corner1, corner0);
-	}
+			dv[i + j*packetW] = data.dir00 + data.dirStepX*(float)i + data.dirStepY*(float)j;
+	data.dirPacket00 = Packet::Construct(dv);
+	data.dirPacketStepX = data.dirStepX*(float)packetW;
+#if BVH_THREADS
+	const unsigned numThreads = GetNumThreads(scheduler);
+#else
+	TaskScheduler* scheduler = NULL;
+	const unsigned numThreads = 0;
+#endif // BVH_THREADS
 #if BVH_STATS
 	BVHStats stats;
-	EntryPointSearchStats ep_stats;
+	EntryPointSearchStats epStats;
 #endif // BVH_STATS
-	ProgressDisplay progress("rendering BHV4 - %ux%u ray packets - %ux%u tiles", packetW, packetH, tileW, tileH);
-	PacketType dirTileRowStart = dirStart;
-	float* zptrTileRowStart = zbuf;
-	for (unsigned row = 0; row < numRows; row++) {
-		PacketType dirTile = dirTileRowStart;
-		float* zptrTile = zptrTileRowStart;
-		const unsigned tileH1 = tileH - ((row == numRows - 1) ? h%tileH : 0);
-		for (unsigned col = 0; col < numCols; col++) {
-			const Plane3V frustum[] = {planesX[col], planesY[row], -planesX[col + 1], -planesY[row + 1]};
-			PacketType dirRowStart = dirTile;
-			float* zptrRowStart = zptrTile;
-			const uintptr_t ref = root->EntryPointSearch(frustum BVH_STATS_ONLY(, ep_stats));
-			if (ref) {
-				const unsigned tileW1 = tileW - ((col == numCols - 1) ? w%tileW : 0);
-				for (unsigned j = 0; j < tileH1; j += packetH) {
-					PacketType dir = dirRowStart;
-					ComponentType* zptr = reinterpret_cast<ComponentType*>(zptrRowStart);
-					ForceAssert((reinterpret_cast<uintptr_t>(zptr) & (packetSize*sizeof(float) - 1)) == 0);
-					for (unsigned i = 0; i < tileW1; i += packetW) {
-						BVH4Node::TraceStatic(ref, origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
-						dir += dirPacketStepX;
-					}
-					dirRowStart += dirPacketStepY;
-					zptrRowStart += w;
-				}
-			}
-			dirTile += dirTileStepX;
-			zptrTile += tileW;
-		}
-		dirTileRowStart += dirTileStepY;
-		zptrTileRowStart += w*tileH;
-	}
+	ProgressDisplay progress("rendering BVH4 - %ux%u ray packets - %ux%u tiles (%u threads)", packetW, packetH, data.tileW, data.tileH, numThreads);
+	BVH_COUNTERS_ONLY(RenderCounters counters(Max(1U, numThreads)));
+	data.Render(scheduler BVH_COUNTERS_ONLY(, counters) BVH_STATS_ONLY(, stats, epStats));
 	UnswizzleZBuffer<packetW,packetH>(zbuf, w, h);
 	const float raysPerSecond = ((float)(w*h))/progress.GetTimeInSeconds();
 #if BVH_STATS
@@ -718,149 +923,314 @@ template <unsigned packetW, unsigned packetH> void RenderTriangles_BVH_TILES(con
 		stats.m_nodeCount,
 		stats.m_leafCount,
 		stats.m_triCount,
-		ep_stats.m_all_outs,
-		ep_stats.m_all_ins,
-		ep_stats.m_mixed_ins_outs,
-		ep_stats.m_child_codes[0],
-		ep_stats.m_child_codes[1],
-		ep_stats.m_child_codes[2]);
+		epStats.m_all_outs,
+		epStats.m_all_ins,
+		epStats.m_mixed_ins_outs,
+		epStats.m_child_codes[0],
+		epStats.m_child_codes[1],
+		epStats.m_child_codes[2]);
 	stats.Report(packetSize);
 #else
 	progress.End("%.4f Mrays/sec", raysPerSecond/1000000.0f);
 #endif
-	delete[] planesX;
-	delete[] planesY;
 	char ext[64];
-	sprintf(ext, "_BVH4_%ux%u_%ux%u_tiles", packetW, packetH, tileW, tileH);
+	sprintf(ext, "_BVH4_%ux%u_%ux%u_tiles", packetW, packetH, data.tileW, data.tileH);
+	BVH_COUNTERS_ONLY(counters.Export(ext + 1, w*h));
 	NormalizeAndSaveZBufferImage(zbuf, w, h, zscale, zoffset, calc_z_range, path, ext);
 }
 
-template <> void RenderTriangles_BVH_TILES<1,1>(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path)
+#define DEF_RENDER_TRIANGLES_BVH_TILES(packetW,packetH) \
+void RenderTriangles_BVH_TILES_##packetW##x##packetH(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler)) \
+{ \
+	RenderTriangles_BVH_TILES<packetW,packetH>(root,camera,tanVFOV,zbuf,w,h,tileW,tileH,zclear,zscale,zoffset,calc_z_range,path BVH_THREADS_ONLY(,scheduler)); \
+}
+DEF_RENDER_TRIANGLES_BVH_TILES(1,1)
+DEF_RENDER_TRIANGLES_BVH_TILES(4,1)
+DEF_RENDER_TRIANGLES_BVH_TILES(2,2)
+#if HAS_VEC8V
+DEF_RENDER_TRIANGLES_BVH_TILES(8,1)
+DEF_RENDER_TRIANGLES_BVH_TILES(4,2)
+#endif // HAS_VEC8V
+#undef DEF_RENDER_TRIANGLES_BVH_TILES
+
+void BenchmarkTiles(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, unsigned w, unsigned h BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	typedef void (*RenderFunc)(const BVH4Node*, Mat34V_arg, float, float*, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+	typedef void (*RenderTilesFunc)(const BVH4Node*, Mat34V_arg, float, float*, unsigned, unsigned, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+	const struct { const char* name; RenderFunc render; RenderTilesFunc renderTiles; } variants[] = {
+		{"1x1", RenderTriangles_BVH_1x1, RenderTriangles_BVH_TILES_1x1},
+		{"4x1", RenderTriangles_BVH_4x1, RenderTriangles_BVH_TILES_4x1},
+		{"2x2", RenderTriangles_BVH_2x2, RenderTriangles_BVH_TILES_2x2},
+	#if HAS_VEC8V
+		{"8x1", RenderTriangles_BVH_8x1, RenderTriangles_BVH_TILES_8x1},
+		{"4x2", RenderTriangles_BVH_4x2, RenderTriangles_BVH_TILES_4x2},
+	#endif // HAS_VEC8V
+	};
+	const unsigned tileSizes[] = {16, 32, 64, 128};
+	float* reference = AlignedAlloc<float>(w*h, 64);
+	float* zbuf = AlignedAlloc<float>(w*h, 64);
+	float zscale = 1.0f;
+	float zoffset = 0.0f;
+	bool calc_z_range = false;
+	for (unsigned i = 0; i < countof(variants); i++) {
+		uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		variants[i].render(root, camera, tanVFOV, reference, w, h, true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, scheduler)); // NULL path keeps the raw z values
+		const float seconds = ProgressDisplay::GetTimeInSeconds(startTime);
+		for (unsigned j = 0; j < countof(tileSizes); j++) {
+			startTime = ProgressDisplay::GetCurrentPerformanceTime();
+			variants[i].renderTiles(root, camera, tanVFOV, zbuf, w, h, tileSizes[j], tileSizes[j], true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, scheduler));
+			const float tileSeconds = ProgressDisplay::GetTimeInSeconds(startTime);
+			float maxDiff;
+			const unsigned numDiffs = CountZBufferDiffs(zbuf, reference, w*h, maxDiff); // should be zero, tiles only change where traversal starts
+			printf("tiles %s %ux%u: %.4f Mrays/sec vs %.4f Mrays/sec untiled (%.2fx), %u pixels differ (max diff %f)\n", variants[i].name, tileSizes[j], tileSizes[j], (float)(w*h)/(tileSeconds*1000000.0f), (float)(w*h)/(seconds*1000000.0f), seconds/tileSeconds, numDiffs, maxDiff);
+		}
+	}
+	AlignedFree(reference);
+	AlignedFree(zbuf);
+}
+#endif // BVH_TILES
+
+#if BVH_LARGE_PACKETS
+// each largeW x largeH block of pixels is traced with one BVH4Node::TraceLargePacket call over its packetW x packetH
+// sub-packets, which read and write their z values in place (so the z buffer is swizzled per sub-packet as usual)
+template <unsigned packetW, unsigned packetH> static void RenderTriangles_BVH_LARGE(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned largeW, unsigned largeH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler))
 {
-	const unsigned packetMask = 0x0001;
+	const unsigned packetSize = packetW*packetH;
+	typedef typename SOA_T<packetSize>::Vec3V_SOAType PacketType;
+	typedef typename SOA_T<packetSize>::Vec3V_SOAType::ComponentType ComponentType;
+	ForceAssert(w%packetW == 0 && h%packetH == 0);
+	const unsigned subPacketsX = Max(1U, (largeW + packetW - 1)/packetW); // large packets are whole sub-packets
+	const unsigned subPacketsY = Max(1U, (largeH + packetH - 1)/packetH);
+	ForceAssert(subPacketsX*subPacketsY <= BVH_LARGE_PACKET_MAX_SUBPACKETS);
 	if (zclear)
 		ClearZBuffer(zbuf, w, h);
 	const Vec3V origin = camera.d();
 	const float tanHFOV = tanVFOV*(float)w/(float)h;
 	const Vec3V dirStepX = +camera.a()*(2.0f*tanHFOV/(float)(w - 1)); // change in dir for each pixel horizontally
 	const Vec3V dirStepY = -camera.b()*(2.0f*tanVFOV/(float)(h - 1)); // change in dir for each pixel vertically
-	const Vec3V dirStart = camera.TransformDir(Vec3V(-tanHFOV, tanVFOV, 1.0f));
-	const Vec3V dirTileStepX = dirStepX*(float)tileW;
-	const Vec3V dirTileStepY = dirStepY*(float)tileH;
-	const unsigned numCols = (w + tileW - 1)/tileW;
-	const unsigned numRows = (h + tileH - 1)/tileH;
-	Plane3V* planesX = new Plane3V[numCols + 1];
-	Plane3V* planesY = new Plane3V[numRows + 1];
-	for (unsigned col = 0; col <= numCols; col++) {
-		const float x = -1.0f + 2.0f*(float)col/(float)numCols; // [-1..1]
-		const Vec3V corner0 = camera.Transform(Vec3V(x*tanHFOV, -tanVFOV, 1.0f)); // flip tanVFOV?
-		const Vec3V corner1 = camera.Transform(Vec3V(x*tanHFOV, +tanVFOV, 1.0f));
-		planesX[col] = Plane3V::ConstructFrom3Points(origin, corner1, corner0);
-	}
-	for (unsigned row = 0; row <= numRows; row++) {
-		const float y = -1.0f + 2.0f*(float)row/(float)numRows; // [-1..1]
-		const Vec3V corner0 = camera.Transform(Vec3V(+tanHFOV, y*tanVFOV, 1.0f)); // flip tanVFOV?
-		const Vec3V corner1 = camera.Transform(Vec3V(-tanHFOV, y*tanVFOV, 1.0f));
-		planesY[row] = Plane3V::ConstructFrom3Points(origin, corner1, corner0);
-	}
-#if BVH_STATS
-	BVHStats stats;
-	EntryPointSearchStats ep_stats;
-	uint32* depths = new uint32[numCols*numRows];
-	memset(depths, 0xFF, numCols*numRows*sizeof(uint32));
-#endif // BVH_STATS
-	ProgressDisplay progress("rendering BHV4 - 1x1 ray packets - %ux%u tiles", tileW, tileH);
-	Vec3V dirTileRowStart = dirStart;
-	float* zptrTileRowStart = zbuf;
-	for (unsigned row = 0; row < numRows; row++) {
-		Vec3V dirTile = dirTileRowStart;
-		float* zptrTile = zptrTileRowStart;
-		const unsigned tileH1 = tileH - ((row == numRows - 1) ? h%tileH : 0);
-		for (unsigned col = 0; col < numCols; col++) {
-			const Plane3V frustum[] = {planesX[col], planesY[row], -planesX[col + 1], -planesY[row + 1]};
-		#if 1
-			Vec3V n(V_ZERO);
-			for (int i = 0; i < 4; i++)
-				n += frustum[i].GetNormal();
-			ForceAssert(Dot(n, camera.c()) > 0.0f); // planes face inwards
-		#endif
-			const uintptr_t ref = root->EntryPointSearch(frustum BVH_STATS_ONLY(, ep_stats));
-			if (ref) {
-				BVH_STATS_ONLY(if (depths) depths[col + row*numCols] = BVH4Node::GetDepthStatic(ref));
-				Vec3V dirRowStart = dirTile;
-				float* zptrRowStart = zptrTile;
-				const unsigned tileW1 = tileW - ((col == numCols - 1) ? w%tileW : 0);
-				for (unsigned j = 0; j < tileH1; j++) {
-					Vec3V dir = dirRowStart;
-					float* zptr = zptrRowStart;
-					for (unsigned i = 0; i < tileW1; i++) {
-						BVH4Node::TraceStatic(ref, origin, dir, *zptr++ BVH_STATS_ONLY(, packetMask, stats));
-						dir += dirStepX;
-					}
-					dirRowStart += dirStepY;
-					zptrRowStart += w;
-				}
+	const Vec3V dirPacketStepX = dirStepX*(float)packetW;
+	const Vec3V dirPacketStepY = dirStepY*(float)packetH;
+	const Vec3V dir00 = camera.TransformDir(Vec3V(-tanHFOV, tanVFOV, 1.0f));
+	Vec3V dv[packetSize];
+	for (unsigned j = 0; j < packetH; j++)
+		for (unsigned i = 0; i < packetW; i++)
+			dv[i + j*packetW] = dir00 + dirStepX*(float)i + dirStepY*(float)j;
+	const PacketType dirPacket00(dv);
+	ComponentType* zptr = reinterpret_cast<ComponentType*>(zbuf);
+	ForceAssert((reinterpret_cast<uintptr_t>(zptr) & (packetSize*sizeof(float) - 1)) == 0);
+	const unsigned packetsX = w/packetW;
+	const unsigned packetsY = h/packetH;
+	const unsigned numLargeX = (packetsX + subPacketsX - 1)/subPacketsX;
+	const unsigned numLargeY = (packetsY + subPacketsY - 1)/subPacketsY;
+	auto RenderLargePacket = [&](unsigned index BVH_STATS_ONLY(, BVHStats& stats)) {
+		const unsigned x0 = (index%numLargeX)*subPacketsX;
+		const unsigned y0 = (index/numLargeX)*subPacketsY;
+		const unsigned x1 = Min(x0 + subPacketsX, packetsX);
+		const unsigned y1 = Min(y0 + subPacketsY, packetsY);
+		Vec3V origins[BVH_LARGE_PACKET_MAX_SUBPACKETS];
+		PacketType dirs[BVH_LARGE_PACKET_MAX_SUBPACKETS];
+		ComponentType t[BVH_LARGE_PACKET_MAX_SUBPACKETS];
+		unsigned numPackets = 0;
+		for (unsigned y = y0; y < y1; y++) {
+			for (unsigned x = x0; x < x1; x++) {
+				origins[numPackets] = origin;
+				dirs[numPackets] = dirPacket00;
+				dirs[numPackets] += dirPacketStepX*(float)x + dirPacketStepY*(float)y;
+				t[numPackets++] = zptr[x + y*packetsX]; // packets are stored in swizzled order, row-major over packets
 			}
-			dirTile += dirTileStepX;
-			zptrTile += tileW;
 		}
-		dirTileRowStart += dirTileStepY;
-		zptrTileRowStart += w*tileH;
+		root->TraceLargePacket(origins, dirs, t, numPackets BVH_STATS_ONLY(, stats));
+		numPackets = 0;
+		for (unsigned y = y0; y < y1; y++)
+			for (unsigned x = x0; x < x1; x++)
+				zptr[x + y*packetsX] = t[numPackets++];
+	};
+	BVH_STATS_ONLY(BVHStats stats);
+#if BVH_THREADS
+	const unsigned numThreads = GetNumThreads(scheduler);
+	ProgressDisplay progress("rendering BVH4 - %ux%u ray packets - %ux%u large packets (%u threads)", packetW, packetH, subPacketsX*packetW, subPacketsY*packetH, numThreads);
+#else
+	ProgressDisplay progress("rendering BVH4 - %ux%u ray packets - %ux%u large packets", packetW, packetH, subPacketsX*packetW, subPacketsY*packetH);
+#endif
+	BVH_COUNTERS_ONLY(RenderCounters counters(BVH_THREADS_SWITCH(Max(1U, numThreads), 1)));
+#if BVH_THREADS
+	if (scheduler) {
+		BVH_STATS_ONLY(BVHStats* threadStats = new BVHStats[scheduler->GetNumThreads()]);
+		scheduler->ParallelFor(numLargeX*numLargeY, 1, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+		#if BVH_COUNTERS
+			counters.Count(threadIndex, [&]() {
+				for (unsigned index = begin; index < end; index++)
+					RenderLargePacket(index BVH_STATS_ONLY(, threadStats[threadIndex]));
+			});
+		#else
+			for (unsigned index = begin; index < end; index++)
+				RenderLargePacket(index BVH_STATS_ONLY(, threadStats[threadIndex]));
+		#endif // BVH_COUNTERS
+		});
+	#if BVH_STATS
+		for (unsigned i = 0; i < scheduler->GetNumThreads(); i++)
+			stats += threadStats[i];
+		delete[] threadStats;
+	#endif // BVH_STATS
+	} else
+#endif // BVH_THREADS
+	{
+		BVH_COUNTERS_ONLY(BVHCounters::Scope countersScope(counters.Get(0)));
+		for (unsigned index = 0; index < numLargeX*numLargeY; index++)
+			RenderLargePacket(index BVH_STATS_ONLY(, stats));
 	}
+	UnswizzleZBuffer<packetW,packetH>(zbuf, w, h);
 	const float raysPerSecond = ((float)(w*h))/progress.GetTimeInSeconds();
 #if BVH_STATS
-	progress.End("%.4f Mrays/sec (nodes=%zd,leaves=%zd,tris=%zd) (out=%zd,in=%zd,mixed=%zd,codes=%zd,%zd,%zd)",
-		raysPerSecond/1000000.0f,
-		stats.m_nodeCount,
-		stats.m_leafCount,
-		stats.m_triCount,
-		ep_stats.m_all_outs,
-		ep_stats.m_all_ins,
-		ep_stats.m_mixed_ins_outs,
-		ep_stats.m_child_codes[0],
-		ep_stats.m_child_codes[1],
-		ep_stats.m_child_codes[2]);
-	stats.Report(1);
-	if (1) {
-		printf("tile depths for entry point search:\n");
-		for (unsigned row = 0; row < numRows; row++) {
-			for (unsigned col = 0; col < numCols; col++) {
-				const uint32 depth = depths[col + row*numCols];
-				if (depth != ~0U)
-					printf("%s%u", col ? "," : "", depth);
-				else
-					printf("%s-", col ? "," : "");
-			}
-			printf("\n");
-		}
-	}
-	delete[] depths;
+	progress.End("%.4f Mrays/sec (nodes=%zd,leaves=%zd,tris=%zd)", raysPerSecond/1000000.0f, stats.m_nodeCount, stats.m_leafCount, stats.m_triCount);
 #else
 	progress.End("%.4f Mrays/sec", raysPerSecond/1000000.0f);
 #endif
-	delete[] planesX;
-	delete[] planesY;
 	char ext[64];
-	sprintf(ext, "_BVH4_1x1_%ux%u_tiles", tileW, tileH);
+	sprintf(ext, "_BVH4_%ux%u_%ux%u_large", packetW, packetH, subPacketsX*packetW, subPacketsY*packetH);
+	BVH_COUNTERS_ONLY(counters.Export(ext + 1, w*h));
 	NormalizeAndSaveZBufferImage(zbuf, w, h, zscale, zoffset, calc_z_range, path, ext);
 }
 
-#define DEF_RENDER_TRIANGLES_BVH_TILES(packetW,packetH) \
-void RenderTriangles_BVH_TILES_##packetW##x##packetH(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path) \
+#define DEF_RENDER_TRIANGLES_BVH_LARGE(packetW,packetH) \
+void RenderTriangles_BVH_LARGE_##packetW##x##packetH(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned largeW, unsigned largeH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler)) \
 { \
-	RenderTriangles_BVH_TILES<packetW,packetH>(root,camera,tanVFOV,zbuf,w,h,tileW,tileH,zclear,zscale,zoffset,calc_z_range,path); \
+	RenderTriangles_BVH_LARGE<packetW,packetH>(root,camera,tanVFOV,zbuf,w,h,largeW,largeH,zclear,zscale,zoffset,calc_z_range,path BVH_THREADS_ONLY(,scheduler)); \
 }
-DEF_RENDER_TRIANGLES_BVH_TILES(1,1)
-DEF_RENDER_TRIANGLES_BVH_TILES(4,1)
-DEF_RENDER_TRIANGLES_BVH_TILES(2,2)
+DEF_RENDER_TRIANGLES_BVH_LARGE(4,1)
+DEF_RENDER_TRIANGLES_BVH_LARGE(2,2)
 #if HAS_VEC8V
-DEF_RENDER_TRIANGLES_BVH_TILES(8,1)
-DEF_RENDER_TRIANGLES_BVH_TILES(4,2)
+DEF_RENDER_TRIANGLES_BVH_LARGE(8,1)
+DEF_RENDER_TRIANGLES_BVH_LARGE(4,2)
 #endif // HAS_VEC8V
-#undef DEF_RENDER_TRIANGLES_BVH_TILES
-#endif // BVH_TILES
+#undef DEF_RENDER_TRIANGLES_BVH_LARGE
+
+void BenchmarkLargePackets(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, unsigned w, unsigned h BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	typedef void (*RenderFunc)(const BVH4Node*, Mat34V_arg, float, float*, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+	typedef void (*RenderLargeFunc)(const BVH4Node*, Mat34V_arg, float, float*, unsigned, unsigned, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+	const struct { const char* name; RenderFunc render; RenderLargeFunc renderLarge; } variants[] = {
+		{"4x1", RenderTriangles_BVH_4x1, RenderTriangles_BVH_LARGE_4x1},
+		{"2x2", RenderTriangles_BVH_2x2, RenderTriangles_BVH_LARGE_2x2},
+	#if HAS_VEC8V
+		{"8x1", RenderTriangles_BVH_8x1, RenderTriangles_BVH_LARGE_8x1},
+		{"4x2", RenderTriangles_BVH_4x2, RenderTriangles_BVH_LARGE_4x2},
+	#endif // HAS_VEC8V
+	};
+	const unsigned largeSizes[] = {8, 16};
+	float* reference = AlignedAlloc<float>(w*h, 64);
+	float* zbuf = AlignedAlloc<float>(w*h, 64);
+	float zscale = 1.0f;
+	float zoffset = 0.0f;
+	bool calc_z_range = false;
+	for (unsigned i = 0; i < countof(variants); i++) {
+		uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		variants[i].render(root, camera, tanVFOV, reference, w, h, true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, scheduler)); // NULL path keeps the raw z values
+		const float seconds = ProgressDisplay::GetTimeInSeconds(startTime);
+		for (unsigned j = 0; j < countof(largeSizes); j++) {
+			startTime = ProgressDisplay::GetCurrentPerformanceTime();
+			variants[i].renderLarge(root, camera, tanVFOV, zbuf, w, h, largeSizes[j], largeSizes[j], true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, scheduler));
+			const float largeSeconds = ProgressDisplay::GetTimeInSeconds(startTime);
+			float maxDiff;
+			const unsigned numDiffs = CountZBufferDiffs(zbuf, reference, w*h, maxDiff); // should be zero, the interval test only culls boxes which every ray misses
+			printf("large packets %s %ux%u: %.4f Mrays/sec vs %.4f Mrays/sec (%.2fx), %u pixels differ (max diff %f)\n", variants[i].name, largeSizes[j], largeSizes[j], (float)(w*h)/(largeSeconds*1000000.0f), (float)(w*h)/(seconds*1000000.0f), seconds/largeSeconds, numDiffs, maxDiff);
+		}
+	}
+	AlignedFree(reference);
+	AlignedFree(zbuf);
+}
+#endif // BVH_LARGE_PACKETS
+
+Mat34V_out GetBoundsViewCamera(const Box3V& bounds, Vec3V_arg forward, float tanVFOV)
+{
+	const float distance = Mag(bounds.GetExtent()).f()/tanVFOV; // far enough for the bounding sphere to (roughly) fill the view
+	const Vec3V up = fabsf(forward.yf()) > 0.9f ? Vec3V(0.0f, 0.0f, 1.0f) : Vec3V(0.0f, 1.0f, 0.0f);
+	const Vec3V right = Normalize(Cross(up, forward));
+	return Mat34V(right, Cross(forward, right), forward, bounds.GetCenter() - forward*distance);
+}
+
+#if BVH_CHILD_ORDER
+void BenchmarkChildOrder(BVH4Node* root, float tanVFOV, unsigned w, unsigned h BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	typedef void (*RenderFunc)(const BVH4Node*, Mat34V_arg, float, float*, unsigned, unsigned, bool, float&, float&, bool&, const char* BVH_THREADS_ONLY(, TaskScheduler*));
+	const struct { const char* name; RenderFunc render; } variants[] = {
+		{"1x1", RenderTriangles_BVH_1x1},
+		{"4x1", RenderTriangles_BVH_4x1},
+	#if HAS_VEC8V
+		{"8x1", RenderTriangles_BVH_8x1},
+	#endif // HAS_VEC8V
+	};
+	Vec3V views[6 + 8]; // looking along each axis and each diagonal, so every octant is covered
+	unsigned numViews = 0;
+	for (unsigned axis = 0; axis < 3; axis++) {
+		for (float sign = -1.0f; sign <= 1.0f; sign += 2.0f)
+			views[numViews++] = Vec3V(axis == 0 ? sign : 0.0f, axis == 1 ? sign : 0.0f, axis == 2 ? sign : 0.0f);
+	}
+	for (unsigned octant = 0; octant < 8; octant++)
+		views[numViews++] = Normalize(Vec3V((octant & 1) ? -1.0f : 1.0f, (octant & 2) ? -1.0f : 1.0f, (octant & 4) ? -1.0f : 1.0f));
+	const Box3V bounds = root->GetBounds();
+	float* zbuf[2] = {AlignedAlloc<float>(w*h, 64), AlignedAlloc<float>(w*h, 64)};
+	float zscale = 1.0f;
+	float zoffset = 0.0f;
+	bool calc_z_range = false;
+	for (unsigned i = 0; i < countof(variants); i++) {
+		float totalSeconds[2] = {0.0f, 0.0f};
+		for (unsigned j = 0; j < numViews; j++) {
+			const Vec3V forward = views[j];
+			const Mat34V camera = GetBoundsViewCamera(bounds, forward, tanVFOV);
+			float seconds[2];
+			for (unsigned frontToBack = 0; frontToBack < 2; frontToBack++) {
+				root->UpdateChildOrder(frontToBack != 0);
+				const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+				variants[i].render(root, camera, tanVFOV, zbuf[frontToBack], w, h, true, zscale, zoffset, calc_z_range, NULL BVH_THREADS_ONLY(, scheduler)); // NULL path keeps the raw z values
+				seconds[frontToBack] = ProgressDisplay::GetTimeInSeconds(startTime);
+				totalSeconds[frontToBack] += seconds[frontToBack];
+			}
+			unsigned numDiffs = 0; // should be zero, the order only changes how soon t shrinks
+			for (unsigned k = 0; k < w*h; k++) {
+				if (zbuf[0][k] != zbuf[1][k])
+					numDiffs++;
+			}
+			printf("child order %s view (%+.2f,%+.2f,%+.2f): %.4f Mrays/sec front-to-back vs %.4f Mrays/sec index order (%.2fx), %u pixels differ\n", variants[i].name, forward.xf(), forward.yf(), forward.zf(), (float)(w*h)/(seconds[1]*1000000.0f), (float)(w*h)/(seconds[0]*1000000.0f), seconds[0]/seconds[1], numDiffs);
+		}
+		printf("child order %s all views: %.4f Mrays/sec front-to-back vs %.4f Mrays/sec index order (%.2fx)\n", variants[i].name, (float)(w*h*numViews)/(totalSeconds[1]*1000000.0f), (float)(w*h*numViews)/(totalSeconds[0]*1000000.0f), totalSeconds[0]/totalSeconds[1]);
+	}
+	root->UpdateChildOrder(true);
+	AlignedFree(zbuf[0]);
+	AlignedFree(zbuf[1]);
+}
+#endif // BVH_CHILD_ORDER
+
+const char* GetOcclusionModeName(OcclusionMode mode)
+{
+	switch (mode) {
+	case OCCLUSION_TRACE: return "single rays";
+	case OCCLUSION_RAY_STREAM: return "ray stream";
+	case OCCLUSION_OCCLUDED: return "occluded";
+	case OCCLUSION_OCCLUDED_PACKETS: return "occluded packets";
+	}
+	return "?";
+}
 
-void RenderOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, const std::vector<Vec3V>& normals, std::vector<float>& occlusion, unsigned numSamples BVH_THREADS_ONLY(, unsigned numThreads))
+// counts occluded samples for one vertex, samples are traced in packets which share the vertex's origin
+template <unsigned packetSize> static uint32 CountOccludedPackets(const BVH4Node* root, Vec3V_arg origin, Mat33V_arg basis, const std::vector<Vec3V>& samples)
+{
+	typedef typename SOA_T<packetSize>::Vec3V_SOAType PacketType;
+	typedef typename SOA_T<packetSize>::Vec3V_SOAType::ComponentType ComponentType;
+	const uint32 numSamples = (uint32)samples.size();
+	uint32 numOccluded = 0;
+	for (uint32 sampleIndex = 0; sampleIndex < numSamples; sampleIndex += packetSize) {
+		const uint32 count = Min(packetSize, numSamples - sampleIndex);
+		Vec3V dirs[packetSize];
+		for (uint32 i = 0; i < packetSize; i++)
+			dirs[i] = basis.Transform(samples[sampleIndex + Min(i, count - 1)]); // pad the last packet by repeating the last sample
+		const uint32 mask = root->Occluded(origin, PacketType(dirs), ComponentType(ZBUFFER_DEFAULT));
+		numOccluded += (uint32)__popcnt(mask & ((1U << count) - 1));
+	}
+	return numOccluded;
+}
+
+void RenderOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, const std::vector<Vec3V>& normals, std::vector<float>& occlusion, unsigned numSamples BVH_THREADS_ONLY(, TaskScheduler* scheduler), OcclusionMode mode)
 {
 	BVH_STATS_ONLY(BVHStats stats(1));
 	occlusion.resize(verts.size());
@@ -875,116 +1245,90 @@ void RenderOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, cons
 		bounds.Grow(verts[vertIndex]);
 	const ScalarV bias = MaxElement(bounds.GetExtent())*relativeBias;
 	const uint32 numVerts = (uint32)verts.size();
+	const uint32 batchSize = 64; // verts per task (and per ray stream)
 #if BVH_THREADS
-	ProgressDisplay progress("rendering occlusion (%u verts, %u samples, %u threads)", numVerts, numSamples, numThreads);
+	const unsigned numThreads = GetNumThreads(scheduler);
+	ProgressDisplay progress("rendering occlusion (%u verts, %u samples, %s, %u threads)", numVerts, numSamples, GetOcclusionModeName(mode), numThreads);
 #else
-	ProgressDisplay progress("rendering occlusion (%u verts, %u samples)", numVerts, numSamples);
+	ProgressDisplay progress("rendering occlusion (%u verts, %u samples, %s)", numVerts, numSamples, GetOcclusionModeName(mode));
 #endif
-#if BVH_THREADS
-	if (numThreads > 0) {
-		class LocalData
-		{
-		public:
-			void Render() const
-			{
-				for (vertIndex = 0; vertIndex < numVerts; vertIndex++) {
-					const Vec3V normal = normals[vertIndex];
-					const Vec3V origin = verts[vertIndex] + normal*bias;
-					const Mat33V basis = Mat33V::ConstructBasis(normal);
-					uint32 numOccluded = 0;
+	BVH_COUNTERS_ONLY(RenderCounters counters(BVH_THREADS_SWITCH(numThreads, 1)));
+	auto RenderBatch = [&](uint32 begin, uint32 end, BVHRayStream& stream, std::vector<BVHRayHit>& hits BVH_STATS_ONLY(, BVHStats& stats)) {
+		if (mode == OCCLUSION_RAY_STREAM) { // all the batch's hemisphere rays are traced together, then counted
+			stream.Clear();
+			for (uint32 vertIndex = begin; vertIndex < end; vertIndex++) {
+				const Vec3V normal = normals[vertIndex];
+				const Vec3V origin = verts[vertIndex] + normal*bias;
+				const Mat33V basis = Mat33V::ConstructBasis(normal);
+				for (uint32 sampleIndex = 0; sampleIndex < numSamples; sampleIndex++)
+					stream.AddRay(origin, basis.Transform(samples[sampleIndex]));
+			}
+			stream.Trace(root, hits BVH_STATS_ONLY(, stats));
+			const BVHRayHit* hit = hits.data();
+			for (uint32 vertIndex = begin; vertIndex < end; vertIndex++) {
+				uint32 numOccluded = 0;
+				for (uint32 sampleIndex = 0; sampleIndex < numSamples; sampleIndex++)
+					numOccluded += (hit++)->IsHit() ? 1 : 0;
+				occlusion[vertIndex] = 1.0f - (float)numOccluded/(float)numSamples;
+			}
+		} else {
+			for (uint32 vertIndex = begin; vertIndex < end; vertIndex++) {
+				const Vec3V normal = normals[vertIndex];
+				const Vec3V origin = verts[vertIndex] + normal*bias;
+				const Mat33V basis = Mat33V::ConstructBasis(normal);
+				uint32 numOccluded = 0;
+				if (mode == OCCLUSION_OCCLUDED_PACKETS)
+					numOccluded = CountOccludedPackets<BVH_OCCLUSION_PACKET_SIZE>(root, origin, basis, samples);
+				else if (mode == OCCLUSION_OCCLUDED) {
+					for (uint32 sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
+						if (root->Occluded(origin, basis.Transform(samples[sampleIndex])))
+							numOccluded++;
+					}
+				} else {
 					for (uint32 sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
 						ScalarV t(ZBUFFER_DEFAULT);
 						const Vec3V dir = basis.Transform(samples[sampleIndex]);
-						root->Trace(origin, dir, t BVH_STATS_ONLY(, 0x0001, *stats));
+						root->Trace(origin, dir, t BVH_STATS_ONLY(, 0x0001, stats));
 						DEBUG_ASSERT(t >= 0.0f);
 						if (t < ZBUFFER_DEFAULT)
 							numOccluded++;
 					}
-					occlusion[vertIndex] = 1.0f - (float)numOccluded/(float)numSamples;
 				}
+				occlusion[vertIndex] = 1.0f - (float)numOccluded/(float)numSamples;
 			}
-		#if PLATFORM_PC
-			static DWORD WINAPI StaticRender(LPVOID param) { reinterpret_cast<LocalData*>(param)->Render(); return 0; }
-		#elif USE_XXX_MULTITASK
-			static bool StaticRender(MultiTask task) { reinterpret_cast<LocalData*>(task)->Render(); return true; }
-		#endif
-			const BVH4Node* root;
-			uint32 numSamples;
-			const Vec3V* samples;
-			uint32 numVerts;
-			const Vec3V* verts;
-			const Vec3V* normals;
-			ScalarV bias;
-			float* occlusion;
-			BVH_STATS_ONLY(BVHStats* stats);
-			mutable uint32 vertIndex;
-		};
-		LocalData* data = AlignedAlloc<LocalData>(numThreads, 32);
-	#if PLATFORM_PC
-		HANDLE* threads = new HANDLE[numThreads];
-	#elif USE_XXX_MULTITASK
-		MultiTask_InitQueue();
-	#endif
-		uint32 vertIndex = 0;
-		for (unsigned i = 0; i < numThreads; i++) {
-			data[i].root = root;
-			data[i].numSamples = numSamples;
-			data[i].samples = &samples.front();
-			data[i].numVerts = Min((numVerts + numThreads - 1)/numThreads, numVerts - vertIndex);
-			data[i].verts = &verts[vertIndex];
-			data[i].normals = &normals[vertIndex];
-			data[i].bias = bias;
-			data[i].occlusion = &occlusion[vertIndex];
-			BVH_STATS_ONLY(data[i].stats = new BVHStats);
-			vertIndex += data[i].numVerts;
-		#if PLATFORM_PC
-			threads[i] = CreateThread(NULL, 0, LocalData::StaticRender, &data[i], 0, NULL);
-		#elif USE_XXX_MULTITASK
-			MultiTask_AddTask((MultiTask)&data[i]);
-		#endif
 		}
-	#if PLATFORM_PC
-		if (1) { // show minimum progress of threads
-			while (WaitForMultipleObjects(numThreads, threads, TRUE, 100) >= numThreads) {
-				float prog = FLT_MAX;
-				for (unsigned i = 0; i < numThreads; i++)
-					prog = Min((float)data[i].vertIndex/(float)data[i].numVerts, prog);
-				progress.Update(prog);
-			}
-		} else
-			WaitForMultipleObjects(numThreads, threads, TRUE, INFINITE);
-	#elif USE_XXX_MULTITASK
-		MultiTask_ProcessQueue(LocalData::StaticRender);
-	#endif
-		for (unsigned i = 0; i < numThreads; i++) {
-		#if PLATFORM_PC
-			CloseHandle(threads[i]);
-		#endif // PLATFORM_PC
-			BVH_STATS_ONLY(stats += *data[i].stats);
-			BVH_STATS_ONLY(delete data[i].stats);
-		}
-	#if PLATFORM_PC
-		delete[] threads;
-	#endif // PLATFORM_PC
-		AlignedFree(data);
+	};
+#if BVH_THREADS
+	if (scheduler) {
+		std::atomic<uint32> numVertsDone(0);
+		std::vector<BVHRayStream> streams(scheduler->GetNumThreads()); // per thread, so the ray and scratch buffers are reused across batches
+		std::vector<std::vector<BVHRayHit>> hits(scheduler->GetNumThreads());
+		BVH_STATS_ONLY(BVHStats* threadStats = new BVHStats[scheduler->GetNumThreads()]);
+		scheduler->ParallelFor(numVerts, batchSize, [&](unsigned begin, unsigned end, unsigned threadIndex) {
+		#if BVH_COUNTERS
+			counters.Count(threadIndex, [&]() { RenderBatch(begin, end, streams[threadIndex], hits[threadIndex] BVH_STATS_ONLY(, threadStats[threadIndex])); });
+		#else
+			RenderBatch(begin, end, streams[threadIndex], hits[threadIndex] BVH_STATS_ONLY(, threadStats[threadIndex]));
+		#endif // BVH_COUNTERS
+			const uint32 done = numVertsDone.fetch_add(end - begin) + (end - begin);
+			if (threadIndex == 0) // progress display is not thread safe
+				progress.Update(done, numVerts);
+		});
+	#if BVH_STATS
+		for (unsigned i = 0; i < scheduler->GetNumThreads(); i++)
+			stats += threadStats[i];
+		delete[] threadStats;
+	#endif // BVH_STATS
 	} else
 #endif // BVH_THREADS
-	for (uint32 vertIndex = 0; vertIndex < numVerts; vertIndex++) {
-		if (vertIndex%64 == 0)
-			progress.Update(vertIndex, numVerts);
-		const Vec3V normal = normals[vertIndex];
-		const Vec3V origin = verts[vertIndex] + normal*bias;
-		const Mat33V basis = Mat33V::ConstructBasis(normal);
-		uint32 numOccluded = 0;
-		for (uint32 sampleIndex = 0; sampleIndex < numSamples; sampleIndex++) {
-			ScalarV t(ZBUFFER_DEFAULT);
-			const Vec3V dir = basis.Transform(samples[sampleIndex]);
-			root->Trace(origin, dir, t BVH_STATS_ONLY(, 0x0001, stats));
-			DEBUG_ASSERT(t >= 0.0f);
-			if (t < ZBUFFER_DEFAULT)
-				numOccluded++;
+	{
+		BVH_COUNTERS_ONLY(BVHCounters::Scope countersScope(counters.Get(0)));
+		BVHRayStream stream;
+		std::vector<BVHRayHit> hits;
+		for (uint32 begin = 0; begin < numVerts; begin += batchSize) {
+			progress.Update(begin, numVerts);
+			RenderBatch(begin, Min(begin + batchSize, numVerts), stream, hits BVH_STATS_ONLY(, stats));
 		}
-		occlusion[vertIndex] = 1.0f - (float)numOccluded/(float)numSamples;
 	}
 	const float raysPerSecond = ((float)(numSamples*numVerts))/progress.GetTimeInSeconds();
 #if BVH_STATS
@@ -993,4 +1337,51 @@ void RenderOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, cons
 #else
 	progress.End("%.4f Mrays/sec", raysPerSecond/1000000.0f);
 #endif
+#if BVH_COUNTERS
+	char label[64];
+	sprintf(label, "occlusion %s", GetOcclusionModeName(mode));
+	counters.Export(label, (uint64)numSamples*numVerts);
+#endif // BVH_COUNTERS
+}
+
+void BenchmarkOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, const std::vector<Vec3V>& normals, unsigned numSamples BVH_THREADS_ONLY(, TaskScheduler* scheduler))
+{
+	const OcclusionMode modes[] = {OCCLUSION_TRACE, OCCLUSION_RAY_STREAM, OCCLUSION_OCCLUDED, OCCLUSION_OCCLUDED_PACKETS};
+	std::vector<float> occlusion[countof(modes)];
+	float seconds[countof(modes)];
+	for (unsigned i = 0; i < countof(modes); i++) {
+		const uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+		RenderOcclusion(root, verts, normals, occlusion[i], numSamples BVH_THREADS_ONLY(, scheduler), modes[i]);
+		seconds[i] = ProgressDisplay::GetTimeInSeconds(startTime);
+	}
+	const float numRays = (float)numSamples*(float)verts.size();
+	for (unsigned i = 0; i < countof(modes); i++) {
+		float maxDiff = 0.0f; // should be zero, every mode counts the same hits
+		for (size_t vertIndex = 0; vertIndex < verts.size(); vertIndex++)
+			maxDiff = Max(fabsf(occlusion[0][vertIndex] - occlusion[i][vertIndex]), maxDiff);
+		printf("occlusion %-18s %.4f Mrays/sec (%.2fx), max diff %f\n", GetOcclusionModeName(modes[i]), numRays/(seconds[i]*1000000.0f), seconds[0]/seconds[i], maxDiff);
+	}
+}
+
+void BenchmarkClosestPoint(const BVH4Node* root, const std::vector<Vec3V>& points, float startRadius)
+{
+	const float maxDistance = startRadius*2.0f; // bisection with the default step can't report anything further
+	std::vector<float> exact(points.size());
+	std::vector<float> bisection(points.size());
+	uint64 startTime = ProgressDisplay::GetCurrentPerformanceTime();
+	for (size_t i = 0; i < points.size(); i++) {
+		BVHClosestPoint closest;
+		root->FindClosestPoint(points[i], closest, maxDistance);
+		exact[i] = closest.m_distance;
+	}
+	const float exactSeconds = ProgressDisplay::GetTimeInSeconds(startTime);
+	startTime = ProgressDisplay::GetCurrentPerformanceTime();
+	for (size_t i = 0; i < points.size(); i++)
+		bisection[i] = fabsf(root->FindMinimumDistanceToSurfaceBisection(points[i], startRadius));
+	const float bisectionSeconds = ProgressDisplay::GetTimeInSeconds(startTime);
+	float maxDiff = 0.0f; // should be within the bisection's resolution
+	for (size_t i = 0; i < points.size(); i++)
+		maxDiff = Max(fabsf(exact[i] - bisection[i]), maxDiff);
+	const float numQueries = (float)points.size();
+	printf("closest point exact %.4f Mqueries/sec, bisection %.4f Mqueries/sec (%.2fx), max diff %f\n", numQueries/(exactSeconds*1000000.0f), numQueries/(bisectionSeconds*1000000.0f), bisectionSeconds/exactSeconds, maxDiff);
 }
\ No newline at end of file
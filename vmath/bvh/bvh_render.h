@@ -8,6 +8,7 @@
 #include "common/common.h"
 
 #include "vmath/bvh/bvh.h"
+#include "vmath/bvh/bvh_flat.h"
 
 #include "vmath/vmath_common.h"
 #include "vmath/vmath_matrix.h"
@@ -26,12 +27,38 @@ void RenderTriangles_tri4(const std::vector<Triangle3V_SOA4>& triangles, Mat34V_
 void RenderTriangles_tri8(const std::vector<Triangle3V_SOA8>& triangles, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path);
 #endif // HAS_VEC8V
 
-void RenderTriangles_BVH_1x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads));
-void RenderTriangles_BVH_4x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads));
-void RenderTriangles_BVH_2x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads));
+// binned tile rasterizer (raster::RasterizeDepth) - same z values as the ray traced renders, but fast enough on large meshes
+// to be the reference when validating them, w must be a multiple of 4
+void RenderTriangles_RASTER(const std::vector<Triangle3V>& triangles, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+
+// number of pixels whose z differs from the reference by more than tolerance (relative to the reference z), including pixels
+// which are covered in one and not the other - numCoverageMismatches gets the number of those if it's not NULL
+unsigned CountZBufferMismatches(const float* zbuf, const float* reference, unsigned w, unsigned h, float tolerance = 0.001f, unsigned* numCoverageMismatches = NULL);
+
+// the BVH renders (and RenderTriangles_RASTER) split the screen into tiles on the caller's scheduler, NULL renders on the
+// calling thread - callers which render repeatedly should keep one scheduler alive rather than creating one per render
+void RenderTriangles_BVH_1x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_4x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_2x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#if HAS_VEC8V
+void RenderTriangles_BVH_8x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_4x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#endif // HAS_VEC8V
+
 #if HAS_VEC8V
-void RenderTriangles_BVH_8x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads));
-void RenderTriangles_BVH_4x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, unsigned numThreads));
+void RenderTriangles_BVH8_1x1(const BVH8Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH8_4x1(const BVH8Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH8_2x2(const BVH8Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH8_8x1(const BVH8Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH8_4x2(const BVH8Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#endif // HAS_VEC8V
+
+void RenderTriangles_BVH4Flat_1x1(const BVH4Flat* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH4Flat_4x1(const BVH4Flat* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH4Flat_2x2(const BVH4Flat* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#if HAS_VEC8V
+void RenderTriangles_BVH4Flat_8x1(const BVH4Flat* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH4Flat_4x2(const BVH4Flat* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
 #endif // HAS_VEC8V
 
 #if defined(_EMBREE_SOURCE)
@@ -40,15 +67,67 @@ void RenderTriangles_8x1_EMBREE(RTCScene scene, Mat34V_arg camera, float tanVFOV
 #endif // defined(_EMBREE_SOURCE)
 
 #if BVH_TILES
-void RenderTriangles_BVH_TILES_1x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path);
-void RenderTriangles_BVH_TILES_4x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path);
-void RenderTriangles_BVH_TILES_2x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path);
+// tileW,tileH are rounded up to whole packets, w,h must be multiples of the packet size
+void RenderTriangles_BVH_TILES_1x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_TILES_4x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_TILES_2x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
 #if HAS_VEC8V
-void RenderTriangles_BVH_TILES_8x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path);
-void RenderTriangles_BVH_TILES_4x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path);
+void RenderTriangles_BVH_TILES_8x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_TILES_4x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned tileW, unsigned tileH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
 #endif // HAS_VEC8V
+
+// renders every packet size with and without tiles (16..128 pixel tiles), reports Mrays/sec and the number of pixels whose z differs
+void BenchmarkTiles(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, unsigned w, unsigned h BVH_THREADS_ONLY(, TaskScheduler* scheduler));
 #endif // BVH_TILES
 
-void RenderOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, const std::vector<Vec3V>& normals, std::vector<float>& occlusion, unsigned numSamples BVH_THREADS_ONLY(, unsigned numThreads));
+#if BVH_LARGE_PACKETS
+// largeW,largeH are rounded up to whole packets, (largeW/packetW)*(largeH/packetH) must be at most BVH_LARGE_PACKET_MAX_SUBPACKETS
+void RenderTriangles_BVH_LARGE_4x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned largeW, unsigned largeH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_LARGE_2x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned largeW, unsigned largeH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#if HAS_VEC8V
+void RenderTriangles_BVH_LARGE_8x1(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned largeW, unsigned largeH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+void RenderTriangles_BVH_LARGE_4x2(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, float* zbuf, unsigned w, unsigned h, unsigned largeW, unsigned largeH, bool zclear, float& zscale, float& zoffset, bool& calc_z_range, const char* path BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#endif // HAS_VEC8V
+
+// renders every packet size with ordinary and 8x8, 16x16 pixel large packets, reports Mrays/sec and the number of pixels whose z differs
+void BenchmarkLargePackets(const BVH4Node* root, Mat34V_arg camera, float tanVFOV, unsigned w, unsigned h BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#endif // BVH_LARGE_PACKETS
+
+// camera looking along forward (normalized) at the center of bounds, backed off far enough for the bounding sphere to (roughly)
+// fill the view
+Mat34V_out GetBoundsViewCamera(const Box3V& bounds, Vec3V_arg forward, float tanVFOV);
+
+#if BVH_CHILD_ORDER
+// renders the tree from each face and corner of its bounds with index order and front-to-back child order, reports Mrays/sec
+// for each view and packet size - the tree's child order is rewritten while benchmarking and left front-to-back
+void BenchmarkChildOrder(BVH4Node* root, float tanVFOV, unsigned w, unsigned h BVH_THREADS_ONLY(, TaskScheduler* scheduler));
+#endif // BVH_CHILD_ORDER
+
+#if HAS_VEC8V
+#define BVH_OCCLUSION_PACKET_SIZE (8)
+#else
+#define BVH_OCCLUSION_PACKET_SIZE (4)
+#endif
+
+enum OcclusionMode
+{
+	OCCLUSION_TRACE            = 0, // closest hit, one ray at a time (BVH4Node::Trace)
+	OCCLUSION_RAY_STREAM       = 1, // closest hit, each batch of verts' hemisphere rays traced through BVHRayStream
+	OCCLUSION_OCCLUDED         = 2, // any hit, one ray at a time (BVH4Node::Occluded)
+	OCCLUSION_OCCLUDED_PACKETS = 3, // any hit, packets of BVH_OCCLUSION_PACKET_SIZE samples sharing the vertex origin
+};
+
+const char* GetOcclusionModeName(OcclusionMode mode);
+void RenderOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, const std::vector<Vec3V>& normals, std::vector<float>& occlusion, unsigned numSamples BVH_THREADS_ONLY(, TaskScheduler* scheduler), OcclusionMode mode = OCCLUSION_OCCLUDED);
+void BenchmarkOcclusion(const BVH4Node* root, const std::vector<Vec3V>& verts, const std::vector<Vec3V>& normals, unsigned numSamples BVH_THREADS_ONLY(, TaskScheduler* scheduler)); // all modes, in Mrays/sec
+
+void BenchmarkClosestPoint(const BVH4Node* root, const std::vector<Vec3V>& points, float startRadius); // exact query vs. sphere bisection, in Mqueries/sec
+
+#if BVH_COUNTERS
+// while an output is set, each BVH render (RenderTriangles_BVH*, RenderTriangles_BVH_TILES*, RenderOcclusion) gives every
+// thread its own BVHCounters and writes the merged counters when it's done - jsonPath is overwritten by each render, csvPath
+// gets a row per render, either can be NULL and passing NULL for both turns it off
+void SetRenderCountersOutput(const char* jsonPath, const char* csvPath);
+#endif // BVH_COUNTERS
 
 #endif // _INCLUDE_BVH_RENDER_
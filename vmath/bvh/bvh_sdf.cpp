@@ -0,0 +1,169 @@
+// ======================
+// common/bvh/bvh_sdf.cpp
+// ======================
+
+#include "bvh_sdf.h"
+#include "GraphicsTools/util/dds.h"
+#include "GraphicsTools/util/progressdisplay.h"
+#include "GraphicsTools/util/taskscheduler.h"
+
+void BVHDistanceVolume::Bake(const BVH4Node* root,const Box3V& bounds,unsigned w,unsigned h,unsigned d,float bandWidth,bool sign,TaskScheduler* scheduler)
+{
+	ForceAssert(w >= 2 && h >= 2 && d >= 2);
+	Clear();
+	m_w = w;
+	m_h = h;
+	m_d = d;
+	m_bounds = bounds;
+	m_spacing = bounds.GetSize()/Vec3V((float)(w - 1),(float)(h - 1),(float)(d - 1));
+	m_bandWidth = bandWidth > 0.0f ? bandWidth : FLT_MAX;
+	m_bricksX = (w + BVH_SDF_BRICK_SIZE - 1)/BVH_SDF_BRICK_SIZE;
+	m_bricksY = (h + BVH_SDF_BRICK_SIZE - 1)/BVH_SDF_BRICK_SIZE;
+	m_bricksZ = (d + BVH_SDF_BRICK_SIZE - 1)/BVH_SDF_BRICK_SIZE;
+	const unsigned numBricks = m_bricksX*m_bricksY*m_bricksZ;
+	m_brickIndex.resize(numBricks);
+	m_brickValue.resize(numBricks,0.0f);
+	ProgressDisplay progress("baking distance volume (%ux%ux%u, %u bricks, %u threads)",w,h,d,numBricks,scheduler ? scheduler->GetNumThreads() : 1);
+
+	// two passes - culling decides which bricks need storage, so the bake pass can write to preallocated bricks from any thread
+	auto ForEachBrick = [&](unsigned count,const std::function<void(unsigned)>& func,bool updateProgress) {
+		if (scheduler) {
+			std::atomic<uint32> numDone(0);
+			scheduler->ParallelFor(count,1,[&](unsigned begin,unsigned end,unsigned threadIndex) {
+				for (unsigned i = begin; i < end; i++)
+					func(i);
+				const uint32 done = numDone.fetch_add(end - begin) + (end - begin);
+				if (updateProgress && threadIndex == 0) // progress display is not thread safe
+					progress.Update(done,count);
+			});
+		} else {
+			for (unsigned i = 0; i < count; i++) {
+				if (updateProgress)
+					progress.Update(i,count);
+				func(i);
+			}
+		}
+	};
+	ForEachBrick(numBricks,[&](unsigned brickIndex) { m_brickIndex[brickIndex] = CullBrick(root,brickIndex,sign) ? BVH_SDF_EMPTY_BRICK : 0; },false);
+	std::vector<uint32> bricksToBake;
+	for (unsigned brickIndex = 0; brickIndex < numBricks; brickIndex++) {
+		if (m_brickIndex[brickIndex] == BVH_SDF_EMPTY_BRICK)
+			m_numEmptyBricks++;
+		else {
+			m_brickIndex[brickIndex] = (uint32)(bricksToBake.size()*BVH_SDF_BRICK_SIZE*BVH_SDF_BRICK_SIZE*BVH_SDF_BRICK_SIZE);
+			bricksToBake.push_back(brickIndex);
+		}
+	}
+	m_brickData.resize(bricksToBake.size()*BVH_SDF_BRICK_SIZE*BVH_SDF_BRICK_SIZE*BVH_SDF_BRICK_SIZE,0.0f);
+	ForEachBrick((unsigned)bricksToBake.size(),[&](unsigned i) { BakeBrick(root,bricksToBake[i],sign); },true);
+	progress.End("%u of %u bricks empty",m_numEmptyBricks,numBricks);
+}
+
+void BVHDistanceVolume::Clear()
+{
+	m_w = m_h = m_d = 0;
+	m_bricksX = m_bricksY = m_bricksZ = 0;
+	m_brickIndex.clear();
+	m_brickValue.clear();
+	m_brickData.clear();
+	m_numEmptyBricks = 0;
+}
+
+void BVHDistanceVolume::GetBrickSampleRange(unsigned brickIndex,unsigned& i0,unsigned& j0,unsigned& k0,unsigned& i1,unsigned& j1,unsigned& k1) const
+{
+	i0 = (brickIndex%m_bricksX)*BVH_SDF_BRICK_SIZE;
+	j0 = ((brickIndex/m_bricksX)%m_bricksY)*BVH_SDF_BRICK_SIZE;
+	k0 = (brickIndex/(m_bricksX*m_bricksY))*BVH_SDF_BRICK_SIZE;
+	i1 = Min(i0 + BVH_SDF_BRICK_SIZE,m_w);
+	j1 = Min(j0 + BVH_SDF_BRICK_SIZE,m_h);
+	k1 = Min(k0 + BVH_SDF_BRICK_SIZE,m_d);
+}
+
+bool BVHDistanceVolume::CullBrick(const BVH4Node* root,unsigned brickIndex,bool sign)
+{
+	if (m_bandWidth < FLT_MAX) {
+		unsigned i0,j0,k0,i1,j1,k1;
+		GetBrickSampleRange(brickIndex,i0,j0,k0,i1,j1,k1);
+		const Vec3V bmin = GetSamplePosition(i0,j0,k0);
+		const Vec3V bmax = GetSamplePosition(i1 - 1,j1 - 1,k1 - 1);
+		if (!root->IntersectsBox(Box3V(bmin - Vec3V(m_bandWidth),bmax + Vec3V(m_bandWidth)))) { // no triangle within bandWidth of any sample
+			float value = m_bandWidth;
+			if (sign) { // one unbounded query for the whole brick
+				BVHClosestPoint closest;
+				root->FindClosestPoint((bmin + bmax)*0.5f,closest);
+				value *= closest.m_sign;
+			}
+			m_brickValue[brickIndex] = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+void BVHDistanceVolume::BakeBrick(const BVH4Node* root,unsigned brickIndex,bool sign)
+{
+	unsigned i0,j0,k0,i1,j1,k1;
+	GetBrickSampleRange(brickIndex,i0,j0,k0,i1,j1,k1);
+	float* samples = &m_brickData[m_brickIndex[brickIndex]];
+	const float spacing[3] = {m_spacing.xf(),m_spacing.yf(),m_spacing.zf()};
+	for (unsigned k = k0; k < k1; k++) {
+		for (unsigned j = j0; j < j1; j++) {
+			for (unsigned i = i0; i < i1; i++) {
+				float* sample = &samples[(i - i0) + ((j - j0) + (k - k0)*BVH_SDF_BRICK_SIZE)*BVH_SDF_BRICK_SIZE];
+				// distance changes by at most the distance moved, so the previously baked neighbour bounds the search radius
+				float maxDistance = m_bandWidth;
+				if (i > i0)
+					maxDistance = Min((fabsf(sample[-1]) + spacing[0])*1.001f,maxDistance);
+				else if (j > j0)
+					maxDistance = Min((fabsf(sample[-BVH_SDF_BRICK_SIZE]) + spacing[1])*1.001f,maxDistance);
+				else if (k > k0)
+					maxDistance = Min((fabsf(sample[-BVH_SDF_BRICK_SIZE*BVH_SDF_BRICK_SIZE]) + spacing[2])*1.001f,maxDistance);
+				const Vec3V pos = GetSamplePosition(i,j,k);
+				BVHClosestPoint closest;
+				if (!root->FindClosestPoint(pos,closest,maxDistance) && sign) // outside the band, but we still need to know which side we're on
+					root->FindClosestPoint(pos,closest);
+				*sample = Min(closest.m_distance,m_bandWidth)*(sign ? closest.m_sign : 1.0f);
+			}
+		}
+	}
+}
+
+float BVHDistanceVolume::GetSample(unsigned i,unsigned j,unsigned k) const
+{
+	DEBUG_ASSERT(i < m_w && j < m_h && k < m_d);
+	const unsigned brickIndex = i/BVH_SDF_BRICK_SIZE + (j/BVH_SDF_BRICK_SIZE + (k/BVH_SDF_BRICK_SIZE)*m_bricksY)*m_bricksX;
+	const uint32 offset = m_brickIndex[brickIndex];
+	if (offset == BVH_SDF_EMPTY_BRICK)
+		return m_brickValue[brickIndex];
+	return m_brickData[offset + i%BVH_SDF_BRICK_SIZE + (j%BVH_SDF_BRICK_SIZE + (k%BVH_SDF_BRICK_SIZE)*BVH_SDF_BRICK_SIZE)*BVH_SDF_BRICK_SIZE];
+}
+
+void BVHDistanceVolume::GetDenseGrid(std::vector<float>& grid) const
+{
+	grid.resize((size_t)m_w*m_h*m_d);
+	float* dst = grid.data();
+	for (unsigned k = 0; k < m_d; k++) {
+		for (unsigned j = 0; j < m_h; j++) {
+			for (unsigned i = 0; i < m_w; i++)
+				*(dst++) = GetSample(i,j,k);
+		}
+	}
+}
+
+bool BVHDistanceVolume::SaveDDS(const char* path) const
+{
+	FILE* dds = fopen(path,"wb");
+	if (dds == NULL)
+		return false;
+	WriteDDSHeader(dds,DDS_IMAGE_TYPE_3D,m_w,m_h,m_d,1,1,GetDDSPixelFormatFromDX10Format(DDS_DXGI_FORMAT_R32_FLOAT),DDS_DXGI_FORMAT_R32_FLOAT);
+	std::vector<float> row(m_w);
+	for (unsigned k = 0; k < m_d; k++) {
+		for (unsigned j = 0; j < m_h; j++) {
+			for (unsigned i = 0; i < m_w; i++)
+				row[i] = GetSample(i,j,k);
+			fwrite(row.data(),sizeof(float),m_w,dds);
+		}
+	}
+	fclose(dds);
+	return true;
+}
\ No newline at end of file
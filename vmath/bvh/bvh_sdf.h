@@ -0,0 +1,56 @@
+// ====================
+// common/bvh/bvh_sdf.h
+// ====================
+
+#ifndef _INCLUDE_BVH_SDF_H_
+#define _INCLUDE_BVH_SDF_H_
+
+#include "bvh.h"
+
+#define BVH_SDF_BRICK_SIZE (8) // samples per brick side, bricks are the unit of work and of sparse storage
+#define BVH_SDF_EMPTY_BRICK (~0U)
+
+// distance volume baked from a BVH - samples are at the grid points of 'bounds' (so each sample is shared by the up to
+// eight cells around it, rather than being evaluated once per cell like FindMinimumDistanceToSurfaceEx does)
+// bricks further than bandWidth from the surface are culled with IntersectsBox and stored as a single value (+/-bandWidth),
+// so the volume is sparse for narrow-band bakes and dense when bandWidth covers the whole volume
+class BVHDistanceVolume
+{
+public:
+	BVHDistanceVolume() : m_w(0),m_h(0),m_d(0),m_bricksX(0),m_bricksY(0),m_bricksZ(0),m_bandWidth(0.0f),m_numEmptyBricks(0) {}
+
+	// w,h,d >= 2 samples, bandWidth <= 0 bakes the full volume, scheduler = NULL bakes on the calling thread
+	// sign uses the facing of the closest triangle (see BVHClosestPoint), so it needs a closed mesh
+	void Bake(const BVH4Node* root,const Box3V& bounds,unsigned w,unsigned h,unsigned d,float bandWidth = 0.0f,bool sign = false,TaskScheduler* scheduler = NULL);
+	void Clear();
+
+	VMATH_INLINE unsigned GetWidth() const { return m_w; }
+	VMATH_INLINE unsigned GetHeight() const { return m_h; }
+	VMATH_INLINE unsigned GetDepth() const { return m_d; }
+	VMATH_INLINE const Box3V& GetBounds() const { return m_bounds; }
+	VMATH_INLINE Vec3V_out GetSamplePosition(unsigned i,unsigned j,unsigned k) const { return m_bounds.GetMin() + m_spacing*Vec3V((float)i,(float)j,(float)k); }
+	VMATH_INLINE unsigned GetBrickCount() const { return (unsigned)m_brickIndex.size(); }
+	VMATH_INLINE unsigned GetEmptyBrickCount() const { return m_numEmptyBricks; }
+
+	float GetSample(unsigned i,unsigned j,unsigned k) const;
+	void GetDenseGrid(std::vector<float>& grid) const; // w*h*d samples, x fastest
+
+	bool SaveDDS(const char* path) const; // R32_FLOAT volume texture
+
+private:
+	void GetBrickSampleRange(unsigned brickIndex,unsigned& i0,unsigned& j0,unsigned& k0,unsigned& i1,unsigned& j1,unsigned& k1) const;
+	bool CullBrick(const BVH4Node* root,unsigned brickIndex,bool sign); // true if the whole brick is outside the band
+	void BakeBrick(const BVH4Node* root,unsigned brickIndex,bool sign);
+
+	unsigned m_w,m_h,m_d;
+	unsigned m_bricksX,m_bricksY,m_bricksZ;
+	Box3V m_bounds;
+	Vec3V m_spacing; // distance between samples
+	float m_bandWidth; // FLT_MAX for full volumes
+	std::vector<uint32> m_brickIndex; // per brick, offset of its samples in m_brickData or BVH_SDF_EMPTY_BRICK
+	std::vector<float> m_brickValue; // per brick, the value of all its samples if it's empty
+	std::vector<float> m_brickData; // BVH_SDF_BRICK_SIZE^3 samples per non-empty brick
+	unsigned m_numEmptyBricks;
+};
+
+#endif // _INCLUDE_BVH_SDF_H_
\ No newline at end of file
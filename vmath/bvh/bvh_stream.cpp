@@ -0,0 +1,170 @@
+// =========================
+// common/bvh/bvh_stream.cpp
+// =========================
+
+#include "bvh_stream.h"
+
+static uint32 MortonExpandBits(uint32 x) // 10 bits -> every third bit of 30
+{
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+void BVHRayStream::Reserve(size_t count)
+{
+	m_rays.reserve(count);
+	m_tmax.reserve(count);
+}
+
+void BVHRayStream::Clear()
+{
+	m_rays.clear();
+	m_tmax.clear();
+}
+
+void BVHRayStream::SortRays()
+{
+	const uint32 numRays = (uint32)m_rays.size();
+	Box3V bounds = Box3V::Invalid();
+	for (uint32 i = 0; i < numRays; i++)
+		bounds.Grow(m_rays[i].m_origin);
+	const Vec3V extent = bounds.GetExtent();
+	const float quantize = 511.0f; // 9 bits per axis, 3 bits for the octant
+	const Vec3V scale = Vec3V(quantize)/Max(extent,Vec3V(FLT_MIN));
+	m_keys.resize(numRays);
+	for (uint32 i = 0; i < numRays; i++) {
+		const Vec3V q = (m_rays[i].m_origin - bounds.GetMin())*scale;
+		const uint32 morton =
+			(MortonExpandBits((uint32)Clamp(q.xf(),0.0f,quantize)) << 0) |
+			(MortonExpandBits((uint32)Clamp(q.yf(),0.0f,quantize)) << 1) |
+			(MortonExpandBits((uint32)Clamp(q.zf(),0.0f,quantize)) << 2);
+		const uint32 key = (BVHCommon::GetDirectionOctant(m_rays[i].m_dir) << 27) | morton;
+		m_keys[i] = ((uint64)key << 32) | i;
+	}
+	std::sort(m_keys.begin(),m_keys.end());
+}
+
+void BVHRayStream::Trace(const BVH4Node* root,std::vector<BVHRayHit>& hits BVH_STATS_ONLY(,BVHStats& stats))
+{
+	const uint32 numRays = (uint32)m_rays.size();
+	hits.resize(numRays);
+	m_invdirs.resize(numRays);
+	for (uint32 i = 0; i < numRays; i++) {
+		hits[i].m_t = m_tmax[i];
+		hits[i].m_triIndex = 0;
+		hits[i].m_leaf = NULL;
+		m_invdirs[i] = Recip(m_rays[i].m_dir);
+	}
+	if (numRays == 0)
+		return;
+	m_hits = hits.data();
+	BVH_COUNTERS_ONLY(m_counters = BVHCounters::GetCurrent());
+	SortRays();
+	m_active.reserve(m_chunkSize*8); // typically enough for the whole traversal path, saves reallocating per chunk
+	uint32 chunkStart = 0;
+	while (chunkStart < numRays) {
+		const unsigned octant = (unsigned)(m_keys[chunkStart] >> (32 + 27));
+		uint32 chunkEnd = chunkStart;
+		m_active.clear();
+		while (chunkEnd < numRays && chunkEnd - chunkStart < m_chunkSize && (unsigned)(m_keys[chunkEnd] >> (32 + 27)) == octant) // chunks don't straddle octants
+			m_active.push_back((uint32)m_keys[chunkEnd++]);
+		BVH_COUNTERS_ONLY(if (m_counters) m_counters->m_numTraversals++);
+		TraverseNode(root,octant,0,m_active.size() BVH_COUNTERS_ONLY(,1) BVH_STATS_ONLY(,stats));
+		chunkStart = chunkEnd;
+	}
+	m_hits = NULL;
+	BVH_COUNTERS_ONLY(m_counters = NULL);
+}
+
+// m_active[begin..end) are the rays which hit this node's bounds
+// for each child we append the rays which hit the child's bounds (using their current t) and recurse on that range
+void BVHRayStream::TraverseNode(const BVH4Node* node,unsigned octant,size_t begin,size_t end BVH_COUNTERS_ONLY(,unsigned depth) BVH_STATS_ONLY(,BVHStats& stats))
+{
+	Box3V childBounds[BVH4Node::N]; // extracted once per node, amortized over all the rays in the chunk
+	unsigned order[BVH4Node::N];
+	unsigned numChildren = 0;
+#if BVH_CHILD_ORDER
+	const unsigned childOrder = node->GetChildOrder(octant);
+	for (unsigned k = BVH4Node::N; k-- > 0;) { // push order is farthest first, so walk it backwards
+		const unsigned i = BVH4Node::GetChildPushIndex(childOrder,k);
+		if (node->IsChildNonEmpty(i)) {
+			childBounds[i] = node->GetChildBounds(i);
+			order[numChildren++] = i;
+		}
+	}
+#else
+	const Vec3V octantDir((octant & 1) ? -1.0f : 1.0f,(octant & 2) ? -1.0f : 1.0f,(octant & 4) ? -1.0f : 1.0f);
+	float childDist[BVH4Node::N];
+	for (unsigned i = 0; i < BVH4Node::N && node->IsChildNonEmpty(i); i++) {
+		childBounds[i] = node->GetChildBounds(i);
+		const Vec3V nearCorner = Select(childBounds[i].GetMin(),childBounds[i].GetMax(),octantDir < Vec3V(V_ZERO)); // max corner along negative axes
+		const float dist = Dot(nearCorner,octantDir).f();
+		unsigned j = numChildren++;
+		for (; j > 0 && childDist[j - 1] > dist; j--) { // insertion sort, front-to-back along the octant
+			childDist[j] = childDist[j - 1];
+			order[j] = order[j - 1];
+		}
+		childDist[j] = dist;
+		order[j] = i;
+	}
+#endif
+	BVH_COUNTERS_ONLY(if (m_counters) m_counters->VisitNode(numChildren*(unsigned)(end - begin),depth));
+	for (unsigned k = 0; k < numChildren; k++) {
+		const unsigned i = order[k];
+		const size_t childBegin = m_active.size();
+		for (size_t j = begin; j < end; j++) {
+			const uint32 rayIndex = m_active[j];
+			if (childBounds[i].IntersectsRay(m_rays[rayIndex].m_origin,m_invdirs[rayIndex],ScalarV(m_hits[rayIndex].m_t)))
+				m_active.push_back(rayIndex);
+		}
+		const size_t childEnd = m_active.size();
+	#if BVH_COUNTERS
+		if (m_counters) {
+			m_counters->m_activeLanes += childEnd - childBegin;
+			m_counters->m_laneSlots += end - begin;
+		}
+	#endif // BVH_COUNTERS
+		if (childEnd > childBegin) {
+			if (node->IsChildLeaf(i)) {
+			#if BVH_COUNTERS
+				if (m_counters) {
+					for (size_t j = childBegin; j < childEnd; j++)
+						m_counters->VisitLeaf(node->GetChildLeaf(i)->m_count);
+				}
+			#endif // BVH_COUNTERS
+				IntersectsLeaf(node->GetChildLeaf(i),childBegin,childEnd BVH_STATS_ONLY(,stats));
+			} else {
+			#if BVH_STATS
+				for (size_t j = childBegin; j < childEnd; j++)
+					stats.EnterNode(0x0001,node->GetChildNode(i)->m_depth);
+			#endif // BVH_STATS
+				TraverseNode(node->GetChildNode(i),octant,childBegin,childEnd BVH_COUNTERS_ONLY(,depth + 1) BVH_STATS_ONLY(,stats));
+			}
+		}
+		m_active.resize(childBegin);
+	}
+}
+
+void BVHRayStream::IntersectsLeaf(const BVHCommon::Leaf* leaf,size_t begin,size_t end BVH_STATS_ONLY(,BVHStats& stats))
+{
+	for (size_t j = begin; j < end; j++) {
+		const uint32 rayIndex = m_active[j];
+		const Vec3V origin = m_rays[rayIndex].m_origin;
+		const Vec3V dir = m_rays[rayIndex].m_dir;
+		BVHRayHit& hit = m_hits[rayIndex];
+		BVH_STATS_ONLY(stats.EnterLeaf(0x0001,leaf->m_depth));
+	#if BVH_STATS
+		for (unsigned k = 0; k < leaf->size(); k++)
+			stats.TestAgainstTriangle(0x0001,leaf->m_depth);
+	#endif // BVH_STATS
+		ScalarV t(hit.m_t);
+		if (leaf->IntersectsRayClosest(origin,dir,t,hit.m_triIndex)) {
+			hit.m_t = t.f();
+			hit.m_leaf = leaf;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+// =======================
+// common/bvh/bvh_stream.h
+// =======================
+
+#ifndef _INCLUDE_BVH_STREAM_H_
+#define _INCLUDE_BVH_STREAM_H_
+
+#include "bvh.h"
+
+#define BVH_RAY_STREAM_CHUNK_SIZE (16*1024) // rays traversed together, bounds the size of the active ray lists
+
+class BVHRayHit
+{
+public:
+	VMATH_INLINE bool IsHit() const { return m_leaf != NULL; }
+	VMATH_INLINE const Triangle3V GetTriangle() const { DEBUG_ASSERT(IsHit()); return m_leaf->GetTriangle(m_triIndex); }
+	VMATH_INLINE uint32 GetPrimID() const { return IsHit() ? m_leaf->GetPrimID(m_triIndex) : BVH_INVALID_PRIM_ID; }
+
+	float m_t; // tmax if nothing was hit
+	uint32 m_triIndex; // index into m_leaf's triangles
+	const BVHCommon::Leaf* m_leaf; // NULL if nothing was hit
+};
+
+// traces large batches of incoherent rays (AO/GI bakes, secondary rays) which don't fit into coherent packets
+// rays are binned by direction octant and sorted by origin (morton order) within each octant, then each chunk of rays
+// is traversed depth-first as a stream - a node is visited once per chunk, with the list of rays which hit its bounds
+// compacted before descending, and children are visited front-to-back for the chunk's octant
+// NOTE -- depth-first (rather than a breadth-first queue of (node,rays) pairs) so that hits in nearer subtrees shorten the
+// rays before farther siblings are tested, and so the scratch is one ray list per level of the current path rather than
+// one per node in the frontier
+class BVHRayStream
+{
+public:
+	BVHRayStream(uint32 chunkSize = BVH_RAY_STREAM_CHUNK_SIZE) : m_chunkSize(Max(1U,chunkSize)) {}
+
+	void Reserve(size_t count);
+	void Clear();
+
+	VMATH_INLINE uint32 AddRay(Vec3V_arg origin,Vec3V_arg dir,float tmax = ZBUFFER_DEFAULT)
+	{
+		const uint32 index = (uint32)m_rays.size();
+		Ray ray;
+		ray.m_origin = origin;
+		ray.m_dir = dir;
+		m_rays.push_back(ray);
+		m_tmax.push_back(tmax);
+		return index;
+	}
+
+	VMATH_INLINE size_t GetRayCount() const { return m_rays.size(); }
+
+	// hits[i] is the closest hit for the i'th ray added
+	void Trace(const BVH4Node* root,std::vector<BVHRayHit>& hits BVH_STATS_ONLY(,BVHStats& stats));
+
+private:
+	class Ray
+	{
+	public:
+		Vec3V m_origin;
+		Vec3V m_dir;
+	};
+
+	void SortRays();
+	void TraverseNode(const BVH4Node* node,unsigned octant,size_t begin,size_t end BVH_COUNTERS_ONLY(,unsigned depth) BVH_STATS_ONLY(,BVHStats& stats));
+	void IntersectsLeaf(const BVHCommon::Leaf* leaf,size_t begin,size_t end BVH_STATS_ONLY(,BVHStats& stats));
+
+	uint32 m_chunkSize;
+	std::vector<Ray> m_rays;
+	std::vector<float> m_tmax;
+
+	// scratch, valid during Trace
+	std::vector<uint64> m_keys; // (octant,morton) << 32 | ray index
+	std::vector<Vec3V> m_invdirs;
+	std::vector<uint32> m_active; // stack of active ray lists, one per level of the current traversal path
+	BVHRayHit* m_hits;
+#if BVH_COUNTERS
+	// a chunk counts as one traversal and its ray list as the lanes, every ray tests every child box and leaf triangle
+	BVHCounters* m_counters;
+#endif // BVH_COUNTERS
+};
+
+#endif // _INCLUDE_BVH_STREAM_H_
\ No newline at end of file
@@ -118,6 +118,7 @@ public:
 	}
 
 	VMATH_INLINE ScalarV_out GetDistanceToPoint(Vec3V_arg point) const { return Mag(Max(Vec3V(V_ZERO),Abs(point - GetCenter()) - GetExtent())); }
+	VMATH_INLINE ScalarV_out GetDistanceSqrToPoint(Vec3V_arg point) const { return MagSqr(Max(Vec3V(V_ZERO),Abs(point - GetCenter()) - GetExtent())); }
 
 	template <typename OriginType,typename DirType> VMATH_INLINE uint32 IntersectsRay(const OriginType& origin,const DirType& invdir,typename DirType::ComponentType::ArgType t) const
 	{
@@ -227,6 +228,9 @@ public:
 		return BoxType(bmin,bmax);
 	}
 
+	// squared distance from point to each of the boxes (zero for boxes containing the point)
+	VMATH_INLINE typename T::ComponentType_out GetDistanceSqrToPoint(typename T::VectorType_arg point) const { return MagSqr(Max(Max(m_min - point,point - m_max),T(0.0f))); }
+
 	// note that IntersectsRay can be called with DirType as an SOA vector, if box has been constructed from a single Box3V expanded for SOA
 	template <typename OriginType,typename DirType> VMATH_INLINE uint32 IntersectsRay(const OriginType& origin,const DirType& invdir,typename T::ComponentType::ArgType t) const
 	{
@@ -6,6 +6,76 @@
 #include "vmath_sphere.h"
 #include "vmath_triangle.h"
 
+Vec3V_out Triangle3V::GetClosestPoint(Vec3V_arg point) const // Ericson, "Real-Time Collision Detection" 5.1.5
+{
+	const Vec3V a = m_positions[0];
+	const Vec3V b = m_positions[1];
+	const Vec3V c = m_positions[2];
+	const Vec3V ab = b - a;
+	const Vec3V ac = c - a;
+	const float d1 = Dot(ab,point - a).f();
+	const float d2 = Dot(ac,point - a).f();
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a; // vertex region a
+	const float d3 = Dot(ab,point - b).f();
+	const float d4 = Dot(ac,point - b).f();
+	if (d3 >= 0.0f && d4 <= d3)
+		return b; // vertex region b
+	const float vc = d1*d4 - d3*d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab*(d1/(d1 - d3)); // edge region ab
+	const float d5 = Dot(ab,point - c).f();
+	const float d6 = Dot(ac,point - c).f();
+	if (d6 >= 0.0f && d5 <= d6)
+		return c; // vertex region c
+	const float vb = d5*d2 - d1*d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac*(d2/(d2 - d6)); // edge region ac
+	const float va = d3*d6 - d5*d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+		return b + (c - b)*((d4 - d3)/((d4 - d3) + (d5 - d6))); // edge region bc
+	const float denom = 1.0f/(va + vb + vc);
+	return a + ab*(vb*denom) + ac*(vc*denom); // face region
+}
+
+// squared distance from the origin to segment AB
+template <typename T> static VMATH_INLINE typename T::ComponentType GetSegmentDistanceSqr_SOA(const T& A,const T& B)
+{
+	typedef typename T::ComponentType ComponentType;
+	const T AB = B - A;
+	const ComponentType s = Clamp(-Dot(A,AB)/Max(Dot(AB,AB),ComponentType(FLT_MIN)),ComponentType(V_ZERO),ComponentType(V_ONE));
+	return MagSqr(A + AB*s);
+}
+
+// branchless version of GetClosestPoint for SOA triangles - the distance to the plane if the point projects inside the
+// triangle, otherwise the distance to the closest of the three edges
+template <typename T> static VMATH_INLINE typename T::ComponentType GetDistanceSqrToPoint_SOA(const T positions[3],Vec3V_arg point)
+{
+	typedef typename T::ComponentType ComponentType;
+	const ComponentType zero(V_ZERO);
+	const T A = positions[0] - point;
+	const T B = positions[1] - point;
+	const T C = positions[2] - point;
+	const T N = Cross(B - A,C - A);
+	const ComponentType nn = Dot(N,N);
+	const ComponentType d = Dot(A,N);
+	const typename ComponentType::BoolV inside = Dot(Cross(A,B),N) >= zero && Dot(Cross(B,C),N) >= zero && Dot(Cross(C,A),N) >= zero && nn > zero;
+	const ComponentType edges = Min(GetSegmentDistanceSqr_SOA(A,B),GetSegmentDistanceSqr_SOA(B,C),GetSegmentDistanceSqr_SOA(C,A));
+	return Select(edges,d*d/Max(nn,ComponentType(FLT_MIN)),inside);
+}
+
+Vec4V_out Triangle3V_SOA4::GetDistanceSqrToPoint(Vec3V_arg point) const
+{
+	return GetDistanceSqrToPoint_SOA(m_positions,point);
+}
+
+#if HAS_VEC8V
+Vec8V_out Triangle3V_SOA8::GetDistanceSqrToPoint(Vec3V_arg point) const
+{
+	return GetDistanceSqrToPoint_SOA(m_positions,point);
+}
+#endif // HAS_VEC8V
+
 uint32 Triangle3V::IntersectsRaySign(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,ScalarV& sign,float epsilon) const
 {
 	const Vec3V v0v1 = m_positions[1] - m_positions[0];
@@ -73,50 +143,67 @@ uint32 Triangle3V::IntersectsSphere(const Sphere3V& sphere) const
 	return (test1 && test2 && test3 && test4 && test5 && test6 && test7) ? 1 : 0;
 }
 
-uint32 Triangle3V_SOA4::IntersectsSphere(const Sphere3V& sphere) const
+// same tests as Triangle3V::IntersectsSphere, for all the triangles at once
+template <typename T> static VMATH_INLINE uint32 IntersectsSphere_SOA(const T positions[3],const Sphere3V& sphere)
 {
-	if (!Intersects(sphere,GetBounds()))
-		return 0;
+	typedef typename T::ComponentType ComponentType;
+	typedef typename ComponentType::BoolV BoolV;
 	const Vec3V P = sphere.GetCenter();
 	const ScalarV r = sphere.GetRadius();
-	const Vec3V_SOA4 A = m_positions[0] - P;
-	const Vec3V_SOA4 B = m_positions[1] - P;
-	const Vec3V_SOA4 C = m_positions[2] - P;
+	const T A = positions[0] - P;
+	const T B = positions[1] - P;
+	const T C = positions[2] - P;
 	const ScalarV rr = r*r;
-	const Vec3V_SOA4 V = Cross(B - A,C - A);
-	const Vec4V d = Dot(A,V);
-	const Vec4V e = Dot(V,V);
-	const Vec4V::BoolV test1 = (d*d <= rr*e);
-	const Vec4V aa = Dot(A,A);
-	const Vec4V ab = Dot(A,B);
-	const Vec4V ac = Dot(A,C);
-	const Vec4V bb = Dot(B,B);
-	const Vec4V bc = Dot(B,C);
-	const Vec4V cc = Dot(C,C);
-	const Vec4V::BoolV test2 = (aa <= rr || ab <= aa || ac <= aa);
-	const Vec4V::BoolV test3 = (bb <= rr || ab <= bb || bc <= bb);
-	const Vec4V::BoolV test4 = (cc <= rr || ac <= cc || bc <= cc);
-	const Vec3V_SOA4 AB = B - A;
-	const Vec3V_SOA4 BC = C - B;
-	const Vec3V_SOA4 CA = A - C;
-	const Vec4V d1 = ab - aa;
-	const Vec4V d2 = bc - bb;
-	const Vec4V d3 = ac - cc;
-	const Vec4V e1 = Dot(AB,AB);
-	const Vec4V e2 = Dot(BC,BC);
-	const Vec4V e3 = Dot(CA,CA);
-	const Vec3V_SOA4 Q1 = A*e1 - d1*AB;
-	const Vec3V_SOA4 Q2 = B*e2 - d2*BC;
-	const Vec3V_SOA4 Q3 = C*e3 - d3*CA;
-	const Vec3V_SOA4 QC = C*e1 - Q1;
-	const Vec3V_SOA4 QA = A*e2 - Q2;
-	const Vec3V_SOA4 QB = B*e3 - Q3;
-	const Vec4V::BoolV test5 = (Dot(Q1,Q1) <= rr*e1*e1 || Dot(Q1,QC) <= 0.0f);
-	const Vec4V::BoolV test6 = (Dot(Q2,Q2) <= rr*e2*e2 || Dot(Q2,QA) <= 0.0f);
-	const Vec4V::BoolV test7 = (Dot(Q3,Q3) <= rr*e3*e3 || Dot(Q3,QB) <= 0.0f);
+	const T V = Cross(B - A,C - A);
+	const ComponentType d = Dot(A,V);
+	const ComponentType e = Dot(V,V);
+	const BoolV test1 = (d*d <= rr*e);
+	const ComponentType aa = Dot(A,A);
+	const ComponentType ab = Dot(A,B);
+	const ComponentType ac = Dot(A,C);
+	const ComponentType bb = Dot(B,B);
+	const ComponentType bc = Dot(B,C);
+	const ComponentType cc = Dot(C,C);
+	const BoolV test2 = (aa <= rr || ab <= aa || ac <= aa);
+	const BoolV test3 = (bb <= rr || ab <= bb || bc <= bb);
+	const BoolV test4 = (cc <= rr || ac <= cc || bc <= cc);
+	const T AB = B - A;
+	const T BC = C - B;
+	const T CA = A - C;
+	const ComponentType d1 = ab - aa;
+	const ComponentType d2 = bc - bb;
+	const ComponentType d3 = ac - cc;
+	const ComponentType e1 = Dot(AB,AB);
+	const ComponentType e2 = Dot(BC,BC);
+	const ComponentType e3 = Dot(CA,CA);
+	const T Q1 = A*e1 - d1*AB;
+	const T Q2 = B*e2 - d2*BC;
+	const T Q3 = C*e3 - d3*CA;
+	const T QC = C*e1 - Q1;
+	const T QA = A*e2 - Q2;
+	const T QB = B*e3 - Q3;
+	const BoolV test5 = (Dot(Q1,Q1) <= rr*e1*e1 || Dot(Q1,QC) <= 0.0f);
+	const BoolV test6 = (Dot(Q2,Q2) <= rr*e2*e2 || Dot(Q2,QA) <= 0.0f);
+	const BoolV test7 = (Dot(Q3,Q3) <= rr*e3*e3 || Dot(Q3,QB) <= 0.0f);
 	return (test1 && test2 && test3 && test4 && test5 && test6 && test7).GetMask();
 }
 
+uint32 Triangle3V_SOA4::IntersectsSphere(const Sphere3V& sphere) const
+{
+	if (!Intersects(sphere,GetBounds()))
+		return 0;
+	return IntersectsSphere_SOA(m_positions,sphere);
+}
+
+#if HAS_VEC8V
+uint32 Triangle3V_SOA8::IntersectsSphere(const Sphere3V& sphere) const
+{
+	if (!Intersects(sphere,GetBounds()))
+		return 0;
+	return IntersectsSphere_SOA(m_positions,sphere);
+}
+#endif // HAS_VEC8V
+
 uint32 Triangle3V::IntersectsBox(const Box3V& box) const
 {
 	// ============================================================================
@@ -181,43 +268,50 @@ uint32 Triangle3V::IntersectsBox(const Box3V& box) const
 	return 1;
 }
 
-uint32 Triangle3V_SOA4::IntersectsBox(const Box3V& box) const
+// Akenine-Moller's triangle/box test (see Triangle3V::IntersectsBox) for all the triangles at once - the plane test is done
+// on the triangles' weighted normals directly, so it doesn't need an SOA plane type for each width
+template <typename T> static VMATH_INLINE uint32 IntersectsBox_SOA(const T positions[3],const Box3V& box)
 {
-	uint32 mask = Vec4V::BoolV::MaskAll;
-	mask &= IntersectsBox3V_SOA(box,GetBounds_SOA());
-	if (mask == 0)
-		return 0;
-	mask &= Intersects(GetWeightedPlane(),box); // plane doesn't need to be normalized
+	typedef typename T::ComponentType ComponentType;
+	uint32 mask = IntersectsBox3V_SOA(box,Box3V_SOA_T<T>(Min(positions[0],positions[1],positions[2]),Max(positions[0],positions[1],positions[2])));
 	if (mask == 0)
 		return 0;
 
 	const Vec3V center = box.GetCenter();
 	const Vec3V extent = box.GetExtent();
 
-	const Vec3V_SOA4 v0 = m_positions[0] - center;
-	const Vec3V_SOA4 v1 = m_positions[1] - center;
-	const Vec3V_SOA4 v2 = m_positions[2] - center;
+	const T v0 = positions[0] - center;
+	const T v1 = positions[1] - center;
+	const T v2 = positions[2] - center;
+
+	const T e0 = v1 - v0; // TODO -- rename e01, etc.
+	const T e1 = v2 - v1;
+	const T e2 = v0 - v2;
+
+	const T n = Cross(e0,e1); // plane doesn't need to be normalized
+	const T an = Abs(n);
+	const ComponentType pd = Dot(n,v0);
+	const ComponentType pr = an.x()*extent.x() + an.y()*extent.y() + an.z()*extent.z();
+	mask &= (pd <= pr && -pr <= pd).GetMask();
+	if (mask == 0)
+		return 0;
 
-	const Vec3V_SOA4 e0 = v1 - v0; // TODO -- rename e01, etc.
-	const Vec3V_SOA4 e1 = v2 - v1;
-	const Vec3V_SOA4 e2 = v0 - v2;
-	
 #define AXISTEST_X01(a,b,fa,fb) { p2 =  a*v2.y() - b*v2.z(); p0 =  a*v0.y() - b*v0.z(); r = fa*extent.y() + fb*extent.z(); mask &= (Min(p0,p2) <= r && -r <= Max(p0,p2)).GetMask(); }
 #define AXISTEST_X2( a,b,fa,fb) { p0 =  a*v0.y() - b*v0.z(); p1 =  a*v1.y() - b*v1.z(); r = fa*extent.y() + fb*extent.z(); mask &= (Min(p0,p1) <= r && -r <= Max(p0,p1)).GetMask(); }
 #define AXISTEST_Y02(a,b,fa,fb) { p2 = -a*v2.x() + b*v2.z(); p0 = -a*v0.x() + b*v0.z(); r = fa*extent.x() + fb*extent.z(); mask &= (Min(p0,p2) <= r && -r <= Max(p0,p2)).GetMask(); }
 #define AXISTEST_Y1( a,b,fa,fb) { p0 = -a*v0.x() + b*v0.z(); p1 = -a*v1.x() + b*v1.z(); r = fa*extent.x() + fb*extent.z(); mask &= (Min(p0,p1) <= r && -r <= Max(p0,p1)).GetMask(); }
 #define AXISTEST_Z12(a,b,fa,fb) { p1 =  a*v1.x() - b*v1.y(); p2 =  a*v2.x() - b*v2.y(); r = fa*extent.x() + fb*extent.y(); mask &= (Min(p1,p2) <= r && -r <= Max(p1,p2)).GetMask(); }
 #define AXISTEST_Z0( a,b,fa,fb) { p0 =  a*v0.x() - b*v0.y(); p1 =  a*v1.x() - b*v1.y(); r = fa*extent.x() + fb*extent.y(); mask &= (Min(p0,p1) <= r && -r <= Max(p0,p1)).GetMask(); }
-	Vec4V p0,p1,p2,r;
-	const Vec3V_SOA4 a0 = Abs(e0);
+	ComponentType p0,p1,p2,r;
+	const T a0 = Abs(e0);
 	AXISTEST_X01(e0.z(),e0.y(),a0.z(),a0.y());
 	AXISTEST_Y02(e0.z(),e0.x(),a0.z(),a0.x());
 	AXISTEST_Z12(e0.y(),e0.x(),a0.y(),a0.x());
-	const Vec3V_SOA4 a1 = Abs(e1);
+	const T a1 = Abs(e1);
 	AXISTEST_X01(e1.z(),e1.y(),a1.z(),a1.y());
 	AXISTEST_Y02(e1.z(),e1.x(),a1.z(),a1.x());
 	AXISTEST_Z0( e1.y(),e1.x(),a1.y(),a1.x());
-	const Vec3V_SOA4 a2 = Abs(e2);
+	const T a2 = Abs(e2);
 	AXISTEST_X2( e2.z(),e2.y(),a2.z(),a2.y());
 	AXISTEST_Y1( e2.z(),e2.x(),a2.z(),a2.x());
 	AXISTEST_Z12(e2.y(),e2.x(),a2.y(),a2.x());
@@ -231,6 +325,18 @@ uint32 Triangle3V_SOA4::IntersectsBox(const Box3V& box) const
 	return mask;
 }
 
+uint32 Triangle3V_SOA4::IntersectsBox(const Box3V& box) const
+{
+	return IntersectsBox_SOA(m_positions,box);
+}
+
+#if HAS_VEC8V
+uint32 Triangle3V_SOA8::IntersectsBox(const Box3V& box) const
+{
+	return IntersectsBox_SOA(m_positions,box);
+}
+#endif // HAS_VEC8V
+
 #if 1 // early outs
 #define EARLY_OUT4(mask) if (_mm_movemask_ps(mask) == Vec4V::BoolV::MaskAll) return 0
 #define EARLY_OUT4_FINAL(mask,maskbits) const uint32 maskbits = _mm_movemask_ps(mask); if (maskbits == Vec4V::BoolV::MaskAll) return 0
@@ -502,16 +608,14 @@ uint32 Triangle3V_SOA4::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA4_arg origin_,Ve
 	uint32 bit = 1;
 	RAY_PACKET_INDEPENDENT_ORIGINS_ONLY(Vec3V origins[4]; origin_.GetVectors(origins));
 	Vec3V dirs[4]; dir_.GetVectors(dirs);
-	for (unsigned i = 0; mask; i++, bit <<= 1) {
-		DEBUG_ASSERT(i < countof(dirs));
-		if (mask & bit) {
-			ScalarV t;
-			if (IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
-				t_[i] = t.f();
-			else {
-				t_[i] = ZBUFFER_DEFAULT;
-				mask ^= bit;
-			}
+	mask &= (uint32)((1ULL << countof(dirs)) - 1); // callers pass -1 for "all rays", don't walk off the end of the packet
+	for (unsigned i = 0; i < countof(dirs); i++, bit <<= 1) {
+		ScalarV t;
+		if ((mask & bit) && IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
+			t_[i] = t.f();
+		else {
+			t_[i] = ZBUFFER_DEFAULT; // inactive rays get a miss too, since the leaf takes Min(t_,t) across the whole packet
+			mask &= ~bit;
 		}
 	}
 	return mask;
@@ -523,16 +627,14 @@ uint32 Triangle3V_SOA4::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA8_arg origin_,Ve
 	uint32 bit = 1;
 	RAY_PACKET_INDEPENDENT_ORIGINS_ONLY(Vec3V origins[8]; origin_.GetVectors(origins));
 	Vec3V dirs[8]; dir_.GetVectors(dirs);
-	for (unsigned i = 0; mask; i++, bit <<= 1) {
-		DEBUG_ASSERT(i < countof(dirs));
-		if (mask & bit) {
-			ScalarV t;
-			if (IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
-				t_[i] = t.f();
-			else {
-				t_[i] = ZBUFFER_DEFAULT;
-				mask ^= bit;
-			}
+	mask &= (uint32)((1ULL << countof(dirs)) - 1); // callers pass -1 for "all rays", don't walk off the end of the packet
+	for (unsigned i = 0; i < countof(dirs); i++, bit <<= 1) {
+		ScalarV t;
+		if ((mask & bit) && IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
+			t_[i] = t.f();
+		else {
+			t_[i] = ZBUFFER_DEFAULT; // inactive rays get a miss too, since the leaf takes Min(t_,t) across the whole packet
+			mask &= ~bit;
 		}
 	}
 	return mask;
@@ -544,16 +646,14 @@ uint32 Triangle3V_SOA4::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA16_arg origin_,V
 	uint32 bit = 1;
 	RAY_PACKET_INDEPENDENT_ORIGINS_ONLY(Vec3V origins[16]; origin_.GetVectors(origins));
 	Vec3V dirs[16]; dir_.GetVectors(dirs);
-	for (unsigned i = 0; mask; i++, bit <<= 1) {
-		DEBUG_ASSERT(i < countof(dirs));
-		if (mask & bit) {
-			ScalarV t;
-			if (IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
-				t_[i] = t.f();
-			else {
-				t_[i] = ZBUFFER_DEFAULT;
-				mask ^= bit;
-			}
+	mask &= (uint32)((1ULL << countof(dirs)) - 1); // callers pass -1 for "all rays", don't walk off the end of the packet
+	for (unsigned i = 0; i < countof(dirs); i++, bit <<= 1) {
+		ScalarV t;
+		if ((mask & bit) && IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
+			t_[i] = t.f();
+		else {
+			t_[i] = ZBUFFER_DEFAULT; // inactive rays get a miss too, since the leaf takes Min(t_,t) across the whole packet
+			mask &= ~bit;
 		}
 	}
 	return mask;
@@ -601,16 +701,14 @@ uint32 Triangle3V_SOA8::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA4_arg origin_,Ve
 	uint32 bit = 1;
 	RAY_PACKET_INDEPENDENT_ORIGINS_ONLY(Vec3V origins[4]; origin_.GetVectors(origins));
 	Vec3V dirs[4]; dir_.GetVectors(dirs);
-	for (unsigned i = 0; mask; i++, bit <<= 1) {
-		DEBUG_ASSERT(i < countof(dirs));
-		if (mask & bit) {
-			ScalarV t;
-			if (IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
-				t_[i] = t.f();
-			else {
-				t_[i] = ZBUFFER_DEFAULT;
-				mask ^= bit;
-			}
+	mask &= (uint32)((1ULL << countof(dirs)) - 1); // callers pass -1 for "all rays", don't walk off the end of the packet
+	for (unsigned i = 0; i < countof(dirs); i++, bit <<= 1) {
+		ScalarV t;
+		if ((mask & bit) && IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
+			t_[i] = t.f();
+		else {
+			t_[i] = ZBUFFER_DEFAULT; // inactive rays get a miss too, since the leaf takes Min(t_,t) across the whole packet
+			mask &= ~bit;
 		}
 	}
 	return mask;
@@ -621,16 +719,14 @@ uint32 Triangle3V_SOA8::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA8_arg origin_,Ve
 	uint32 bit = 1;
 	RAY_PACKET_INDEPENDENT_ORIGINS_ONLY(Vec3V origins[8]; origin_.GetVectors(origins));
 	Vec3V dirs[8]; dir_.GetVectors(dirs);
-	for (unsigned i = 0; mask; i++, bit <<= 1) {
-		DEBUG_ASSERT(i < countof(dirs));
-		if (mask & bit) {
-			ScalarV t;
-			if (IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
-				t_[i] = t.f();
-			else {
-				t_[i] = ZBUFFER_DEFAULT;
-				mask ^= bit;
-			}
+	mask &= (uint32)((1ULL << countof(dirs)) - 1); // callers pass -1 for "all rays", don't walk off the end of the packet
+	for (unsigned i = 0; i < countof(dirs); i++, bit <<= 1) {
+		ScalarV t;
+		if ((mask & bit) && IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
+			t_[i] = t.f();
+		else {
+			t_[i] = ZBUFFER_DEFAULT; // inactive rays get a miss too, since the leaf takes Min(t_,t) across the whole packet
+			mask &= ~bit;
 		}
 	}
 	return mask;
@@ -642,16 +738,14 @@ uint32 Triangle3V_SOA8::IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA16_arg origin_,V
 	uint32 bit = 1;
 	RAY_PACKET_INDEPENDENT_ORIGINS_ONLY(Vec3V origins[16]; origin_.GetVectors(origins));
 	Vec3V dirs[16]; dir_.GetVectors(dirs);
-	for (unsigned i = 0; mask; i++, bit <<= 1) {
-		DEBUG_ASSERT(i < countof(dirs));
-		if (mask & bit) {
-			ScalarV t;
-			if (IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
-				t_[i] = t.f();
-			else {
-				t_[i] = ZBUFFER_DEFAULT;
-				mask ^= bit;
-			}
+	mask &= (uint32)((1ULL << countof(dirs)) - 1); // callers pass -1 for "all rays", don't walk off the end of the packet
+	for (unsigned i = 0; i < countof(dirs); i++, bit <<= 1) {
+		ScalarV t;
+		if ((mask & bit) && IntersectsRay(RAY_PACKET_INDEPENDENT_ORIGINS_SWITCH(origins[i],origin_),dirs[i],t,twosided,epsilon))
+			t_[i] = t.f();
+		else {
+			t_[i] = ZBUFFER_DEFAULT; // inactive rays get a miss too, since the leaf takes Min(t_,t) across the whole packet
+			mask &= ~bit;
 		}
 	}
 	return mask;
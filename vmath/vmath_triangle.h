@@ -97,6 +97,9 @@ public:
 	VMATH_INLINE const Plane3V GetWeightedPlane() const { return Plane3V::ConstructFromPointAndNormal(m_positions[0],GetWeightedNormal()); }
 	VMATH_INLINE const Plane3V GetPlane() const { return Plane3V::ConstructFromPointAndNormal(m_positions[0],GetNormal()); }
 
+	Vec3V_out GetClosestPoint(Vec3V_arg point) const; // closest point on the triangle (interior, edges or vertices)
+	VMATH_INLINE ScalarV_out GetDistanceSqrToPoint(Vec3V_arg point) const { return MagSqr(point - GetClosestPoint(point)); }
+
 	uint32 IntersectsRay(Vec3V_arg origin,Vec3V_arg dir,float& t,float& u,float& v,bool twosided = TRIANGLE_TWOSIDED_DEFAULT,float epsilon = TRIANGLE_RAY_EPSILON) const;
 	uint32 IntersectsRay(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,bool twosided = TRIANGLE_TWOSIDED_DEFAULT,float epsilon = TRIANGLE_RAY_EPSILON) const;
 	uint32 IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA4_arg origin,Vec3V_SOA4_arg dir,Vec4V& t,uint32,bool twosided = TRIANGLE_TWOSIDED_DEFAULT,float epsilon = TRIANGLE_RAY_EPSILON) const;
@@ -216,6 +219,8 @@ public:
 	VMATH_INLINE const Plane3V_SOA4 GetWeightedPlane() const { return Plane3V_SOA4::ConstructFromPointAndNormal(m_positions[0],GetWeightedNormal()); }
 	VMATH_INLINE const Plane3V_SOA4 GetPlane() const { return Plane3V_SOA4::ConstructFromPointAndNormal(m_positions[0],GetNormal()); }
 
+	Vec4V_out GetDistanceSqrToPoint(Vec3V_arg point) const; // squared distance from point to each of the four triangles
+
 	uint32 IntersectsSphere(const Sphere3V& sphere) const;
 	uint32 IntersectsBox(const Box3V& box) const; // TODO
 
@@ -266,6 +271,11 @@ public:
 			Vec3V(MaxElement(bmax.x()),MaxElement(bmax.y()),MaxElement(bmax.z())));
 	}
 
+	Vec8V_out GetDistanceSqrToPoint(Vec3V_arg point) const; // squared distance from point to each of the eight triangles
+
+	uint32 IntersectsSphere(const Sphere3V& sphere) const;
+	uint32 IntersectsBox(const Box3V& box) const;
+
 	uint32 IntersectsRay(Vec3V_arg origin,Vec3V_arg dir,ScalarV& t,bool twosided = TRIANGLE_TWOSIDED_DEFAULT,float epsilon = TRIANGLE_RAY_EPSILON) const;
 	uint32 IntersectsRay(RAY_PACKET_ORIGIN_TYPE_SOA4_arg origin,Vec3V_SOA4_arg dir,Vec4V& t,uint32 mask,bool twosided = TRIANGLE_TWOSIDED_DEFAULT,float epsilon = TRIANGLE_RAY_EPSILON) const;
 #if HAS_VEC8V